@@ -10,6 +10,7 @@
 
 #include <map>
 #include <math.h>
+#include <mutex>
 #include <sstream>
 #include <stack>
 #include <stdio.h>
@@ -36,6 +37,10 @@ private:
 
 	/** Attributes of the cache **/
 	memcache::Memcache client = NULL;
+	// Clones of the client used for fetching rows, one per concurrent caller
+	// since a client cannot be shared among threads
+	std::vector<memcache::Memcache*> m_idleClients;
+	std::mutex m_clientsMutex;
 
 public:
 
@@ -80,6 +85,8 @@ public:
 	 * Retrieves the requested descriptor by obtaining it from cache
 	 * and if necessary load the associated descriptor.
 	 *
+	 * @note It is safe to call it from several threads at once.
+	 *
 	 * @param descriptorIndex - Index of the descriptor to retrieve
 	 * @return requested descriptor
 	 */
@@ -101,6 +108,27 @@ public:
 	 */
 	bool empty() const;
 
+private:
+
+	/**
+	 * Takes an idle clone of the cache client, a new one is created if none is idle.
+	 *
+	 * @return the client, it must be given back by calling releaseClient
+	 */
+	memcache::Memcache* acquireClient();
+
+	/**
+	 * Gives back a client obtained by calling acquireClient.
+	 *
+	 * @param cacheClient - The client to give back
+	 */
+	void releaseClient(memcache::Memcache* cacheClient);
+
+	/**
+	 * Releases all the idle clones of the cache client.
+	 */
+	void releaseIdleClients();
+
 };
 
 static vlr::Mat DEFAULT_INPUTDATA = vlr::Mat();
@@ -28,6 +28,17 @@ public:
 	void writeRow(const std::string &query, cv::Mat& scores, cv::Mat& perm,
 			int num_nns, const std::vector<std::string>& db_images);
 
+	/**
+	 * Writes the row of a query given its candidates already ranked.
+	 *
+	 * @param query - The name of the query image
+	 * @param candidates - The (DB image id, score) pairs sorted by decreasing score
+	 * @param db_images - The names of the DB images
+	 */
+	void writeRow(const std::string &query,
+			const std::vector<std::pair<int, float> >& candidates,
+			const std::vector<std::string>& db_images);
+
 	void close();
 
 	std::string getHtml() const;
@@ -0,0 +1,60 @@
+/*
+ * Logging.hpp
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: andresf
+ */
+
+#ifndef LOGGING_HPP_
+#define LOGGING_HPP_
+
+#include <string>
+
+namespace vlr {
+
+// Verbosity levels, a message is printed if its level is not above the current one
+enum LogLevel {
+	LOG_QUIET = 0, LOG_ERROR = 1, LOG_INFO = 2, LOG_DEBUG = 3
+};
+
+/**
+ * Sets the verbosity level for the whole process.
+ *
+ * @param level - The new level
+ */
+void setLogLevel(LogLevel level);
+
+LogLevel getLogLevel();
+
+/**
+ * Checks whether messages of a level are printed, to be used for skipping
+ * the work of producing messages (e.g. timing) that would be discarded.
+ *
+ * @param level - The level to check
+ * @return true if messages of the given level are printed
+ */
+inline bool isLogEnabled(LogLevel level) {
+	return level <= getLogLevel();
+}
+
+/**
+ * Parses the name of a level.
+ *
+ * @param name - One of QUIET, ERROR, INFO or DEBUG
+ * @return the level
+ */
+LogLevel parseLogLevel(const std::string& name);
+
+/**
+ * Prints a message in printf style if its level is enabled, errors go to
+ * standard error and the rest to standard output.
+ *
+ * @param level - The level of the message
+ * @param format - The printf format of the message
+ */
+void logMessage(LogLevel level, const char* format, ...)
+		__attribute__((format(printf, 2, 3)));
+
+} /* namespace vlr */
+
+#endif /* LOGGING_HPP_ */
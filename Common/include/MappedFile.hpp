@@ -0,0 +1,76 @@
+/*
+ * MappedFile.hpp
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: andresf
+ */
+
+#ifndef MAPPEDFILE_HPP_
+#define MAPPEDFILE_HPP_
+
+#include <stddef.h>
+#include <string>
+
+namespace vlr {
+
+/**
+ * Read-only memory mapping of a whole file, the mapping is released
+ * when the instance is destroyed.
+ */
+class MappedFile {
+
+private:
+
+	// Address where the file is mapped
+	unsigned char* m_data;
+	// Size of the file in bytes
+	size_t m_size;
+
+public:
+
+	/**
+	 * Class constructor, maps the whole file in read-only mode.
+	 *
+	 * @param filename - The path to the file to map
+	 */
+	MappedFile(const std::string& filename);
+
+	/**
+	 * Class destroyer, unmaps the file.
+	 */
+	~MappedFile();
+
+	const unsigned char* data() const {
+		return m_data;
+	}
+
+	size_t size() const {
+		return m_size;
+	}
+
+	/**
+	 * Checks whether a file starts with a given sequence of bytes, it is meant
+	 * for recognizing binary formats without mapping the file.
+	 *
+	 * @param filename - The path to the file to check
+	 * @param magic - Pointer to the expected sequence of bytes
+	 * @param length - Number of bytes to compare
+	 * @return true if and only if the file can be read and starts with the given bytes
+	 */
+	static bool hasMagic(const std::string& filename, const char* magic,
+			size_t length);
+
+private:
+
+	/**
+	 * Copy constructor and the assignment operator are private
+	 * to prevent obtaining copies of the instance.
+	 */
+	MappedFile(MappedFile const&); // Don't Implement
+	void operator=(MappedFile const&); // Don't implement
+
+};
+
+} /* namespace vlr */
+
+#endif /* MAPPEDFILE_HPP_ */
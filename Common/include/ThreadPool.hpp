@@ -0,0 +1,152 @@
+/*
+ * ThreadPool.hpp
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: andresf
+ */
+
+#ifndef THREADPOOL_HPP_
+#define THREADPOOL_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vlr {
+
+/**
+ * Pool of worker threads executing tasks, every worker owns a queue of tasks
+ * and steals from the queues of the other workers once its own is empty.
+ *
+ * Tasks submitted from a worker go to the queue of that worker and are taken
+ * in LIFO order, while stealing takes the oldest tasks, so recursive work
+ * (e.g. subtrees) is split at the coarsest grain.
+ */
+class ThreadPool {
+
+public:
+
+	typedef std::function<void()> Task;
+
+private:
+
+	struct WorkerQueue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	// One queue per worker
+	std::vector<std::unique_ptr<WorkerQueue> > m_queues;
+	std::vector<std::thread> m_workers;
+
+	// Number of tasks submitted and not yet finished
+	size_t m_pending;
+	// Number of tasks waiting in the queues
+	size_t m_queued;
+	// First exception thrown by a task, rethrown by wait()
+	std::exception_ptr m_exception;
+	bool m_stop;
+	// Queue where tasks submitted from outside the pool are pushed next
+	size_t m_nextQueue;
+
+	std::mutex m_mutex;
+	// Signaled when tasks are queued or the pool is stopped
+	std::condition_variable m_taskAvailable;
+	// Signaled when the number of pending tasks drops to zero
+	std::condition_variable m_allDone;
+
+public:
+
+	/**
+	 * Class constructor, starts the workers.
+	 *
+	 * @param numThreads - Number of worker threads, if not positive
+	 * 					   the number of hardware threads is used
+	 */
+	ThreadPool(int numThreads = 0);
+
+	/**
+	 * Class destroyer, waits for the pending tasks and joins the workers.
+	 */
+	~ThreadPool();
+
+	/**
+	 * Submits a task for asynchronous execution.
+	 *
+	 * @param task - The task to execute
+	 */
+	void submit(const Task& task);
+
+	/**
+	 * Blocks until every submitted task, including the tasks submitted by
+	 * other tasks, has finished.
+	 *
+	 * @note If a task threw an exception it is rethrown here.
+	 */
+	void wait();
+
+	/**
+	 * Calls a function over every chunk of a range of indices, the chunks are
+	 * processed concurrently by the calling thread and the workers and the call
+	 * returns once all of them are done. It can be called from within a task.
+	 *
+	 * @param begin - First index of the range
+	 * @param end - One past the last index of the range
+	 * @param chunkSize - Number of indices per chunk
+	 * @param body - Function called as body(chunkBegin, chunkEnd) for each chunk
+	 */
+	void parallelFor(int begin, int end, int chunkSize,
+			const std::function<void(int, int)>& body);
+
+	int getNumThreads() const {
+		return m_workers.size();
+	}
+
+	/**
+	 * Returns the position of the calling thread in the pool it belongs to.
+	 *
+	 * @return the worker index, or -1 if the calling thread is not a worker
+	 */
+	static int getWorkerIndex();
+
+private:
+
+	/**
+	 * Loop run by each worker.
+	 *
+	 * @param workerIdx - The index of the worker
+	 */
+	void run(int workerIdx);
+
+	/**
+	 * Takes a task from the own queue or, if empty, steals one from another worker.
+	 *
+	 * @param workerIdx - The index of the worker looking for a task
+	 * @param task - The task taken
+	 * @return true if a task was taken
+	 */
+	bool takeTask(int workerIdx, Task& task);
+
+	/**
+	 * Executes a task and accounts for its completion.
+	 */
+	void execute(Task& task);
+
+	/**
+	 * Copy constructor and the assignment operator are private
+	 * to prevent obtaining copies of the instance.
+	 */
+	ThreadPool(ThreadPool const&); // Don't Implement
+	void operator=(ThreadPool const&); // Don't implement
+
+};
+
+} /* namespace vlr */
+
+#endif /* THREADPOOL_HPP_ */
@@ -0,0 +1,133 @@
+/*
+ * TimingCollector.hpp
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: andresf
+ */
+
+#ifndef TIMINGCOLLECTOR_HPP_
+#define TIMINGCOLLECTOR_HPP_
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace vlr {
+
+/**
+ * Latency statistics of a stage, times are in milliseconds.
+ */
+struct StageSummary {
+	std::string stage;
+	size_t count;
+	double total;
+	double mean;
+	double p50;
+	double p90;
+	double p99;
+	double max;
+};
+
+// --------------------------------------------------------------------------
+
+/**
+ * Collects the time taken by each run of the stages of a process (e.g. load,
+ * quantize, score) and summarizes them as latency percentiles. Samples can be
+ * added concurrently from several threads.
+ */
+class TimingCollector {
+
+protected:
+
+	// Samples in milliseconds of each stage
+	std::map<std::string, std::vector<double> > m_samples;
+	// Stages in order of first appearance
+	std::vector<std::string> m_stages;
+
+	mutable std::mutex m_mutex;
+
+public:
+
+	/**
+	 * Adds the time taken by a run of a stage.
+	 *
+	 * @param stage - The name of the stage
+	 * @param milliseconds - The time taken
+	 */
+	void addSample(const std::string& stage, double milliseconds);
+
+	/**
+	 * Computes the statistics of every stage.
+	 *
+	 * @return the summary of each stage in order of first appearance
+	 */
+	std::vector<StageSummary> summarize() const;
+
+	/**
+	 * Saves the summary of every stage to a file, in JSON format if the
+	 * file name ends with .json and in CSV format otherwise.
+	 *
+	 * @param filename - The name of the file where to save the summary
+	 */
+	void save(const std::string& filename) const;
+
+	/**
+	 * Removes all samples.
+	 */
+	void clear();
+
+};
+
+// --------------------------------------------------------------------------
+
+/**
+ * Measures the time from its construction until it is stopped or destroyed
+ * and adds it to a collector as a sample of a stage.
+ */
+class StageTimer {
+
+protected:
+
+	TimingCollector* m_collector;
+	std::string m_stage;
+	std::chrono::steady_clock::time_point m_start;
+
+public:
+
+	/**
+	 * Class constructor, starts measuring.
+	 *
+	 * @param collector - The collector where to add the sample, if NULL nothing is measured
+	 * @param stage - The name of the stage
+	 */
+	StageTimer(TimingCollector* collector, const std::string& stage) :
+			m_collector(collector), m_stage(stage) {
+		if (m_collector != NULL) {
+			m_start = std::chrono::steady_clock::now();
+		}
+	}
+
+	~StageTimer() {
+		stop();
+	}
+
+	/**
+	 * Adds the time elapsed since construction to the collector, only the
+	 * first call has effect.
+	 */
+	void stop() {
+		if (m_collector != NULL) {
+			std::chrono::duration<double, std::milli> elapsed =
+					std::chrono::steady_clock::now() - m_start;
+			m_collector->addSample(m_stage, elapsed.count());
+			m_collector = NULL;
+		}
+	}
+
+};
+
+} /* namespace vlr */
+
+#endif /* TIMINGCOLLECTOR_HPP_ */
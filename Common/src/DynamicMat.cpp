@@ -136,6 +136,7 @@ Mat::~Mat() {
 #if DYNMATVERBOSE
 	printf("[DynamicMat] Destroying\n");
 #endif
+	releaseIdleClients();
 }
 
 // --------------------------------------------------------------------------
@@ -152,6 +153,9 @@ Mat& Mat::operator=(const Mat& other) {
 	rows = other.rows;
 	cols = other.cols;
 
+	// Clones of the previous client are no longer valid
+	releaseIdleClients();
+
 	return *this;
 }
 
@@ -174,7 +178,9 @@ cv::Mat Mat::row(int descriptorIdx) {
 	std::stringstream ss;
 	ss << descriptorIdx;
 	std::vector<char> value;
-	client.get(ss.str(), value);
+	memcache::Memcache* cacheClient = acquireClient();
+	cacheClient->get(ss.str(), value);
+	releaseClient(cacheClient);
 
 	cv::Mat descriptor(1, cols, m_descriptorType);
 	memcpy(reinterpret_cast<char*>(descriptor.data), reinterpret_cast<char*>(value.data()), value.size());
@@ -200,4 +206,38 @@ bool Mat::empty() const {
 	return rows == 0;
 }
 
+// --------------------------------------------------------------------------
+
+memcache::Memcache* Mat::acquireClient() {
+
+	std::lock_guard<std::mutex> lock(m_clientsMutex);
+
+	if (m_idleClients.empty() == true) {
+		// Copying a client clones its connection settings
+		return new memcache::Memcache(client);
+	}
+
+	memcache::Memcache* cacheClient = m_idleClients.back();
+	m_idleClients.pop_back();
+
+	return cacheClient;
+}
+
+// --------------------------------------------------------------------------
+
+void Mat::releaseClient(memcache::Memcache* cacheClient) {
+	std::lock_guard<std::mutex> lock(m_clientsMutex);
+	m_idleClients.push_back(cacheClient);
+}
+
+// --------------------------------------------------------------------------
+
+void Mat::releaseIdleClients() {
+	std::lock_guard<std::mutex> lock(m_clientsMutex);
+	for (memcache::Memcache* cacheClient : m_idleClients) {
+		delete cacheClient;
+	}
+	m_idleClients.clear();
+}
+
 } /* namespace vlr */
@@ -82,6 +82,39 @@ void HtmlResultsWriter::writeRow(const std::string &query, cv::Mat& scores,
 
 // --------------------------------------------------------------------------
 
+void HtmlResultsWriter::writeRow(const std::string &query,
+		const std::vector<std::pair<int, float> >& candidates,
+		const std::vector<std::string>& db_images) {
+
+	char q_base[512], q_thumb[512];
+	basifyFilename(query.c_str(), q_base);
+	sprintf(q_thumb, "%s.thumb.jpg", q_base);
+
+	fprintf(f_html,
+			"<tr align=center>\n<td><img src=\"%s\" style=\"max-height:200px\"><br><p>%s</p></td>\n",
+			q_thumb, q_thumb);
+
+	for (size_t i = 0; i < candidates.size(); i++) {
+		char d_base[512], d_thumb[512];
+		basifyFilename(db_images[candidates[i].first].c_str(), d_base);
+		sprintf(d_thumb, "%s.thumb.jpg", d_base);
+
+		fprintf(f_html,
+				"<td><img src=\"%s\" style=\"max-height:200px\"><br><p>%s</p></td>\n",
+				d_thumb, d_thumb);
+	}
+
+	fprintf(f_html, "</tr>\n<tr align=right>\n");
+
+	fprintf(f_html, "<td></td>\n");
+	for (size_t i = 0; i < candidates.size(); i++)
+		fprintf(f_html, "<td>%0.5f</td>\n", candidates[i].second);
+
+	fprintf(f_html, "</tr>\n");
+}
+
+// --------------------------------------------------------------------------
+
 void HtmlResultsWriter::close() {
 	fprintf(f_html, "</tr>\n"
 			"</table>\n"
@@ -0,0 +1,68 @@
+/*
+ * Logging.cpp
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: andresf
+ */
+
+#include <Logging.hpp>
+
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <stdexcept>
+
+namespace vlr {
+
+namespace {
+
+std::atomic<int> g_logLevel(LOG_INFO);
+
+} /* namespace */
+
+// --------------------------------------------------------------------------
+
+void setLogLevel(LogLevel level) {
+	g_logLevel = level;
+}
+
+// --------------------------------------------------------------------------
+
+LogLevel getLogLevel() {
+	return (LogLevel) g_logLevel.load(std::memory_order_relaxed);
+}
+
+// --------------------------------------------------------------------------
+
+LogLevel parseLogLevel(const std::string& name) {
+
+	if (name.compare("QUIET") == 0) {
+		return LOG_QUIET;
+	} else if (name.compare("ERROR") == 0) {
+		return LOG_ERROR;
+	} else if (name.compare("INFO") == 0) {
+		return LOG_INFO;
+	} else if (name.compare("DEBUG") == 0) {
+		return LOG_DEBUG;
+	}
+
+	throw std::runtime_error(
+			"[vlr::parseLogLevel] Unknown log level [" + name + "]");
+}
+
+// --------------------------------------------------------------------------
+
+void logMessage(LogLevel level, const char* format, ...) {
+
+	if (isLogEnabled(level) == false) {
+		return;
+	}
+
+	va_list args;
+	va_start(args, format);
+	vfprintf(level == LOG_ERROR ? stderr : stdout, format, args);
+	va_end(args);
+
+}
+
+} /* namespace vlr */
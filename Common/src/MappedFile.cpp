@@ -0,0 +1,79 @@
+/*
+ * MappedFile.cpp
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: andresf
+ */
+
+#include <MappedFile.hpp>
+
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace vlr {
+
+MappedFile::MappedFile(const std::string& filename) :
+		m_data(NULL), m_size(0) {
+
+	int fd = open(filename.c_str(), O_RDONLY);
+
+	if (fd == -1) {
+		throw std::runtime_error("[MappedFile::MappedFile] "
+				"Unable to open file [" + filename + "] for reading");
+	}
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) == -1 || fileStat.st_size == 0) {
+		close(fd);
+		throw std::runtime_error("[MappedFile::MappedFile] "
+				"File [" + filename + "] is empty or cannot be inspected");
+	}
+
+	m_size = fileStat.st_size;
+
+	void* addr = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	// The mapping stays valid once the descriptor is closed
+	close(fd);
+
+	if (addr == MAP_FAILED) {
+		throw std::runtime_error("[MappedFile::MappedFile] "
+				"Unable to map file [" + filename + "]");
+	}
+
+	m_data = static_cast<unsigned char*>(addr);
+}
+
+// --------------------------------------------------------------------------
+
+MappedFile::~MappedFile() {
+	if (m_data != NULL) {
+		munmap(m_data, m_size);
+	}
+}
+
+// --------------------------------------------------------------------------
+
+bool MappedFile::hasMagic(const std::string& filename, const char* magic,
+		size_t length) {
+
+	int fd = open(filename.c_str(), O_RDONLY);
+
+	if (fd == -1) {
+		return false;
+	}
+
+	std::vector<char> buffer(length);
+	ssize_t bytesRead = read(fd, buffer.data(), length);
+	close(fd);
+
+	return bytesRead == ssize_t(length)
+			&& memcmp(buffer.data(), magic, length) == 0;
+}
+
+} /* namespace vlr */
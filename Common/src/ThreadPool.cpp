@@ -0,0 +1,265 @@
+/*
+ * ThreadPool.cpp
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: andresf
+ */
+
+#include <ThreadPool.hpp>
+
+#include <algorithm>
+
+namespace vlr {
+
+namespace {
+
+// Pool owning the calling thread and its index in it, if the thread is a worker
+thread_local ThreadPool* t_pool = NULL;
+thread_local int t_workerIdx = -1;
+
+/**
+ * State shared by the calling thread and the helper tasks of a parallelFor call.
+ */
+struct ParallelForState {
+	std::atomic<int> nextChunk;
+	int numChunks;
+	int done;
+	std::exception_ptr exception;
+	std::mutex mutex;
+	std::condition_variable allDone;
+	ParallelForState(int _numChunks) :
+			nextChunk(0), numChunks(_numChunks), done(0) {
+	}
+};
+
+void runChunks(ParallelForState& state, int begin, int end, int chunkSize,
+		const std::function<void(int, int)>& body) {
+	int chunk;
+	while ((chunk = state.nextChunk++) < state.numChunks) {
+		int chunkBegin = begin + chunk * chunkSize;
+		try {
+			body(chunkBegin, std::min(end, chunkBegin + chunkSize));
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(state.mutex);
+			if (!state.exception) {
+				state.exception = std::current_exception();
+			}
+		}
+		std::lock_guard<std::mutex> lock(state.mutex);
+		if (++state.done == state.numChunks) {
+			state.allDone.notify_all();
+		}
+	}
+}
+
+} /* namespace */
+
+// --------------------------------------------------------------------------
+
+ThreadPool::ThreadPool(int numThreads) :
+		m_pending(0), m_queued(0), m_stop(false), m_nextQueue(0) {
+
+	if (numThreads <= 0) {
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	for (int i = 0; i < numThreads; ++i) {
+		m_queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+	}
+
+	for (int i = 0; i < numThreads; ++i) {
+		m_workers.push_back(std::thread(&ThreadPool::run, this, i));
+	}
+
+}
+
+// --------------------------------------------------------------------------
+
+ThreadPool::~ThreadPool() {
+
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_allDone.wait(lock, [this] {return m_pending == 0;});
+		m_stop = true;
+	}
+	m_taskAvailable.notify_all();
+
+	for (std::thread& worker : m_workers) {
+		worker.join();
+	}
+
+}
+
+// --------------------------------------------------------------------------
+
+void ThreadPool::submit(const Task& task) {
+
+	size_t queueIdx;
+	if (t_pool == this) {
+		queueIdx = t_workerIdx;
+	} else {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		queueIdx = m_nextQueue;
+		m_nextQueue = (m_nextQueue + 1) % m_queues.size();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_queues[queueIdx]->mutex);
+		m_queues[queueIdx]->tasks.push_back(task);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		++m_pending;
+		++m_queued;
+	}
+	m_taskAvailable.notify_one();
+
+}
+
+// --------------------------------------------------------------------------
+
+void ThreadPool::wait() {
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_allDone.wait(lock, [this] {return m_pending == 0;});
+
+	if (m_exception) {
+		std::exception_ptr exception = m_exception;
+		m_exception = std::exception_ptr();
+		std::rethrow_exception(exception);
+	}
+
+}
+
+// --------------------------------------------------------------------------
+
+void ThreadPool::parallelFor(int begin, int end, int chunkSize,
+		const std::function<void(int, int)>& body) {
+
+	if (begin >= end) {
+		return;
+	}
+
+	chunkSize = std::max(1, chunkSize);
+	int numChunks = (end - begin + chunkSize - 1) / chunkSize;
+
+	if (numChunks == 1) {
+		body(begin, end);
+		return;
+	}
+
+	std::shared_ptr<ParallelForState> state = std::make_shared<
+			ParallelForState>(numChunks);
+
+	// Helpers hold the state alive, those starting after every chunk
+	// has been taken return without touching the body
+	int numHelpers = std::min(getNumThreads(), numChunks - 1);
+	for (int i = 0; i < numHelpers; ++i) {
+		submit([state, begin, end, chunkSize, &body] {
+			runChunks(*state, begin, end, chunkSize, body);
+		});
+	}
+
+	// The calling thread works as well, so nested calls make progress
+	// even when every worker is busy
+	runChunks(*state, begin, end, chunkSize, body);
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->allDone.wait(lock,
+			[&state] {return state->done == state->numChunks;});
+
+	if (state->exception) {
+		std::rethrow_exception(state->exception);
+	}
+
+}
+
+// --------------------------------------------------------------------------
+
+int ThreadPool::getWorkerIndex() {
+	return t_workerIdx;
+}
+
+// --------------------------------------------------------------------------
+
+void ThreadPool::run(int workerIdx) {
+
+	t_pool = this;
+	t_workerIdx = workerIdx;
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_taskAvailable.wait(lock, [this] {return m_stop || m_queued > 0;});
+			if (m_queued == 0) {
+				// Stopped and no more work
+				return;
+			}
+			// Reserve a task, it is guaranteed to be found in some queue
+			--m_queued;
+		}
+
+		Task task;
+		while (takeTask(workerIdx, task) == false) {
+			std::this_thread::yield();
+		}
+
+		execute(task);
+	}
+
+}
+
+// --------------------------------------------------------------------------
+
+bool ThreadPool::takeTask(int workerIdx, Task& task) {
+
+	// Newest task from the own queue
+	{
+		WorkerQueue& queue = *m_queues[workerIdx];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty() == false) {
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+			return true;
+		}
+	}
+
+	// Oldest task from any other queue
+	for (size_t i = 1; i < m_queues.size(); ++i) {
+		WorkerQueue& queue = *m_queues[(workerIdx + i) % m_queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty() == false) {
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// --------------------------------------------------------------------------
+
+void ThreadPool::execute(Task& task) {
+
+	try {
+		task();
+	} catch (...) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_exception) {
+			m_exception = std::current_exception();
+		}
+	}
+
+	// Release captured state before accounting the task as finished
+	task = Task();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (--m_pending == 0) {
+		m_allDone.notify_all();
+	}
+
+}
+
+} /* namespace vlr */
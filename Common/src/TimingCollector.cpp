@@ -0,0 +1,123 @@
+/*
+ * TimingCollector.cpp
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: andresf
+ */
+
+#include <TimingCollector.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+namespace vlr {
+
+namespace {
+
+/**
+ * Nearest-rank percentile of a set of sorted samples.
+ */
+double percentile(const std::vector<double>& sorted, double p) {
+	size_t rank = (size_t) std::ceil(p / 100.0 * sorted.size());
+	return sorted[std::max((size_t) 1, rank) - 1];
+}
+
+} /* namespace */
+
+// --------------------------------------------------------------------------
+
+void TimingCollector::addSample(const std::string& stage,
+		double milliseconds) {
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	std::vector<double>& samples = m_samples[stage];
+	if (samples.empty() == true) {
+		m_stages.push_back(stage);
+	}
+	samples.push_back(milliseconds);
+
+}
+
+// --------------------------------------------------------------------------
+
+std::vector<StageSummary> TimingCollector::summarize() const {
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	std::vector<StageSummary> summaries;
+
+	for (const std::string& stage : m_stages) {
+		std::vector<double> sorted = m_samples.at(stage);
+		std::sort(sorted.begin(), sorted.end());
+
+		StageSummary summary;
+		summary.stage = stage;
+		summary.count = sorted.size();
+		summary.total = 0.0;
+		for (double sample : sorted) {
+			summary.total += sample;
+		}
+		summary.mean = summary.total / summary.count;
+		summary.p50 = percentile(sorted, 50);
+		summary.p90 = percentile(sorted, 90);
+		summary.p99 = percentile(sorted, 99);
+		summary.max = sorted.back();
+
+		summaries.push_back(summary);
+	}
+
+	return summaries;
+}
+
+// --------------------------------------------------------------------------
+
+void TimingCollector::save(const std::string& filename) const {
+
+	std::ofstream os(filename.c_str(), std::fstream::out);
+
+	if (os.good() == false) {
+		throw std::runtime_error("[TimingCollector::save] "
+				"Unable to open file [" + filename + "] for writing");
+	}
+
+	std::vector<StageSummary> summaries = summarize();
+
+	bool json = filename.size() >= 5
+			&& filename.compare(filename.size() - 5, 5, ".json") == 0;
+
+	if (json == true) {
+		os << "[\n";
+		for (size_t i = 0; i < summaries.size(); ++i) {
+			const StageSummary& s = summaries[i];
+			os << "  {\"stage\": \"" << s.stage << "\", \"count\": " << s.count
+					<< ", \"total_ms\": " << s.total << ", \"mean_ms\": "
+					<< s.mean << ", \"p50_ms\": " << s.p50 << ", \"p90_ms\": "
+					<< s.p90 << ", \"p99_ms\": " << s.p99 << ", \"max_ms\": "
+					<< s.max << "}" << (i + 1 < summaries.size() ? "," : "")
+					<< "\n";
+		}
+		os << "]\n";
+	} else {
+		os << "stage,count,total_ms,mean_ms,p50_ms,p90_ms,p99_ms,max_ms\n";
+		for (const StageSummary& s : summaries) {
+			os << s.stage << "," << s.count << "," << s.total << "," << s.mean
+					<< "," << s.p50 << "," << s.p90 << "," << s.p99 << ","
+					<< s.max << "\n";
+		}
+	}
+
+	os.close();
+}
+
+// --------------------------------------------------------------------------
+
+void TimingCollector::clear() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_samples.clear();
+	m_stages.clear();
+}
+
+} /* namespace vlr */
@@ -0,0 +1,78 @@
+/*
+ * ThreadPool_test.cpp
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: andresf
+ */
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+
+#include <ThreadPool.hpp>
+
+void spawnTasks(vlr::ThreadPool& pool, std::atomic<int>& leaves, int depth) {
+	if (depth == 0) {
+		++leaves;
+		return;
+	}
+	for (int c = 0; c < 4; ++c) {
+		pool.submit([&pool, &leaves, depth] {
+			spawnTasks(pool, leaves, depth - 1);
+		});
+	}
+}
+
+TEST(ThreadPool, RecursiveTasks) {
+
+	vlr::ThreadPool pool(4);
+
+	std::atomic<int> leaves(0);
+
+	spawnTasks(pool, leaves, 6);
+	pool.wait();
+
+	ASSERT_EQ(4096, leaves.load());
+
+}
+
+TEST(ThreadPool, ParallelFor) {
+
+	vlr::ThreadPool pool(4);
+
+	std::vector<int> values(10000, 0);
+
+	// Nested calls from within tasks must not block
+	for (int t = 0; t < 8; ++t) {
+		pool.submit([&pool, &values, t] {
+			pool.parallelFor(t * 1250, (t + 1) * 1250, 100, [&values](int begin, int end) {
+						for (int i = begin; i < end; ++i) {
+							values[i] = i;
+						}
+					});
+		});
+	}
+	pool.wait();
+
+	for (int i = 0; i < int(values.size()); ++i) {
+		ASSERT_EQ(i, values[i]);
+	}
+
+}
+
+TEST(ThreadPool, Exception) {
+
+	vlr::ThreadPool pool(2);
+
+	pool.submit([] {throw std::runtime_error("Task failed");});
+
+	ASSERT_THROW(pool.wait(), std::runtime_error);
+
+	// Pool is still usable
+	std::atomic<int> leaves(0);
+	spawnTasks(pool, leaves, 2);
+	pool.wait();
+
+	ASSERT_EQ(16, leaves.load());
+
+}
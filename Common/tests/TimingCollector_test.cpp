@@ -0,0 +1,111 @@
+/*
+ * TimingCollector_test.cpp
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: andresf
+ */
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+
+#include <Logging.hpp>
+#include <TimingCollector.hpp>
+
+TEST(TimingCollector, Percentiles) {
+
+	vlr::TimingCollector timings;
+
+	// Samples 1..100 ms added in reverse order
+	for (int i = 100; i >= 1; --i) {
+		timings.addSample("score", i);
+	}
+	timings.addSample("load", 5.0);
+
+	std::vector<vlr::StageSummary> summaries = timings.summarize();
+
+	ASSERT_EQ(2u, summaries.size());
+
+	// Stages are kept in order of first appearance
+	EXPECT_EQ("score", summaries[0].stage);
+	EXPECT_EQ("load", summaries[1].stage);
+
+	EXPECT_EQ(100u, summaries[0].count);
+	EXPECT_DOUBLE_EQ(5050.0, summaries[0].total);
+	EXPECT_DOUBLE_EQ(50.5, summaries[0].mean);
+	EXPECT_DOUBLE_EQ(50.0, summaries[0].p50);
+	EXPECT_DOUBLE_EQ(90.0, summaries[0].p90);
+	EXPECT_DOUBLE_EQ(99.0, summaries[0].p99);
+	EXPECT_DOUBLE_EQ(100.0, summaries[0].max);
+
+	EXPECT_EQ(1u, summaries[1].count);
+	EXPECT_DOUBLE_EQ(5.0, summaries[1].p99);
+
+}
+
+TEST(TimingCollector, StageTimer) {
+
+	vlr::TimingCollector timings;
+
+	{
+		vlr::StageTimer timer(&timings, "write");
+		timer.stop();
+		// Stopping twice adds a single sample
+	}
+
+	{
+		// No collector means nothing is measured
+		vlr::StageTimer timer(NULL, "write");
+	}
+
+	std::vector<vlr::StageSummary> summaries = timings.summarize();
+
+	ASSERT_EQ(1u, summaries.size());
+	EXPECT_EQ(1u, summaries[0].count);
+	EXPECT_GE(summaries[0].total, 0.0);
+
+}
+
+TEST(TimingCollector, SaveCsvAndJson) {
+
+	vlr::TimingCollector timings;
+	timings.addSample("quantize", 2.0);
+	timings.addSample("quantize", 4.0);
+
+	timings.save("test_timings.csv");
+	timings.save("test_timings.json");
+
+	std::ifstream csv("test_timings.csv");
+	std::string header, row;
+	std::getline(csv, header);
+	std::getline(csv, row);
+	EXPECT_EQ("stage,count,total_ms,mean_ms,p50_ms,p90_ms,p99_ms,max_ms",
+			header);
+	EXPECT_EQ("quantize,2,6,3,2,4,4,4", row);
+
+	std::ifstream json("test_timings.json");
+	std::string line;
+	std::getline(json, line);
+	EXPECT_EQ("[", line);
+	std::getline(json, line);
+	EXPECT_NE(std::string::npos, line.find("\"stage\": \"quantize\""));
+
+}
+
+TEST(Logging, Levels) {
+
+	vlr::LogLevel previous = vlr::getLogLevel();
+
+	vlr::setLogLevel(vlr::parseLogLevel("ERROR"));
+	EXPECT_TRUE(vlr::isLogEnabled(vlr::LOG_ERROR));
+	EXPECT_FALSE(vlr::isLogEnabled(vlr::LOG_INFO));
+
+	vlr::setLogLevel(vlr::parseLogLevel("DEBUG"));
+	EXPECT_TRUE(vlr::isLogEnabled(vlr::LOG_INFO));
+	EXPECT_TRUE(vlr::isLogEnabled(vlr::LOG_DEBUG));
+
+	EXPECT_THROW(vlr::parseLogLevel("LOUD"), std::runtime_error);
+
+	vlr::setLogLevel(previous);
+
+}
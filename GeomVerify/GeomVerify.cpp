@@ -6,6 +6,7 @@
  */
 
 #include <iostream>
+#include <memory>
 #include <stdexcept>
 
 #include <opencv2/calib3d/calib3d.hpp>
@@ -17,8 +18,8 @@
 #include <FileUtils.hpp>
 #include <FunctionUtils.hpp>
 #include <HtmlResultsWriter.hpp>
-
-double mytime;
+#include <ThreadPool.hpp>
+#include <VocabDB.hpp>
 
 // For each query
 //	 - Load its keys
@@ -31,16 +32,126 @@ double mytime;
 //		 - Obtain number of inliers
 //	 - Re-order list of candidates by its number of inliers
 
+/**
+ * Parameters of the verification of a query against its candidates.
+ */
+struct VerificationParams {
+	// Folder holding the key-points of the database images
+	std::string dbKeysFolder;
+	// Folder holding the key-points of the queries
+	std::string queriesKeysFolder;
+	// Folder holding the lists of ranked candidates of the queries
+	std::string rankedListsFolder;
+	int topCandidates;
+	int topKeypoints;
+	double ratioThreshold;
+	double distanceThreshold;
+	int ransacMinMatches;
+	double ransacThreshold;
+	// Whether to keep the key-points and inlier matches to draw them
+	bool keepMatches;
+};
+
+/**
+ * Outcome of verifying a candidate, filled concurrently and consumed in
+ * candidate order.
+ */
+struct CandidateResult {
+	// Number of putative matches between query and candidate
+	int numMatches;
+	// Number of putative matches consistent with the homography, 0 if it was not computed
+	int numInliers;
+	// Time in ms taken to find the putative matches
+	double matchTime;
+	// Time in ms taken to compute the homography, -1 if it was not computed
+	double homographyTime;
+	// Filtered key-points of the candidate and the inlier matches to the query,
+	// only kept when drawing the matches
+	std::vector<cv::KeyPoint> keypoints;
+	std::vector<cv::DMatch> inlierMatches;
+	// Error that stopped verifying the candidate, empty on success
+	std::string error;
+};
+
+/**
+ * Outcome of verifying a query, filled concurrently and consumed in query
+ * order.
+ */
+struct QueryResult {
+	// Base name of the query, used to name the match images
+	std::string queryBase;
+	// Filtered key-points of the query, only kept when drawing the matches
+	std::vector<cv::KeyPoint> keypoints;
+	// Candidates as ranked by the database
+	std::vector<std::string> rankedCandidates;
+	// Outcome of each of the top candidates, in ranked order
+	std::vector<CandidateResult> candidates;
+	// Error that stopped verifying the query, empty on success
+	std::string error;
+};
+
+/**
+ * Loads the features of a query and its ranked candidates and verifies the
+ * top candidates, concurrently if a thread pool is given.
+ *
+ * @param params - The verification parameters
+ * @param db - The database holding the direct index, if empty features are matched by brute force
+ * @param dbDescList - The descriptors file of every database image, in database order
+ * @param query - The query to verify
+ * @param queryIdx - The position of the query in the list of queries
+ * @param pool - The pool verifying the candidates, if empty they are verified serially
+ * @param result - The outcome of every top candidate, or the error if the query could not be verified
+ */
+void verifyQuery(const VerificationParams& params,
+		const cv::Ptr<vlr::HKMDB>& db,
+		const std::vector<std::string>& dbDescList,
+		const FileUtils::Query& query, size_t queryIdx,
+		const cv::Ptr<vlr::ThreadPool>& pool, QueryResult& result);
+
+/**
+ * Loads the features of a candidate, matches them against the query features
+ * and computes the homography between candidate and query.
+ *
+ * @param params - The verification parameters
+ * @param db - The database holding the direct index, if empty features are matched by brute force
+ * @param dbDescList - The descriptors file of every database image, in database order
+ * @param queryKeypoints - The filtered key-points of the query
+ * @param queryDescriptors - The filtered descriptors of the query
+ * @param queryIndex - The direct index holding the query features as its only image
+ * @param candidate - The name of the candidate
+ * @param result - The matches and inliers found, or the error if the candidate could not be verified
+ */
+void verifyCandidate(const VerificationParams& params,
+		const cv::Ptr<vlr::HKMDB>& db,
+		const std::vector<std::string>& dbDescList,
+		const std::vector<cv::KeyPoint>& queryKeypoints,
+		const cv::Mat& queryDescriptors, const vlr::DirectIndex& queryIndex,
+		const std::string& candidate, CandidateResult& result);
+
+/**
+ * Draws the inlier matches between a query and each of its candidates for
+ * which a homography was computed and saves them as images. It only reads
+ * the images, so it can run once the query is verified.
+ *
+ * @param imagesFolder - The folder holding the JPEG images of queries and candidates
+ * @param outFolder - The folder where to save the match images
+ * @param result - The verified query
+ */
+void drawQueryMatches(const std::string& imagesFolder,
+		const std::string& outFolder, const QueryResult& result);
+
 int main(int argc, char **argv) {
 
-	if (argc < 9 || argc > 13) {
+	if (argc < 9 || argc > 18) {
 		printf(
 				"\nUsage:\n"
 						"\tGeomVerify "
 						"<in.ranked.files.folder> <in.ranked.files.prefix> "
 						"<in.db.descriptors.list> <in.db.keypoints.folder> <in.queries.descriptors.list> <in.queries.keypoints.folder> "
 						"<out.re-ranked.files.folder> <in.top.candidates> "
-						"[in.topKeypoints:500] [in.ratio.thr:0.8|in.distance.thr:90] [im.min.matches:8] [in.ransac.thr:10]"
+						"[in.topKeypoints:500] [in.ratio.thr:0.8|in.distance.thr:90] [im.min.matches:8] [in.ransac.thr:10] "
+						"[in.vocab:-] [in.direct.index:-] [in.num.threads:1] [in.num.queries:1] "
+						"[in.images.folder:-]"
 						"\n\n");
 		return EXIT_FAILURE;
 	}
@@ -59,9 +170,53 @@ int main(int argc, char **argv) {
 	double distanceThreshold = argc >= 11 ? atof(argv[10]) : 90; // Distance threshold for nearest neighbor test (for binary descriptors)
 	int ransacMinMatches = argc >= 12 ? atoi(argv[11]) : 8;
 	double ransacThreshold = argc >= 13 ? atof(argv[12]) : 10.0;
+	std::string in_vocab = argc >= 14 ? argv[13] : "-";
+	std::string in_direct_index = argc >= 15 ? argv[14] : "-";
+	int in_num_threads = argc >= 16 ? atoi(argv[15]) : 1;
+	int in_num_queries = argc >= 17 ? atoi(argv[16]) : 1;
+	// Folder of the JPEG images from which the matches are drawn, if not given
+	// no match images are written
+	std::string in_images_folder = argc >= 18 ? argv[17] : "-";
+
+	if (in_num_queries < 1) {
+		fprintf(stderr, "Number of queries verified concurrently must be"
+				" positive\n");
+		return EXIT_FAILURE;
+	}
 
 	// Step 1/4: load tree + direct index
 
+	// Putative matches are searched only among the features assigned to the
+	// same node of the tree when both the vocabulary and the direct index of the
+	// database are given, otherwise all the features are compared
+	cv::Ptr<vlr::HKMDB> db;
+
+	if (in_vocab.compare("-") != 0 && in_direct_index.compare("-") != 0) {
+
+		std::string in_type = vlr::VocabBase::loadVocabType(in_vocab);
+
+		if (in_type.compare("HKM") != 0 && in_type.compare("HKMAJ") != 0) {
+			fprintf(stderr,
+					"Direct index requires a HKM or HKMAJ vocabulary, got [%s]\n",
+					in_type.c_str());
+			return EXIT_FAILURE;
+		}
+
+		printf("-- Loading vocabulary from [%s]\n", in_vocab.c_str());
+		db = new vlr::HKMDB(in_type.compare("HKMAJ") == 0);
+		db->loadBoFModel(in_vocab);
+
+		printf("-- Loading direct index from [%s]\n", in_direct_index.c_str());
+		try {
+			db->loadDirectIndex(in_direct_index);
+		} catch (const std::runtime_error& error) {
+			fprintf(stderr, "%s\n", error.what());
+			return EXIT_FAILURE;
+		}
+		printf("   Loaded, got [%lu] images at level [%d]\n",
+				db->getDirectIndex()->size(), db->getDirectIndexLevel());
+	}
+
 	printf(
 			"-- Running spatial verification using topCandidates=[%d] topKeypoints=[%d] "
 					"ratioThr=[%2.1f] distanceThre=[%f] ransacMinMatches=[%d] ransacThr=[%2.1f]\n",
@@ -86,282 +241,443 @@ int main(int argc, char **argv) {
 
 	// Step 4/4: load and process queries key-points
 	printf("-- Loading and processing queries key-points\n");
-	std::vector<cv::KeyPoint> queryKeypoints;
 
-	std::vector<std::string> ranked_candidates_list,
-			geom_ranked_candidates_list;
-	std::vector<cv::KeyPoint> candidateKeypoints;
-	std::stringstream ranked_list_fname;
+	VerificationParams params;
+	params.dbKeysFolder = in_db_keys_folder;
+	params.queriesKeysFolder = in_queries_keys_folder;
+	params.rankedListsFolder = in_ranked_lists_folder;
+	params.topCandidates = topCandidates;
+	params.topKeypoints = topKeypoints;
+	params.ratioThreshold = ratioThreshold;
+	params.distanceThreshold = distanceThreshold;
+	params.ransacMinMatches = ransacMinMatches;
+	params.ransacThreshold = ransacThreshold;
+	params.keepMatches = in_images_folder.compare("-") != 0;
+
+	// Candidates are independent, so the top candidates of a query are verified
+	// concurrently. Queries are processed in windows whose results are reported
+	// and saved in query order once the whole window is verified.
+	cv::Ptr<vlr::ThreadPool> pool;
+	size_t window = in_num_queries;
+
+	if (in_num_threads != 1) {
+		pool = new vlr::ThreadPool(in_num_threads);
+		printf("   Verifying candidates of up to [%lu] queries concurrently "
+				"using [%d] threads\n", window, pool->getNumThreads());
+	}
 
-	std::vector<cv::DMatch> matchesCandidateToQuery, inlierMatches;
-	std::vector<cv::Point2f> matchedCandidatePoints, matchedQueryPoints;
-	int top = -1;
+	std::vector<QueryResult> results(window);
 
-	cv::Mat inliers_idx, H;
+	// Match images are drawn by a separate worker once each query is verified,
+	// so decoding and encoding the images does not delay the verification
+	cv::Ptr<vlr::ThreadPool> drawer;
+
+	if (params.keepMatches == true) {
+		drawer = new vlr::ThreadPool(1);
+		printf("   Drawing matches from the images in [%s]\n",
+				in_images_folder.c_str());
+	}
+
+	std::vector<std::string> geom_ranked_candidates_list;
+	std::stringstream ranked_list_fname;
 	std::vector<int> candidates_inliers;
 	std::vector<size_t> candidates_inliers_idx;
 
-	cv::Mat imgOut;
-	cv::Mat queryImg, candidateImg;
-	cv::Mat candidateDescriptors;
-	cv::Mat queryDescriptors;
-
-	std::string queryBase, candidateBase;
+	std::string candidateBase;
 
 	cvflann::Logger::setDestination("inliers.log");
 
 	// Loop over list of queries key-points
-	for (size_t i = 0; i < queries_desc_list.size(); ++i) {
-		printf("-- Processing query [%lu] - [%s]\n", i,
-				queries_desc_list[i].name.c_str());
+	for (size_t first = 0; first < queries_desc_list.size(); first += window) {
+
+		size_t last = std::min(first + window, queries_desc_list.size());
+
+		if (pool.empty() == true || last - first == 1) {
+			for (size_t i = first; i < last; ++i) {
+				verifyQuery(params, db, db_desc_list, queries_desc_list[i], i,
+						pool, results[i - first]);
+			}
+		} else {
+			pool->parallelFor(first, last, 1, [&](int begin, int end) {
+				for (int i = begin; i < end; ++i) {
+					verifyQuery(params, db, db_desc_list, queries_desc_list[i],
+							i, pool, results[i - first]);
+				}
+			});
+		}
+
+		for (size_t i = first; i < last; ++i) {
+
+			QueryResult& result = results[i - first];
+
+			printf("-- Processing query [%lu] - [%s]\n", i,
+					queries_desc_list[i].name.c_str());
+
+			if (result.error.empty() == false) {
+				fprintf(stderr, "%s\n", result.error.c_str());
+				return EXIT_FAILURE;
+			}
+
+			std::vector<std::string>& ranked_candidates_list =
+					result.rankedCandidates;
+
+			printf("   Loaded, got [%lu] candidates\n",
+					ranked_candidates_list.size());
+
+			int top = int(result.candidates.size());
+
+			candidates_inliers.clear();
+			candidates_inliers.resize(top, 0);
+
+			for (int j = 0; j < top; ++j) {
+
+				CandidateResult& candidate = result.candidates[j];
+
+				candidateBase = ranked_candidates_list[j];
+
+				if (candidate.error.empty() == false) {
+					fprintf(stderr, "%s\n", candidate.error.c_str());
+					return EXIT_FAILURE;
+				}
+
+				printf("   Found [%d] putative matches between query [%lu] "
+						"and candidate [%d] in [%lf] ms\n",
+						candidate.numMatches, i, j, candidate.matchTime);
+
+				if (candidate.numMatches < ransacMinMatches) {
+					fprintf(stderr, "   Cannot compute homography between"
+							" query [%lu] and candidate [%d], "
+							"need at least [%d] putative matches\n", i, j,
+							ransacMinMatches);
+				} else {
+					printf("   Computed homography between query [%lu] and "
+							"candidate [%d] in [%lf] ms, found [%d] inliers\n",
+							i, j, candidate.homographyTime,
+							candidate.numInliers);
+
+					candidates_inliers[j] = candidate.numInliers;
+				}
 
-		queryBase = queries_desc_list[i].name.substr(8,
-				queries_desc_list[i].name.length() - 12);
+				cvflann::Logger::log(0,
+						"query=[%s] candidate=[%s] numberInliers=[%d]\n",
+						result.queryBase.c_str(), candidateBase.c_str(),
+						candidates_inliers[j]);
+
+			}
+
+			printf("-- Re-ranking candidates list\n");
+
+			// Re-order list of candidates by its inlier number, the sort is stable
+			// so candidates with the same number of inliers keep their ranking
+			// and the result does not depend on the order they were verified
+			sortAndKeepIdx(candidates_inliers, candidates_inliers_idx,
+					CV_SORT_DESCENDING);
+
+			// Copying re-ranked candidates
+			geom_ranked_candidates_list.clear();
+			for (size_t j = 0; int(j) < top; ++j) {
+				geom_ranked_candidates_list.push_back(
+						ranked_candidates_list[candidates_inliers_idx[j]]);
+			}
+
+#if GVVERBOSE
+			printf("Original ranked candidates list:\n");
+			for (std::string candidate : ranked_candidates_list) {
+				printf("%s, ", candidate.c_str());
+			}
+			printf("\n");
+#endif
+
+#if GVVERBOSE
+			printf("Re-ranked candidates list:\n");
+			for (std::string candidate : geom_ranked_candidates_list) {
+				printf("%s, ", candidate.c_str());
+			}
+			printf("\n");
+#endif
+
+			// Copying non re-ranked candidates
+			geom_ranked_candidates_list.insert(
+					geom_ranked_candidates_list.end(),
+					ranked_candidates_list.begin() + top,
+					ranked_candidates_list.end());
+
+			printf("   Done, re-ranked top [%d] candidates out of [%lu]\n", top,
+					geom_ranked_candidates_list.size());
+
+#if GVVERBOSE
+			printf("Full re-ranked candidates list:\n");
+			for (std::string candidate : geom_ranked_candidates_list) {
+				printf("%s, ", candidate.c_str());
+			}
+			printf("\n");
+#endif
+
+			printf("-- Saving list of re-ranked candidates\n");
+
+			ranked_list_fname.str("");
+			ranked_list_fname << out_ranked_lists_folder << "/query_" << i
+					<< "_ranked.txt";
+			FileUtils::saveList(ranked_list_fname.str(),
+					geom_ranked_candidates_list);
+
+			printf("   Done, saved [%lu] entries\n",
+					geom_ranked_candidates_list.size());
+
+			if (drawer.empty() == false) {
+				// The drawing task takes over the key-points and matches of the query
+				std::shared_ptr<QueryResult> verified = std::make_shared<
+						QueryResult>();
+				std::swap(*verified, result);
+				drawer->submit([=]() {
+					drawQueryMatches(in_images_folder, out_ranked_lists_folder,
+							*verified);
+				});
+			}
+
+			// Release the features of the query before the next window
+			result = QueryResult();
+		}
+	}
+
+	if (drawer.empty() == false) {
+		printf("-- Waiting for the match images to be written\n");
+		try {
+			drawer->wait();
+		} catch (const std::exception& e) {
+			fprintf(stderr, "%s\n", e.what());
+			return EXIT_FAILURE;
+		}
+	}
+
+//	HtmlResultsWriter::getInstance().close();
+
+}
+
+// --------------------------------------------------------------------------
+
+void verifyQuery(const VerificationParams& params,
+		const cv::Ptr<vlr::HKMDB>& db,
+		const std::vector<std::string>& dbDescList,
+		const FileUtils::Query& query, size_t queryIdx,
+		const cv::Ptr<vlr::ThreadPool>& pool, QueryResult& result) {
+
+	result = QueryResult();
+
+	cv::Mat queryDescriptors;
+	vlr::DirectIndex queryIndex;
+
+	try {
+
+		result.queryBase = query.name.substr(8, query.name.length() - 12);
 
 		// Step 4a: load and pre-process query features
 		FileUtils::loadKeypoints(
-				in_queries_keys_folder + "/" + queryBase + ".yaml.gz",
-				queryKeypoints);
-		FileUtils::loadDescriptors(queries_desc_list[i].name, queryDescriptors);
-		filterFeatures(queryKeypoints, queryDescriptors, topKeypoints);
+				params.queriesKeysFolder + "/" + result.queryBase + ".yaml.gz",
+				result.keypoints);
+		FileUtils::loadDescriptors(query.name, queryDescriptors);
+		filterFeatures(result.keypoints, queryDescriptors,
+				params.topKeypoints);
+
+		if (db.empty() == false) {
+			// Assign the kept query features to the nodes of the direct index level
+			std::vector<int> wordIds(queryDescriptors.rows);
+			std::vector<int> nodeIds(queryDescriptors.rows);
+			db->quantize(queryDescriptors, wordIds.data(), nodeIds.data());
+			queryIndex.addImage(0, nodeIds);
+		}
 
 		// Step 4b: load list of query ranked candidates
-		printf("   Loading list of ranked candidates\n");
-		// Load list of query ranked candidates
 		// Note: recall that elements in the lists of queries key-points and descriptors
 		// follow the same order and hence using query key-points filename position to build
 		// its ranked candidates filename its legal
-		ranked_list_fname.str("");
-		ranked_list_fname << in_ranked_lists_folder << "/query_" << i
+		std::stringstream ranked_list_fname;
+		ranked_list_fname << params.rankedListsFolder << "/query_" << queryIdx
 				<< "_ranked.txt";
-		FileUtils::loadList(ranked_list_fname.str(), ranked_candidates_list);
-		printf("   Loaded, got [%lu] candidates\n",
-				ranked_candidates_list.size());
+		FileUtils::loadList(ranked_list_fname.str(), result.rankedCandidates);
 
-		top = MIN(int(ranked_candidates_list.size()), topCandidates);
+	} catch (const std::exception& e) {
+		result.error = e.what();
+		return;
+	}
 
-		candidates_inliers.clear();
-		candidates_inliers.resize(top, 0);
+	int top = std::min(int(result.rankedCandidates.size()),
+			params.topCandidates);
 
-		queryImg = cv::imread("oxbuild_images/" + queryBase + ".jpg",
-				CV_LOAD_IMAGE_GRAYSCALE);
+	result.candidates.resize(std::max(top, 0));
 
-//		imgOut = cv::Mat();
-//		cv::drawKeypoints(queryImg, queryKeypoints, imgOut,
-//				cv::Scalar(255, 255, 0), cv::DrawMatchesFlags::DEFAULT);
-//		cv::namedWindow("oxbuild_images/" + queryBase + ".jpg",
-//				cv::WINDOW_NORMAL);
-//		cv::resizeWindow("oxbuild_images/" + queryBase + ".jpg", 500, 500);
-//		cv::imshow("oxbuild_images/" + queryBase + ".jpg", imgOut);
-//		cv::waitKey(0);
-
-		// Step 4c: load and pre-process candidate features
-		for (int j = 0; j < top; ++j) {
-
-			printf("   Load and pre-process candidate features\n");
-			FileUtils::loadKeypoints(
-					in_db_keys_folder + "/" + ranked_candidates_list[j]
-							+ ".yaml.gz", candidateKeypoints);
-			FileUtils::loadDescriptors(
-					"db/" + ranked_candidates_list[j] + ".bin",
-					candidateDescriptors);
-			filterFeatures(candidateKeypoints, candidateDescriptors,
-					topKeypoints);
-
-			// Searching putative matches
-			printf("   Matching key-points of query [%lu] "
-					"against candidate [%d]\n", i, j);
-
-			// Id of database image
-			std::vector<std::string>::iterator it = std::find(
-					db_desc_list.begin(), db_desc_list.end(),
-					"db/" + ranked_candidates_list[j] + ".bin");
-
-			if (it == db_desc_list.end()) {
-				throw std::runtime_error("Candidate [%s] not found "
-						"in list of database filenames");
-			}
+	// Step 4c: verify every top candidate
+	auto verify = [&](int begin, int end) {
+		for (int j = begin; j < end; ++j) {
+			verifyCandidate(params, db, dbDescList, result.keypoints,
+					queryDescriptors, queryIndex, result.rankedCandidates[j],
+					result.candidates[j]);
+		}
+	};
 
-			candidateBase = ranked_candidates_list[j];
-			candidateImg = cv::imread(
-					"oxbuild_images/" + candidateBase + ".jpg",
-					CV_LOAD_IMAGE_GRAYSCALE);
-
-//			imgOut = cv::Mat();
-//			cv::drawKeypoints(candidateImg, candidateKeypoints, imgOut,
-//					cv::Scalar(255, 255, 0), cv::DrawMatchesFlags::DEFAULT);
-//			cv::namedWindow("oxbuild_images/" + candidateBase + ".jpg",
-//					cv::WINDOW_NORMAL);
-//			cv::resizeWindow("oxbuild_images/" + candidateBase + ".jpg", 500,
-//					500);
-//			cv::imshow("oxbuild_images/" + candidateBase + ".jpg", imgOut);
-//			cv::waitKey(0);
-
-			mytime = cv::getTickCount();
-
-			// TODO Use the direct index to pre-filter query and candidate key-points
-
-			matchKeypoints(candidateDescriptors, queryDescriptors,
-					matchesCandidateToQuery, ratioThreshold, distanceThreshold);
-
-			matchedCandidatePoints.clear();
-			matchedQueryPoints.clear();
-
-			for (cv::DMatch& match : matchesCandidateToQuery) {
-//				double kptsDist = cv::norm(
-//						cv::Point(candidateKeypoints[match.queryIdx].pt.x,
-//								candidateKeypoints[match.queryIdx].pt.y)
-//								- cv::Point(queryKeypoints[match.trainIdx].pt.x,
-//										queryKeypoints[match.trainIdx].pt.y));
-//
-//				// Apply a proximity threshold
-//				if (kptsDist > 200) {
-//					continue;
-//				}
-				// Add points to vectors of matched
-				matchedQueryPoints.push_back(queryKeypoints[match.trainIdx].pt);
-				matchedCandidatePoints.push_back(
-						candidateKeypoints[match.queryIdx].pt);
-			}
+	if (pool.empty() == true) {
+		verify(0, top);
+	} else {
+		pool->parallelFor(0, top, 1, verify);
+	}
 
-			mytime = (double(cv::getTickCount()) - mytime)
-					/ cv::getTickFrequency() * 1000;
-
-			printf("   Found [%d] putative matches in [%lf] ms\n",
-					int(matchesCandidateToQuery.size()), mytime);
-
-//			imgOut = cv::Mat();
-//			cv::drawMatches(candidateImg, candidateKeypoints, queryImg,
-//					queryKeypoints, matchesCandidateToQuery, imgOut);
-//			cv::namedWindow(
-//					"oxbuild_images/" + queryBase + "_" + candidateBase
-//							+ ".jpg", cv::WINDOW_NORMAL);
-//			cv::resizeWindow(
-//					"oxbuild_images/" + queryBase + "_" + candidateBase
-//							+ ".jpg", 500, 500);
-//			cv::imshow(
-//					"oxbuild_images/" + queryBase + "_" + candidateBase
-//							+ ".jpg", imgOut);
-//			cv::waitKey(0);
-
-			if ((int(matchesCandidateToQuery.size())) < ransacMinMatches) {
-				fprintf(stderr, "   Cannot compute homography between"
-						" query [%lu] and candidate [%d], "
-						"need at least [%d] putative matches\n", i, j,
-						ransacMinMatches);
-			} else {
-				// Compute a projective transformation between query and ranked file using direct index
-				printf("   Computing projective transformation "
-						"between query [%lu] and candidate [%d]\n", i, j);
-
-				inliers_idx = cv::Mat();
-
-				mytime = cv::getTickCount();
-				H = cv::findHomography(matchedCandidatePoints,
-						matchedQueryPoints, CV_RANSAC, ransacThreshold,
-						inliers_idx);
-				mytime = (double(cv::getTickCount()) - mytime)
-						/ cv::getTickFrequency() * 1000;
-
-				// Obtain number of inliers
-				int numInliers = int(sum(inliers_idx)[0]);
-
-				printf(
-						"   Computed homography in [%0.3fs], found [%d] inliers\n",
-						mytime, numInliers);
-
-				candidates_inliers[j] = numInliers;
-
-				inlierMatches.clear();
-				for (int i = 0; i < inliers_idx.rows; ++i) {
-					if (int(inliers_idx.at<uchar>(i)) == int(1)) {
-						inlierMatches.push_back(matchesCandidateToQuery.at(i));
-					}
-				}
-				imgOut = cv::Mat();
-				cv::drawMatches(candidateImg, candidateKeypoints, queryImg,
-						queryKeypoints, inlierMatches, imgOut);
-				cv::imwrite(
-						out_ranked_lists_folder + "/match_" + queryBase + "_"
-								+ candidateBase + ".jpg", imgOut);
-
-//				cv::namedWindow(
-//						"oxbuild_images/match_" + queryBase + "_"
-//								+ candidateBase + ".jpg", cv::WINDOW_NORMAL);
-//				cv::resizeWindow(
-//						"oxbuild_images/match_" + queryBase + "_"
-//								+ candidateBase + ".jpg", 500, 500);
-//				cv::imshow(
-//						"oxbuild_images/match_" + queryBase + "_"
-//								+ candidateBase + ".jpg", imgOut);
-//				cv::waitKey(0);
+	if (params.keepMatches == false) {
+		std::vector<cv::KeyPoint>().swap(result.keypoints);
+	}
 
-			}
+}
 
-			cvflann::Logger::log(0,
-					"query=[%s] candidate=[%s] numberInliers=[%d]\n",
-					queryBase.c_str(), candidateBase.c_str(),
-					candidates_inliers[j]);
+// --------------------------------------------------------------------------
 
-		}
+void verifyCandidate(const VerificationParams& params,
+		const cv::Ptr<vlr::HKMDB>& db,
+		const std::vector<std::string>& dbDescList,
+		const std::vector<cv::KeyPoint>& queryKeypoints,
+		const cv::Mat& queryDescriptors, const vlr::DirectIndex& queryIndex,
+		const std::string& candidate, CandidateResult& result) {
 
-		printf("-- Re-ranking candidates list\n");
+	result = CandidateResult();
+	result.numMatches = 0;
+	result.numInliers = 0;
+	result.matchTime = 0.0;
+	result.homographyTime = -1.0;
 
-		// Re-order list of candidates by its inlier number
-		sortAndKeepIdx(candidates_inliers, candidates_inliers_idx,
-				CV_SORT_DESCENDING);
+	// Descriptors are only read, the header is copied as the matchers take
+	// non-constant references
+	cv::Mat queryDesc = queryDescriptors;
+	cv::Mat candidateDescriptors;
+	std::vector<size_t> candidateKeptIndices;
+	std::vector<vlr::NodeFeature> candidateNodes;
+	std::vector<cv::DMatch> matchesCandidateToQuery;
+	std::vector<cv::Point2f> matchedCandidatePoints, matchedQueryPoints;
+
+	try {
 
-		// Copying re-ranked candidates
-		geom_ranked_candidates_list.clear();
-		for (size_t j = 0; int(j) < top; ++j) {
-			geom_ranked_candidates_list.push_back(
-					ranked_candidates_list[candidates_inliers_idx[j]]);
+		FileUtils::loadKeypoints(
+				params.dbKeysFolder + "/" + candidate + ".yaml.gz",
+				result.keypoints);
+		FileUtils::loadDescriptors("db/" + candidate + ".bin",
+				candidateDescriptors);
+		filterFeatures(result.keypoints, candidateDescriptors,
+				params.topKeypoints, &candidateKeptIndices);
+
+		// Id of database image
+		std::vector<std::string>::const_iterator it = std::find(
+				dbDescList.begin(), dbDescList.end(),
+				"db/" + candidate + ".bin");
+
+		if (it == dbDescList.end()) {
+			throw std::runtime_error("Candidate [" + candidate + "] not found "
+					"in list of database filenames");
 		}
 
-#if GVVERBOSE
-		printf("Original ranked candidates list:\n");
-		for (std::string candidate : ranked_candidates_list) {
-			printf("%s, ", candidate.c_str());
+		// Searching putative matches
+		double startTime = cv::getTickCount();
+
+		if (db.empty() == false) {
+			// Only candidate and query features sharing a node are compared
+			selectNodeFeatures(
+					db->getDirectIndex()->lookUpImg(int(it - dbDescList.begin())),
+					candidateKeptIndices, candidateNodes);
+			matchKeypoints(
+					vlr::NodeFeatureRange(candidateNodes.data(),
+							candidateNodes.data() + candidateNodes.size()),
+					candidateDescriptors, queryIndex.lookUpImg(0), queryDesc,
+					matchesCandidateToQuery, params.ratioThreshold,
+					params.distanceThreshold);
+		} else {
+			matchKeypoints(candidateDescriptors, queryDesc,
+					matchesCandidateToQuery, params.ratioThreshold,
+					params.distanceThreshold);
 		}
-		printf("\n");
-#endif
 
-#if GVVERBOSE
-		printf("Re-ranked candidates list:\n");
-		for (std::string candidate : geom_ranked_candidates_list) {
-			printf("%s, ", candidate.c_str());
+		for (cv::DMatch& match : matchesCandidateToQuery) {
+			// Add points to vectors of matched
+			matchedQueryPoints.push_back(queryKeypoints[match.trainIdx].pt);
+			matchedCandidatePoints.push_back(
+					result.keypoints[match.queryIdx].pt);
 		}
-		printf("\n");
-#endif
 
-		// Copying non re-ranked candidates
-		geom_ranked_candidates_list.insert(geom_ranked_candidates_list.end(),
-				ranked_candidates_list.begin() + top,
-				ranked_candidates_list.end());
+		result.matchTime = (double(cv::getTickCount()) - startTime)
+				/ cv::getTickFrequency() * 1000;
+		result.numMatches = int(matchesCandidateToQuery.size());
 
-		printf("   Done, re-ranked top [%d] candidates out of [%lu]\n", top,
-				geom_ranked_candidates_list.size());
+		if (result.numMatches < params.ransacMinMatches) {
+			return;
+		}
 
-#if GVVERBOSE
-		printf("Full re-ranked candidates list:\n");
-		for (std::string candidate : geom_ranked_candidates_list) {
-			printf("%s, ", candidate.c_str());
+		// Compute a projective transformation between query and ranked file
+		cv::Mat inliers_idx;
+
+		startTime = cv::getTickCount();
+		cv::findHomography(matchedCandidatePoints, matchedQueryPoints,
+				CV_RANSAC, params.ransacThreshold, inliers_idx);
+		result.homographyTime = (double(cv::getTickCount()) - startTime)
+				/ cv::getTickFrequency() * 1000;
+
+		// Obtain number of inliers
+		result.numInliers = int(sum(inliers_idx)[0]);
+
+		for (int i = 0; params.keepMatches == true && i < inliers_idx.rows;
+				++i) {
+			if (int(inliers_idx.at<uchar>(i)) == int(1)) {
+				result.inlierMatches.push_back(matchesCandidateToQuery.at(i));
+			}
 		}
-		printf("\n");
-#endif
 
-		printf("-- Saving list of re-ranked candidates\n");
+	} catch (const std::exception& e) {
+		result.error = e.what();
+	}
 
-		ranked_list_fname.str("");
-		ranked_list_fname << out_ranked_lists_folder << "/query_" << i
-				<< "_ranked.txt";
-		FileUtils::saveList(ranked_list_fname.str(),
-				geom_ranked_candidates_list);
+	if (params.keepMatches == false) {
+		std::vector<cv::KeyPoint>().swap(result.keypoints);
+	}
 
-		printf("   Done, saved [%lu] entries\n",
-				geom_ranked_candidates_list.size());
+}
+
+// --------------------------------------------------------------------------
+
+void drawQueryMatches(const std::string& imagesFolder,
+		const std::string& outFolder, const QueryResult& result) {
+
+	cv::Mat queryImg = cv::imread(
+			imagesFolder + "/" + result.queryBase + ".jpg",
+			CV_LOAD_IMAGE_GRAYSCALE);
+
+	if (queryImg.empty() == true) {
+		fprintf(stderr, "Unable to read image of query [%s]\n",
+				result.queryBase.c_str());
+		return;
 	}
 
-//	HtmlResultsWriter::getInstance().close();
+	cv::Mat candidateImg, imgOut;
+
+	for (size_t j = 0; j < result.candidates.size(); ++j) {
+
+		const CandidateResult& candidate = result.candidates[j];
+
+		// Only candidates for which a homography was computed
+		if (candidate.homographyTime < 0) {
+			continue;
+		}
+
+		const std::string& candidateBase = result.rankedCandidates[j];
+
+		candidateImg = cv::imread(imagesFolder + "/" + candidateBase + ".jpg",
+				CV_LOAD_IMAGE_GRAYSCALE);
+
+		if (candidateImg.empty() == true) {
+			fprintf(stderr, "Unable to read image of candidate [%s]\n",
+					candidateBase.c_str());
+			continue;
+		}
+
+		imgOut = cv::Mat();
+		cv::drawMatches(candidateImg, candidate.keypoints, queryImg,
+				result.keypoints, candidate.inlierMatches, imgOut);
+		cv::imwrite(
+				outFolder + "/match_" + result.queryBase + "_" + candidateBase
+						+ ".jpg", imgOut);
+	}
 
 }
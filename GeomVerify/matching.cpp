@@ -9,6 +9,9 @@
 
 #include <opencv2/legacy/legacy.hpp>
 
+#include <algorithm>
+#include <limits>
+
 void matchKeypoints(cv::Mat& descriptors1, cv::Mat& descriptors2,
 		std::vector<cv::DMatch>& matches1to2, double ratioThreshold,
 		double distanceThreshold) {
@@ -62,12 +65,99 @@ void matchKeypoints(cv::Mat& descriptors1, cv::Mat& descriptors2,
 
 }
 
+void matchKeypoints(const vlr::NodeFeatureRange& nodes1, cv::Mat& descriptors1,
+		const vlr::NodeFeatureRange& nodes2, cv::Mat& descriptors2,
+		std::vector<cv::DMatch>& matches1to2, double ratioThreshold,
+		double distanceThreshold) {
+
+	// Clean up non constant variables received as parameters
+	matches1to2.clear();
+
+	CV_Assert(descriptors1.cols == descriptors2.cols);
+	CV_Assert(descriptors1.type() == descriptors2.type());
+	CV_Assert(descriptors1.type() == CV_8U || descriptors1.type() == CV_32F);
+
+	bool isBinary = descriptors1.type() == CV_8U;
+
+	auto distance = [&](int i1, int i2) {
+		if (isBinary == true) {
+			return float(cv::normHamming(descriptors1.ptr<uchar>(i1),
+							descriptors2.ptr<uchar>(i2), descriptors1.cols));
+		}
+		const float* d1 = descriptors1.ptr<float>(i1);
+		const float* d2 = descriptors2.ptr<float>(i2);
+		float sum = 0.0f;
+		for (int k = 0; k < descriptors1.cols; ++k) {
+			sum += (d1[k] - d2[k]) * (d1[k] - d2[k]);
+		}
+		return std::sqrt(sum);
+	};
+
+	// Every feature of the first image is compared only against the features of
+	// the second image sharing its node
+	vlr::intersectNodes(nodes1, nodes2,
+			[&](int nodeId, const vlr::NodeFeature* begin1,
+					const vlr::NodeFeature* end1, const vlr::NodeFeature* begin2,
+					const vlr::NodeFeature* end2) {
+				for (const vlr::NodeFeature* it1 = begin1; it1 != end1; ++it1) {
+
+					CV_Assert(it1->m_featureId >= 0
+							&& it1->m_featureId < descriptors1.rows);
+
+					float dBest = std::numeric_limits<float>::max();
+					float dSecondBest = std::numeric_limits<float>::max();
+					int idBest = -1;
+
+					for (const vlr::NodeFeature* it2 = begin2; it2 != end2; ++it2) {
+
+						CV_Assert(it2->m_featureId >= 0
+								&& it2->m_featureId < descriptors2.rows);
+
+						float descsDist = distance(it1->m_featureId,
+								it2->m_featureId);
+
+						if (descsDist < dBest) {
+							dSecondBest = dBest;
+							dBest = descsDist;
+							idBest = it2->m_featureId;
+						} else if (descsDist < dSecondBest) {
+							dSecondBest = descsDist;
+						}
+					}
+
+					// Discard matches by applying ratio or distance threshold
+					if (isBinary == true) {
+						if (double(dBest) > distanceThreshold) {
+							continue;
+						}
+					} else if (idBest == -1
+							|| dSecondBest == std::numeric_limits<float>::max()
+							|| double(dBest) > ratioThreshold * double(dSecondBest)) {
+						// Without a second neighbor the ratio test cannot
+						// tell a distinctive match from a distant one
+						continue;
+					}
+
+					// Set pair as a match
+					matches1to2.push_back(
+							cv::DMatch(it1->m_featureId, idBest, dBest));
+				}
+			});
+
+}
+
 void filterFeatures(std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors,
-		int top) {
+		int top, std::vector<size_t>* keptIndices) {
 
 	CV_Assert(int(keypoints.size()) == descriptors.rows);
 
 	if (top < 0) {
+		if (keptIndices != NULL) {
+			keptIndices->resize(keypoints.size());
+			for (size_t i = 0; i < keptIndices->size(); ++i) {
+				(*keptIndices)[i] = i;
+			}
+		}
 		// Do nothing
 		return;
 	}
@@ -101,6 +191,43 @@ void filterFeatures(std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors,
 	keypoints = topKeypoints;
 	descriptors = topDescriptors.clone();
 
+	if (keptIndices != NULL) {
+		keptIndices->assign(indices.begin(), indices.begin() + top);
+	}
+
+}
+
+void selectNodeFeatures(const vlr::NodeFeatureRange& features,
+		const std::vector<size_t>& keptIndices,
+		std::vector<vlr::NodeFeature>& selected) {
+
+	selected.clear();
+
+	// Map from the original index of a feature to its filtered row, -1 if dropped
+	size_t numFeatures = 0;
+	for (size_t index : keptIndices) {
+		numFeatures = std::max(numFeatures, index + 1);
+	}
+	for (const vlr::NodeFeature& feature : features) {
+		numFeatures = std::max(numFeatures, size_t(feature.m_featureId) + 1);
+	}
+
+	std::vector<int> rows(numFeatures, -1);
+	for (size_t row = 0; row < keptIndices.size(); ++row) {
+		rows[keptIndices[row]] = int(row);
+	}
+
+	for (const vlr::NodeFeature& feature : features) {
+		if (feature.m_featureId >= 0 && rows[feature.m_featureId] >= 0) {
+			selected.push_back(
+					vlr::NodeFeature(feature.m_nodeId,
+							rows[feature.m_featureId]));
+		}
+	}
+
+	// Rows do not follow the original order of the features within a node
+	std::sort(selected.begin(), selected.end());
+
 }
 
 void sortKptsByResponse(const std::vector<cv::KeyPoint>& values,
@@ -119,82 +246,6 @@ void sortKptsByResponse(const std::vector<cv::KeyPoint>& values,
 
 }
 
-//void matchKeypoints(const cv::Ptr<vlr::DirectIndex> directIndex1, int idImg1,
-//		const std::vector<cv::KeyPoint>& keypoints1,
-//		std::vector<cv::Point2f>& matchedPoints1,
-//		const cv::Ptr<vlr::DirectIndex> directIndex2, int idImg2,
-//		const std::vector<cv::KeyPoint>& keypoints2,
-//		std::vector<cv::Point2f>& matchedPoints2,
-//		std::vector<cv::DMatch>& matches1to2, double proximityThreshold) {
-//
-//	// Clean up variables received as arguments
-//	matchedPoints1.clear();
-//	matchedPoints2.clear();
-//	matches1to2.clear();
-//
-//	// Lookup query and database images in the index and get nodes list
-//	vlr::TreeNode nodes1 = directIndex1->lookUpImg(idImg1);
-//	vlr::TreeNode nodes2 = directIndex2->lookUpImg(idImg2);
-//
-//	// Declare and initialize iterators to the maps to intersect
-//	typename vlr::TreeNode::const_iterator it1 = nodes1.begin();
-//	typename vlr::TreeNode::const_iterator it2 = nodes2.begin();
-//
-//	cv::Point2f point1, point2;
-//
-//	double kptsDist;
-//
-//	// Intersect nodes maps, solution taken from:
-//	// http://stackoverflow.com/questions/3772664/intersection-of-two-stl-maps
-//	while (it1 != nodes1.end() && it2 != nodes2.end()) {
-//		if (it1->first < it2->first) {
-//			++it1;
-//		} else if (it2->first < it1->first) {
-//			++it2;
-//		} else {
-//			// Match together all query keypoints vs candidate keypoints of an intersected node
-//			for (int i1 : it1->second) {
-//				for (int i2 : it2->second) {
-//
-//					// Assert that feature ids stored in the direct index are in range
-//					CV_Assert(
-//							i1 >= 0
-//									&& i1
-//											< static_cast<int>(keypoints1.size()));
-//					CV_Assert(
-//							i2 >= 0
-//									&& i2
-//											< static_cast<int>(keypoints2.size()));
-//
-//					// Extract point
-//					point1 = keypoints1[i1].pt;
-//					point2 = keypoints2[i2].pt;
-//
-//					kptsDist = cv::norm(
-//							cv::Point(point1.x, point1.y)
-//									- cv::Point(point2.x, point2.y));
-//
-//					// Apply a proximity threshold
-//					if (kptsDist > proximityThreshold) {
-//						continue;
-//					}
-//
-//					// Add points to vectors of matched
-//					matchedPoints1.push_back(point1);
-//					matchedPoints2.push_back(point2);
-//
-//					cv::DMatch match = cv::DMatch(i1, i2,
-//							cv::norm(point1 - point2));
-//					// Set pair as a match
-//					matches1to2.push_back(match);
-//				}
-//			}
-//			++it1, ++it2;
-//		}
-//	}
-//
-//}
-
 //template<class TDescriptor, class Distance>
 //void match(const cv::Mat& descriptors1, const cv::Mat& descriptors2,
 //		std::vector<std::vector<cv::DMatch>>& matches1to2) {
@@ -239,27 +290,3 @@ void sortKptsByResponse(const std::vector<cv::KeyPoint>& values,
 //	}
 //
 //}
-
-//template<typename KeyType, typename LeftValue, typename RightValue>
-//std::map<KeyType, std::pair<LeftValue, RightValue> > intersectMaps(
-//		const std::map<KeyType, LeftValue> & left,
-//		const std::map<KeyType, RightValue> & right) {
-//	std::map<KeyType, std::pair<LeftValue, RightValue> > result;
-//	typename std::map<KeyType, LeftValue>::const_iterator il = left.begin();
-//	typename std::map<KeyType, RightValue>::const_iterator ir = right.begin();
-//	while (il != left.end() && ir != right.end()) {
-//		if (il->first < ir->first)
-//			++il;
-//		else if (ir->first < il->first)
-//			++ir;
-//		else {
-//			result.insert(
-//					std::make_pair(il->first,
-//							std::make_pair(il->second, ir->second)));
-//			++il;
-//			++ir;
-//		}
-//	}
-//	return result;
-//}
-
@@ -13,7 +13,7 @@
 #include <opencv2/core/core.hpp>
 #include <opencv2/features2d/features2d.hpp>
 
-//#include <DirectIndex.hpp>
+#include <DirectIndex.hpp>
 
 /**
  *
@@ -27,15 +27,53 @@ void matchKeypoints(cv::Mat& descriptors1, cv::Mat& descriptors2,
 		std::vector<cv::DMatch>& matches1to2, double ratioThreshold,
 		double distanceThreshold);
 
+/**
+ * Matches two images by comparing only the features assigned to the same node
+ * of the vocabulary tree, for each feature of the first image the two closest
+ * features of the second image within the node are searched. Matches are kept
+ * by applying a distance threshold for binary descriptors and a ratio
+ * threshold otherwise, where a feature alone in its node of the second image
+ * has no second neighbor to be compared with and thus is not matched.
+ *
+ * @param nodes1 - The features of the first image sorted by node id, with feature ids
+ * 				   indexing the rows of descriptors1
+ * @param descriptors1 - The descriptors of the first image
+ * @param nodes2 - The features of the second image sorted by node id, with feature ids
+ * 				   indexing the rows of descriptors2
+ * @param descriptors2 - The descriptors of the second image
+ * @param matches1to2 - The found matches, query index in the first image and train
+ * 						index in the second one
+ * @param ratioThreshold - Maximum ratio between the best and second best distances
+ * @param distanceThreshold - Maximum distance of a match between binary descriptors
+ */
+void matchKeypoints(const vlr::NodeFeatureRange& nodes1, cv::Mat& descriptors1,
+		const vlr::NodeFeatureRange& nodes2, cv::Mat& descriptors2,
+		std::vector<cv::DMatch>& matches1to2, double ratioThreshold,
+		double distanceThreshold);
+
 /**
  * Filters out features in order to keep the ones with higher key-point response.
  *
  * @param keypoints - The vector of key-points corresponding to the features to filter
  * @param descriptors - The matrix of descriptors corresponding to the features to filter
  * @param topKeypoints - Top number of features to keep
+ * @param keptIndices - If not NULL, it is filled with the original index of every
+ * 						kept feature
  */
 void filterFeatures(std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors,
-		int top);
+		int top, std::vector<size_t>* keptIndices = NULL);
+
+/**
+ * Selects from the direct index entries of an image the features kept by
+ * filterFeatures, re-numbering them by their row in the filtered descriptors.
+ *
+ * @param features - The features of the image sorted by node id
+ * @param keptIndices - The original index of every kept feature
+ * @param selected - The kept features sorted by node id
+ */
+void selectNodeFeatures(const vlr::NodeFeatureRange& features,
+		const std::vector<size_t>& keptIndices,
+		std::vector<vlr::NodeFeature>& selected);
 
 /**
  * Sorts a vector in ascending/descending order by keeping track of the indices.
@@ -70,27 +108,6 @@ void sortAndKeepIdx(std::vector<T>& values, std::vector<size_t>& indices,
 
 }
 
-///**
-// *
-// * @param directIndex1
-// * @param idImg1
-// * @param keypoints1
-// * @param matchedPoints1
-// * @param directIndex2
-// * @param idImg2
-// * @param keypoints2
-// * @param matchedPoints2
-// * @param matches1to2
-// * @param proximityThreshold
-// */
-//void matchKeypoints(const cv::Ptr<vlr::DirectIndex> directIndex1, int idImg1,
-//		const std::vector<cv::KeyPoint>& keypoints1,
-//		std::vector<cv::Point2f>& matchedPoints1,
-//		const cv::Ptr<vlr::DirectIndex> directIndex2, int idImg2,
-//		const std::vector<cv::KeyPoint>& keypoints2,
-//		std::vector<cv::Point2f>& matchedPoints2,
-//		std::vector<cv::DMatch>& matches1to2, double proximityThreshold);
-
 ///**
 // *
 // * @param descriptors1
@@ -101,15 +118,4 @@ void sortAndKeepIdx(std::vector<T>& values, std::vector<size_t>& indices,
 //void match(const cv::Mat& descriptors1, const cv::Mat& descriptors2,
 //		std::vector<std::vector<cv::DMatch>>& matches1to2);
 
-///**
-// *
-// * @param left
-// * @param right
-// * @return
-// */
-//template<typename KeyType, typename LeftValue, typename RightValue>
-//std::map<KeyType, std::pair<LeftValue, RightValue> > intersectMaps(
-//		const std::map<KeyType, LeftValue> & left,
-//		const std::map<KeyType, RightValue> & right);
-
 #endif /* MATCHING_HPP_ */
@@ -0,0 +1,96 @@
+/*
+ * matching_test.cpp
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: andresf
+ */
+
+#include <gtest/gtest.h>
+#include <opencv2/core/core.hpp>
+
+#include <matching.hpp>
+
+TEST(Matching, NodeMatchesPassRatioTest) {
+
+	// Two features of the second image share the node of the query feature,
+	// the closest one is distinctive enough to be matched
+	float data1[] = { 0.0f, 0.0f };
+	float data2[] = { 1.0f, 0.0f, 10.0f, 0.0f };
+	cv::Mat descriptors1(1, 2, CV_32F, data1);
+	cv::Mat descriptors2(2, 2, CV_32F, data2);
+
+	std::vector<vlr::NodeFeature> nodes1, nodes2;
+	nodes1.push_back(vlr::NodeFeature(4, 0));
+	nodes2.push_back(vlr::NodeFeature(4, 0));
+	nodes2.push_back(vlr::NodeFeature(4, 1));
+
+	std::vector<cv::DMatch> matches;
+	matchKeypoints(
+			vlr::NodeFeatureRange(nodes1.data(), nodes1.data() + nodes1.size()),
+			descriptors1,
+			vlr::NodeFeatureRange(nodes2.data(), nodes2.data() + nodes2.size()),
+			descriptors2, matches, 0.8, 90);
+
+	ASSERT_EQ(1u, matches.size());
+	EXPECT_EQ(0, matches[0].queryIdx);
+	EXPECT_EQ(0, matches[0].trainIdx);
+	EXPECT_FLOAT_EQ(1.0f, matches[0].distance);
+
+}
+
+TEST(Matching, LoneDistantFeatureIsNotMatched) {
+
+	// The only feature of the second image in the node is far away, with no
+	// second neighbor it must not be taken as a match
+	float data1[] = { 0.0f, 0.0f, 5.0f, 5.0f };
+	float data2[] = { 1000.0f, 1000.0f, 5.0f, 5.0f };
+	cv::Mat descriptors1(2, 2, CV_32F, data1);
+	cv::Mat descriptors2(2, 2, CV_32F, data2);
+
+	std::vector<vlr::NodeFeature> nodes1, nodes2;
+	nodes1.push_back(vlr::NodeFeature(2, 0));
+	nodes1.push_back(vlr::NodeFeature(7, 1));
+	nodes2.push_back(vlr::NodeFeature(2, 0));
+	nodes2.push_back(vlr::NodeFeature(9, 1));
+
+	std::vector<cv::DMatch> matches;
+	matchKeypoints(
+			vlr::NodeFeatureRange(nodes1.data(), nodes1.data() + nodes1.size()),
+			descriptors1,
+			vlr::NodeFeatureRange(nodes2.data(), nodes2.data() + nodes2.size()),
+			descriptors2, matches, 0.8, 90);
+
+	// Features in nodes not shared are never compared either
+	EXPECT_TRUE(matches.empty());
+
+}
+
+TEST(Matching, SelectNodeFeatures) {
+
+	std::vector<vlr::NodeFeature> features;
+	features.push_back(vlr::NodeFeature(1, 0));
+	features.push_back(vlr::NodeFeature(1, 3));
+	features.push_back(vlr::NodeFeature(2, 1));
+	features.push_back(vlr::NodeFeature(2, 4));
+	features.push_back(vlr::NodeFeature(5, 2));
+
+	// Original features 4, 0 and 2 are kept as rows 0, 1 and 2
+	std::vector<size_t> keptIndices;
+	keptIndices.push_back(4);
+	keptIndices.push_back(0);
+	keptIndices.push_back(2);
+
+	std::vector<vlr::NodeFeature> selected;
+	selectNodeFeatures(
+			vlr::NodeFeatureRange(features.data(),
+					features.data() + features.size()), keptIndices, selected);
+
+	ASSERT_EQ(3u, selected.size());
+	EXPECT_EQ(1, selected[0].m_nodeId);
+	EXPECT_EQ(1, selected[0].m_featureId);
+	EXPECT_EQ(2, selected[1].m_nodeId);
+	EXPECT_EQ(0, selected[1].m_featureId);
+	EXPECT_EQ(5, selected[2].m_nodeId);
+	EXPECT_EQ(2, selected[2].m_featureId);
+
+}
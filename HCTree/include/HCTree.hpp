@@ -13,13 +13,14 @@
 
 #include <CentersChooser.h>
 #include <DynamicMat.hpp>
+#include <HammingDistance.hpp>
 
 #include <stdlib.h>
 
 namespace vlr {
 
 typedef uchar TDescriptor;
-typedef cv::Hamming Distance;
+typedef vlr::Hamming Distance;
 typedef typename Distance::ResultType DistanceType;
 
 struct HCTreeParams: public cvflann::IndexParams {
@@ -8,24 +8,121 @@
 #ifndef CENTERSCHOOSER_H_
 #define CENTERSCHOOSER_H_
 
+#include <algorithm>
 #include <ctime>
+#include <vector>
 
 #include <opencv2/flann/flann.hpp>
 
 #include <DynamicMat.hpp>
 #include <FunctionUtils.hpp>
 
+/**
+ * Generates the integers in [0, n) in random order without repetitions,
+ * as cvflann::UniqueRandom does but drawing from a given generator.
+ */
+class UniqueRandomSequence {
+
+private:
+
+	// Generator to draw from, NULL to delegate to cvflann::UniqueRandom
+	cv::RNG* m_rng;
+	cvflann::UniqueRandom m_shared;
+	std::vector<int> m_values;
+	int m_counter;
+
+public:
+
+	UniqueRandomSequence(cv::RNG* rng, int n) :
+			m_rng(rng), m_shared(rng == NULL ? n : 0), m_values(
+					rng == NULL ? 0 : n), m_counter(0) {
+		for (int i = 0; i < int(m_values.size()); ++i) {
+			m_values[i] = i;
+		}
+	}
+
+	/**
+	 * Returns the next number of the sequence.
+	 *
+	 * @return the next number, or -1 if all the numbers were already returned
+	 */
+	int next() {
+		if (m_rng == NULL) {
+			return m_shared.next();
+		}
+		int n = m_values.size();
+		if (m_counter == n) {
+			return -1;
+		}
+		// Lazy Fisher-Yates shuffle
+		std::swap(m_values[m_counter],
+				m_values[m_counter + m_rng->uniform(0, n - m_counter)]);
+		return m_values[m_counter++];
+	}
+
+};
+
+// --------------------------------------------------------------------------
+
 template<typename TDescriptor, typename Distance>
 class CentersChooser {
+protected:
+	// Generator for the random choices made by the chooser
+	cv::RNG m_rng;
+	// Whether the choices are drawn from the shared cvflann generator instead
+	bool m_sharedGenerator;
+
+	CentersChooser() :
+			m_sharedGenerator(true) {
+	}
+
+	/**
+	 * Returns the generator of the chooser.
+	 *
+	 * @return the generator, or NULL if the shared cvflann generator is used
+	 */
+	cv::RNG* getGenerator() {
+		return m_sharedGenerator == true ? NULL : &m_rng;
+	}
+
+	int randomInt(int high) {
+		return m_sharedGenerator == true ?
+				cvflann::rand_int(high) : m_rng.uniform(0, high);
+	}
+
+	double randomDouble(double high) {
+		return m_sharedGenerator == true ?
+				cvflann::rand_double(high) : m_rng.uniform(0., high);
+	}
+
 public:
 	virtual ~CentersChooser() {
 	}
 	virtual void chooseCenters(int k, int* indices, int indices_length,
 			std::vector<int>& centers, int& centers_length, vlr::Mat& dataset,
 			Distance distance = Distance()) = 0;
+
+	/**
+	 * Creates a centers chooser drawing from the shared cvflann generator, hence
+	 * seeding the latter makes the choices reproducible.
+	 *
+	 * @param type - The algorithm for choosing the centers
+	 * @return the centers chooser
+	 */
 	static cv::Ptr<CentersChooser<TDescriptor, Distance> > create(
 			const cvflann::flann_centers_init_t& type);
 
+	/**
+	 * Creates a centers chooser whose generator is seeded with the given seed,
+	 * it doesn't use any shared state so distinct choosers can be used concurrently.
+	 *
+	 * @param type - The algorithm for choosing the centers
+	 * @param seed - The seed of the generator
+	 * @return the centers chooser
+	 */
+	static cv::Ptr<CentersChooser<TDescriptor, Distance> > create(
+			const cvflann::flann_centers_init_t& type, uint64 seed);
+
 };
 
 template<typename TDescriptor, typename Distance>
@@ -119,7 +216,7 @@ void RandomCenters<TDescriptor, Distance>::chooseCenters(int k, int* indices,
 	// Assert there is enough data
 	CV_Assert(k <= indices_length);
 
-	cvflann::UniqueRandom r(indices_length);
+	UniqueRandomSequence r(this->getGenerator(), indices_length);
 
 	int index;
 	for (index = 0; index < k; ++index) {
@@ -164,7 +261,7 @@ void GonzalezCenters<TDescriptor, Distance>::chooseCenters(int k, int* indices,
 		vlr::Mat& dataset, Distance distance) {
 	int n = indices_length;
 
-	int rnd = cvflann::rand_int(n);
+	int rnd = this->randomInt(n);
 	assert(rnd >= 0 && rnd < n);
 
 	centers[0] = indices[rnd];
@@ -212,7 +309,7 @@ void KmeansppCenters<TDescriptor, Distance>::chooseCenters(int k, int* indices,
 	DistanceType* closestDistSq = new DistanceType[n];
 
 	// Choose one random center and set the closestDistSq values
-	int index = cvflann::rand_int(n);
+	int index = this->randomInt(n);
 	assert(index >= 0 && index < n);
 	centers[0] = indices[index];
 
@@ -235,7 +332,7 @@ void KmeansppCenters<TDescriptor, Distance>::chooseCenters(int k, int* indices,
 
 			// Choose our center - have to be slightly careful to return a valid answer even accounting
 			// for possible rounding errors
-			double randVal = cvflann::rand_double(currentPot);
+			double randVal = this->randomDouble(currentPot);
 			for (index = 0; index < n - 1; index++) {
 				if (randVal <= closestDistSq[index])
 					break;
@@ -282,13 +379,26 @@ template<typename TDescriptor, typename Distance>
 cv::Ptr<CentersChooser<TDescriptor, Distance> > CentersChooser<TDescriptor,
 		Distance>::create(const cvflann::flann_centers_init_t& type) {
 
-	cv::Ptr<CentersChooser<TDescriptor, Distance> > cc;
-
 #if SEEDRANDOM
 	// Seeding random number generator
 	cvflann::seed_random(unsigned(std::time(0)));
 #endif
 
+	cv::Ptr<CentersChooser<TDescriptor, Distance> > cc = create(type, 0);
+	cc->m_sharedGenerator = true;
+
+	return cc;
+}
+
+// --------------------------------------------------------------------------
+
+template<typename TDescriptor, typename Distance>
+cv::Ptr<CentersChooser<TDescriptor, Distance> > CentersChooser<TDescriptor,
+		Distance>::create(const cvflann::flann_centers_init_t& type,
+		uint64 seed) {
+
+	cv::Ptr<CentersChooser<TDescriptor, Distance> > cc;
+
 	if (type == cvflann::FLANN_CENTERS_RANDOM) {
 		cc = new RandomCenters<TDescriptor, Distance>();
 	} else if (type == cvflann::FLANN_CENTERS_GONZALES) {
@@ -300,6 +410,9 @@ cv::Ptr<CentersChooser<TDescriptor, Distance> > CentersChooser<TDescriptor,
 				"Unknown algorithm for choosing initial centers");
 	}
 
+	cc->m_rng = cv::RNG(seed);
+	cc->m_sharedGenerator = false;
+
 	return cc;
 }
 
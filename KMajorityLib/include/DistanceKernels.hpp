@@ -0,0 +1,207 @@
+/*
+ * DistanceKernels.hpp
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: andresf
+ */
+
+#ifndef DISTANCEKERNELS_HPP_
+#define DISTANCEKERNELS_HPP_
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/features2d/features2d.hpp>
+
+#include <HammingDistance.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace vlr {
+
+/**
+ * Kernels computing the distances from one descriptor to a set of descriptors
+ * stored contiguously (e.g. the centers of all the children of a tree node).
+ *
+ * The generic version calls the distance functor once per descriptor,
+ * specializations are provided for the distances used by the vocabulary trees.
+ */
+template<class TDescriptor, class Distance>
+struct DistanceKernels {
+
+	typedef typename Distance::ResultType DistanceType;
+
+	/**
+	 * Computes the distances from a descriptor to a set of descriptors.
+	 *
+	 * @param distance - The distance functor
+	 * @param query - Pointer to the query descriptor
+	 * @param vectors - Pointer to the first descriptor of the set
+	 * @param numVectors - Number of descriptors in the set
+	 * @param veclen - Length of the descriptors
+	 * @param distances - Array where to store the distance to each descriptor of the set
+	 */
+	static void distances(const Distance& distance, const TDescriptor* query,
+			const TDescriptor* vectors, int numVectors, size_t veclen,
+			DistanceType* distances) {
+		for (int j = 0; j < numVectors; ++j) {
+			distances[j] = distance(query, vectors + j * veclen, veclen);
+		}
+	}
+
+	/**
+	 * Finds the descriptor of a set which is the closest to a query descriptor,
+	 * ties are resolved in favor of the first one.
+	 *
+	 * @param distance - The distance functor
+	 * @param query - Pointer to the query descriptor
+	 * @param vectors - Pointer to the first descriptor of the set
+	 * @param numVectors - Number of descriptors in the set, must be positive
+	 * @param veclen - Length of the descriptors
+	 * @param bestDistance - The distance to the closest descriptor
+	 * @return the position in the set of the closest descriptor
+	 */
+	static int argmin(const Distance& distance, const TDescriptor* query,
+			const TDescriptor* vectors, int numVectors, size_t veclen,
+			DistanceType& bestDistance) {
+		int best = 0;
+		bestDistance = distance(query, vectors, veclen);
+		for (int j = 1; j < numVectors; ++j) {
+			DistanceType d = distance(query, vectors + j * veclen, veclen);
+			if (d < bestDistance) {
+				bestDistance = d;
+				best = j;
+			}
+		}
+		return best;
+	}
+
+};
+
+// --------------------------------------------------------------------------
+
+/**
+ * Hamming kernels, the query is loaded once and XOR/popcount is applied
+ * against every descriptor of the set.
+ */
+template<>
+struct DistanceKernels<uchar, vlr::Hamming> {
+
+	typedef vlr::Hamming::ResultType DistanceType;
+
+	// Number of distances computed per kernel call when looking for the minimum
+	static const int BLOCK_SIZE = 16;
+
+	static void distances(const vlr::Hamming& distance, const uchar* query,
+			const uchar* vectors, int numVectors, size_t veclen,
+			DistanceType* distances) {
+		distance.distances(query, vectors, numVectors, veclen, distances);
+	}
+
+	static int argmin(const vlr::Hamming& distance, const uchar* query,
+			const uchar* vectors, int numVectors, size_t veclen,
+			DistanceType& bestDistance) {
+		DistanceType block[BLOCK_SIZE];
+		int best = 0;
+		bestDistance = 0;
+		for (int begin = 0; begin < numVectors; begin += BLOCK_SIZE) {
+			int length = std::min(BLOCK_SIZE, numVectors - begin);
+			distance.distances(query, vectors + begin * veclen, length, veclen,
+					block);
+			for (int j = 0; j < length; ++j) {
+				if (begin + j == 0 || block[j] < bestDistance) {
+					bestDistance = block[j];
+					best = begin + j;
+				}
+			}
+		}
+		return best;
+	}
+
+};
+
+// --------------------------------------------------------------------------
+
+/**
+ * Euclidean kernels, the squared distances are computed as a small matrix-vector
+ * product processing four descriptors per pass over the query so that every query
+ * element is loaded once for the four of them. As with cv::L2 the square root of
+ * the sum of squared differences is returned.
+ */
+template<>
+struct DistanceKernels<float, cv::L2<float> > {
+
+	typedef cv::L2<float>::ResultType DistanceType;
+
+	// Number of distances computed per kernel call when looking for the minimum
+	static const int BLOCK_SIZE = 16;
+
+	static void squaredDistances(const float* query, const float* vectors,
+			int numVectors, size_t veclen, float* distances) {
+		int j = 0;
+		for (; j + 4 <= numVectors; j += 4) {
+			const float* v0 = vectors + j * veclen;
+			const float* v1 = v0 + veclen;
+			const float* v2 = v1 + veclen;
+			const float* v3 = v2 + veclen;
+			float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+			for (size_t k = 0; k < veclen; ++k) {
+				float q = query[k];
+				float d0 = q - v0[k], d1 = q - v1[k], d2 = q - v2[k], d3 = q
+						- v3[k];
+				s0 += d0 * d0;
+				s1 += d1 * d1;
+				s2 += d2 * d2;
+				s3 += d3 * d3;
+			}
+			distances[j] = s0;
+			distances[j + 1] = s1;
+			distances[j + 2] = s2;
+			distances[j + 3] = s3;
+		}
+		for (; j < numVectors; ++j) {
+			const float* v = vectors + j * veclen;
+			float s = 0;
+			for (size_t k = 0; k < veclen; ++k) {
+				float d = query[k] - v[k];
+				s += d * d;
+			}
+			distances[j] = s;
+		}
+	}
+
+	static void distances(const cv::L2<float>& /*distance*/, const float* query,
+			const float* vectors, int numVectors, size_t veclen,
+			DistanceType* distances) {
+		squaredDistances(query, vectors, numVectors, veclen, distances);
+		for (int j = 0; j < numVectors; ++j) {
+			distances[j] = (DistanceType) std::sqrt((double) distances[j]);
+		}
+	}
+
+	static int argmin(const cv::L2<float>& /*distance*/, const float* query,
+			const float* vectors, int numVectors, size_t veclen,
+			DistanceType& bestDistance) {
+		// The square root is monotonic, so it is only applied to the minimum
+		float block[BLOCK_SIZE];
+		float bestSqDistance = 0;
+		int best = 0;
+		for (int begin = 0; begin < numVectors; begin += BLOCK_SIZE) {
+			int length = std::min(BLOCK_SIZE, numVectors - begin);
+			squaredDistances(query, vectors + begin * veclen, length, veclen,
+					block);
+			for (int j = 0; j < length; ++j) {
+				if (begin + j == 0 || block[j] < bestSqDistance) {
+					bestSqDistance = block[j];
+					best = begin + j;
+				}
+			}
+		}
+		bestDistance = (DistanceType) std::sqrt((double) bestSqDistance);
+		return best;
+	}
+
+};
+
+} /* namespace vlr */
+
+#endif /* DISTANCEKERNELS_HPP_ */
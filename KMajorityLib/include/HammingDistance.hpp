@@ -0,0 +1,149 @@
+/*
+ * HammingDistance.hpp
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: andresf
+ */
+
+#ifndef HAMMINGDISTANCE_HPP_
+#define HAMMINGDISTANCE_HPP_
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/flann/dist.h>
+
+#include <stddef.h>
+
+namespace vlr {
+
+namespace hamming {
+
+// Instruction sets for which a Hamming distance kernel is available
+enum InstructionSet {
+	PORTABLE = 0, POPCNT = 1, AVX2 = 2, AVX512_VPOPCNTDQ = 3
+};
+
+typedef int (*DistanceKernel)(const unsigned char* a, const unsigned char* b,
+		size_t size);
+
+typedef void (*DistancesKernel)(const unsigned char* query,
+		const unsigned char* vectors, int numVectors, size_t size,
+		int* distances);
+
+/**
+ * Set of kernels used for computing Hamming distances.
+ */
+struct Kernels {
+	// Kernel for 32-byte vectors (e.g. ORB, BRIEF)
+	DistanceKernel distance32;
+	// Kernel for 64-byte vectors (e.g. FREAK)
+	DistanceKernel distance64;
+	// Kernel for vectors of any length
+	DistanceKernel distance;
+	// Kernels from one vector to many contiguous vectors of 32 bytes,
+	// 64 bytes and any length respectively
+	DistancesKernel distances32;
+	DistancesKernel distances64;
+	DistancesKernel distances;
+	// Instruction set the kernels were compiled for
+	InstructionSet instructionSet;
+};
+
+// Kernels in use, they are selected at load time according to the CPU capabilities
+extern Kernels activeKernels;
+
+/**
+ * Checks whether the CPU supports the given instruction set.
+ *
+ * @param instructionSet - The instruction set to check
+ * @return true if kernels for the instruction set can be run on this CPU
+ */
+bool isSupported(InstructionSet instructionSet);
+
+/**
+ * Forces the kernels compiled for the given instruction set to be used.
+ *
+ * @param instructionSet - The instruction set to use
+ * @return false if the instruction set is not supported, in which case
+ * 		   the active kernels are left unchanged
+ */
+bool selectKernels(InstructionSet instructionSet);
+
+/**
+ * Selects the kernels for the best instruction set supported by the CPU.
+ */
+void selectBestKernels();
+
+/**
+ * Returns the name of an instruction set.
+ *
+ * @param instructionSet - The instruction set
+ * @return the name of the instruction set
+ */
+const char* getInstructionSetName(InstructionSet instructionSet);
+
+} /* namespace hamming */
+
+/**
+ * Hamming distance functor computing distances by 64-bit popcount and SIMD kernels,
+ * it is a drop-in replacement for cv::Hamming and cvflann::Hamming<uchar>.
+ */
+struct Hamming {
+
+	enum {
+		normType = cv::NORM_HAMMING
+	};
+
+	typedef cvflann::False is_kdtree_distance;
+	typedef cvflann::False is_vector_space_distance;
+
+	typedef unsigned char ValueType;
+	typedef unsigned char ElementType;
+	typedef int ResultType;
+
+	/**
+	 * Computes the Hamming distance between two binary vectors.
+	 *
+	 * @param a - Pointer to the first vector
+	 * @param b - Pointer to the second vector
+	 * @param size - Length of the vectors in bytes
+	 * @return the number of bits that differ between both vectors
+	 */
+	ResultType operator()(const unsigned char* a, const unsigned char* b,
+			size_t size, ResultType /*worst_dist*/= -1) const {
+		if (size == 32) {
+			return hamming::activeKernels.distance32(a, b, size);
+		} else if (size == 64) {
+			return hamming::activeKernels.distance64(a, b, size);
+		}
+		return hamming::activeKernels.distance(a, b, size);
+	}
+
+	/**
+	 * Computes the Hamming distances from a binary vector to a set of binary vectors
+	 * stored contiguously, the query vector is loaded once for the whole set.
+	 *
+	 * @param query - Pointer to the query vector
+	 * @param vectors - Pointer to the first vector of the set
+	 * @param numVectors - Number of vectors in the set
+	 * @param size - Length of the vectors in bytes
+	 * @param distances - Array where to store the distance to each vector of the set
+	 */
+	void distances(const unsigned char* query, const unsigned char* vectors,
+			int numVectors, size_t size, ResultType* distances) const {
+		if (size == 32) {
+			hamming::activeKernels.distances32(query, vectors, numVectors, size,
+					distances);
+		} else if (size == 64) {
+			hamming::activeKernels.distances64(query, vectors, numVectors, size,
+					distances);
+		} else {
+			hamming::activeKernels.distances(query, vectors, numVectors, size,
+					distances);
+		}
+	}
+
+};
+
+} /* namespace vlr */
+
+#endif /* HAMMINGDISTANCE_HPP_ */
@@ -13,9 +13,10 @@
 #include <opencv2/flann/flann.hpp>
 
 #include <DynamicMat.hpp>
+#include <HammingDistance.hpp>
 #include <VocabBase.hpp>
 
-typedef cvflann::Hamming<uchar> Distance;
+typedef vlr::Hamming Distance;
 typedef typename Distance::ResultType DistanceType;
 
 namespace vlr {
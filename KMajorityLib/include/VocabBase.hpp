@@ -8,13 +8,54 @@
 #ifndef VOCABBASE_HPP_
 #define VOCABBASE_HPP_
 
+#include <cstring>
 #include <fstream>
+#include <stdint.h>
 
 #include <boost/iostreams/filter/gzip.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
 
 namespace vlr {
 
+// Signature at the beginning of every binary vocabulary file
+static const char VOCAB_FILE_MAGIC[8] = { 'V', 'L', 'R', 'V', 'O', 'C', 'A',
+		'B' };
+
+// Version of the binary vocabulary file format
+static const uint32_t VOCAB_FILE_VERSION = 1;
+
+/**
+ * Header of the binary vocabulary files, it is followed by the vocabulary payload
+ * whose layout is given by the offsets. Values are stored in the host byte order.
+ */
+struct VocabFileHeader {
+	// File signature, equal to VOCAB_FILE_MAGIC
+	char magic[8];
+	// Version of the file format
+	uint32_t version;
+	// OpenCV type of the descriptors (e.g. CV_8U or CV_32F)
+	int32_t descriptorType;
+	// Vocabulary type as accepted by VocabLearn, NULL terminated
+	char vocabType[16];
+	// Vocabulary parameters
+	int32_t iterations;
+	int32_t branching;
+	int32_t depth;
+	// Size in bytes of each entry of the nodes table
+	int32_t nodeSize;
+	uint64_t vectorLength;
+	// Number of nodes
+	uint64_t size;
+	// Number of words
+	uint64_t numWords;
+	// Offsets in bytes from the beginning of the file of the nodes table and
+	// of the centers, the latter are aligned to cache lines
+	uint64_t nodesOffset;
+	uint64_t centersOffset;
+};
+
+// --------------------------------------------------------------------------
+
 class VocabBase {
 
 public:
@@ -44,8 +85,21 @@ public:
 	 */
 	virtual size_t size() const = 0;
 
+	/**
+	 * Returns the type of the vocabulary stored in a file, both
+	 * the binary and the gzip-compressed YAML formats are recognized.
+	 *
+	 * @param filename - The name of the file storing the vocabulary
+	 * @return the vocabulary type, or UNKNOWN if it is not found
+	 */
 	static std::string loadVocabType(const std::string& filename) {
 
+		VocabFileHeader header;
+		if (loadVocabFileHeader(filename, header) == true) {
+			return std::string(header.vocabType,
+					strnlen(header.vocabType, sizeof(header.vocabType)));
+		}
+
 		std::ifstream inputZippedFileStream;
 		boost::iostreams::filtering_istream inputFileStream;
 
@@ -96,6 +150,32 @@ public:
 		return vocabType;
 	}
 
+	/**
+	 * Reads the header of a binary vocabulary file.
+	 *
+	 * @param filename - The name of the file storing the vocabulary
+	 * @param header - The header where to store the read values
+	 * @return true if the file is a binary vocabulary file of a supported version,
+	 * 		   false otherwise
+	 */
+	static bool loadVocabFileHeader(const std::string& filename,
+			VocabFileHeader& header) {
+
+		std::ifstream inputFileStream(filename.c_str(),
+				std::fstream::in | std::fstream::binary);
+
+		if (inputFileStream.good() == false) {
+			return false;
+		}
+
+		inputFileStream.read((char*) &header, sizeof(header));
+
+		return inputFileStream.gcount() == std::streamsize(sizeof(header))
+				&& memcmp(header.magic, VOCAB_FILE_MAGIC,
+						sizeof(VOCAB_FILE_MAGIC)) == 0
+				&& header.version == VOCAB_FILE_VERSION;
+	}
+
 };
 
 } /* namespace vlr */
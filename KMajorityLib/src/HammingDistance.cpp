@@ -0,0 +1,419 @@
+/*
+ * HammingDistance.cpp
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: andresf
+ */
+
+#include <HammingDistance.hpp>
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HAMMING_X86_KERNELS 1
+#include <immintrin.h>
+#else
+#define HAMMING_X86_KERNELS 0
+#endif
+
+namespace vlr {
+
+namespace hamming {
+
+namespace {
+
+inline uint64_t load64(const unsigned char* p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+// --------------------------------------------------------------------------
+
+/**** Kernel bodies, inlined into each instruction set specific kernel ****/
+
+template<size_t N>
+inline __attribute__((always_inline)) int fixedDistance(const unsigned char* a,
+		const unsigned char* b) {
+	int result = 0;
+	for (size_t i = 0; i < N; i += 8) {
+		result += __builtin_popcountll(load64(a + i) ^ load64(b + i));
+	}
+	return result;
+}
+
+inline __attribute__((always_inline)) int anyDistance(const unsigned char* a,
+		const unsigned char* b, size_t size) {
+	int result = 0;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		result += __builtin_popcountll(load64(a + i) ^ load64(b + i));
+	}
+	for (; i < size; ++i) {
+		result += __builtin_popcount(a[i] ^ b[i]);
+	}
+	return result;
+}
+
+template<size_t N>
+inline __attribute__((always_inline)) void fixedDistances(
+		const unsigned char* query, const unsigned char* vectors,
+		int numVectors, int* distances) {
+	// Query words are kept in registers for the whole set
+	uint64_t q[N / 8];
+	for (size_t w = 0; w < N / 8; ++w) {
+		q[w] = load64(query + 8 * w);
+	}
+	for (int i = 0; i < numVectors; ++i, vectors += N) {
+		int result = 0;
+		for (size_t w = 0; w < N / 8; ++w) {
+			result += __builtin_popcountll(q[w] ^ load64(vectors + 8 * w));
+		}
+		distances[i] = result;
+	}
+}
+
+inline __attribute__((always_inline)) void anyDistances(
+		const unsigned char* query, const unsigned char* vectors,
+		int numVectors, size_t size, int* distances) {
+	for (int i = 0; i < numVectors; ++i, vectors += size) {
+		distances[i] = anyDistance(query, vectors, size);
+	}
+}
+
+// --------------------------------------------------------------------------
+
+/**** Portable kernels ****/
+
+template<size_t N>
+int portableFixed(const unsigned char* a, const unsigned char* b,
+		size_t /*size*/) {
+	return fixedDistance<N>(a, b);
+}
+
+int portableAny(const unsigned char* a, const unsigned char* b, size_t size) {
+	return anyDistance(a, b, size);
+}
+
+template<size_t N>
+void portableFixedMany(const unsigned char* query,
+		const unsigned char* vectors, int numVectors, size_t /*size*/,
+		int* distances) {
+	fixedDistances<N>(query, vectors, numVectors, distances);
+}
+
+void portableAnyMany(const unsigned char* query, const unsigned char* vectors,
+		int numVectors, size_t size, int* distances) {
+	anyDistances(query, vectors, numVectors, size, distances);
+}
+
+#if HAMMING_X86_KERNELS
+
+// --------------------------------------------------------------------------
+
+/**** Kernels using the hardware 64-bit popcount ****/
+
+template<size_t N>
+__attribute__((target("popcnt")))
+int popcntFixed(const unsigned char* a, const unsigned char* b,
+		size_t /*size*/) {
+	return fixedDistance<N>(a, b);
+}
+
+__attribute__((target("popcnt")))
+int popcntAny(const unsigned char* a, const unsigned char* b, size_t size) {
+	return anyDistance(a, b, size);
+}
+
+template<size_t N>
+__attribute__((target("popcnt")))
+void popcntFixedMany(const unsigned char* query, const unsigned char* vectors,
+		int numVectors, size_t /*size*/, int* distances) {
+	fixedDistances<N>(query, vectors, numVectors, distances);
+}
+
+__attribute__((target("popcnt")))
+void popcntAnyMany(const unsigned char* query, const unsigned char* vectors,
+		int numVectors, size_t size, int* distances) {
+	anyDistances(query, vectors, numVectors, size, distances);
+}
+
+// --------------------------------------------------------------------------
+
+/**** AVX2 kernels: per-nibble lookup table popcount ****/
+
+__attribute__((target("avx2")))
+inline __m256i popcount256(__m256i v) {
+	const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2,
+			3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i lowMask = _mm256_set1_epi8(0x0f);
+	__m256i lo = _mm256_and_si256(v, lowMask);
+	__m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), lowMask);
+	__m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+			_mm256_shuffle_epi8(lookup, hi));
+	// Sum the byte counts into four 64-bit lanes
+	return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+inline int sum256(__m256i v) {
+	__m128i s = _mm_add_epi64(_mm256_castsi256_si128(v),
+			_mm256_extracti128_si256(v, 1));
+	return (int) (_mm_cvtsi128_si64(s) + _mm_extract_epi64(s, 1));
+}
+
+__attribute__((target("avx2")))
+inline __m256i load256(const unsigned char* p) {
+	return _mm256_loadu_si256((const __m256i*) p);
+}
+
+__attribute__((target("avx2")))
+inline __m256i xor256(const unsigned char* a, const unsigned char* b) {
+	return _mm256_xor_si256(load256(a), load256(b));
+}
+
+__attribute__((target("avx2,popcnt")))
+int avx2Distance64(const unsigned char* a, const unsigned char* b,
+		size_t /*size*/) {
+	return sum256(
+			_mm256_add_epi64(popcount256(xor256(a, b)),
+					popcount256(xor256(a + 32, b + 32))));
+}
+
+__attribute__((target("avx2,popcnt")))
+int avx2Any(const unsigned char* a, const unsigned char* b, size_t size) {
+	__m256i acc = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32) {
+		acc = _mm256_add_epi64(acc, popcount256(xor256(a + i, b + i)));
+	}
+	return sum256(acc) + anyDistance(a + i, b + i, size - i);
+}
+
+__attribute__((target("avx2,popcnt")))
+void avx2Distances64(const unsigned char* query, const unsigned char* vectors,
+		int numVectors, size_t /*size*/, int* distances) {
+	__m256i q0 = load256(query);
+	__m256i q1 = load256(query + 32);
+	for (int i = 0; i < numVectors; ++i, vectors += 64) {
+		__m256i x0 = _mm256_xor_si256(q0, load256(vectors));
+		__m256i x1 = _mm256_xor_si256(q1, load256(vectors + 32));
+		distances[i] = sum256(
+				_mm256_add_epi64(popcount256(x0), popcount256(x1)));
+	}
+}
+
+__attribute__((target("avx2,popcnt")))
+void avx2AnyMany(const unsigned char* query, const unsigned char* vectors,
+		int numVectors, size_t size, int* distances) {
+	for (int i = 0; i < numVectors; ++i, vectors += size) {
+		distances[i] = avx2Any(query, vectors, size);
+	}
+}
+
+// --------------------------------------------------------------------------
+
+/**** AVX-512 kernels: native 64-bit lanes popcount ****/
+
+#define HAMMING_AVX512_TARGET "avx2,avx512f,avx512vl,avx512vpopcntdq,popcnt"
+
+// The zero-masking forms are used for moving between 256 and 512-bit lanes,
+// as the unmasked ones trigger uninitialized warnings within GCC headers
+
+__attribute__((target(HAMMING_AVX512_TARGET)))
+inline __m256i low256(__m512i v) {
+	return _mm512_maskz_extracti64x4_epi64(0x0F, v, 0);
+}
+
+__attribute__((target(HAMMING_AVX512_TARGET)))
+inline __m256i high256(__m512i v) {
+	return _mm512_maskz_extracti64x4_epi64(0x0F, v, 1);
+}
+
+__attribute__((target(HAMMING_AVX512_TARGET)))
+inline int sum512(__m512i v) {
+	return sum256(_mm256_add_epi64(low256(v), high256(v)));
+}
+
+__attribute__((target(HAMMING_AVX512_TARGET)))
+int vpopcntDistance32(const unsigned char* a, const unsigned char* b,
+		size_t /*size*/) {
+	return sum256(_mm256_popcnt_epi64(xor256(a, b)));
+}
+
+__attribute__((target(HAMMING_AVX512_TARGET)))
+int vpopcntDistance64(const unsigned char* a, const unsigned char* b,
+		size_t /*size*/) {
+	__m512i x = _mm512_xor_si512(_mm512_loadu_si512((const void*) a),
+			_mm512_loadu_si512((const void*) b));
+	return sum512(_mm512_popcnt_epi64(x));
+}
+
+__attribute__((target(HAMMING_AVX512_TARGET)))
+int vpopcntAny(const unsigned char* a, const unsigned char* b, size_t size) {
+	__m512i acc = _mm512_setzero_si512();
+	size_t i = 0;
+	for (; i + 64 <= size; i += 64) {
+		__m512i x = _mm512_xor_si512(_mm512_loadu_si512((const void*) (a + i)),
+				_mm512_loadu_si512((const void*) (b + i)));
+		acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+	}
+	return sum512(acc) + anyDistance(a + i, b + i, size - i);
+}
+
+__attribute__((target(HAMMING_AVX512_TARGET)))
+void vpopcntDistances32(const unsigned char* query,
+		const unsigned char* vectors, int numVectors, size_t /*size*/,
+		int* distances) {
+	// Query is broadcast to both halves so two vectors are handled per register
+	__m512i q = _mm512_maskz_broadcast_i64x4(0xFF, load256(query));
+	int i = 0;
+	for (; i + 2 <= numVectors; i += 2, vectors += 64) {
+		__m512i counts = _mm512_popcnt_epi64(
+				_mm512_xor_si512(q, _mm512_loadu_si512((const void*) vectors)));
+		distances[i] = sum256(low256(counts));
+		distances[i + 1] = sum256(high256(counts));
+	}
+	if (i < numVectors) {
+		distances[i] = vpopcntDistance32(query, vectors, 32);
+	}
+}
+
+__attribute__((target(HAMMING_AVX512_TARGET)))
+void vpopcntDistances64(const unsigned char* query,
+		const unsigned char* vectors, int numVectors, size_t /*size*/,
+		int* distances) {
+	__m512i q = _mm512_loadu_si512((const void*) query);
+	for (int i = 0; i < numVectors; ++i, vectors += 64) {
+		__m512i x = _mm512_xor_si512(q, _mm512_loadu_si512((const void*) vectors));
+		distances[i] = sum512(_mm512_popcnt_epi64(x));
+	}
+}
+
+__attribute__((target(HAMMING_AVX512_TARGET)))
+void vpopcntAnyMany(const unsigned char* query, const unsigned char* vectors,
+		int numVectors, size_t size, int* distances) {
+	for (int i = 0; i < numVectors; ++i, vectors += size) {
+		distances[i] = vpopcntAny(query, vectors, size);
+	}
+}
+
+#endif
+
+// --------------------------------------------------------------------------
+
+/**
+ * Selects the best kernels when the library is loaded.
+ */
+struct KernelsSelector {
+	KernelsSelector() {
+		selectBestKernels();
+	}
+};
+
+KernelsSelector kernelsSelector;
+
+} /* anonymous namespace */
+
+// --------------------------------------------------------------------------
+
+// Portable kernels are statically initialized, hence usable even
+// before the best kernels for the CPU are selected
+Kernels activeKernels = { portableFixed<32>, portableFixed<64>, portableAny,
+		portableFixedMany<32>, portableFixedMany<64>, portableAnyMany, PORTABLE };
+
+// --------------------------------------------------------------------------
+
+bool isSupported(InstructionSet instructionSet) {
+	switch (instructionSet) {
+	case PORTABLE:
+		return true;
+#if HAMMING_X86_KERNELS
+	case POPCNT:
+		return __builtin_cpu_supports("popcnt");
+	case AVX2:
+		return __builtin_cpu_supports("avx2")
+				&& __builtin_cpu_supports("popcnt");
+	case AVX512_VPOPCNTDQ:
+		return __builtin_cpu_supports("avx2")
+				&& __builtin_cpu_supports("avx512f")
+				&& __builtin_cpu_supports("avx512vl")
+				&& __builtin_cpu_supports("avx512vpopcntdq")
+				&& __builtin_cpu_supports("popcnt");
+#endif
+	default:
+		return false;
+	}
+}
+
+// --------------------------------------------------------------------------
+
+bool selectKernels(InstructionSet instructionSet) {
+
+	if (isSupported(instructionSet) == false) {
+		return false;
+	}
+
+	Kernels kernels = { portableFixed<32>, portableFixed<64>, portableAny,
+			portableFixedMany<32>, portableFixedMany<64>, portableAnyMany,
+			PORTABLE };
+
+#if HAMMING_X86_KERNELS
+	if (instructionSet == POPCNT) {
+		Kernels popcntKernels = { popcntFixed<32>, popcntFixed<64>, popcntAny,
+				popcntFixedMany<32>, popcntFixedMany<64>, popcntAnyMany, POPCNT };
+		kernels = popcntKernels;
+	} else if (instructionSet == AVX2) {
+		// Four scalar popcounts beat the lookup table on 32-byte vectors
+		Kernels avx2Kernels = { popcntFixed<32>, avx2Distance64, avx2Any,
+				popcntFixedMany<32>, avx2Distances64, avx2AnyMany, AVX2 };
+		kernels = avx2Kernels;
+	} else if (instructionSet == AVX512_VPOPCNTDQ) {
+		Kernels vpopcntKernels = { vpopcntDistance32, vpopcntDistance64,
+				vpopcntAny, vpopcntDistances32, vpopcntDistances64,
+				vpopcntAnyMany, AVX512_VPOPCNTDQ };
+		kernels = vpopcntKernels;
+	}
+#endif
+
+	activeKernels = kernels;
+
+	return true;
+}
+
+// --------------------------------------------------------------------------
+
+void selectBestKernels() {
+#if HAMMING_X86_KERNELS
+	// Called from a static constructor, possibly before the CPU model used by
+	// __builtin_cpu_supports has been initialized
+	__builtin_cpu_init();
+#endif
+	if (selectKernels(AVX512_VPOPCNTDQ) == false
+			&& selectKernels(AVX2) == false
+			&& selectKernels(POPCNT) == false) {
+		selectKernels(PORTABLE);
+	}
+}
+
+// --------------------------------------------------------------------------
+
+const char* getInstructionSetName(InstructionSet instructionSet) {
+	switch (instructionSet) {
+	case PORTABLE:
+		return "portable";
+	case POPCNT:
+		return "popcnt";
+	case AVX2:
+		return "avx2";
+	case AVX512_VPOPCNTDQ:
+		return "avx512vpopcntdq";
+	default:
+		return "unknown";
+	}
+}
+
+} /* namespace hamming */
+
+} /* namespace vlr */
@@ -157,7 +157,7 @@ void KMajority::initCentroids() {
 	}
 
 	// Randomly chose centers
-	CentersChooser<Distance::ElementType, cv::Hamming>::create(
+	CentersChooser<Distance::ElementType, Distance>::create(
 			m_centersInitMethod)->chooseCenters(m_numClusters, indices,
 			m_numDatapoints, centers_idx, centers_length, m_dataset);
 	CV_Assert(centers_length == m_numClusters);
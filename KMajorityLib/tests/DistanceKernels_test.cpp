@@ -0,0 +1,91 @@
+/*
+ * DistanceKernels_test.cpp
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: andresf
+ */
+
+#include <gtest/gtest.h>
+
+#include <DistanceKernels.hpp>
+
+TEST(DistanceKernels, HammingArgmin) {
+
+	int branching = 10, veclen = 32;
+
+	cv::Mat queries(100, veclen, CV_8U), centers(branching, veclen, CV_8U);
+	cv::RNG rng(0);
+	rng.fill(queries, cv::RNG::UNIFORM, 0, 256);
+	rng.fill(centers, cv::RNG::UNIFORM, 0, 256);
+
+	// Duplicated center so that ties are exercised
+	centers.row(2).copyTo(centers.row(7));
+
+	vlr::Hamming distance;
+
+	for (int i = 0; i < queries.rows; ++i) {
+		int best = 0;
+		int bestDistance = distance(queries.ptr<uchar>(i), centers.ptr<uchar>(0),
+				veclen);
+		for (int j = 1; j < branching; ++j) {
+			int d = distance(queries.ptr<uchar>(i), centers.ptr<uchar>(j),
+					veclen);
+			if (d < bestDistance) {
+				bestDistance = d;
+				best = j;
+			}
+		}
+
+		int kernelDistance;
+		ASSERT_EQ(best,
+				(vlr::DistanceKernels<uchar, vlr::Hamming>::argmin(distance,
+						queries.ptr<uchar>(i), centers.ptr<uchar>(0), branching,
+						veclen, kernelDistance)));
+		ASSERT_EQ(bestDistance, kernelDistance);
+	}
+
+}
+
+TEST(DistanceKernels, L2Argmin) {
+
+	int branching = 10, veclen = 128;
+
+	cv::Mat queries(100, veclen, CV_32F), centers(branching, veclen, CV_32F);
+	cv::RNG rng(0);
+	rng.fill(queries, cv::RNG::UNIFORM, 0, 1);
+	rng.fill(centers, cv::RNG::UNIFORM, 0, 1);
+
+	cv::L2<float> distance;
+
+	std::vector<float> distances(branching);
+
+	for (int i = 0; i < queries.rows; ++i) {
+		int best = 0;
+		float bestDistance = distance(queries.ptr<float>(i),
+				centers.ptr<float>(0), veclen);
+		for (int j = 1; j < branching; ++j) {
+			float d = distance(queries.ptr<float>(i), centers.ptr<float>(j),
+					veclen);
+			if (d < bestDistance) {
+				bestDistance = d;
+				best = j;
+			}
+		}
+
+		float kernelDistance;
+		ASSERT_EQ(best,
+				(vlr::DistanceKernels<float, cv::L2<float> >::argmin(distance,
+						queries.ptr<float>(i), centers.ptr<float>(0), branching,
+						veclen, kernelDistance)));
+		ASSERT_NEAR(bestDistance, kernelDistance, 1e-4);
+
+		vlr::DistanceKernels<float, cv::L2<float> >::distances(distance,
+				queries.ptr<float>(i), centers.ptr<float>(0), branching, veclen,
+				distances.data());
+		for (int j = 0; j < branching; ++j) {
+			ASSERT_NEAR(distance(queries.ptr<float>(i), centers.ptr<float>(j),
+					veclen), distances[j], 1e-4);
+		}
+	}
+
+}
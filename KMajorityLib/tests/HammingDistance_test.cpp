@@ -0,0 +1,127 @@
+/*
+ * HammingDistance_test.cpp
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: andresf
+ */
+
+#include <gtest/gtest.h>
+
+#include <HammingDistance.hpp>
+
+TEST(HammingDistance, MatchesOpenCVHamming) {
+
+	cv::Mat a(1, 200, CV_8U), b(1, 200, CV_8U);
+	cv::RNG rng(0);
+	rng.fill(a, cv::RNG::UNIFORM, 0, 256);
+	rng.fill(b, cv::RNG::UNIFORM, 0, 256);
+
+	cv::Hamming reference;
+	vlr::Hamming distance;
+
+	for (int instructionSet = vlr::hamming::PORTABLE;
+			instructionSet <= vlr::hamming::AVX512_VPOPCNTDQ;
+			++instructionSet) {
+
+		if (vlr::hamming::selectKernels(
+				vlr::hamming::InstructionSet(instructionSet)) == false) {
+			printf("   Skipping [%s], not supported by this CPU\n",
+					vlr::hamming::getInstructionSetName(
+							vlr::hamming::InstructionSet(instructionSet)));
+			continue;
+		}
+
+		// Check every length, including the specialized ones (32 and 64 bytes),
+		// and unaligned vectors
+		for (int size = 0; size <= 128; ++size) {
+			for (int offset = 0; offset < 3; ++offset) {
+				ASSERT_EQ(reference(a.data + offset, b.data + offset, size),
+						distance(a.data + offset, b.data + offset, size));
+			}
+		}
+	}
+
+	vlr::hamming::selectBestKernels();
+
+}
+
+TEST(HammingDistance, ManyMatchesSingle) {
+
+	int numVectors = 13;
+
+	cv::Mat query(1, 128, CV_8U), vectors(1, numVectors * 128, CV_8U);
+	cv::RNG rng(0);
+	rng.fill(query, cv::RNG::UNIFORM, 0, 256);
+	rng.fill(vectors, cv::RNG::UNIFORM, 0, 256);
+
+	vlr::Hamming distance;
+	std::vector<int> distances(numVectors);
+
+	for (int instructionSet = vlr::hamming::PORTABLE;
+			instructionSet <= vlr::hamming::AVX512_VPOPCNTDQ;
+			++instructionSet) {
+
+		if (vlr::hamming::selectKernels(
+				vlr::hamming::InstructionSet(instructionSet)) == false) {
+			continue;
+		}
+
+		// Odd and even number of vectors, specialized and generic lengths
+		for (int size = 1; size <= 128; ++size) {
+			for (int n = 0; n <= numVectors; ++n) {
+				distance.distances(query.data, vectors.data, n, size,
+						distances.data());
+				for (int j = 0; j < n; ++j) {
+					ASSERT_EQ(distance(query.data, vectors.data + j * size, size),
+							distances[j]);
+				}
+			}
+		}
+	}
+
+	vlr::hamming::selectBestKernels();
+
+}
+
+TEST(HammingDistance, Throughput) {
+
+	int rounds = 10000;
+
+	cv::Mat data(1000, 32, CV_8U);
+	cv::RNG rng(0);
+	rng.fill(data, cv::RNG::UNIFORM, 0, 256);
+
+	cv::Hamming reference;
+	vlr::Hamming distance;
+
+	int checksumReference = 0;
+	double referenceTime = (double) cv::getTickCount();
+	for (int r = 0; r < rounds; ++r) {
+		for (int i = 1; i < data.rows; ++i) {
+			checksumReference += reference(data.ptr<uchar>(0),
+					data.ptr<uchar>(i), data.cols);
+		}
+	}
+	referenceTime = ((double) cv::getTickCount() - referenceTime)
+			/ cv::getTickFrequency();
+
+	int checksum = 0;
+	double time = (double) cv::getTickCount();
+	for (int r = 0; r < rounds; ++r) {
+		for (int i = 1; i < data.rows; ++i) {
+			checksum += distance(data.ptr<uchar>(0), data.ptr<uchar>(i),
+					data.cols);
+		}
+	}
+	time = ((double) cv::getTickCount() - time) / cv::getTickFrequency();
+
+	printf("   cv::Hamming computed [%lf] distances/s\n",
+			rounds * (data.rows - 1) / referenceTime);
+	printf("   vlr::Hamming (%s) computed [%lf] distances/s\n",
+			vlr::hamming::getInstructionSetName(
+					vlr::hamming::activeKernels.instructionSet),
+			rounds * (data.rows - 1) / time);
+
+	ASSERT_EQ(checksumReference, checksum);
+
+}
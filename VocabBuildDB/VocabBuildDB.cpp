@@ -17,24 +17,48 @@
 
 #include <VocabTree.h>
 #include <VocabDB.hpp>
+#include <ShardedDB.hpp>
 
 #include <FileUtils.hpp>
+#include <ThreadPool.hpp>
 
 double mytime;
 
 int main(int argc, char **argv) {
 
-	if (argc < 4 || argc > 7) {
+	if (argc < 4 || argc > 12) {
 		printf("\nUsage:\n\tVocabBuildDB <in.db.images.list> "
 				"<in.vocab> <out.inverted.index>"
-				" [in.weighting:TFIDF] [in.norm:L2] [out.nn.index:nn_index.bin]\n\n"
+				" [in.weighting:TFIDF] [in.norm:L2] [out.nn.index:nn_index.bin]"
+				" [in.weights.bits:32] [in.num.threads:1] [in.incremental:0]"
+				" [in.num.shards:1] [out.direct.index:-]\n\n"
 				"Weighting:\n"
 				"\tTFIDF: Term Frequency - Inverse Document Frequency\n"
 				"\tTF: Term Frequency\n"
 				"\tBIN: Binary\n\n"
 				"Norm:\n"
 				"\tL1: L1-norm\n"
-				"\tL2: L2-norm\t\n\n");
+				"\tL2: L2-norm\t\n\n"
+				"Weights bits:\n"
+				"\tBits of the posting weights when the inverted index is saved\n"
+				"\tin binary format (.bin), either 32 (float), 16 or 8\n\n"
+				"Threads:\n"
+				"\tNumber of images loaded and quantized concurrently,"
+				" 0 to use as many as hardware threads\n\n"
+				"Incremental:\n"
+				"\tIf 1 the inverted index keeps the raw counts, so that the weighting\n"
+				"\tand the norm are applied when scoring, and if it already exists\n"
+				"\tthe images are appended to it\n\n"
+				"Shards:\n"
+				"\tNumber of inverted indexes the database is split into, each one\n"
+				"\tholding consecutive images and saved to <out.inverted.index> with\n"
+				"\t.shard<i> inserted before the extension. The words weights are\n"
+				"\tcomputed over all the images so that shards can be scored apart\n\n"
+				"Direct index:\n"
+				"\tFile where to save the vocabulary tree nodes of the features of\n"
+				"\tevery image, used by GeomVerify to match features, in binary\n"
+				"\tformat if it ends with .bin. Only for HKM and HKMAJ vocabularies,\n"
+				"\t- to skip it\n\n");
 		return EXIT_FAILURE;
 	}
 
@@ -44,6 +68,11 @@ int main(int argc, char **argv) {
 	std::string in_weighting = "TFIDF";
 	std::string in_norm = "L1";
 	std::string out_nn_index = "nn_index.bin";
+	int in_weights_bits = 32;
+	int in_num_threads = 1;
+	bool in_incremental = false;
+	int in_num_shards = 1;
+	std::string out_direct_index = "-";
 
 	if (argc >= 5) {
 		in_weighting = argv[4];
@@ -57,20 +86,90 @@ int main(int argc, char **argv) {
 		out_nn_index = argv[6];
 	}
 
-	boost::regex expression("^(.+)(\\.)(yaml|xml)(\\.)(gz)$");
+	if (argc >= 8) {
+		in_weights_bits = atoi(argv[7]);
+	}
+
+	if (argc >= 9) {
+		in_num_threads = atoi(argv[8]);
+	}
+
+	if (argc >= 10) {
+		in_incremental = atoi(argv[9]);
+	}
+
+	if (argc >= 11) {
+		in_num_shards = atoi(argv[10]);
+	}
+
+	if (argc >= 12) {
+		out_direct_index = argv[11];
+	}
+
+	bool buildDirectIndex = out_direct_index.compare("-") != 0;
+
+	boost::regex expression("^(.+)(\\.)((yaml|xml)(\\.)(gz)|bin)$");
+	boost::regex vocabExpression("^(.+)(\\.)((yaml|xml)(\\.)(gz)|bin)$");
 
-	if (boost::regex_match(in_vocab, expression) == false) {
+	if (boost::regex_match(in_vocab, vocabExpression) == false) {
 		fprintf(stderr,
-				"Input vocabulary file must have the extension .yaml.gz or .xml.gz\n");
+				"Input vocabulary file must have the extension .yaml.gz, .xml.gz or .bin\n");
 		return EXIT_FAILURE;
 	}
 
 	if (boost::regex_match(out_inv_index, expression) == false) {
 		fprintf(stderr,
-				"Output inverted index file must have the extension .yaml.gz or .xml.gz\n");
+				"Output inverted index file must have the extension .yaml.gz, .xml.gz or .bin\n");
+		return EXIT_FAILURE;
+	}
+
+	if (buildDirectIndex == true
+			&& boost::regex_match(out_direct_index, expression) == false) {
+		fprintf(stderr,
+				"Output direct index file must have the extension .yaml.gz, .xml.gz or .bin\n");
+		return EXIT_FAILURE;
+	}
+
+	vlr::WeightEncoding weightEncoding = vlr::WEIGHTS_FLOAT32;
+
+	if (in_weights_bits == 16) {
+		weightEncoding = vlr::WEIGHTS_UINT16;
+	} else if (in_weights_bits == 8) {
+		weightEncoding = vlr::WEIGHTS_UINT8;
+	} else if (in_weights_bits != 32) {
+		fprintf(stderr, "Weights bits must be either 32, 16 or 8\n");
+		return EXIT_FAILURE;
+	}
+
+	if (in_incremental == true && weightEncoding != vlr::WEIGHTS_FLOAT32) {
+		fprintf(stderr, "Raw counts of incremental indexes are saved as float\n");
 		return EXIT_FAILURE;
 	}
 
+	if (in_num_shards < 1) {
+		fprintf(stderr, "Number of shards must be positive\n");
+		return EXIT_FAILURE;
+	}
+
+	if (in_incremental == true && in_num_shards > 1) {
+		fprintf(stderr, "Incremental indexes cannot be sharded\n");
+		return EXIT_FAILURE;
+	}
+
+	vlr::WeightingType weighting = vlr::TF_IDF;
+
+	if (in_weighting.compare("TF") == 0) {
+		weighting = vlr::TF;
+	} else if (in_weighting.compare("BIN") == 0) {
+		weighting = vlr::BINARY;
+	}
+
+	vlr::NormType norm = vlr::NORM_L2;
+
+	if (in_norm.compare("L1") == 0) {
+		norm = vlr::NORM_L1;
+	}
+
 	// Step 1/4: read list of descriptors that shall be used to build the vocabulary
 	printf("-- Loading list of database images descriptors\n");
 	std::vector<std::string> descFilenames;
@@ -97,6 +196,12 @@ int main(int argc, char **argv) {
 		return EXIT_FAILURE;
 	}
 
+	if (buildDirectIndex == true && in_vocab_type.compare("HKM") != 0
+			&& in_vocab_type.compare("HKMAJ") != 0) {
+		fprintf(stderr, "Direct index requires a vocabulary tree\n");
+		return EXIT_FAILURE;
+	}
+
 	printf("-- Reading vocabulary from [%s]\n", in_vocab.c_str());
 
 	mytime = cv::getTickCount();
@@ -131,84 +236,298 @@ int main(int argc, char **argv) {
 	}
 
 	// Step 2/4: Quantize training data (several image descriptor matrices)
-	printf("-- Creating vocabulary database with [%lu] images\n",
-			descFilenames.size());
-	db->clearDatabase();
-	printf("   Clearing Inverted Files\n");
-
-	cv::Mat imgDescriptors;
-	int imgIdx = 0;
-
-	for (std::string& keyFileName : descFilenames) {
-		// Load descriptors
-		FileUtils::loadDescriptors(keyFileName, imgDescriptors);
-
-		// Check descriptors type
-		// Note: for empty matrices FileStorage API sets as 0 the descriptor type
-		// TODO Automatically identify if database uses a BoF model for binary or non-binary data
-//		if (imgDescriptors.empty() == false
-//				&& (imgDescriptors.type() == CV_8U) != isDescriptorBinary) {
-//			fprintf(stderr,
-//					"Descriptor type doesn't coincide, it is said to be [%s] while it is [%s]\n",
-//					isDescriptorBinary == true ? "binary" : "non-binary",
-//					imgDescriptors.type() == CV_8U ? "binary" : "non-binary");
-//			return EXIT_FAILURE;
-//		}
-
-		// Add image to database
-		printf("   Adding image [%u] to database\n", imgIdx);
+	struct stat buffer;
+
+	if (in_incremental == true) {
+		db->setIncremental(weighting, norm);
+	}
+
+	// Images are loaded and quantized concurrently in blocks of consecutive
+	// images, each block into its own buffer of word counts. The buffers of a
+	// window of blocks are then added in block order, so that the images of
+	// every inverted file stay in increasing order, and released.
+	cv::Ptr<vlr::ThreadPool> pool;
+	int blockSize = 1;
+	int window = 1;
+
+	if (in_num_threads != 1) {
+		pool = new vlr::ThreadPool(in_num_threads);
+		blockSize = 16;
+		window = 4 * pool->getNumThreads();
+		printf("   Adding images in blocks of [%d] using [%d] threads\n",
+				blockSize, pool->getNumThreads());
+	}
+
+	// When sharding, every shard is first saved with its raw counts while the
+	// document frequencies of the words are gathered over all the shards
+	int numDbImages = descFilenames.size();
+	std::vector<int> frequencies, shardFrequencies;
+	std::vector<std::string> shardFilenames;
+
+	for (int shardIdx = 0; shardIdx < in_num_shards; ++shardIdx) {
+
+		// First image of the shard in the list of images
+		int shardOffset = (long) shardIdx * numDbImages / in_num_shards;
+		int numImages = (long) (shardIdx + 1) * numDbImages / in_num_shards
+				- shardOffset;
+
+		if (in_num_shards > 1) {
+			shardFilenames.push_back(
+					vlr::getShardFilename(out_inv_index, shardIdx));
+			printf("-- Building shard [%d] with images [%d, %d]\n", shardIdx,
+					shardOffset, shardOffset + numImages - 1);
+		}
+
+		if (in_incremental == true
+				&& stat(out_inv_index.c_str(), &buffer) == 0) {
+			printf("-- Loading incremental inverted index [%s]\n",
+					out_inv_index.c_str());
+			try {
+				db->loadInvertedIndex(out_inv_index);
+			} catch (const std::runtime_error& error) {
+				fprintf(stderr, "%s\n", error.what());
+				return EXIT_FAILURE;
+			}
+			printf("   Appending [%d] images to the [%d] database images\n",
+					numImages, db->getInvertedIndex()->m_numDbImages);
+
+			if (buildDirectIndex == true
+					&& db->getInvertedIndex()->m_numDbImages > 0
+					&& stat(out_direct_index.c_str(), &buffer) != 0) {
+				// Images already in the database would be left without features
+				fprintf(stderr, "Direct index [%s] of the incremental database"
+						" does not exist\n", out_direct_index.c_str());
+				return EXIT_FAILURE;
+			}
+
+			if (buildDirectIndex == true
+					&& stat(out_direct_index.c_str(), &buffer) == 0) {
+				printf("-- Loading direct index [%s]\n",
+						out_direct_index.c_str());
+				try {
+					((cv::Ptr<vlr::HKMDB>) db)->loadDirectIndex(
+							out_direct_index);
+				} catch (const std::runtime_error& error) {
+					fprintf(stderr, "%s\n", error.what());
+					return EXIT_FAILURE;
+				}
+				if (((cv::Ptr<vlr::HKMDB>) db)->getDirectIndex()->size()
+						!= (size_t) db->getInvertedIndex()->m_numDbImages) {
+					fprintf(stderr, "Direct index and inverted index hold a"
+							" different number of images\n");
+					return EXIT_FAILURE;
+				}
+			}
+		} else {
+			printf("-- Creating vocabulary database with [%d] images\n",
+					numImages);
+			db->clearDatabase();
+			printf("   Clearing Inverted Files\n");
+		}
+
+		// Ids of the new images follow those of the images already in the database
+		int firstImgIdx = db->getInvertedIndex()->m_numDbImages;
+
+		int numBlocks = (numImages + blockSize - 1) / blockSize;
+
+		std::vector<std::vector<vlr::WordImageCount> > blockCounts(window);
+		// Direct index node ids of the features of every image of the block
+		std::vector<std::vector<std::vector<int> > > blockNodeIds(window);
+		std::vector<std::string> blockErrors(window);
+
+		auto quantizeBlock = [&](int blockIdx) {
+			std::vector<vlr::WordImageCount>& counts = blockCounts[blockIdx % window];
+			std::vector<std::vector<int> >& nodeIds = blockNodeIds[blockIdx % window];
+			std::string& error = blockErrors[blockIdx % window];
+			counts.clear();
+			nodeIds.clear();
+			error.clear();
+
+			cv::Mat imgDescriptors;
+			int last = std::min((blockIdx + 1) * blockSize, numImages);
+
+			try {
+				for (int imgIdx = blockIdx * blockSize; imgIdx < last; ++imgIdx) {
+					// Load descriptors
+					FileUtils::loadDescriptors(descFilenames[shardOffset + imgIdx],
+							imgDescriptors);
+
+					// Check descriptors type
+					// Note: for empty matrices FileStorage API sets as 0 the descriptor type
+					// TODO Automatically identify if database uses a BoF model for binary or non-binary data
+//					if (imgDescriptors.empty() == false
+//							&& (imgDescriptors.type() == CV_8U) != isDescriptorBinary) {
+//						fprintf(stderr,
+//								"Descriptor type doesn't coincide, it is said to be [%s] while it is [%s]\n",
+//								isDescriptorBinary == true ? "binary" : "non-binary",
+//								imgDescriptors.type() == CV_8U ? "binary" : "non-binary");
+//						return EXIT_FAILURE;
+//					}
+
+					nodeIds.push_back(std::vector<int>());
+					db->quantizeImage(firstImgIdx + imgIdx, imgDescriptors, counts,
+							buildDirectIndex == true ? &nodeIds.back() : NULL);
+				}
+			} catch (const std::exception& e) {
+				error = e.what();
+			}
+		};
+
+		int imgIdx = 0;
+
+		for (int first = 0; first < numBlocks; first += window) {
+
+			int last = std::min(first + window, numBlocks);
+
+			if (pool.empty() == true) {
+				quantizeBlock(first);
+			} else {
+				pool->parallelFor(first, last, 1, [&](int begin, int end) {
+					for (int blockIdx = begin; blockIdx < end; ++blockIdx) {
+						quantizeBlock(blockIdx);
+					}
+				});
+			}
+
+			for (int blockIdx = first; blockIdx < last; ++blockIdx) {
+
+				if (blockErrors[blockIdx % window].empty() == false) {
+					fprintf(stderr, "%s\n", blockErrors[blockIdx % window].c_str());
+					return EXIT_FAILURE;
+				}
+
+				// Add the images of the block to database
+				int numBlockImages = std::min(blockSize, numImages - imgIdx);
+				printf("   Adding images [%d, %d] to database\n",
+						firstImgIdx + imgIdx,
+						firstImgIdx + imgIdx + numBlockImages - 1);
+				try {
+					db->addCountsToDatabase(blockCounts[blockIdx % window],
+							numBlockImages);
+				} catch (const std::runtime_error& error) {
+					fprintf(stderr, "%s\n", error.what());
+					return EXIT_FAILURE;
+				}
+				std::vector<vlr::WordImageCount>().swap(
+						blockCounts[blockIdx % window]);
+
+				// Images of the direct index have the ids of the whole database
+				for (int k = 0; buildDirectIndex == true && k < numBlockImages;
+						++k) {
+					db->addToDirectIndex(shardOffset + firstImgIdx + imgIdx + k,
+							blockNodeIds[blockIdx % window][k]);
+				}
+				std::vector<std::vector<int> >().swap(
+						blockNodeIds[blockIdx % window]);
+
+				// Increase added images counter
+				imgIdx += numBlockImages;
+			}
+		}
+
+		CV_Assert(imgIdx >= 0 && imgIdx == numImages);
+
+		printf("   Added [%u] images\n", imgIdx);
+
+		if (in_num_shards > 1) {
+			db->getDocumentFrequencies(shardFrequencies);
+			frequencies.resize(shardFrequencies.size(), 0);
+			for (size_t i = 0; i < shardFrequencies.size(); ++i) {
+				frequencies[i] += shardFrequencies[i];
+			}
+
+			printf("   Saving raw counts of shard [%d] to [%s]\n", shardIdx,
+					shardFilenames.back().c_str());
+			db->saveInvertedIndex(shardFilenames.back());
+		}
+	}
+
+	if (buildDirectIndex == true) {
+		printf("-- Saving direct index to [%s]\n", out_direct_index.c_str());
+
+		mytime = cv::getTickCount();
 		try {
-			db->addImageToDatabase(imgIdx, imgDescriptors);
+			((cv::Ptr<vlr::HKMDB>) db)->saveDirectIndex(out_direct_index);
 		} catch (const std::runtime_error& error) {
 			fprintf(stderr, "%s\n", error.what());
 			return EXIT_FAILURE;
 		}
+		mytime = ((double) cv::getTickCount() - mytime) / cv::getTickFrequency()
+				* 1000;
 
-		// Increase added images counter
-		++imgIdx;
+		printf("   Direct index saved in [%lf] ms, got [%lu] features\n",
+				mytime,
+				((cv::Ptr<vlr::HKMDB>) db)->getDirectIndex()->getNumFeatures());
 	}
 
-	imgDescriptors.release();
-	imgDescriptors = cv::Mat();
+	// Step 3/4: Compute words weights and normalize DB
 
-	CV_Assert(imgIdx >= 0 && (size_t ) imgIdx == descFilenames.size());
+	if (in_incremental == true) {
+		printf("-- Keeping raw counts, the [%s] weighting and the [%s-norm]"
+				" are applied when scoring\n",
+				weighting == vlr::TF_IDF ? "TF-IDF" :
+				weighting == vlr::TF ? "TF" : "BINARY",
+				norm == vlr::NORM_L1 ? "L1" : "L2");
+	}
 
-	printf("   Added [%u] images\n", imgIdx);
+	for (int shardIdx = 0; in_incremental == false && shardIdx < in_num_shards;
+			++shardIdx) {
+
+		if (in_num_shards > 1) {
+			printf("-- Loading raw counts of shard [%d]\n", shardIdx);
+			try {
+				db->loadRawCounts(shardFilenames[shardIdx]);
+			} catch (const std::runtime_error& error) {
+				fprintf(stderr, "%s\n", error.what());
+				return EXIT_FAILURE;
+			}
+		}
 
-	// Step 3/4: Compute words weights and normalize DB
+		printf("-- Computing words weights using a [%s] weighting scheme\n",
+				weighting == vlr::TF_IDF ? "TF-IDF" :
+				weighting == vlr::TF ? "TF" :
+				weighting == vlr::BINARY ? "BINARY" : "UNKNOWN");
 
-	vlr::WeightingType weighting = vlr::TF_IDF;
+		if (in_num_shards > 1) {
+			// Every shard is weighted as if it held all the database images
+			db->computeWordsWeights(weighting, frequencies, numDbImages);
+		} else {
+			db->computeWordsWeights(weighting);
+		}
 
-	if (in_weighting.compare("TF") == 0) {
-		weighting = vlr::TF;
-	} else if (in_weighting.compare("BIN") == 0) {
-		weighting = vlr::BINARY;
-	}
+		printf("-- Applying words weights to the database BoF vectors counts\n");
+		db->createDatabase();
 
-	printf("-- Computing words weights using a [%s] weighting scheme\n",
-			weighting == vlr::TF_IDF ? "TF-IDF" : weighting == vlr::TF ? "TF" :
-			weighting == vlr::BINARY ? "BINARY" : "UNKNOWN");
+		printf("-- Normalizing database BoF vectors using [%s-norm]\n",
+				norm == vlr::NORM_L1 ? "L1" :
+				norm == vlr::NORM_L2 ? "L2" : "Unknown");
+		db->normalizeDatabase(norm);
 
-	db->computeWordsWeights(weighting);
+		// The inverted files are no longer modified, so the postings are only kept
+		// in the contiguous posting lists from which the index is saved
+		db->freezeDatabase();
 
-	printf("-- Applying words weights to the database BoF vectors counts\n");
-	db->createDatabase();
+		if (in_num_shards > 1) {
+			printf("-- Saving shard [%d] to [%s]\n", shardIdx,
+					shardFilenames[shardIdx].c_str());
 
-	vlr::NormType norm = vlr::NORM_L2;
+			mytime = cv::getTickCount();
+			db->saveInvertedIndex(shardFilenames[shardIdx], weightEncoding);
+			mytime = ((double) cv::getTickCount() - mytime)
+					/ cv::getTickFrequency() * 1000;
 
-	if (in_norm.compare("L1") == 0) {
-		norm = vlr::NORM_L1;
+			printf("   Shard saved in [%lf] ms\n", mytime);
+		}
 	}
 
-	printf("-- Normalizing database BoF vectors using [%s-norm]\n",
-			norm == vlr::NORM_L1 ? "L1" :
-			norm == vlr::NORM_L2 ? "L2" : "Unknown");
-	db->normalizeDatabase(norm);
+	if (in_num_shards > 1) {
+		return EXIT_SUCCESS;
+	}
 
 	printf("-- Saving inverted index to [%s]\n", out_inv_index.c_str());
 
 	mytime = cv::getTickCount();
-	db->saveInvertedIndex(out_inv_index);
+	db->saveInvertedIndex(out_inv_index, weightEncoding);
 	mytime = ((double) cv::getTickCount() - mytime) / cv::getTickFrequency()
 			* 1000;
 
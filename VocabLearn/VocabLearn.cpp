@@ -36,6 +36,9 @@ int main(int argc, char **argv) {
 		printf(
 				"\nUsage:\n"
 						"\tVocabLearn <in.training.images.list> <in.vocab.type> <out.vocab> [-opts <key>=<value>]\n\n"
+						"Output vocabulary:\n"
+						"\t.yaml.gz: gzip-compressed YAML\n"
+						"\t.bin: binary, memory mapped when loaded (only HKM and HKMAJ)\n\n"
 						"Vocabulary type:\n"
 						"\tHKM: Hierarchical K-Means\n"
 						"\tHKMAJ: Hierarchical K-Majority\n"
@@ -44,7 +47,8 @@ int main(int argc, char **argv) {
 						"\tIKM: Incremental K-Means\n\n"
 						"HKM and HKMAJ options:\n"
 						"\tdepth=6\t\t\tbranch.factor=10\n"
-						"\tmax.iterations=10\tcenters.init.method=RANDOM\n\n"
+						"\tmax.iterations=10\tcenters.init.method=RANDOM\n"
+						"\tnum.threads=1 (0: one per hardware thread)\n\n"
 						"AKMAJ options:\n"
 						"\tnum.clusters=1000000\t\tmax.iterations=10\n"
 						"\tcenters.init.method=RANDOM\tnn.type=HIERARCHICAL\n"
@@ -68,10 +72,23 @@ int main(int argc, char **argv) {
 	std::string in_vocab_type = argv[2];
 	std::string out_vocab = argv[3];
 
-	if (out_vocab.substr(out_vocab.length() - 8, out_vocab.length()).compare(
-			".yaml.gz") != 0) {
+	bool binaryOutput = out_vocab.length() >= 4
+			&& out_vocab.compare(out_vocab.length() - 4, 4, ".bin") == 0;
+
+	if (binaryOutput == false
+			&& (out_vocab.length() < 8
+					|| out_vocab.compare(out_vocab.length() - 8, 8, ".yaml.gz")
+							!= 0)) {
+		fprintf(stderr,
+				"Output file containing vocabulary must have the extension .yaml.gz or .bin\n");
+		return EXIT_FAILURE;
+	}
+
+	// Only vocabulary trees support the binary format
+	if (binaryOutput == true && in_vocab_type.compare("HKM") != 0
+			&& in_vocab_type.compare("HKMAJ") != 0) {
 		fprintf(stderr,
-				"Output file containing vocabulary must have the extension .yaml.gz\n");
+				"Binary output (.bin) is only supported by HKM and HKMAJ vocabularies\n");
 		return EXIT_FAILURE;
 	}
 
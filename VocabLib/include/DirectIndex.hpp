@@ -9,26 +9,173 @@
 #define DIRECTINDEX_H_
 
 #include <cstring>
-#include <map>
 #include <stdexcept>
+#include <stdint.h>
 #include <vector>
 
 #include <opencv2/core/core.hpp>
 
 namespace vlr {
 
-typedef std::vector<int> FeatureVector;
-typedef std::map<int, FeatureVector> TreeNode;
 typedef unsigned int uint;
 
+// Signature at the beginning of every binary direct index file
+static const char DIRECT_INDEX_FILE_MAGIC[8] = { 'V', 'L', 'R', 'D', 'I',
+		'R', 'I', 'X' };
+
+// Version of the binary direct index file format
+static const uint32_t DIRECT_INDEX_FILE_VERSION = 1;
+
+/**
+ * Header of the binary direct index files, it is followed by the offsets of
+ * the images (numImages + 1 values of 64 bits) and by the (node, feature)
+ * pairs (numFeatures pairs of 32-bit values). Values are stored in the host
+ * byte order.
+ */
+struct DirectIndexFileHeader {
+	// File signature, equal to DIRECT_INDEX_FILE_MAGIC
+	char magic[8];
+	// Version of the file format
+	uint32_t version;
+	// Level of the tree at which nodes are stored
+	int32_t level;
+	uint64_t numImages;
+	uint64_t numFeatures;
+};
+
+/**
+ * Feature of an image assigned to a node of the vocabulary tree.
+ */
+struct NodeFeature {
+
+	// Id of the node at the level of the direct index
+	int m_nodeId;
+
+	// Index of the feature in the image
+	int m_featureId;
+
+	NodeFeature() :
+			m_nodeId(-1), m_featureId(-1) {
+	}
+
+	NodeFeature(int nodeId, int featureId) :
+			m_nodeId(nodeId), m_featureId(featureId) {
+	}
+
+	bool operator<(const NodeFeature& other) const {
+		return m_nodeId < other.m_nodeId
+				|| (m_nodeId == other.m_nodeId
+						&& m_featureId < other.m_featureId);
+	}
+
+};
+
+// --------------------------------------------------------------------------
+
+/**
+ * Features of an image sorted by node id and then by feature id, hence the
+ * features assigned to the same node are contiguous.
+ */
+class NodeFeatureRange {
+
+protected:
+
+	const NodeFeature* m_begin;
+	const NodeFeature* m_end;
+
+public:
+
+	NodeFeatureRange(const NodeFeature* begin, const NodeFeature* end) :
+			m_begin(begin), m_end(end) {
+	}
+
+	const NodeFeature* begin() const {
+		return m_begin;
+	}
+
+	const NodeFeature* end() const {
+		return m_end;
+	}
+
+	size_t size() const {
+		return m_end - m_begin;
+	}
+
+	bool empty() const {
+		return m_begin == m_end;
+	}
+
+	/**
+	 * Counts the distinct nodes the features are assigned to.
+	 *
+	 * @return the number of nodes
+	 */
+	size_t getNumNodes() const;
+
+};
+
+// --------------------------------------------------------------------------
+
+/**
+ * Intersects the nodes of two images by merging their sorted features, the
+ * callback is called for every shared node as
+ * callback(nodeId, begin1, end1, begin2, end2) where [begin1, end1) and
+ * [begin2, end2) are the features of each image assigned to the node.
+ *
+ * @param features1 - The features of the first image
+ * @param features2 - The features of the second image
+ * @param callback - The function called for every shared node
+ */
+template<typename Callback>
+void intersectNodes(const NodeFeatureRange& features1,
+		const NodeFeatureRange& features2, Callback callback) {
+
+	const NodeFeature* it1 = features1.begin();
+	const NodeFeature* it2 = features2.begin();
+
+	while (it1 != features1.end() && it2 != features2.end()) {
+		if (it1->m_nodeId < it2->m_nodeId) {
+			++it1;
+		} else if (it2->m_nodeId < it1->m_nodeId) {
+			++it2;
+		} else {
+			int nodeId = it1->m_nodeId;
+			const NodeFeature* end1 = it1;
+			while (end1 != features1.end() && end1->m_nodeId == nodeId) {
+				++end1;
+			}
+			const NodeFeature* end2 = it2;
+			while (end2 != features2.end() && end2->m_nodeId == nodeId) {
+				++end2;
+			}
+			callback(nodeId, it1, end1, it2, end2);
+			it1 = end1;
+			it2 = end2;
+		}
+	}
+
+}
+
+// --------------------------------------------------------------------------
+
+/**
+ * Index from images to the nodes of the vocabulary tree at a given level
+ * their features are assigned to. The (node, feature) pairs of all the images
+ * are held in a single array, each image taking a contiguous range sorted by
+ * node id which is located through a table of offsets.
+ */
 class DirectIndex {
 
 protected:
 	// Level at which nodes are stored to construct the direct index
 	int m_level;
 
-	// Vector holding the index of images
-	std::vector<TreeNode> m_index;
+	// (node, feature) pairs of all the images, in image order
+	std::vector<NodeFeature> m_features;
+
+	// Offset in m_features of the first pair of every image, followed by
+	// the total number of pairs
+	std::vector<size_t> m_offsets;
 
 public:
 
@@ -51,6 +198,13 @@ public:
 	 */
 	size_t size() const;
 
+	/**
+	 * Returns the number of (node, feature) pairs of all the images.
+	 *
+	 * @return the number of features
+	 */
+	size_t getNumFeatures() const;
+
 	/**
 	 * Return the level of the tree at which nodes are stored.
 	 *
@@ -61,22 +215,69 @@ public:
 	void setLevel(int level);
 
 	/**
-	 * Updates the direct index of the given image by
-	 * pushing the feature to its corresponding node.
+	 * Updates the direct index of the given image by inserting the feature
+	 * in the range of its node. Images must be added in increasing order, an
+	 * image skipped is left without features.
 	 *
-	 * @param imgIdx
-	 * @param nodeId
-	 * @param featureId
+	 * @param imgIdx - The index of the image, equal or greater than the last one added
+	 * @param nodeId - The id of the node the feature is assigned to
+	 * @param featureId - The index of the feature in the image
+	 *
+	 * @note Features are appended in constant time when given in (node, feature)
+	 * 		 order, otherwise use addImage
 	 */
 	void addFeature(int imgIdx, int nodeId, int featureId);
 
-	const TreeNode& lookUpImg(int imgIdx) const;
+	/**
+	 * Adds all the features of a new image at once.
+	 *
+	 * @param imgIdx - The index of the image, greater than the last one added
+	 * @param nodeIds - The id of the node each feature is assigned to, features
+	 * 					with a negative node id are skipped
+	 */
+	void addImage(int imgIdx, const std::vector<int>& nodeIds);
 
+	/**
+	 * Retrieves the features of an image sorted by node id.
+	 *
+	 * @param imgIdx - The index of the image
+	 * @return the range of the (node, feature) pairs of the image
+	 */
+	NodeFeatureRange lookUpImg(int imgIdx) const;
+
+	/**
+	 * Saves the direct index to a file, in binary format if the file name ends
+	 * with .bin and in YAML format otherwise.
+	 *
+	 * @param filename - The name of the file where to save the index
+	 */
 	void save(const std::string& filename) const;
 
+	/**
+	 * Saves the direct index in binary format, i.e. the offsets table and the
+	 * (node, feature) pairs as they are held in memory.
+	 *
+	 * @param filename - The name of the file where to save the index
+	 */
+	void saveBinary(const std::string& filename) const;
+
+	/**
+	 * Loads the direct index from a file, either in YAML or in binary format.
+	 *
+	 * @param filename - The name of the file from where to load the index
+	 */
 	void load(const std::string& filename);
 
-	void clear() const;
+	/**
+	 * Loads the direct index from a binary file.
+	 *
+	 * @param filename - The name of the file from where to load the index
+	 */
+	void loadBinary(const std::string& filename);
+
+	void clear();
+
+	bool operator==(const DirectIndex& other) const;
 
 };
 
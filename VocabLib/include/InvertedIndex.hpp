@@ -8,10 +8,75 @@
 #ifndef INVERTEDINDEX_H_
 #define INVERTEDINDEX_H_
 
+#include <stdint.h>
+#include <string>
 #include <vector>
 
+#include <opencv2/core/core.hpp>
+
+#include <MappedFile.hpp>
+
 namespace vlr {
 
+// Signature at the beginning of every binary inverted index file
+static const char INVERTED_INDEX_FILE_MAGIC[8] = { 'V', 'L', 'R', 'I', 'N',
+		'V', 'I', 'X' };
+
+// Version of the binary inverted index file format
+static const uint32_t INVERTED_INDEX_FILE_VERSION = 1;
+
+// Encodings of the posting weights in the binary inverted index files,
+// quantized weights are relative to the largest weight of their list
+enum WeightEncoding {
+	WEIGHTS_FLOAT32 = 0, WEIGHTS_UINT16 = 1, WEIGHTS_UINT8 = 2
+};
+
+/**
+ * Header of the binary inverted index files, it is followed by the words table
+ * and by the posting lists. Values are stored in the host byte order.
+ */
+struct InvertedIndexFileHeader {
+	// File signature, equal to INVERTED_INDEX_FILE_MAGIC
+	char magic[8];
+	// Version of the file format
+	uint32_t version;
+	// Encoding of the posting weights (see WeightEncoding)
+	uint32_t weightEncoding;
+	uint64_t numDbImages;
+	uint64_t numWords;
+	uint64_t numPostings;
+	// Offsets in bytes from the beginning of the file of the words table
+	// and of the posting lists, and size in bytes of the posting lists
+	uint64_t wordsOffset;
+	uint64_t postingsOffset;
+	uint64_t postingsSize;
+};
+
+/**
+ * Entry of the words table of the binary inverted index files.
+ *
+ * The posting list of a word is made of the ids of its images, delta-encoded
+ * as varints, followed by the weights of the images.
+ */
+struct InvertedFileEntry {
+	// Weight of the word
+	double weight;
+	// Largest weight of the posting list, used to decode quantized weights
+	float scale;
+	// Number of postings of the word
+	uint32_t numPostings;
+	// Offset in bytes of the posting list from the beginning of the posting lists
+	uint64_t offset;
+};
+
+/**
+ * Buffers where posting lists are decoded when they are not kept in memory.
+ */
+struct PostingListBuffer {
+	std::vector<uint32_t> imageIds;
+	std::vector<float> weights;
+};
+
 class ImageCount {
 
 public:
@@ -152,6 +217,33 @@ public:
 	// Number of database images
 	int m_numDbImages;
 
+protected:
+
+	// Posting lists in structure-of-arrays layout used for scoring, the postings
+	// of word i are at positions [m_postingsOffsets[i], m_postingsOffsets[i + 1])
+	std::vector<size_t> m_postingsOffsets;
+	std::vector<uint32_t> m_postingsImageIds;
+	std::vector<float> m_postingsWeights;
+
+	// Compact posting lists, used instead of the image ids and float weights above
+	// when the weights are quantized: ids take 16 bits if the DB images fit and
+	// weights are quantized relative to the largest weight of their word
+	WeightEncoding m_postingsEncoding;
+	std::vector<uint16_t> m_postingsShortImageIds;
+	std::vector<uint16_t> m_postingsWeights16;
+	std::vector<uint8_t> m_postingsWeights8;
+	std::vector<float> m_postingsScales;
+
+	// Whether the inverted files were released after building the posting lists
+	bool m_frozen;
+
+	// Mapped binary file whose posting lists are decoded on demand, NULL when
+	// the posting lists are held in memory
+	cv::Ptr<MappedFile> m_mappedFile;
+	const InvertedFileEntry* m_mappedWords;
+	const unsigned char* m_mappedPostings;
+	size_t m_mappedPostingsSize;
+
 public:
 
 	/**
@@ -184,19 +276,173 @@ public:
 	void addFeatureToInvertedFile(int wordIdx, uint imgIdx);
 
 	/**
-	 * Saves the inverted index to a file stream.
+	 * Saves the inverted index to a file stream, in binary format with float
+	 * weights if the file name ends with .bin and in YAML format otherwise.
 	 *
 	 * @param filename - The name of the file stream where to save the index
 	 */
 	void save(const std::string& filename) const;
 
 	/**
-	 * Loads the inverted index from a file stream.
+	 * Saves the inverted index in binary format, the image ids of each posting
+	 * list are delta-encoded as varints and the weights stored as given.
+	 *
+	 * @param filename - The name of the file where to save the index
+	 * @param encoding - The encoding of the posting weights
+	 *
+	 * @note The images of every inverted file must be in increasing order
+	 */
+	void saveBinary(const std::string& filename,
+			WeightEncoding encoding = WEIGHTS_FLOAT32) const;
+
+	/**
+	 * Loads the inverted index from a file stream, either in YAML or in binary format.
 	 *
 	 * @param filename - The name of the file stream from where to load the index
 	 */
 	void load(const std::string& filename);
 
+	/**
+	 * Loads the inverted index from a binary file by mapping it into memory.
+	 *
+	 * @param filename - The name of the file from where to load the index
+	 * @param decodeOnDemand - If true the posting lists are kept compressed in the
+	 * 						   mapped file and decoded whenever they are scored,
+	 * 						   otherwise they are all decoded into the inverted files
+	 *
+	 * @note When decoding on demand only the words weights are loaded into the
+	 * 		 inverted files, hence the index can be scored but not modified
+	 */
+	void loadBinary(const std::string& filename, bool decodeOnDemand = false);
+
+	bool isDecodedOnDemand() const {
+		return m_mappedFile.empty() == false;
+	}
+
+	/**
+	 * Copies the inverted files into contiguous arrays of image ids and weights used
+	 * for scoring, validating along the way that the entries are normalized counts
+	 * of existing DB images so that scoring does not need to check them.
+	 *
+	 * @param encoding - The encoding of the weights in memory, quantized weights
+	 * 					 are dequantized while scoring and make image ids compact
+	 *
+	 * @note It must be called again after the inverted files are modified
+	 */
+	void buildPostingLists(WeightEncoding encoding = WEIGHTS_FLOAT32);
+
+	/**
+	 * Builds the posting lists from inverted files of raw counts, leaving the
+	 * inverted files untouched. Each count is multiplied by the weight of its word
+	 * (or replaced by one with binary weighting) and divided by the norm of its image.
+	 *
+	 * @param encoding - The encoding of the weights in memory
+	 * @param imageNorms - The norm of the weighted BoF vector of every DB image
+	 */
+	void buildPostingLists(WeightEncoding encoding,
+			const std::vector<float>& imageNorms);
+
+	/**
+	 * Releases the posting lists, to be called when the inverted files are modified.
+	 */
+	void clearPostingLists();
+
+	bool hasPostingLists() const {
+		return m_postingsOffsets.empty() == false || isDecodedOnDemand();
+	}
+
+	/**
+	 * Builds the posting lists, if not built yet with the given encoding, and
+	 * releases the inverted files, so that the postings are only held in the
+	 * contiguous arrays used for scoring. The words keep their weights.
+	 *
+	 * @param encoding - The encoding of the weights in memory
+	 *
+	 * @note A frozen index can be scored, saved and read through getInvertedFile
+	 * 		 but not modified, clearPostingLists leaves it with empty inverted files
+	 */
+	void freeze(WeightEncoding encoding = WEIGHTS_FLOAT32);
+
+	/**
+	 * @return true if the inverted files are not held in memory, either because
+	 * 		   the index was frozen or because it is decoded on demand
+	 */
+	bool isFrozen() const {
+		return m_frozen || isDecodedOnDemand();
+	}
+
+	/**
+	 * Retrieves the inverted file of a word, from the posting lists if frozen.
+	 *
+	 * @param wordIdx - The id of the word
+	 * @param buffer - Vector where the inverted file is rebuilt when frozen
+	 * @return the inverted file, either that of the word or the buffer
+	 */
+	const std::vector<ImageCount>& getInvertedFile(int wordIdx,
+			std::vector<ImageCount>& buffer) const;
+
+	WeightEncoding getPostingsEncoding() const {
+		return m_postingsEncoding;
+	}
+
+	/**
+	 * @return the number of bytes taken by the posting lists in memory
+	 */
+	size_t getPostingsMemorySize() const;
+
+	/**
+	 * Retrieves the posting list of a word.
+	 *
+	 * @param wordIdx - The id of the word
+	 * @param imageIds - Pointer to the ids of the images in the posting list
+	 * @param weights - Pointer to the weights of the images in the posting list
+	 * @param buffer - Buffers where the posting list is decoded if it is not in
+	 * 				   memory, the pointers are valid until they are reused
+	 * @return the number of postings of the word
+	 *
+	 * @note The word id is not checked and the posting lists must have been built
+	 */
+	size_t getPostingList(int wordIdx, const uint32_t*& imageIds,
+			const float*& weights, PostingListBuffer& buffer) const {
+		if (isDecodedOnDemand() == true) {
+			return decodePostingList(wordIdx, imageIds, weights, buffer);
+		}
+		if (m_postingsEncoding != WEIGHTS_FLOAT32) {
+			return dequantizePostingList(wordIdx, imageIds, weights, buffer);
+		}
+		size_t begin = m_postingsOffsets[wordIdx];
+		imageIds = m_postingsImageIds.data() + begin;
+		weights = m_postingsWeights.data() + begin;
+		return m_postingsOffsets[wordIdx + 1] - begin;
+	}
+
+private:
+
+	/**
+	 * Builds the posting lists, weighting and normalizing the counts if the
+	 * images norms are given.
+	 */
+	void buildPostingLists(WeightEncoding encoding,
+			const std::vector<float>* imageNorms);
+
+	/**
+	 * Decodes the posting list of a word from the mapped file, validating
+	 * the entries as done by buildPostingLists.
+	 */
+	size_t decodePostingList(int wordIdx, const uint32_t*& imageIds,
+			const float*& weights, PostingListBuffer& buffer) const;
+
+	/**
+	 * Expands the compact posting list of a word into image ids and float weights.
+	 */
+	size_t dequantizePostingList(int wordIdx, const uint32_t*& imageIds,
+			const float*& weights, PostingListBuffer& buffer) const;
+
+	/**
+	 * Releases the mapped file.
+	 */
+	void unmap();
+
 };
 
 } /* namespace vlr */
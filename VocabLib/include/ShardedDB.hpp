@@ -0,0 +1,147 @@
+/*
+ * ShardedDB.hpp
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: andresf
+ */
+
+#ifndef SHARDEDDB_HPP_
+#define SHARDEDDB_HPP_
+
+#include <sys/types.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <VocabDB.hpp>
+
+namespace vlr {
+
+/**
+ * Builds the name of the file of a shard by inserting its index before the
+ * extension of the file name of the whole index, e.g. index.yaml.gz gives
+ * index.shard0.yaml.gz for the first shard.
+ *
+ * @param filename - The name of the file of the whole index
+ * @param shardIdx - The index of the shard
+ * @return the name of the file of the shard
+ */
+std::string getShardFilename(const std::string& filename, int shardIdx);
+
+// --------------------------------------------------------------------------
+
+/**
+ * Database whose images are partitioned into shards of consecutive images,
+ * each one held by a worker process in its own inverted index. Queries are
+ * sent as sparse BoF vectors to every worker, which returns its top-k images,
+ * and the results are merged into the global top-k.
+ *
+ * Workers are forked processes connected through Unix sockets. The shards must
+ * have been weighted with the words weights of the whole database (see
+ * VocabDB::computeWordsWeights), so that their scores are comparable.
+ */
+class ShardedDB {
+
+protected:
+
+	// Sockets connected to the workers, one per shard
+	std::vector<int> m_sockets;
+	// Process ids of the workers
+	std::vector<pid_t> m_workers;
+	// Global id of the first image of each shard
+	std::vector<int> m_offsets;
+	// Total number of DB images over all shards
+	int m_numDbImages;
+	// Words weights of the whole database, shared by all the shards
+	std::vector<double> m_wordsWeights;
+
+	// Serializes queries since they share the sockets
+	std::mutex m_mutex;
+
+public:
+
+	/**
+	 * Class constructor.
+	 */
+	ShardedDB();
+
+	/**
+	 * Class destroyer, stops the workers.
+	 */
+	~ShardedDB();
+
+	/**
+	 * Starts a worker process for each shard, which loads the inverted index
+	 * of its shard and waits for queries.
+	 *
+	 * @param shardFilenames - The inverted index file of each shard, in image order
+	 * @param postingsEncoding - The encoding of the posting weights in memory
+	 *
+	 * @note Since workers are forked, it should be called before starting threads
+	 */
+	void start(const std::vector<std::string>& shardFilenames,
+			WeightEncoding postingsEncoding = WEIGHTS_FLOAT32);
+
+	/**
+	 * Stops the workers and waits for them to exit.
+	 */
+	void stop();
+
+	int getNumShards() const {
+		return m_sockets.size();
+	}
+
+	int getNumDbImages() const {
+		return m_numDbImages;
+	}
+
+	/**
+	 * Returns the words weights the shards were weighted with, sent by the
+	 * workers when they start so that queries can be weighted without loading
+	 * any shard (see VocabDB::setWordsWeights).
+	 *
+	 * @return the weight of every word of the vocabulary
+	 */
+	const std::vector<double>& getWordsWeights() const {
+		return m_wordsWeights;
+	}
+
+	/**
+	 * Scores a query BoF vector against the images of every shard and selects
+	 * the images with the highest scores.
+	 *
+	 * @param query - The normalized sparse query BoF vector
+	 * @param k - The number of images to select
+	 * @param distance - Distance used to compare BoF vectors
+	 * @param topImages - Vector where to store the global ids and scores of the
+	 * 					  min(k, n) best images sorted by decreasing score
+	 *
+	 * @note If sending to or receiving from a worker fails, all the workers are
+	 * 		 stopped before throwing, hence later queries throw as well
+	 */
+	void queryTopK(const SparseBoFVector& query, int k,
+			vlr::ScoringType distance, std::vector<vlr::ImageScore>& topImages);
+
+	/**
+	 * Serves the queries of a coordinator over a socket until it is closed,
+	 * this is the loop run by every worker process.
+	 *
+	 * @param socket - The socket connected to the coordinator
+	 * @param shardFilename - The inverted index file of the shard
+	 * @param postingsEncoding - The encoding of the posting weights in memory
+	 */
+	static void serveShard(int socket, const std::string& shardFilename,
+			WeightEncoding postingsEncoding);
+
+private:
+
+	// Disable copying, the workers are owned by a single instance
+	ShardedDB(ShardedDB const&); // Don't Implement
+	void operator=(ShardedDB const&); // Don't implement
+
+};
+
+} /* namespace vlr */
+
+#endif /* SHARDEDDB_HPP_ */
@@ -12,6 +12,10 @@
 #include <InvertedIndex.hpp>
 #include <VocabTree.h>
 #include <IncrementalKMeans.hpp>
+#include <TimingCollector.hpp>
+
+#include <atomic>
+#include <mutex>
 
 namespace vlr {
 
@@ -27,18 +31,98 @@ enum ScoringType {
 	L1, L2, COS
 };
 
+/**
+ * Non-zero entry of a sparse BoF vector.
+ */
+struct BoFEntry {
+
+	// Id of the word
+	int m_wordId;
+
+	// (Weighted, normalized) count of the word
+	float m_weight;
+
+	BoFEntry() :
+			m_wordId(-1), m_weight(0.0f) {
+	}
+
+	BoFEntry(int wordId, float weight) :
+			m_wordId(wordId), m_weight(weight) {
+	}
+
+	bool operator<(const BoFEntry& other) const {
+		return m_wordId < other.m_wordId;
+	}
+
+};
+
+// Sparse BoF vector made of its non-zero entries sorted by word id
+typedef std::vector<BoFEntry> SparseBoFVector;
+
+// Pair of DB image id and score
+typedef std::pair<int, float> ImageScore;
+
+/**
+ * Count of a word in a DB image, produced when quantizing DB images apart from
+ * the inverted index so that several images can be quantized concurrently.
+ */
+struct WordImageCount {
+
+	int m_wordId;
+	uint32_t m_imgIdx;
+	float m_count;
+
+	WordImageCount(int wordId, uint32_t imgIdx, float count) :
+			m_wordId(wordId), m_imgIdx(imgIdx), m_count(count) {
+	}
+
+};
+
 class VocabDB {
 
 protected:
 
 	cv::Ptr<vlr::InvertedIndex> m_invertedIndex;
 
+	// Number of words each query feature votes for, 1 means hard assignment
+	int m_softAssignmentKnn;
+	// Width of the Gaussian weighting the votes, if not positive the
+	// distance to the nearest word is used
+	double m_softAssignmentSigma;
+	// Maximum number of leaves visited and of branches kept for backtracking
+	// when searching the words of a feature (see VocabTreeSearchParams)
+	int m_softAssignmentMaxLeaves;
+	int m_softAssignmentMaxBranches;
+
+	// Encoding of the weights of the posting lists held in memory for scoring
+	vlr::WeightEncoding m_postingsEncoding;
+
+	// Collector of the time taken by each stage of scoring, it may be NULL
+	vlr::TimingCollector* m_timings;
+
+	// Whether the inverted files keep raw counts so that images can be added
+	// and removed, with the words weights and images norms applied lazily
+	bool m_incremental;
+	vlr::WeightingType m_incrementalWeighting;
+	vlr::NormType m_incrementalNorm;
+	// Images removed from the database, indexed by image id
+	std::vector<bool> m_removedImages;
+	// Norms of the weighted DB BoF vectors computed by the last refresh
+	mutable std::vector<float> m_imageNorms;
+	// Whether the words weights and the posting lists are out of date
+	mutable std::atomic<bool> m_stale;
+	mutable std::mutex m_refreshMutex;
+
 public:
 
 	/**
 	 * Class constructor (always called from derived classes).
 	 */
-	VocabDB() {
+	VocabDB() :
+			m_softAssignmentKnn(1), m_softAssignmentSigma(0.0), m_softAssignmentMaxLeaves(
+					1), m_softAssignmentMaxBranches(32), m_postingsEncoding(
+					vlr::WEIGHTS_FLOAT32), m_timings(NULL), m_incremental(false), m_incrementalWeighting(
+					vlr::TF_IDF), m_incrementalNorm(vlr::NORM_L1), m_stale(false) {
 		m_invertedIndex = new vlr::InvertedIndex();
 	}
 
@@ -61,6 +145,105 @@ public:
 	virtual void quantize(const cv::Mat& feature, int& wordId,
 			double& wordWeight) const = 0;
 
+	/**
+	 * Quantizes a set of feature vectors into words and stores the resulting word ids.
+	 *
+	 * @param features - Matrix of feature vectors to quantize, one per row
+	 * @param wordIds - Preallocated array where to store the word id of each feature vector
+	 * @param nodeIds - Preallocated array where to store the direct index node id of each
+	 * 					feature vector, it can be NULL if not needed
+	 *
+	 * @note By default feature vectors are quantized one at a time, derived classes
+	 * 		 override it when the BoF model supports quantizing them all at once.
+	 */
+	virtual void quantize(const cv::Mat& features, int* wordIds,
+			int* nodeIds) const;
+
+	/**
+	 * Quantizes a single feature vector into its closest words.
+	 *
+	 * @param feature - Row vector representing the feature vector to quantize
+	 * @param knn - Maximum number of words to return
+	 * @param wordIds - Vector where to store the ids of the found words,
+	 * 					sorted by increasing distance
+	 * @param distances - Vector where to store the distance from the feature
+	 * 					  vector to each found word
+	 *
+	 * @note By default only the closest word is returned with a null distance,
+	 * 		 derived classes override it when the BoF model supports searching
+	 * 		 several words.
+	 */
+	virtual void quantize(const cv::Mat& feature, int knn,
+			std::vector<int>& wordIds, std::vector<float>& distances) const;
+
+	/**
+	 * Sets up the soft assignment of query features, where each feature votes for its
+	 * knn closest words with a weight given by a Gaussian of the distance to the word.
+	 * The votes of a feature are normalized to add up to one, so that it has the same
+	 * mass as with hard assignment. Only query BoF vectors are affected, the DB BoF
+	 * vectors stored in the inverted index are left as they are.
+	 *
+	 * @param knn - Number of words each feature votes for, 1 disables soft assignment
+	 * @param sigma - Width of the Gaussian, if not positive the distance from each
+	 * 				  feature to its nearest word is used
+	 * @param maxLeaves - Maximum number of leaves visited when searching the words
+	 * 					  of a feature, at least knn, trading cost for recall
+	 * @param maxBranches - Maximum number of unexplored branches kept for backtracking
+	 */
+	void setSoftAssignment(int knn, double sigma = 0.0, int maxLeaves = 0,
+			int maxBranches = 32);
+
+	int getSoftAssignmentKnn() const {
+		return m_softAssignmentKnn;
+	}
+
+	double getSoftAssignmentSigma() const {
+		return m_softAssignmentSigma;
+	}
+
+	int getSoftAssignmentMaxLeaves() const {
+		return m_softAssignmentMaxLeaves;
+	}
+
+	int getSoftAssignmentMaxBranches() const {
+		return m_softAssignmentMaxBranches;
+	}
+
+	/**
+	 * Sets how the weights of the posting lists are held in memory for scoring.
+	 * Quantized weights take 16 or 8 bits relative to the largest weight of each
+	 * word, image ids take 16 bits when the DB images fit, and both are expanded
+	 * while scoring. It applies to posting lists built afterwards, when the inverted
+	 * index is loaded or the database normalized, except when decoded on demand.
+	 *
+	 * @param encoding - The encoding of the weights
+	 */
+	void setPostingsEncoding(vlr::WeightEncoding encoding) {
+		m_postingsEncoding = encoding;
+	}
+
+	vlr::WeightEncoding getPostingsEncoding() const {
+		return m_postingsEncoding;
+	}
+
+	/**
+	 * @return the number of bytes taken by the posting lists used for scoring
+	 */
+	size_t getPostingsMemorySize() const {
+		return m_invertedIndex->getPostingsMemorySize();
+	}
+
+	/**
+	 * Sets where to record the time taken by the quantize, score and select
+	 * stages of every query.
+	 *
+	 * @param timings - The collector, it is not owned by the DB and may be NULL
+	 * 					to stop recording
+	 */
+	void setTimingCollector(vlr::TimingCollector* timings) {
+		m_timings = timings;
+	}
+
 	/**
 	 * Loads the BoF model from a file stream.
 	 *
@@ -76,27 +259,81 @@ public:
 	virtual size_t getNumOfWords() const = 0;
 
 	/**
-	 * Saves the inverted index to a file stream.
+	 * Saves the inverted index to a file stream, in binary format if the file
+	 * name ends with .bin and in YAML format otherwise.
 	 *
 	 * @param filename - The name of the file stream where to save the index
+	 * @param encoding - The encoding of the posting weights in binary format
 	 */
-	void saveInvertedIndex(const std::string& filename) const;
+	void saveInvertedIndex(const std::string& filename,
+			WeightEncoding encoding = WEIGHTS_FLOAT32) const;
 
 	/**
-	 * Loads the inverted index from a file stream.
+	 * Loads the inverted index from a file stream, either in YAML or in binary format,
+	 * and freezes it (see freezeDatabase).
 	 *
 	 * @param filename - The name of the file stream from where to load the index
+	 * @param decodeOnDemand - If true and the file is in binary format, the posting
+	 * 						   lists are kept compressed and decoded when scored
 	 */
-	void loadInvertedIndex(const std::string& filename);
+	void loadInvertedIndex(const std::string& filename,
+			bool decodeOnDemand = false);
 
 	/**
-	 * Quantizes DB image features into the vocabulary and updates the inverted file.
+	 * Releases the inverted files once the database is built, keeping the postings
+	 * only in the contiguous posting lists used for scoring. The database can
+	 * still be scored and saved but no longer modified. Loading an inverted
+	 * index freezes it as well.
+	 */
+	void freezeDatabase();
+
+	/**
+	 * Quantizes DB image features into the vocabulary and updates the inverted file
+	 * and, if the BoF model has one, the direct index.
 	 *
 	 * @param dbImgIdx - The id of the image
 	 * @param dbImgFeatures - Matrix of features representing the image
 	 */
 	void addImageToDatabase(int dbImgIdx, cv::Mat dbImgFeatures);
 
+	/**
+	 * Quantizes DB image features into the vocabulary without modifying the
+	 * inverted index, it can be called concurrently.
+	 *
+	 * @param dbImgIdx - The id of the image
+	 * @param dbImgFeatures - Matrix of features representing the image
+	 * @param counts - Vector where the count of each word of the image is appended,
+	 * 				   sorted by word id
+	 * @param nodeIds - Vector where to store the direct index node id of each
+	 * 					feature, -1 if the BoF model has no direct index. It can be
+	 * 					NULL if not needed
+	 */
+	void quantizeImage(int dbImgIdx, const cv::Mat& dbImgFeatures,
+			std::vector<vlr::WordImageCount>& counts,
+			std::vector<int>* nodeIds = NULL) const;
+
+	/**
+	 * Adds the features of a DB image to the direct index, BoF models without
+	 * direct index ignore it. Images must be added in increasing order of id.
+	 *
+	 * @param dbImgIdx - The id of the image
+	 * @param nodeIds - The direct index node id of each feature, as given by quantizeImage
+	 */
+	virtual void addToDirectIndex(int /*dbImgIdx*/,
+			const std::vector<int>& /*nodeIds*/) {
+	}
+
+	/**
+	 * Adds word counts produced by quantizeImage to the inverted files. Since the
+	 * images of every inverted file are kept in increasing order, the counts must
+	 * be given image after image in increasing order of image id.
+	 *
+	 * @param counts - The counts to add
+	 * @param numImages - The number of DB images the counts belong to
+	 */
+	void addCountsToDatabase(const std::vector<vlr::WordImageCount>& counts,
+			int numImages);
+
 	/**
 	 * Assigns weights to the vocabulary words by applying the chosen
 	 * weighting scheme to the entries on the inverted files.
@@ -105,6 +342,44 @@ public:
 	 */
 	void computeWordsWeights(vlr::WeightingType weighting);
 
+	/**
+	 * Assigns weights to the vocabulary words given the document frequency of
+	 * every word, e.g. gathered over all the shards of a database so that the
+	 * IDF is the same in every shard.
+	 *
+	 * @param weighting - The weighting scheme to apply
+	 * @param frequencies - The number of DB images where each word appears
+	 * @param numDbImages - The total number of DB images
+	 */
+	void computeWordsWeights(vlr::WeightingType weighting,
+			const std::vector<int>& frequencies, int numDbImages);
+
+	/**
+	 * Retrieves the number of DB images where each word appears, i.e. the length
+	 * of its inverted file.
+	 *
+	 * @param frequencies - Vector where to store the frequency of every word
+	 */
+	void getDocumentFrequencies(std::vector<int>& frequencies) const;
+
+	/**
+	 * Loads an inverted index of raw counts, saved before any weighting was
+	 * applied, keeping its inverted files so that the database can be weighted
+	 * and normalized (e.g. a shard built in a first pass).
+	 *
+	 * @param filename - The name of the file stream from where to load the index
+	 */
+	void loadRawCounts(const std::string& filename);
+
+	/**
+	 * Sets the words weights of a database whose images are held and scored
+	 * elsewhere (e.g. by the workers of a ShardedDB), its inverted files are
+	 * left empty so that it is only used to transform queries.
+	 *
+	 * @param weights - The weight of every word of the vocabulary
+	 */
+	void setWordsWeights(const std::vector<double>& weights);
+
 	/**
 	 * Computes the DB BoF vectors by applying the words weights
 	 * to the image counts in the inverted files.
@@ -124,6 +399,52 @@ public:
 	 */
 	void clearDatabase();
 
+	/**
+	 * Switches the database to incremental mode, where the inverted files keep
+	 * the raw counts of the images instead of being weighted and normalized in
+	 * place. Images can then be appended and removed at any time, the words
+	 * weights, the images norms and the posting lists are recomputed from the
+	 * raw counts by refreshDatabase, which scoring calls when they are out of date.
+	 * With TF-IDF weighting, only the images with features count for the IDF.
+	 *
+	 * @param weighting - The weighting scheme applied to the raw counts
+	 * @param norm - Method used to normalize the DB BoF vectors
+	 *
+	 * @note It must be called before any weighting is applied to the inverted
+	 * 		 files, and before loading an inverted index saved in incremental mode
+	 */
+	void setIncremental(vlr::WeightingType weighting, vlr::NormType norm);
+
+	bool isIncremental() const {
+		return m_incremental;
+	}
+
+	/**
+	 * Quantizes the features of a new image and adds them to the inverted files,
+	 * in incremental mode.
+	 *
+	 * @param dbImgFeatures - Matrix of features representing the image
+	 * @return the id given to the image, the number of DB images before adding it
+	 */
+	int appendImage(const cv::Mat& dbImgFeatures);
+
+	/**
+	 * Removes an image from the database, in incremental mode. The id of the image
+	 * is not reused, its postings are dropped on the next refresh and from then
+	 * on it does not match any query.
+	 *
+	 * @param dbImgIdx - The id of the image
+	 */
+	void removeImage(int dbImgIdx);
+
+	/**
+	 * Recomputes the words weights, the images norms and the posting lists from
+	 * the raw counts if images were added or removed since the last refresh, in
+	 * incremental mode. Scoring calls it before reading the posting lists, hence
+	 * queries can still be scored concurrently.
+	 */
+	void refreshDatabase() const;
+
 	/**
 	 * Computes the query BoF vector of an image by quantizing the query image
 	 * features and applying the words weights, followed by efficiently scoring it against
@@ -135,15 +456,83 @@ public:
 	 * @param distance - Distance used to compare BoF vectors
 	 *
 	 * @note DB BoF vectors must be normalized beforehand
+	 * @note The DB is not modified, so several queries can be scored concurrently
 	 */
 	void scoreQuery(const cv::Mat& queryImgFeatures, cv::Mat& scores,
 			vlr::NormType norm, vlr::ScoringType distance) const;
 
 	/**
-	 * Transforms a set of data (representing a single image) into a BoF vector.
+	 * Scores a query like scoreQuery but only retrieves the k DB images with the
+	 * highest scores, the selection costs O(n log k) instead of the O(n log n)
+	 * of sorting all the scores.
+	 *
+	 * @param queryImgFeatures - Matrix containing the features of the query image
+	 * @param k - Number of DB images to retrieve
+	 * @param norm - Method used to normalize BoF vectors
+	 * @param distance - Distance used to compare BoF vectors
+	 * @param topImages - Vector where to store the (image id, score) pairs of the
+	 * 					  min(k, n) best DB images sorted by decreasing score
+	 */
+	void queryTopK(const cv::Mat& queryImgFeatures, int k, vlr::NormType norm,
+			vlr::ScoringType distance,
+			std::vector<vlr::ImageScore>& topImages) const;
+
+	/**
+	 * Selects the k highest scores, ties are resolved in favor of the lowest image id.
+	 *
+	 * @param scores - Array of scores, indexed by DB image id
+	 * @param numScores - Number of scores
+	 * @param k - Number of scores to select
+	 * @param topImages - Vector where to store the (image id, score) pairs of the
+	 * 					  min(k, numScores) highest scores sorted by decreasing score
+	 */
+	static void selectTopK(const float* scores, int numScores, int k,
+			std::vector<vlr::ImageScore>& topImages);
+
+	/**
+	 * Turns the sums accumulated by accumulateScores into scores in the range [0,1],
+	 * higher meaning more similar.
+	 *
+	 * @param scores - Array of accumulated sums, replaced by the scores
+	 * @param numScores - The number of scores
+	 * @param distance - Distance used to compare BoF vectors
+	 */
+	static void completeScores(float* scores, int numScores,
+			vlr::ScoringType distance);
+
+	/**
+	 * Adds to the scores of the DB images the terms of the efficient scoring
+	 * corresponding to the words present in a query BoF vector.
+	 *
+	 * @param invertedIndex - Inverted index whose posting lists have been built
+	 * @param queryBoFVector - Normalized sparse BoF vector of the query
+	 * @param distance - Distance used to compare BoF vectors
+	 * @param scores - Array of size n where n is the number DB images
+	 */
+	static void accumulateScores(const vlr::InvertedIndex& invertedIndex,
+			const vlr::SparseBoFVector& queryBoFVector,
+			vlr::ScoringType distance, float* scores);
+
+	/**
+	 * Transforms a set of data (representing a single image) into a sparse BoF vector,
+	 * each feature votes either for its closest word or, when soft assignment is
+	 * enabled, for its closest words (see setSoftAssignment).
+	 *
+	 * @param featuresVector - Matrix of data to quantize
+	 * @param bofVector - Sparse BoF vector of weighted words
+	 * @param norm - Method used to normalize BoF vectors
+	 *
+	 * @note The cost depends on the number of features, not on the vocabulary size
+	 */
+	void transform(const cv::Mat& featuresVector,
+			vlr::SparseBoFVector& bofVector, vlr::NormType norm) const;
+
+	/**
+	 * Transforms a set of data (representing a single image) into a dense BoF vector.
 	 *
 	 * @param featuresVector - Matrix of data to quantize
-	 * @param bofVector - BoF vector of weighted words
+	 * @param bofVector - Row vector of weighted words of size [1 x n] where n
+	 * 					  is the number of words
 	 * @param norm - Method used to normalize BoF vectors
 	 */
 	void transform(const cv::Mat& featuresVector, cv::Mat& bofVector,
@@ -201,20 +590,49 @@ public:
 	void quantize(const cv::Mat& feature, int& wordId,
 			double& wordWeight) const;
 
-	void loadBoFModel(const std::string& filename);
+	void quantize(const cv::Mat& features, int* wordIds, int* nodeIds) const;
 
-private:
+	void quantize(const cv::Mat& feature, int knn, std::vector<int>& wordIds,
+			std::vector<float>& distances) const;
 
-	size_t getNumOfWords() const;
+	void loadBoFModel(const std::string& filename);
 
-	int getDirectIndexLevel();
+	void addToDirectIndex(int dbImgIdx, const std::vector<int>& nodeIds);
 
-	void setDirectIndexLevel(int levelsUp);
+	int getDirectIndexLevel() const;
 
+	/**
+	 * Direct index getter.
+	 *
+	 * @return smart OpenCV pointer to the direct index, mapping every DB image
+	 * 		   to the nodes its features are assigned to
+	 */
+	const cv::Ptr<vlr::DirectIndex>& getDirectIndex() const {
+		return m_directIndex;
+	}
+
+	/**
+	 * Saves the direct index to a file stream, in binary format if the file
+	 * name ends with .bin and in YAML format otherwise.
+	 *
+	 * @param filename - The name of the file stream where to save the index
+	 */
 	void saveDirectIndex(const std::string& filename) const;
 
+	/**
+	 * Loads the direct index from a file stream, either in YAML or in binary
+	 * format. Its level must match the one set from the BoF model.
+	 *
+	 * @param filename - The name of the file stream from where to load the index
+	 */
 	void loadDirectIndex(const std::string& filename);
 
+private:
+
+	size_t getNumOfWords() const;
+
+	void setDirectIndexLevel(int levelsUp);
+
 };
 
 // --------------------------------------------------------------------------
@@ -224,7 +642,7 @@ class AKMajDB: public VocabDB {
 protected:
 
 	cv::Ptr<KMajority> m_bofModel;
-	cvflann::NNIndex<cvflann::Hamming<uchar> >* m_nnIndex = NULL;
+	cvflann::NNIndex<vlr::Hamming>* m_nnIndex = NULL;
 
 public:
 
@@ -242,6 +660,11 @@ public:
 	void quantize(const cv::Mat& feature, int& wordId,
 			double& wordWeight) const;
 
+	void quantize(const cv::Mat& features, int* wordIds, int* nodeIds) const;
+
+	void quantize(const cv::Mat& feature, int knn, std::vector<int>& wordIds,
+			std::vector<float>& distances) const;
+
 	void loadBoFModel(const std::string& filename);
 
 	size_t getNumOfWords() const;
@@ -273,6 +696,8 @@ public:
 
 	int getFeaturesLength() const;
 
+	using VocabDB::quantize;
+
 	void quantize(const cv::Mat& feature, int& wordId, double& wordWeight) const;
 
 	void loadBoFModel(const std::string& filename);
@@ -46,25 +46,45 @@
 
 #include <CentersChooser.h>
 #include <DirectIndex.hpp>
+#include <DistanceKernels.hpp>
 #include <DynamicMat.hpp>
 #include <FileUtils.hpp>
 #include <FunctionUtils.hpp>
+#include <HammingDistance.hpp>
 #include <InvertedIndex.hpp>
 #include <KMajority.h>
+#include <MappedFile.hpp>
+#include <ThreadPool.hpp>
 #include <VocabBase.hpp>
 
 #include <fstream>
+#include <limits>
 
 namespace vlr {
 
 struct VocabTreeParams: public cvflann::IndexParams {
 	VocabTreeParams(int branching = 10, int depth = 6, int maxIterations = 10,
 			cvflann::flann_centers_init_t centersInitMethod =
-					cvflann::FLANN_CENTERS_RANDOM) {
+					cvflann::FLANN_CENTERS_RANDOM, int numThreads = 1) {
 		(*this)["depth"] = depth;
 		(*this)["branch.factor"] = branching;
 		(*this)["max.iterations"] = maxIterations;
 		(*this)["centers.init.method"] = centersInitMethod;
+		(*this)["num.threads"] = numThreads;
+	}
+};
+
+// --------------------------------------------------------------------------
+
+/**
+ * Parameters of the multi-branch search performed when quantizing into several words.
+ */
+struct VocabTreeSearchParams: public cvflann::IndexParams {
+	VocabTreeSearchParams(int maxLeaves = 1, int maxBranches = 32) {
+		// Maximum number of leaves visited, 1 means a greedy descent
+		(*this)["max.leaves"] = maxLeaves;
+		// Maximum number of unexplored branches kept for backtracking
+		(*this)["max.branches"] = maxBranches;
 	}
 };
 
@@ -84,6 +104,13 @@ public:
 	virtual void quantize(const cv::Mat& feature, int diLevel, int& wordId,
 			int& nodeAtL) const = 0;
 
+	virtual void quantize(const cv::Mat& features, int diLevel, int* wordIds,
+			int* nodesAtL) const = 0;
+
+	virtual void quantize(const cv::Mat& feature, int knn,
+			const cvflann::IndexParams& searchParams, std::vector<int>& wordIds,
+			std::vector<float>& distances) const = 0;
+
 	virtual void save(const std::string& filename) const = 0;
 
 	virtual void load(const std::string& filename) = 0;
@@ -122,6 +149,27 @@ struct VocabTreeNode {
 
 // --------------------------------------------------------------------------
 
+/**
+ * Structure representing a node in the flattened (frozen) vocabulary tree.
+ *
+ * @note The children of a node are stored contiguously in the nodes table, hence
+ * 		 they are addressed by the index of the first one, the same index
+ * 		 addresses the row holding the node center in the centers buffer.
+ */
+struct VocabTreeFlatNode {
+	// The node id
+	int node_id;
+	// Word id (only for terminal nodes, -1 otherwise)
+	int word_id;
+	// Index of the first child in the nodes table (-1 for terminal nodes)
+	int first_child;
+	VocabTreeFlatNode() :
+			node_id(-1), word_id(-1), first_child(-1) {
+	}
+};
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class Distance>
 class VocabTree: public VocabTreeBase {
 
@@ -130,6 +178,18 @@ private:
 	typedef typename Distance::ResultType DistanceType;
 	typedef VocabTreeNode<TDescriptor>* VocabTreeNodePtr;
 
+	// Alignment in bytes of the buffer holding the nodes centers
+	static const size_t CENTERS_ALIGNMENT = 64;
+
+	// Minimum number of descriptors of a node for assigning them and
+	// accumulating them into the centroids in parallel
+	static const int PARALLEL_MIN_SIZE = 10000;
+	// Number of descriptors assigned per parallel task
+	static const int PARALLEL_ASSIGNMENT_CHUNK_SIZE = 1000;
+	// Number of partial accumulators used for computing the centroids of big nodes,
+	// it doesn't depend on the number of threads so the result doesn't either
+	static const int ACCUMULATION_BLOCKS = 64;
+
 protected:
 
 	/** Attributes useful for building the tree **/
@@ -139,6 +199,11 @@ protected:
 	int m_iterations;
 	// The data set used by this index
 	vlr::Mat& m_dataset;
+	// Number of threads used for building the tree, 1 means a serial build
+	// and a non-positive value means one per hardware thread
+	int m_numThreads;
+	// Pool running the clustering of subtrees (only while building in parallel)
+	cv::Ptr<ThreadPool> m_threadPool;
 
 	/** Attributes of the tree **/
 	// Branching factor (number of partitions in which
@@ -150,10 +215,20 @@ protected:
 	size_t m_veclen;
 	// Number of nodes in the tree
 	size_t m_size;
-	// The root node of the tree
+	// Number of words (leaf nodes) in the tree
+	size_t m_numWords;
+	// The root node of the tree (only while building, released once frozen)
 	VocabTreeNodePtr m_root;
-	// Words of the vocabulary
-	std::vector<VocabTreeNodePtr> m_words;
+	// Table of nodes of the frozen tree, the root is stored at position 0
+	const VocabTreeFlatNode* m_nodes;
+	// Storage backing the nodes table (unless the tree is memory mapped)
+	std::vector<VocabTreeFlatNode> m_nodesData;
+	// Centers of the frozen tree nodes, i-th row is the center of the i-th node
+	cv::Mat m_centers;
+	// Aligned storage backing the centers matrix (unless the tree is memory mapped)
+	cv::Mat m_centersData;
+	// Binary file backing the nodes table and the centers when loaded from it
+	cv::Ptr<MappedFile> m_mappedFile;
 
 	/** Other attributes **/
 	// The distance measure used to evaluate similarity between features
@@ -178,8 +253,11 @@ public:
 	/**
 	 * Builds the tree.
 	 *
-	 * @note After this method is executed m_root holds a pointer to the tree,
-	 *		 while m_words holds pointers to the leaf nodes.
+	 * @note After this method is executed the tree is stored in its flattened form,
+	 * 		 i.e. m_nodes holds the nodes table while m_centers holds the centers.
+	 * @note Every node draws its random choices from a generator seeded from the seed
+	 * 		 of its parent, and node and word ids are assigned once the clustering is
+	 * 		 done, hence a parallel build yields the same tree as a serial one.
 	 * @note Interior nodes have only 'center' and 'children' information,
 	 * 		 while leaf nodes have only 'center' and 'word_id', all weights for
 	 * 		 interior nodes are 0 while weights for leaf nodes are 1.
@@ -189,9 +267,43 @@ public:
 	void quantize(const cv::Mat& feature, int diLevel, int& wordId,
 			int& nodeAtL) const;
 
+	/**
+	 * Quantizes a set of feature vectors by descending the tree with all of them at once,
+	 * descriptors reaching the same node are grouped so that the centers of its children
+	 * are scanned once per group.
+	 *
+	 * @param features - Matrix of feature vectors, one per row
+	 * @param diLevel - The direct index level
+	 * @param wordIds - Preallocated array where to store the word id of each feature vector
+	 * @param nodesAtL - Preallocated array where to store the id of the node at the direct
+	 * 					 index level of each feature vector, it can be NULL if not needed
+	 */
+	void quantize(const cv::Mat& features, int diLevel, int* wordIds,
+			int* nodesAtL) const;
+
+	/**
+	 * Quantizes a feature vector into its closest words by a best-bin-first search,
+	 * i.e. after the greedy descent the search backtracks to the closest unexplored
+	 * branches until the maximum number of leaves is visited.
+	 *
+	 * @param feature - Row vector representing the feature vector to quantize
+	 * @param knn - Maximum number of words to return
+	 * @param searchParams - Parameters of the search (see VocabTreeSearchParams)
+	 * @param wordIds - Vector where to store the ids of the closest visited words,
+	 * 					sorted by increasing distance
+	 * @param distances - Vector where to store the distance from the feature vector
+	 * 					  to the center of each word
+	 */
+	void quantize(const cv::Mat& feature, int knn,
+			const cvflann::IndexParams& searchParams, std::vector<int>& wordIds,
+			std::vector<float>& distances) const;
+
 	/**
 	 * Saves the tree to a file stream.
 	 *
+	 * @note If the file name has the .bin extension the tree is saved in binary format,
+	 * 		 otherwise it is saved as gzip-compressed YAML.
+	 *
 	 * @param filename - The name of the file stream where to save the tree
 	 */
 	void save(const std::string& filename) const;
@@ -199,6 +311,9 @@ public:
 	/**
 	 * Loads the tree from a file stream.
 	 *
+	 * @note Binary files are recognized by their signature and memory mapped,
+	 * 		 i.e. the nodes table and the centers are used in place without parsing.
+	 *
 	 * @param filename - The name of the file stream from where to load the tree
 	 */
 	void load(const std::string& filename);
@@ -212,7 +327,7 @@ public:
 	}
 
 	size_t getNumWords() const {
-		return m_words.size();
+		return m_numWords;
 	}
 
 	bool operator==(const VocabTree<TDescriptor, Distance> &other) const;
@@ -220,8 +335,12 @@ public:
 	bool operator!=(const VocabTree<TDescriptor, Distance> &other) const;
 
 	/**** Getters ****/
-	VocabTreeNodePtr getRoot() const {
-		return m_root;
+	const VocabTreeFlatNode& getNode(size_t nodeIdx) const {
+		return m_nodes[nodeIdx];
+	}
+
+	const TDescriptor* getCenter(size_t nodeIdx) const {
+		return m_centers.ptr<TDescriptor>(nodeIdx);
 	}
 
 	int getBranching() const {
@@ -248,29 +367,134 @@ private:
 	/**
 	 * The method responsible with actually doing the recursive hierarchical clustering.
 	 *
+	 * @note When building in parallel the clustering of the children is submitted
+	 * 		 to the thread pool instead of being run by the calling thread.
+	 *
 	 * @param node - The node to cluster
 	 * @param indices - Indices of the points belonging to the current node
 	 * @param indices_length
+	 * @param level - The level of the node
+	 * @param fitted
+	 * @param seed - The seed for the random choices made while clustering the node
 	 */
 	void computeClustering(VocabTreeNodePtr node, int* indices,
-			int indices_length, int level, bool fitted);
+			int indices_length, int level, bool fitted, uint64 seed);
+
+	/**
+	 * Assigns each descriptor of a node to its closest center, in parallel
+	 * if the node is big enough and the tree is built in parallel.
+	 *
+	 * @param indices - Indices of the descriptors to assign
+	 * @param indices_length - Number of descriptors to assign
+	 * @param dcenters - Matrix of centers, one per row
+	 * @param closest - Vector where to store the position of the closest center
+	 * @param distances - Vector where to store the distance to the closest center
+	 */
+	void assignToCenters(const int* indices, int indices_length,
+			const cv::Mat& dcenters, std::vector<int>& closest,
+			std::vector<DistanceType>& distances);
+
+	/**
+	 * Computes the centroids of the clusters of a node given the assignment of its
+	 * descriptors, i.e. the bitwise majority for binary descriptors and the mean
+	 * for real valued ones.
+	 *
+	 * @note Big nodes are split into a fixed number of blocks accumulated separately
+	 * 		 (in parallel if the tree is built in parallel) and reduced in block order.
+	 *
+	 * @param indices - Indices of the descriptors of the node
+	 * @param indices_length - Number of descriptors of the node
+	 * @param belongs_to - Position of the cluster each descriptor belongs to
+	 * @param count - Number of descriptors of each cluster
+	 * @param dcenters - Matrix where to store the centroids, one per row
+	 */
+	void computeCentroids(const int* indices, int indices_length,
+			const std::vector<int>& belongs_to, const std::vector<int>& count,
+			cv::Mat& dcenters);
+
+	/**
+	 * Adds a range of the descriptors of a node to the accumulators of their clusters,
+	 * bit counts for binary descriptors and sums for real valued ones.
+	 *
+	 * @param indices - Indices of the descriptors of the node
+	 * @param begin - First position of the range
+	 * @param end - One past the last position of the range
+	 * @param belongs_to - Position of the cluster each descriptor belongs to
+	 * @param accumulators - Matrix of accumulators, one per row
+	 */
+	void accumulate(const int* indices, int begin, int end,
+			const std::vector<int>& belongs_to, cv::Mat& accumulators);
+
+	/**
+	 * Derives the seed of a child node from the seed of its parent.
+	 *
+	 * @param seed - The seed of the parent node
+	 * @param childIdx - The position of the child among its siblings
+	 * @return the seed of the child
+	 */
+	static uint64 childSeed(uint64 seed, int childIdx);
+
+	/**
+	 * Recursively assigns node ids in depth-first order and word ids
+	 * to the leaves in the same order.
+	 *
+	 * @param node - The node where to start the assignment
+	 */
+	void assignIds(VocabTreeNodePtr node);
+
+	/**
+	 * Allocates the aligned buffer holding the centers of the frozen tree.
+	 *
+	 * @param numNodes - The number of nodes of the tree
+	 */
+	void allocateCenters(size_t numNodes);
+
+	/**
+	 * Converts the tree built by computeClustering into its flattened form
+	 * and releases the memory used by the pointer-based tree.
+	 */
+	void freeze();
+
+	/**
+	 * Recursively copies the children of a node of the pointer-based tree
+	 * into a contiguous block of the nodes table.
+	 *
+	 * @param node - The node whose children are copied
+	 * @param nodeIdx - The position of the node in the nodes table
+	 */
+	void freeze_children(VocabTreeNodePtr node, int nodeIdx);
 
 	/**
 	 * Saves the vocabulary tree starting at a given node to a stream.
 	 *
 	 * @param fs - A reference to the file storage pointing to the file where to save the tree
-	 * @param node - The node indicating the root of the tree to save
+	 * @param nodeIdx - The position in the nodes table of the root of the tree to save
+	 */
+	void save_tree(cv::FileStorage& fs, int nodeIdx) const;
+
+	/**
+	 * Saves the flattened tree in binary format, i.e. a header followed
+	 * by the nodes table and the cache line aligned centers.
+	 *
+	 * @param filename - The name of the file where to save the tree
+	 */
+	void saveBinary(const std::string& filename) const;
+
+	/**
+	 * Maps a tree saved in binary format.
+	 *
+	 * @param filename - The name of the file from where to load the tree
 	 */
-	void save_tree(cv::FileStorage& fs, VocabTreeNodePtr node) const;
+	void loadBinary(const std::string& filename);
 
 	/**
-	 * Loads the vocabulary tree from a stream and stores into into a given node pointer.
+	 * Loads the vocabulary tree from a stream and stores it starting
+	 * at a given position of the nodes table.
 	 *
 	 * @param filename - A reference to the file storage where to read node parameters
-	 * @param node - The node where to store the loaded tree
+	 * @param nodeIdx - The position in the nodes table where to store the loaded tree
 	 */
-	void load_tree(boost::iostreams::filtering_istream& is,
-			VocabTreeNodePtr& node);
+	void load_tree(boost::iostreams::filtering_istream& is, int nodeIdx);
 
 	/**
 	 * Returns whether the tree is empty.
@@ -280,12 +504,15 @@ private:
 	bool empty() const;
 
 	/**
+	 * Recursively compares two subtrees given by their positions in the nodes table.
 	 *
-	 * @param a
-	 * @param b
-	 * @return
+	 * @param a - The position of the root of the subtree in this tree
+	 * @param other - The tree to compare against
+	 * @param b - The position of the root of the subtree in the other tree
+	 * @return true if and only if both subtrees have the same structure and centers
 	 */
-	bool compareEqual(const VocabTreeNodePtr a, const VocabTreeNodePtr b) const;
+	bool compareEqual(int a, const VocabTree<TDescriptor, Distance>& other,
+			int b) const;
 
 	/**
 	 * Copy constructor and the assignment operator are private
@@ -299,15 +526,15 @@ private:
 // --------------------------------------------------------------------------
 
 typedef VocabTree<float, cv::L2<float> > VocabTreeReal;
-typedef VocabTree<uchar, cv::Hamming> VocabTreeBin;
+typedef VocabTree<uchar, vlr::Hamming> VocabTreeBin;
 
 // --------------------------------------------------------------------------
 
 template<class TDescriptor, class Distance>
 VocabTree<TDescriptor, Distance>::VocabTree(vlr::Mat& inputData,
 		const cvflann::IndexParams& params) :
-		m_dataset(inputData), m_veclen(0), m_size(0), m_root(NULL), m_distance(
-				Distance()) {
+		m_dataset(inputData), m_veclen(0), m_size(0), m_numWords(0), m_root(
+				NULL), m_nodes(NULL), m_distance(Distance()) {
 
 	// Attributes initialization
 	m_veclen = m_dataset.cols;
@@ -316,6 +543,7 @@ VocabTree<TDescriptor, Distance>::VocabTree(vlr::Mat& inputData,
 	m_depth = cvflann::get_param<int>(params, "depth");
 	m_centers_init = cvflann::get_param<cvflann::flann_centers_init_t>(params,
 			"centers.init.method");
+	m_numThreads = cvflann::get_param<int>(params, "num.threads", 1);
 
 	if (m_iterations < 0) {
 		m_iterations = std::numeric_limits<int>::max();
@@ -375,21 +603,152 @@ void VocabTree<TDescriptor, Distance>::build() {
 		indices[i] = i;
 	}
 
+	m_size = 0;
+	m_numWords = 0;
+
 	m_root = new VocabTreeNode<TDescriptor>();
 	m_root->center = new TDescriptor[m_veclen];
 	std::fill(m_root->center, m_root->center + m_veclen, 0);
 
+#if SEEDRANDOM
+	// Seeding random number generator
+	cvflann::seed_random(unsigned(std::time(0)));
+#endif
+
+	// Seed of the root, the seeds of the other nodes are derived from it
+	uint64 seed = uint64(cvflann::rand_int());
+
+	if (m_numThreads != 1) {
+		m_threadPool = new ThreadPool(m_numThreads);
+	}
+
 #if VTREEVERBOSE
-	printf("[VocabTree::build] Started clustering\n");
+	printf("[VocabTree::build] Started clustering using [%d] threads\n",
+			m_threadPool.empty() ? 1 : m_threadPool->getNumThreads());
 #endif
 
-	computeClustering(m_root, indices, size, 0, false);
+	try {
+		computeClustering(m_root, indices, size, 0, false, seed);
+		if (m_threadPool.empty() == false) {
+			m_threadPool->wait();
+		}
+	} catch (...) {
+		// Subtrees still being clustered reference the indices
+		if (m_threadPool.empty() == false) {
+			m_threadPool.release();
+		}
+		delete[] indices;
+		free_centers(m_root);
+		m_root = NULL;
+		throw;
+	}
+
+	m_threadPool.release();
 
 #if VTREEVERBOSE
 	printf("[VocabTree::build] Finished clustering\n");
 #endif
 
 	delete[] indices;
+
+	assignIds(m_root);
+
+	freeze();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class Distance>
+void VocabTree<TDescriptor, Distance>::allocateCenters(size_t numNodes) {
+	size_t rowSize = m_veclen * sizeof(TDescriptor);
+	m_centersData.create(1, numNodes * rowSize + CENTERS_ALIGNMENT, CV_8U);
+	m_centers = cv::Mat(numNodes, m_veclen, cv::DataType<TDescriptor>::type,
+			cv::alignPtr(m_centersData.data, CENTERS_ALIGNMENT));
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class Distance>
+void VocabTree<TDescriptor, Distance>::freeze() {
+
+	m_mappedFile.release();
+	m_nodesData.clear();
+	m_nodesData.reserve(m_size);
+	allocateCenters(m_size);
+
+	// Root goes first, then the children of every node are laid out
+	// contiguously in depth-first order so that each descent step
+	// scans a single block of centers
+	m_nodesData.push_back(VocabTreeFlatNode());
+	m_nodesData[0].node_id = m_root->node_id;
+	m_nodesData[0].word_id = m_root->word_id;
+	std::copy(m_root->center, m_root->center + m_veclen,
+			m_centers.ptr<TDescriptor>(0));
+
+	freeze_children(m_root, 0);
+
+	CV_Assert(m_nodesData.size() == m_size);
+	m_nodes = m_nodesData.data();
+
+	free_centers(m_root);
+	m_root = NULL;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class Distance>
+void VocabTree<TDescriptor, Distance>::freeze_children(VocabTreeNodePtr node,
+		int nodeIdx) {
+
+	if (node->children == NULL) {
+		return;
+	}
+
+	int firstChild = m_nodesData.size();
+	m_nodesData[nodeIdx].first_child = firstChild;
+	m_nodesData.resize(firstChild + m_branching);
+
+	for (int c = 0; c < m_branching; ++c) {
+		VocabTreeNodePtr child = node->children[c];
+		m_nodesData[firstChild + c].node_id = child->node_id;
+		m_nodesData[firstChild + c].word_id = child->word_id;
+		std::copy(child->center, child->center + m_veclen,
+				m_centers.ptr<TDescriptor>(firstChild + c));
+	}
+
+	for (int c = 0; c < m_branching; ++c) {
+		freeze_children(node->children[c], firstChild + c);
+	}
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class Distance>
+void VocabTree<TDescriptor, Distance>::assignIds(VocabTreeNodePtr node) {
+
+	node->node_id = m_size;
+	++m_size;
+
+	if (node->children == NULL) {
+		node->word_id = m_numWords;
+		++m_numWords;
+		return;
+	}
+
+	for (int c = 0; c < m_branching; ++c) {
+		assignIds(node->children[c]);
+	}
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class Distance>
+uint64 VocabTree<TDescriptor, Distance>::childSeed(uint64 seed, int childIdx) {
+	// SplitMix64 finalizer over the parent seed and the child position
+	uint64 z = seed + (uint64(childIdx) + 1) * 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
 }
 
 // --------------------------------------------------------------------------
@@ -400,36 +759,260 @@ void VocabTree<TDescriptor, Distance>::quantize(const cv::Mat& feature,
 
 	CV_Assert(0 <= diLevel && diLevel < m_depth);
 
-	VocabTreeNodePtr best_node = m_root;
+	const TDescriptor* query = feature.ptr<TDescriptor>(0);
+
+	// Start at the root
+	int nodeIdx = 0;
+	nodeAtL = -1;
 
 	int level = 0;
 
-	while (best_node->children != NULL) {
+	while (m_nodes[nodeIdx].first_child != -1) {
+
+		int firstChild = m_nodes[nodeIdx].first_child;
+
+		// Centers of all the children are contiguous
+		const TDescriptor* centers = m_centers.ptr<TDescriptor>(firstChild);
+
+		// Distances to all the children computed at once
+		DistanceType best_distance;
+		int best = DistanceKernels<TDescriptor, Distance>::argmin(m_distance,
+				query, centers, m_branching, m_veclen, best_distance);
+
+		nodeIdx = firstChild + best;
+
+		if (level == diLevel) {
+			nodeAtL = m_nodes[nodeIdx].node_id;
+		}
+
+		++level;
+	}
+
+	// Branch ended above the direct index level
+	if (nodeAtL == -1) {
+		nodeAtL = m_nodes[nodeIdx].node_id;
+	}
+
+	wordId = m_nodes[nodeIdx].word_id;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class Distance>
+void VocabTree<TDescriptor, Distance>::quantize(const cv::Mat& features,
+		int diLevel, int* wordIds, int* nodesAtL) const {
+
+	CV_Assert(0 <= diLevel && diLevel < m_depth);
+
+	if (features.rows == 0) {
+		return;
+	}
+
+	CV_Assert(features.type() == cv::DataType<TDescriptor>::type);
+	CV_Assert(features.cols == int(m_veclen));
+
+	// Range of positions in the order array of the descriptors reaching a node
+	struct NodeRange {
+		int nodeIdx;
+		int level;
+		int begin;
+		int end;
+	};
+
+	int n = features.rows;
+
+	// Descriptors indices ordered so that the ones reaching
+	// the same node occupy a contiguous range
+	std::vector<int> order(n);
+	for (int i = 0; i < n; ++i) {
+		order[i] = i;
+	}
+	std::vector<int> reordered(n);
+
+	// Closest child of each descriptor, indexed by position in the order array
+	std::vector<int> closest(n);
+
+	// Start of the range of each child
+	std::vector<int> childStart(m_branching + 1);
 
-		VocabTreeNodePtr node = best_node;
+	if (nodesAtL != NULL) {
+		std::fill(nodesAtL, nodesAtL + n, -1);
+	}
+
+	std::vector<NodeRange> pending;
+	NodeRange root = { 0, 0, 0, n };
+	pending.push_back(root);
+
+	while (pending.empty() == false) {
 
-		// Arbitrarily assign to first child
-		best_node = node->children[0];
-		DistanceType best_distance = m_distance((TDescriptor*) feature.data,
-				best_node->center, m_veclen);
+		NodeRange range = pending.back();
+		pending.pop_back();
 
-		// Looking for a better child
-		for (int j = 1; j < m_branching; ++j) {
-			DistanceType d = m_distance((TDescriptor*) feature.data,
-					node->children[j]->center, m_veclen);
-			if (d < best_distance) {
-				best_distance = d;
-				best_node = node->children[j];
-				if (level == diLevel) {
-					nodeAtL = j;
+		const VocabTreeFlatNode& node = m_nodes[range.nodeIdx];
+
+		if (node.first_child == -1) {
+			for (int i = range.begin; i < range.end; ++i) {
+				wordIds[order[i]] = node.word_id;
+				// Branch ended above the direct index level
+				if (nodesAtL != NULL && nodesAtL[order[i]] == -1) {
+					nodesAtL[order[i]] = node.node_id;
 				}
 			}
+			continue;
 		}
 
-		++level;
+		// Centers of all the children are contiguous
+		const TDescriptor* centers = m_centers.ptr<TDescriptor>(
+				node.first_child);
+
+		std::fill(childStart.begin(), childStart.end(), 0);
+
+		for (int i = range.begin; i < range.end; ++i) {
+			const TDescriptor* query = features.ptr<TDescriptor>(order[i]);
+
+			// Distances to all the children computed at once
+			DistanceType best_distance;
+			closest[i] = DistanceKernels<TDescriptor, Distance>::argmin(
+					m_distance, query, centers, m_branching, m_veclen,
+					best_distance);
+			++childStart[closest[i] + 1];
+		}
+
+		// Group descriptors by closest child preserving their relative order
+		for (int j = 0; j < m_branching; ++j) {
+			childStart[j + 1] += childStart[j];
+		}
+		for (int i = range.begin; i < range.end; ++i) {
+			reordered[range.begin + childStart[closest[i]]++] = order[i];
+		}
+		std::copy(reordered.begin() + range.begin,
+				reordered.begin() + range.end, order.begin() + range.begin);
+
+		// After grouping childStart[j] holds the end of the j-th child range
+		int begin = range.begin;
+		for (int j = 0; j < m_branching; ++j) {
+			int end = range.begin + childStart[j];
+
+			if (nodesAtL != NULL && range.level == diLevel) {
+				for (int i = begin; i < end; ++i) {
+					nodesAtL[order[i]] = m_nodes[node.first_child + j].node_id;
+				}
+			}
+
+			if (end > begin) {
+				NodeRange child = { node.first_child + j, range.level + 1, begin,
+						end };
+				pending.push_back(child);
+			}
+
+			begin = end;
+		}
 	}
+}
+
+// --------------------------------------------------------------------------
 
-	wordId = best_node->word_id;
+template<class TDescriptor, class Distance>
+void VocabTree<TDescriptor, Distance>::quantize(const cv::Mat& feature,
+		int knn, const cvflann::IndexParams& searchParams,
+		std::vector<int>& wordIds, std::vector<float>& distances) const {
+
+	CV_Assert(feature.type() == cv::DataType<TDescriptor>::type);
+	CV_Assert(feature.rows == 1 && feature.cols == int(m_veclen));
+	CV_Assert(knn > 0);
+
+	int maxLeaves = cvflann::get_param<int>(searchParams, "max.leaves", 1);
+	int maxBranches = cvflann::get_param<int>(searchParams, "max.branches",
+			32);
+
+	const TDescriptor* query = feature.ptr<TDescriptor>(0);
+
+	// Candidate to explore or result, the node distance is
+	// the distance from the query to the node center
+	struct Candidate {
+		DistanceType distance;
+		int nodeIdx;
+		bool operator<(const Candidate& other) const {
+			return distance < other.distance;
+		}
+	};
+
+	// Both sets are kept sorted by increasing distance and bounded,
+	// the farthest entry is dropped on overflow
+	std::vector<Candidate> branches;
+	std::vector<Candidate> leaves;
+	branches.reserve(maxBranches + 1);
+	leaves.reserve(knn + 1);
+
+	std::vector<DistanceType> childrenDistances(m_branching);
+
+	Candidate start;
+	start.nodeIdx = 0;
+	start.distance = m_distance(query, m_centers.ptr<TDescriptor>(0),
+			m_veclen);
+
+	int visitedLeaves = 0;
+
+	while (true) {
+
+		// Greedy descent from the start node keeping the siblings as branches
+		Candidate current = start;
+		while (m_nodes[current.nodeIdx].first_child != -1) {
+			int firstChild = m_nodes[current.nodeIdx].first_child;
+
+			DistanceKernels<TDescriptor, Distance>::distances(m_distance, query,
+					m_centers.ptr<TDescriptor>(firstChild), m_branching,
+					m_veclen, childrenDistances.data());
+
+			int best = 0;
+			for (int j = 1; j < m_branching; ++j) {
+				if (childrenDistances[j] < childrenDistances[best]) {
+					best = j;
+				}
+			}
+
+			for (int j = 0; j < m_branching && maxLeaves > 1; ++j) {
+				if (j == best) {
+					continue;
+				}
+				Candidate branch;
+				branch.distance = childrenDistances[j];
+				branch.nodeIdx = firstChild + j;
+				branches.insert(
+						std::upper_bound(branches.begin(), branches.end(),
+								branch), branch);
+				if (int(branches.size()) > maxBranches) {
+					branches.pop_back();
+				}
+			}
+
+			current.nodeIdx = firstChild + best;
+			current.distance = childrenDistances[best];
+		}
+
+		// Leaf reached
+		leaves.insert(std::upper_bound(leaves.begin(), leaves.end(), current),
+				current);
+		if (int(leaves.size()) > knn) {
+			leaves.pop_back();
+		}
+		++visitedLeaves;
+
+		if (visitedLeaves >= maxLeaves || branches.empty()) {
+			break;
+		}
+
+		// Backtrack to the closest unexplored branch
+		start = branches.front();
+		branches.erase(branches.begin());
+	}
+
+	wordIds.resize(leaves.size());
+	distances.resize(leaves.size());
+	for (size_t i = 0; i < leaves.size(); ++i) {
+		wordIds[i] = m_nodes[leaves[i].nodeIdx].word_id;
+		distances[i] = float(leaves[i].distance);
+	}
 }
 
 // --------------------------------------------------------------------------
@@ -441,6 +1024,12 @@ void VocabTree<TDescriptor, Distance>::save(const std::string& filename) const {
 		throw std::runtime_error("[VocabTree::save] Tree is empty");
 	}
 
+	if (filename.size() >= 4
+			&& filename.compare(filename.size() - 4, 4, ".bin") == 0) {
+		saveBinary(filename);
+		return;
+	}
+
 	cv::FileStorage fs(filename.c_str(), cv::FileStorage::WRITE);
 
 	if (fs.isOpened() == false) {
@@ -462,7 +1051,7 @@ void VocabTree<TDescriptor, Distance>::save(const std::string& filename) const {
 
 	fs << "nodes" << "[";
 
-	save_tree(fs, m_root);
+	save_tree(fs, 0);
 
 	fs << "]";
 
@@ -473,24 +1062,178 @@ void VocabTree<TDescriptor, Distance>::save(const std::string& filename) const {
 
 template<class TDescriptor, class Distance>
 void VocabTree<TDescriptor, Distance>::save_tree(cv::FileStorage& fs,
-		VocabTreeNodePtr node) const {
+		int nodeIdx) const {
+
+	const VocabTreeFlatNode& node = m_nodes[nodeIdx];
 
 	// Save node
 	fs << "{";
-	fs << "center"
-			<< cv::Mat(1, m_veclen, cv::DataType<TDescriptor>::type,
-					(uchar*) node->center);
-	fs << "nodeId" << node->node_id;
-	fs << "wordId" << node->word_id;
+	fs << "center" << m_centers.row(nodeIdx);
+	fs << "nodeId" << node.node_id;
+	fs << "wordId" << node.word_id;
 	fs << "}";
 
 	// Save children, if any
-	if (node->children != NULL) {
+	if (node.first_child != -1) {
 		for (int i = 0; i < m_branching; ++i) {
-			save_tree(fs, node->children[i]);
+			save_tree(fs, node.first_child + i);
+		}
+	}
+
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class Distance>
+void VocabTree<TDescriptor, Distance>::saveBinary(
+		const std::string& filename) const {
+
+	VocabFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, VOCAB_FILE_MAGIC, sizeof(VOCAB_FILE_MAGIC));
+	header.version = VOCAB_FILE_VERSION;
+	header.descriptorType = cv::DataType<TDescriptor>::type;
+	strncpy(header.vocabType,
+			typeid(TDescriptor) == typeid(float) ? "HKM" :
+			typeid(TDescriptor) == typeid(uchar) ? "HKMAJ" : "UNKNOWN",
+			sizeof(header.vocabType) - 1);
+	header.iterations = m_iterations;
+	header.branching = m_branching;
+	header.depth = m_depth;
+	header.nodeSize = sizeof(VocabTreeFlatNode);
+	header.vectorLength = m_veclen;
+	header.size = m_size;
+	header.numWords = m_numWords;
+	header.nodesOffset = sizeof(header);
+	header.centersOffset = cv::alignSize(
+			header.nodesOffset + m_size * sizeof(VocabTreeFlatNode),
+			CENTERS_ALIGNMENT);
+
+	std::ofstream outputFileStream(filename.c_str(),
+			std::fstream::out | std::fstream::binary);
+
+	if (outputFileStream.good() == false) {
+		throw std::runtime_error("[VocabTree::saveBinary] "
+				"Unable to open file [" + filename + "] for writing");
+	}
+
+	outputFileStream.write((const char*) &header, sizeof(header));
+	outputFileStream.write((const char*) m_nodes,
+			m_size * sizeof(VocabTreeFlatNode));
+
+	// Padding so that centers are aligned once mapped
+	std::vector<char> padding(
+			header.centersOffset - header.nodesOffset
+					- m_size * sizeof(VocabTreeFlatNode), 0);
+	outputFileStream.write(padding.data(), padding.size());
+
+	// Rows of the centers matrix are contiguous
+	outputFileStream.write((const char*) m_centers.data,
+			m_size * m_veclen * sizeof(TDescriptor));
+
+	if (outputFileStream.good() == false) {
+		throw std::runtime_error("[VocabTree::saveBinary] "
+				"Got error while writing file [" + filename + "]");
+	}
+
+	outputFileStream.close();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class Distance>
+void VocabTree<TDescriptor, Distance>::loadBinary(const std::string& filename) {
+
+	cv::Ptr<MappedFile> mappedFile = new MappedFile(filename);
+
+	if (mappedFile->size() < sizeof(VocabFileHeader)) {
+		throw std::runtime_error("[VocabTree::loadBinary] "
+				"File [" + filename + "] is truncated");
+	}
+
+	const VocabFileHeader& header =
+			*reinterpret_cast<const VocabFileHeader*>(mappedFile->data());
+
+	if (header.version != VOCAB_FILE_VERSION) {
+		throw std::runtime_error("[VocabTree::loadBinary] "
+				"Unsupported format version in file [" + filename + "]");
+	}
+
+	if (header.descriptorType != cv::DataType<TDescriptor>::type
+			|| header.nodeSize != int32_t(sizeof(VocabTreeFlatNode))) {
+		throw std::runtime_error("[VocabTree::loadBinary] "
+				"File [" + filename + "] does not store a tree of this type");
+	}
+
+	if (header.size == 0) {
+		throw std::runtime_error("[VocabTree::loadBinary] "
+				"Tree in file [" + filename + "] is empty");
+	}
+
+	// Sizes are checked one at a time so that they cannot overflow
+	uint64_t fileSize = mappedFile->size();
+
+	if (header.branching < 1 || header.depth < 1 || header.vectorLength == 0
+			|| header.numWords > uint64_t(std::numeric_limits<int>::max())
+			|| header.size > uint64_t(std::numeric_limits<int>::max())
+			|| header.nodesOffset < sizeof(header)
+			|| header.nodesOffset > fileSize
+			|| header.size
+					> (fileSize - header.nodesOffset)
+							/ sizeof(VocabTreeFlatNode)
+			|| header.centersOffset
+					< header.nodesOffset
+							+ header.size * sizeof(VocabTreeFlatNode)
+			|| header.centersOffset % CENTERS_ALIGNMENT != 0
+			|| header.centersOffset > fileSize
+			|| header.vectorLength
+					> (fileSize - header.centersOffset) / sizeof(TDescriptor)
+			|| header.size
+					> (fileSize - header.centersOffset) / sizeof(TDescriptor)
+							/ header.vectorLength) {
+		throw std::runtime_error("[VocabTree::loadBinary] "
+				"File [" + filename + "] is truncated or corrupted");
+	}
+
+	const VocabTreeFlatNode* nodes =
+			reinterpret_cast<const VocabTreeFlatNode*>(mappedFile->data()
+					+ header.nodesOffset);
+
+	// Quantization follows the children and word ids without bounds checks, so
+	// children must lie within the table after their parent, which also rules
+	// out cycles, and leaves must hold a valid word id
+	for (uint64_t nodeIdx = 0; nodeIdx < header.size; ++nodeIdx) {
+		const VocabTreeFlatNode& node = nodes[nodeIdx];
+		bool valid =
+				node.first_child == -1 ?
+						node.word_id >= 0
+								&& uint64_t(node.word_id) < header.numWords :
+						node.first_child >= 0
+								&& uint64_t(node.first_child) > nodeIdx
+								&& uint64_t(node.first_child) + header.branching
+										<= header.size;
+		if (valid == false) {
+			throw std::runtime_error("[VocabTree::loadBinary] "
+					"File [" + filename + "] holds a corrupted nodes table");
 		}
 	}
 
+	m_iterations = header.iterations;
+	m_branching = header.branching;
+	m_depth = header.depth;
+	m_veclen = header.vectorLength;
+	m_size = header.size;
+	m_numWords = header.numWords;
+
+	// Both the nodes table and the centers are used in place
+	m_nodes = nodes;
+	m_centers = cv::Mat(m_size, m_veclen, cv::DataType<TDescriptor>::type,
+			(void*) (mappedFile->data() + header.centersOffset));
+
+	m_nodesData.clear();
+	m_centersData.release();
+	m_mappedFile = mappedFile;
+
 }
 
 // --------------------------------------------------------------------------
@@ -498,6 +1241,12 @@ void VocabTree<TDescriptor, Distance>::save_tree(cv::FileStorage& fs,
 template<class TDescriptor, class Distance>
 void VocabTree<TDescriptor, Distance>::load(const std::string& filename) {
 
+	if (MappedFile::hasMagic(filename, VOCAB_FILE_MAGIC,
+			sizeof(VOCAB_FILE_MAGIC)) == true) {
+		loadBinary(filename);
+		return;
+	}
+
 	std::ifstream inputZippedFileStream;
 	boost::iostreams::filtering_istream inputFileStream;
 
@@ -543,8 +1292,28 @@ void VocabTree<TDescriptor, Distance>::load(const std::string& filename) {
 			}
 		}
 
-		m_root = new VocabTreeNode<TDescriptor>();
-		load_tree(inputFileStream, m_root);
+		if (m_size == 0) {
+			throw std::runtime_error("[VocabTree::load] "
+					"Tree in file [" + filename + "] is empty");
+		}
+
+		// The nodes are read in depth-first order directly into the flattened tree
+		m_numWords = 0;
+		m_mappedFile.release();
+		m_nodes = NULL;
+		m_nodesData.clear();
+		m_nodesData.reserve(m_size);
+		allocateCenters(m_size);
+
+		m_nodesData.push_back(VocabTreeFlatNode());
+		load_tree(inputFileStream, 0);
+
+		if (m_nodesData.size() != m_size) {
+			throw std::runtime_error("[VocabTree::load] "
+					"Number of nodes differs from the size of the tree");
+		}
+
+		m_nodes = m_nodesData.data();
 
 	} catch (const boost::iostreams::gzip_error& e) {
 		throw std::runtime_error("[VocabTree::load] "
@@ -560,8 +1329,7 @@ void VocabTree<TDescriptor, Distance>::load(const std::string& filename) {
 
 template<class TDescriptor, class Distance>
 void VocabTree<TDescriptor, Distance>::load_tree(
-		boost::iostreams::filtering_istream& inputFileStream,
-		VocabTreeNodePtr& node) {
+		boost::iostreams::filtering_istream& inputFileStream, int nodeIdx) {
 
 	enum nodeFields {
 		start, center, rows, cols, dt, data, nodeId, wordId
@@ -572,8 +1340,6 @@ void VocabTree<TDescriptor, Distance>::load_tree(
 	std::string line, field;
 	std::stringstream ss;
 
-	cv::Mat _center;
-
 	int _rows = -1;
 	int _cols = -1;
 	std::string _type;
@@ -595,19 +1361,18 @@ void VocabTree<TDescriptor, Distance>::load_tree(
 		} else if (field.compare(nodeFieldsNames[dt]) == 0) {
 			ss >> _type;
 		} else if (field.compare(nodeFieldsNames[nodeId]) == 0) {
-			ss >> node->node_id;
+			ss >> m_nodesData[nodeIdx].node_id;
 		} else if (field.compare(nodeFieldsNames[wordId]) == 0) {
-			ss >> node->word_id;
+			ss >> m_nodesData[nodeIdx].word_id;
 			break;
 		} else {
 			if (field.compare(nodeFieldsNames[data]) == 0) {
-				_center = cv::Mat::zeros(_rows, _cols,
-						_type.compare("f") == 0 ? CV_32F : CV_8U);
+				// Check dimensions correctness
+				CV_Assert(_rows == 1);
+				CV_Assert(_cols == int(m_veclen));
 				line.replace(line.find(nodeFieldsNames[data]), 5, " ");
 			}
 
-			bool isLastLine = line.find("]") != std::string::npos;
-
 			std::replace(line.begin(), line.end(), '[', ' ');
 			std::replace(line.begin(), line.end(), ',', ' ');
 			std::replace(line.begin(), line.end(), ']', ' ');
@@ -615,40 +1380,34 @@ void VocabTree<TDescriptor, Distance>::load_tree(
 			ss.clear();
 			ss.str(line);
 
+			// Center is written straight into its row of the centers buffer
 			while ((ss >> elem).fail() == false) {
-				_center.at<TDescriptor>(0, ++colIdx) = elem;
-			}
-
-			if (isLastLine) {
-				// Check dimensions correctness
-				CV_Assert(_center.rows == 1);
-				CV_Assert(_center.cols == int(m_veclen));
-
-				// Deep copy
-				node->center = new TDescriptor[m_veclen];
-				for (size_t k = 0; k < m_veclen; ++k) {
-					node->center[k] = _center.at<TDescriptor>(0, k);
-				}
-
-				// Release memory and dereference header
-				_center.release();
-				_center = cv::Mat();
+				CV_Assert(colIdx + 1 < int(m_veclen));
+				m_centers.at<TDescriptor>(nodeIdx, ++colIdx) = elem;
 			}
 		}
 	}
 
-	bool hasChildren = node->word_id == -1;
+	bool hasChildren = m_nodesData[nodeIdx].word_id == -1;
 
 	if (hasChildren == false) {
 		// Node has no children then it's a leaf node
-		node->children = NULL;
-		m_words.push_back(node);
+		m_nodesData[nodeIdx].first_child = -1;
+		++m_numWords;
 	} else {
-		// Node has children then it's an interior node
-		node->children = new VocabTreeNodePtr[m_branching];
+		// Node has children then it's an interior node,
+		// its children are stored in a contiguous block
+		int firstChild = m_nodesData.size();
+
+		if (firstChild + m_branching > int(m_size)) {
+			throw std::runtime_error("[VocabTree::load_tree] "
+					"Number of nodes exceeds the size of the tree");
+		}
+
+		m_nodesData[nodeIdx].first_child = firstChild;
+		m_nodesData.resize(firstChild + m_branching);
 		for (int c = 0; c < m_branching; ++c) {
-			node->children[c] = new VocabTreeNode<TDescriptor>();
-			load_tree(inputFileStream, node->children[c]);
+			load_tree(inputFileStream, firstChild + c);
 		}
 	}
 
@@ -658,10 +1417,7 @@ void VocabTree<TDescriptor, Distance>::load_tree(
 
 template<class TDescriptor, class Distance>
 void VocabTree<TDescriptor, Distance>::computeClustering(VocabTreeNodePtr node,
-		int* indices, int indices_length, int level, bool fitted) {
-
-	node->node_id = m_size;
-	++m_size;
+		int* indices, int indices_length, int level, bool fitted, uint64 seed) {
 
 	// Sort descriptors, caching leverages this fact
 	// Note: it doesn't affect the clustering process since all descriptors referenced by indices belong to the same cluster
@@ -673,8 +1429,6 @@ void VocabTree<TDescriptor, Distance>::computeClustering(VocabTreeNodePtr node,
 	// or when there is less data than clusters
 	if (level == m_depth || indices_length < m_branching) {
 		node->children = NULL;
-		node->word_id = m_words.size();
-		m_words.push_back(node);
 #if VTREEVERBOSE
 		if (level == m_depth) {
 			printf(
@@ -705,7 +1459,7 @@ void VocabTree<TDescriptor, Distance>::computeClustering(VocabTreeNodePtr node,
 #endif
 #endif
 
-	CentersChooser<TDescriptor, Distance>::create(m_centers_init)->chooseCenters(
+	CentersChooser<TDescriptor, Distance>::create(m_centers_init, seed)->chooseCenters(
 			m_branching, indices, indices_length, centers_idx, centers_length,
 			m_dataset);
 
@@ -719,8 +1473,6 @@ void VocabTree<TDescriptor, Distance>::computeClustering(VocabTreeNodePtr node,
 	// less cluster indices than clusters
 	if (centers_length < m_branching) {
 		node->children = NULL;
-		node->word_id = m_words.size();
-		m_words.push_back(node);
 #if VTREEVERBOSE
 		printf(
 				"[VocabTree::computeClustering] (level %d): got less cluster indices than clusters (%d features)\n",
@@ -760,23 +1512,15 @@ void VocabTree<TDescriptor, Distance>::computeClustering(VocabTreeNodePtr node,
 
 	std::vector<int> belongs_to(indices_length);
 	std::vector<DistanceType> distance_to(indices_length);
+	assignToCenters(indices, indices_length, dcenters, belongs_to, distance_to);
 	for (int i = 0; i < indices_length; ++i) {
-		distance_to[i] = m_distance(
-				(TDescriptor*) m_dataset.row(indices[i]).data,
-				(TDescriptor*) dcenters.row(0).data, m_veclen);
-		belongs_to[i] = 0;
-		for (int j = 1; j < m_branching; ++j) {
-			DistanceType new_sq_dist = m_distance(
-					(TDescriptor*) m_dataset.row(indices[i]).data,
-					(TDescriptor*) dcenters.row(j).data, m_veclen);
-			if (distance_to[i] > new_sq_dist) {
-				belongs_to[i] = j;
-				distance_to[i] = new_sq_dist;
-			}
-		}
 		++count[belongs_to[i]];
 	}
 
+	// Closest centers after every iteration
+	std::vector<int> new_belongs_to(indices_length);
+	std::vector<DistanceType> new_distance_to(indices_length);
+
 #if DEBUG
 #if VTREEVERBOSE
 	printf("quantize - End\n");
@@ -801,45 +1545,8 @@ void VocabTree<TDescriptor, Distance>::computeClustering(VocabTreeNodePtr node,
 #endif
 #endif
 
-		// Zeroing all the centroids dimensions
-		dcenters = cv::Scalar::all(0);
-
-		if (m_dataset.type() == CV_8U) {
-			// Warning: using matrix of integers, there might be
-			// an overflow when summing too much descriptors
-			cv::Mat bitwiseCount(m_branching, m_veclen * 8,
-					cv::DataType<int>::type);
-			// Zeroing matrix of cumulative bits
-			bitwiseCount = cv::Scalar::all(0);
-			// Bitwise summing the data into each centroid
-			for (int i = 0; i < indices_length; ++i) {
-				int j = belongs_to[i];
-				cv::Mat b = bitwiseCount.row(j);
-				KMajority::cumBitSum(m_dataset.row(indices[i]), b);
-			}
-			// Bitwise majority voting
-			for (int j = 0; j < m_branching; ++j) {
-				cv::Mat centroid = dcenters.row(j);
-				KMajority::majorityVoting(bitwiseCount.row(j), centroid,
-						count[j]);
-			}
-		} else {
-			// Accumulate data into its corresponding cluster accumulator
-			for (int i = 0; i < indices_length; ++i) {
-				for (unsigned int k = 0; k < m_veclen; ++k) {
-					dcenters.template at<TDescriptor>(belongs_to[i], k) += m_dataset.row(
-							indices[i]).template at<TDescriptor>(0, k);
-				}
-			}
-			// Divide accumulated data by the number transaction assigned to the cluster
-			for (int i = 0; i < m_branching; ++i) {
-				if (count[i] != 0) {
-					for (unsigned int k = 0; k < m_veclen; ++k) {
-						dcenters.template at<TDescriptor>(i, k) /= count[i];
-					}
-				}
-			}
-		}
+		computeCentroids(indices, indices_length, belongs_to, count, dcenters);
+
 #if DEBUG
 #if VTREEVERBOSE
 		printf("computeCentroids - End\n");
@@ -852,25 +1559,15 @@ void VocabTree<TDescriptor, Distance>::computeClustering(VocabTreeNodePtr node,
 #endif
 #endif
 
+		assignToCenters(indices, indices_length, dcenters, new_belongs_to,
+				new_distance_to);
 		for (int i = 0; i < indices_length; ++i) {
-			DistanceType sq_dist = m_distance(
-					(TDescriptor*) m_dataset.row(indices[i]).data,
-					(TDescriptor*) dcenters.row(0).data, m_veclen);
-			int new_centroid = 0;
-			for (int j = 1; j < m_branching; ++j) {
-				DistanceType new_sq_dist = m_distance(
-						(TDescriptor*) m_dataset.row(indices[i]).data,
-						(TDescriptor*) dcenters.row(j).data, m_veclen);
-				if (sq_dist > new_sq_dist) {
-					new_centroid = j;
-					sq_dist = new_sq_dist;
-				}
-			}
+			int new_centroid = new_belongs_to[i];
 			if (new_centroid != belongs_to[i]) {
 				--count[belongs_to[i]];
 				++count[new_centroid];
 				belongs_to[i] = new_centroid;
-				distance_to[i] = sq_dist;
+				distance_to[i] = new_distance_to[i];
 
 				converged = false;
 			}
@@ -940,10 +1637,32 @@ void VocabTree<TDescriptor, Distance>::computeClustering(VocabTreeNodePtr node,
 		}
 	}
 
+	// Re-order indices by chunks in clustering order, the chunks are
+	// disjoint so the children can be clustered concurrently
+	std::vector<int> chunkStart(m_branching + 1, 0);
+	int end = 0;
+	for (int c = 0; c < m_branching; ++c) {
+		chunkStart[c] = end;
+		for (int i = 0; i < indices_length; ++i) {
+			if (belongs_to[i] == c) {
+				std::swap(indices[i], indices[end]);
+				std::swap(belongs_to[i], belongs_to[end]);
+				++end;
+			}
+		}
+	}
+	chunkStart[m_branching] = end;
+
+	dcenters.release();
+
 	// Compute k-means clustering for each of the resulting clusters
 	node->children = new VocabTreeNodePtr[m_branching];
-	int start = 0;
-	int end = start;
+	for (int c = 0; c < m_branching; ++c) {
+		node->children[c] = new VocabTreeNode<TDescriptor>();
+		node->children[c]->center = centers[c];
+	}
+	delete[] centers;
+
 	for (int c = 0; c < m_branching; ++c) {
 
 #if VTREEVERBOSE
@@ -952,24 +1671,142 @@ void VocabTree<TDescriptor, Distance>::computeClustering(VocabTreeNodePtr node,
 				level, c);
 #endif
 
-		// Re-order indices by chunks in clustering order
-		for (int i = 0; i < indices_length; ++i) {
-			if (belongs_to[i] == c) {
-				std::swap(indices[i], indices[end]);
-				std::swap(belongs_to[i], belongs_to[end]);
-				++end;
-			}
+		VocabTreeNodePtr child = node->children[c];
+		int* childIndices = indices + chunkStart[c];
+		int childLength = chunkStart[c + 1] - chunkStart[c];
+		uint64 childNodeSeed = childSeed(seed, c);
+
+		if (m_threadPool.empty() == false) {
+			m_threadPool->submit(
+					[this, child, childIndices, childLength, level, fitted, childNodeSeed]() {
+						computeClustering(child, childIndices, childLength,
+								level + 1, fitted, childNodeSeed);
+					});
+		} else {
+			computeClustering(child, childIndices, childLength, level + 1,
+					fitted, childNodeSeed);
 		}
+	}
+}
 
-		node->children[c] = new VocabTreeNode<TDescriptor>();
-		node->children[c]->center = centers[c];
-		computeClustering(node->children[c], indices + start, end - start,
-				level + 1, fitted);
-		start = end;
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class Distance>
+void VocabTree<TDescriptor, Distance>::assignToCenters(const int* indices,
+		int indices_length, const cv::Mat& dcenters, std::vector<int>& closest,
+		std::vector<DistanceType>& distances) {
+
+	// Fetch each descriptor once and compute the distances to all the centers
+	std::function<void(int, int)> assignRange =
+			[&](int begin, int end) {
+				for (int i = begin; i < end; ++i) {
+					cv::Mat descriptor = m_dataset.row(indices[i]);
+					closest[i] = DistanceKernels<TDescriptor, Distance>::argmin(
+							m_distance, descriptor.ptr<TDescriptor>(0),
+							dcenters.ptr<TDescriptor>(0), m_branching, m_veclen,
+							distances[i]);
+				}
+			};
+
+	if (m_threadPool.empty() == false && indices_length >= PARALLEL_MIN_SIZE) {
+		m_threadPool->parallelFor(0, indices_length,
+				PARALLEL_ASSIGNMENT_CHUNK_SIZE, assignRange);
+	} else {
+		assignRange(0, indices_length);
 	}
+}
 
-	dcenters.release();
-	delete[] centers;
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class Distance>
+void VocabTree<TDescriptor, Distance>::computeCentroids(const int* indices,
+		int indices_length, const std::vector<int>& belongs_to,
+		const std::vector<int>& count, cv::Mat& dcenters) {
+
+	// Binary descriptors are accumulated bitwise into integers
+	// Warning: using matrix of integers, there might be
+	// an overflow when summing too much descriptors
+	bool binary = m_dataset.type() == CV_8U;
+	int accType = binary ? cv::DataType<int>::type : dcenters.type();
+	int accCols = binary ? m_veclen * 8 : m_veclen;
+
+	cv::Mat accumulator(m_branching, accCols, accType, cv::Scalar::all(0));
+
+	if (indices_length < PARALLEL_MIN_SIZE) {
+		accumulate(indices, 0, indices_length, belongs_to, accumulator);
+	} else {
+		int numBlocks = ACCUMULATION_BLOCKS;
+		int blockSize = (indices_length + numBlocks - 1) / numBlocks;
+
+		std::vector<cv::Mat> partials(numBlocks);
+		std::function<void(int, int)> accumulateBlocks =
+				[&](int beginBlock, int endBlock) {
+					for (int b = beginBlock; b < endBlock; ++b) {
+						partials[b] = cv::Mat::zeros(m_branching, accCols, accType);
+						accumulate(indices, std::min(indices_length, b * blockSize),
+								std::min(indices_length, (b + 1) * blockSize),
+								belongs_to, partials[b]);
+					}
+				};
+
+		if (m_threadPool.empty() == false) {
+			m_threadPool->parallelFor(0, numBlocks, 1, accumulateBlocks);
+		} else {
+			accumulateBlocks(0, numBlocks);
+		}
+
+		// Reduction in block order
+		for (int b = 0; b < numBlocks; ++b) {
+			accumulator += partials[b];
+		}
+	}
+
+	// Zeroing all the centroids dimensions
+	dcenters = cv::Scalar::all(0);
+
+	if (binary) {
+		// Bitwise majority voting
+		for (int j = 0; j < m_branching; ++j) {
+			cv::Mat centroid = dcenters.row(j);
+			KMajority::majorityVoting(accumulator.row(j), centroid, count[j]);
+		}
+	} else {
+		// Divide accumulated data by the number transaction assigned to the cluster
+		for (int i = 0; i < m_branching; ++i) {
+			if (count[i] != 0) {
+				for (unsigned int k = 0; k < m_veclen; ++k) {
+					dcenters.at<TDescriptor>(i, k) = accumulator.at<TDescriptor>(
+							i, k) / count[i];
+				}
+			}
+		}
+	}
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class Distance>
+void VocabTree<TDescriptor, Distance>::accumulate(const int* indices,
+		int begin, int end, const std::vector<int>& belongs_to,
+		cv::Mat& accumulators) {
+
+	if (m_dataset.type() == CV_8U) {
+		// Bitwise summing the data into each centroid
+		for (int i = begin; i < end; ++i) {
+			cv::Mat b = accumulators.row(belongs_to[i]);
+			KMajority::cumBitSum(m_dataset.row(indices[i]), b);
+		}
+	} else {
+		// Accumulate data into its corresponding cluster accumulator
+		for (int i = begin; i < end; ++i) {
+			cv::Mat descriptor = m_dataset.row(indices[i]);
+			TDescriptor* acc = accumulators.ptr<TDescriptor>(belongs_to[i]);
+			const TDescriptor* data = descriptor.ptr<TDescriptor>(0);
+			for (unsigned int k = 0; k < m_veclen; ++k) {
+				acc[k] += data[k];
+			}
+		}
+	}
 }
 
 // --------------------------------------------------------------------------
@@ -982,8 +1819,8 @@ bool VocabTree<TDescriptor, Distance>::empty() const {
 // --------------------------------------------------------------------------
 
 template<class TDescriptor, class Distance>
-bool VocabTree<TDescriptor, Distance>::compareEqual(const VocabTreeNodePtr a,
-		const VocabTreeNodePtr b) const {
+bool VocabTree<TDescriptor, Distance>::compareEqual(int a,
+		const VocabTree<TDescriptor, Distance>& other, int b) const {
 
 #if DEBUG
 #if VTREEVERBOSE
@@ -991,29 +1828,33 @@ bool VocabTree<TDescriptor, Distance>::compareEqual(const VocabTreeNodePtr a,
 #endif
 #endif
 
+	const VocabTreeFlatNode& nodeA = m_nodes[a];
+	const VocabTreeFlatNode& nodeB = other.m_nodes[b];
+
 	// Assert both nodes are interior or leaf nodes
-	if ((a->children != NULL && b->children == NULL)
-			|| (a->children == NULL && b->children != NULL)) {
+	if ((nodeA.first_child != -1 && nodeB.first_child == -1)
+			|| (nodeA.first_child == -1 && nodeB.first_child != -1)) {
 		return false;
 	}
 
 	// At this point both nodes have none or some children,
 	// hence valid nodes so we proceed to check the centers
+	const TDescriptor* centerA = getCenter(a);
+	const TDescriptor* centerB = other.getCenter(b);
 	for (size_t k = 0; k < m_veclen; ++k) {
-		// Might be necessary to check as well the type of pointer
-		// i.e. both should be pointers to the same type
-		if (a->center[k] != b->center[k]) {
+		if (centerA[k] != centerB[k]) {
 			return false;
 		}
 	}
 
-	if (a->children == NULL) {
+	if (nodeA.first_child == -1) {
 		// Base case: both are leaf nodes since have no children
 		return true;
 	} else {
 		// Recursion case: both are interior nodes
-		for (size_t i = 0; (int) i < m_branching; ++i) {
-			if (compareEqual(a->children[i], b->children[i]) == false) {
+		for (int i = 0; i < m_branching; ++i) {
+			if (compareEqual(nodeA.first_child + i, other,
+					nodeB.first_child + i) == false) {
 				return false;
 			}
 		}
@@ -1037,7 +1878,11 @@ bool VocabTree<TDescriptor, Distance>::operator==(
 		return false;
 	}
 
-	if (compareEqual(getRoot(), other.getRoot()) == false) {
+	if (empty() == true || other.empty() == true) {
+		return empty() == other.empty();
+	}
+
+	if (compareEqual(0, other, 0) == false) {
 #if DEBUG
 #if VTREEVERBOSE
 		printf("[VocabTree::operator==] Tree is not equal\n");
@@ -7,20 +7,41 @@
 
 #include <DirectIndex.hpp>
 
+#include <MappedFile.hpp>
+
+#include <algorithm>
+#include <fstream>
 #include <sstream>
 #include <stdexcept>
 
 namespace vlr {
 
+size_t NodeFeatureRange::getNumNodes() const {
+	size_t numNodes = 0;
+	for (const NodeFeature* it = m_begin; it != m_end; ++it) {
+		if (it == m_begin || it->m_nodeId != (it - 1)->m_nodeId) {
+			++numNodes;
+		}
+	}
+	return numNodes;
+}
+
+// --------------------------------------------------------------------------
+
 DirectIndex::DirectIndex(int level) {
 	m_level = level;
+	m_offsets.push_back(0);
 }
 
 DirectIndex::~DirectIndex() {
 }
 
 size_t DirectIndex::size() const {
-	return m_index.size();
+	return m_offsets.size() - 1;
+}
+
+size_t DirectIndex::getNumFeatures() const {
+	return m_features.size();
 }
 
 int DirectIndex::getLevel() const {
@@ -33,42 +54,77 @@ void DirectIndex::setLevel(int level) {
 
 void DirectIndex::addFeature(int imgIdx, int nodeId, int featureId) {
 
-	// Lookup image in the direct index
 	// Note: recall that features are added in images order
-	if (imgIdx + 1 != int(m_index.size())) {
-		// Add new entry to the direct index
-		m_index.push_back(TreeNode());
+	if (imgIdx + 1 < int(size())) {
+		throw std::runtime_error("[DirectIndex::addFeature] "
+				"Images must be added in increasing order");
 	}
-	TreeNode& nodeMap = m_index.back();
 
-	// Lookup node in the image index
-	TreeNode::iterator it = nodeMap.find(nodeId);
+	// Add new entries to the direct index, with no features for skipped images
+	while (int(size()) <= imgIdx) {
+		m_offsets.push_back(m_features.size());
+	}
 
-	if (it == nodeMap.end()) {
-		// Insert new node with empty features vector and obtain an iterator to it
-		it = nodeMap.insert(
-				std::pair<int, FeatureVector>(nodeId, FeatureVector())).first;
+	NodeFeature feature(nodeId, featureId);
+
+	// Insert the feature keeping the range of the image sorted
+	std::vector<NodeFeature>::iterator first = m_features.begin()
+			+ m_offsets[imgIdx];
+	if (m_features.size() == m_offsets[imgIdx]
+			|| m_features.back() < feature) {
+		m_features.push_back(feature);
+	} else {
+		m_features.insert(std::upper_bound(first, m_features.end(), feature),
+				feature);
 	}
-	// Obtain a reference to the features vector of the node
-	FeatureVector& fv = it->second;
 
-	fv.push_back(featureId);
+	m_offsets.back() = m_features.size();
 }
 
-const TreeNode& DirectIndex::lookUpImg(int imgIdx) const {
-	if (imgIdx < 0 || imgIdx >= int(m_index.size())) {
+void DirectIndex::addImage(int imgIdx, const std::vector<int>& nodeIds) {
+
+	if (imgIdx < int(size())) {
+		throw std::runtime_error("[DirectIndex::addImage] "
+				"Images must be added in increasing order");
+	}
+
+	while (int(size()) <= imgIdx) {
+		m_offsets.push_back(m_features.size());
+	}
+
+	size_t first = m_features.size();
+
+	for (size_t featureId = 0; featureId < nodeIds.size(); ++featureId) {
+		if (nodeIds[featureId] >= 0) {
+			m_features.push_back(NodeFeature(nodeIds[featureId], featureId));
+		}
+	}
+
+	std::sort(m_features.begin() + first, m_features.end());
+
+	m_offsets.back() = m_features.size();
+}
+
+NodeFeatureRange DirectIndex::lookUpImg(int imgIdx) const {
+	if (imgIdx < 0 || imgIdx >= int(size())) {
 		std::stringstream ss;
 		ss << "[DirectIndex::lookUpImg] "
-				"Image index should be in the range [0, " << m_index.size()
-				<< ")";
+				"Image index should be in the range [0, " << size() << ")";
 		throw std::out_of_range(ss.str());
 	}
-	return m_index[imgIdx];
+	return NodeFeatureRange(m_features.data() + m_offsets[imgIdx],
+			m_features.data() + m_offsets[imgIdx + 1]);
 }
 
 void DirectIndex::save(const std::string& filename) const {
 
-	if (m_index.size() == 0) {
+	if (filename.size() >= 4
+			&& filename.compare(filename.size() - 4, 4, ".bin") == 0) {
+		saveBinary(filename);
+		return;
+	}
+
+	if (size() == 0) {
 		throw std::runtime_error("[DirectIndex::save] "
 				"Index is empty");
 	}
@@ -80,26 +136,26 @@ void DirectIndex::save(const std::string& filename) const {
 				"Unable to open file [" + filename + "] for writing");
 	}
 
-	int imgIdx = 0;
-
 	fs << "Level" << m_level;
 	fs << "DirectIndex" << "[";
-	for (TreeNode node : m_index) {
+	for (int imgIdx = 0; imgIdx < int(size()); ++imgIdx) {
+		NodeFeatureRange features = lookUpImg(imgIdx);
 		fs << "{";
 		fs << "ImgIndex" << imgIdx;
 		fs << "Nodes" << "[";
-		for (TreeNode::iterator it = node.begin(); it != node.end(); it++) {
+		for (const NodeFeature* it = features.begin(); it != features.end();) {
 			fs << "{";
+			fs << "Node" << it->m_nodeId;
 			fs << "Features" << "[:";
-			for (int featIdx : it->second) {
-				fs << featIdx;
+			int nodeId = it->m_nodeId;
+			for (; it != features.end() && it->m_nodeId == nodeId; ++it) {
+				fs << it->m_featureId;
 			}
 			fs << "]";
 			fs << "}";
 		}
 		fs << "]";
 		fs << "}";
-		imgIdx++;
 	}
 	fs << "]";
 
@@ -107,8 +163,54 @@ void DirectIndex::save(const std::string& filename) const {
 
 }
 
+void DirectIndex::saveBinary(const std::string& filename) const {
+
+	if (size() == 0) {
+		throw std::runtime_error("[DirectIndex::saveBinary] "
+				"Index is empty");
+	}
+
+	DirectIndexFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, DIRECT_INDEX_FILE_MAGIC,
+			sizeof(DIRECT_INDEX_FILE_MAGIC));
+	header.version = DIRECT_INDEX_FILE_VERSION;
+	header.level = m_level;
+	header.numImages = size();
+	header.numFeatures = m_features.size();
+
+	std::vector<uint64_t> offsets(m_offsets.begin(), m_offsets.end());
+
+	std::ofstream outputFileStream(filename.c_str(),
+			std::fstream::out | std::fstream::binary);
+
+	if (outputFileStream.good() == false) {
+		throw std::runtime_error("[DirectIndex::saveBinary] "
+				"Unable to open file [" + filename + "] for writing");
+	}
+
+	outputFileStream.write((const char*) &header, sizeof(header));
+	outputFileStream.write((const char*) offsets.data(),
+			offsets.size() * sizeof(uint64_t));
+	outputFileStream.write((const char*) m_features.data(),
+			m_features.size() * sizeof(NodeFeature));
+
+	if (outputFileStream.good() == false) {
+		throw std::runtime_error("[DirectIndex::saveBinary] "
+				"Got error while writing file [" + filename + "]");
+	}
+
+	outputFileStream.close();
+}
+
 void DirectIndex::load(const std::string& filename) {
 
+	if (MappedFile::hasMagic(filename, DIRECT_INDEX_FILE_MAGIC,
+			sizeof(DIRECT_INDEX_FILE_MAGIC)) == true) {
+		loadBinary(filename);
+		return;
+	}
+
 	cv::FileStorage fs(filename.c_str(), cv::FileStorage::READ);
 
 	if (fs.isOpened() == false) {
@@ -116,11 +218,13 @@ void DirectIndex::load(const std::string& filename) {
 				"Unable to open file [" + filename + "] for reading");
 	}
 
+	clear();
+
 	m_level = int(fs["Level"]);
 
 	cv::FileNode directIndex = fs["DirectIndex"], nodes;
 
-	FeatureVector features;
+	std::vector<int> features;
 
 	// Verify that 'DirectIndex' is a sequence
 	if (directIndex.type() != cv::FileNode::SEQ) {
@@ -143,12 +247,21 @@ void DirectIndex::load(const std::string& filename) {
 					"Fetched element 'Nodes' should be a sequence");
 		}
 
+		// Images without features still take an entry
+		while (int(size()) <= imgIdx) {
+			m_offsets.push_back(m_features.size());
+		}
+
 		nodeIdx = 0;
 		for (cv::FileNodeIterator node = nodes.begin(); node != nodes.end();
 				node++, nodeIdx++) {
+			// Files written before node ids were saved only keep their order
+			int nodeId =
+					(*node)["Node"].empty() == true ?
+							nodeIdx : int((*node)["Node"]);
 			(*node)["Features"] >> features;
 			for (int featureIdx : features) {
-				addFeature(imgIdx, nodeIdx, featureIdx);
+				addFeature(imgIdx, nodeId, featureIdx);
 			}
 
 		}
@@ -159,8 +272,86 @@ void DirectIndex::load(const std::string& filename) {
 
 }
 
-void DirectIndex::clear() const {
-//	std::vector<TreeNode>().swap(m_index);
+void DirectIndex::loadBinary(const std::string& filename) {
+
+	MappedFile mappedFile(filename);
+
+	if (mappedFile.size() < sizeof(DirectIndexFileHeader)
+			|| memcmp(mappedFile.data(), DIRECT_INDEX_FILE_MAGIC,
+					sizeof(DIRECT_INDEX_FILE_MAGIC)) != 0) {
+		throw std::runtime_error("[DirectIndex::loadBinary] "
+				"File [" + filename + "] is not a binary direct index");
+	}
+
+	DirectIndexFileHeader header;
+	memcpy(&header, mappedFile.data(), sizeof(header));
+
+	if (header.version != DIRECT_INDEX_FILE_VERSION) {
+		throw std::runtime_error("[DirectIndex::loadBinary] "
+				"Unsupported format version in file [" + filename + "]");
+	}
+
+	// Sizes are checked one at a time so that they cannot overflow
+	uint64_t available = mappedFile.size() - sizeof(header);
+	if (header.numImages >= available / sizeof(uint64_t)
+			|| header.numFeatures
+					> (available - (header.numImages + 1) * sizeof(uint64_t))
+							/ sizeof(NodeFeature)) {
+		throw std::runtime_error("[DirectIndex::loadBinary] "
+				"File [" + filename + "] is truncated or corrupted");
+	}
+
+	const unsigned char* offsetsData = mappedFile.data() + sizeof(header);
+	const unsigned char* featuresData = offsetsData
+			+ (header.numImages + 1) * sizeof(uint64_t);
+
+	std::vector<uint64_t> offsets(header.numImages + 1);
+	memcpy(offsets.data(), offsetsData, offsets.size() * sizeof(uint64_t));
+
+	std::vector<NodeFeature> features(header.numFeatures);
+	memcpy(features.data(), featuresData,
+			features.size() * sizeof(NodeFeature));
+
+	// Offsets must delimit the features and every image must be sorted, as
+	// lookups and intersections rely on it
+	bool valid = offsets.front() == 0
+			&& offsets.back() == header.numFeatures;
+	for (size_t i = 0; valid == true && i + 1 < offsets.size(); ++i) {
+		valid = offsets[i] <= offsets[i + 1];
+		for (uint64_t k = offsets[i] + 1; valid == true && k < offsets[i + 1];
+				++k) {
+			valid = features[k - 1] < features[k];
+		}
+	}
+
+	if (valid == false) {
+		throw std::runtime_error("[DirectIndex::loadBinary] "
+				"File [" + filename + "] is truncated or corrupted");
+	}
+
+	m_level = header.level;
+	m_offsets.assign(offsets.begin(), offsets.end());
+	m_features.swap(features);
+}
+
+void DirectIndex::clear() {
+	std::vector<NodeFeature>().swap(m_features);
+	m_offsets.assign(1, 0);
+}
+
+bool DirectIndex::operator==(const DirectIndex& other) const {
+	if (m_level != other.m_level || m_offsets != other.m_offsets
+			|| m_features.size() != other.m_features.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < m_features.size(); ++i) {
+		if (m_features[i].m_nodeId != other.m_features[i].m_nodeId
+				|| m_features[i].m_featureId
+						!= other.m_features[i].m_featureId) {
+			return false;
+		}
+	}
+	return true;
 }
 
 } /* namespace vlr */
@@ -12,14 +12,145 @@
 
 #include <InvertedIndex.hpp>
 
+#include <algorithm>
 #include <assert.h>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 
 namespace vlr {
 
+namespace {
+
+/**
+ * Appends an unsigned integer to a buffer as a varint, i.e. 7 bits per byte
+ * starting with the least significant ones and the high bit set on all the
+ * bytes but the last.
+ */
+void writeVarint(std::vector<unsigned char>& buffer, uint32_t value) {
+	while (value >= 0x80) {
+		buffer.push_back((unsigned char) ((value & 0x7F) | 0x80));
+		value >>= 7;
+	}
+	buffer.push_back((unsigned char) value);
+}
+
+/**
+ * Reads a varint from a buffer.
+ *
+ * @return a pointer past the varint, or NULL if it overruns the buffer
+ */
+const unsigned char* readVarint(const unsigned char* data,
+		const unsigned char* end, uint32_t& value) {
+	value = 0;
+	for (int shift = 0; shift <= 28 && data < end; shift += 7) {
+		unsigned char byte = *data++;
+		value |= uint32_t(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) {
+			return data;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Number of bytes taken by each weight in the given encoding.
+ */
+size_t getWeightSize(uint32_t encoding) {
+	return encoding == WEIGHTS_UINT8 ? 1 : encoding == WEIGHTS_UINT16 ? 2 : 4;
+}
+
+/**
+ * Largest quantized weight in the given encoding.
+ */
+uint32_t getMaxQuantizedWeight(uint32_t encoding) {
+	return encoding == WEIGHTS_UINT8 ? 0xFF : 0xFFFF;
+}
+
+/**
+ * Quantizes a weight relative to a scale, non-null weights stay non-null.
+ */
+uint32_t quantizeWeight(float weight, float scale, uint32_t maxQuantized) {
+	if (scale <= 0.0f) {
+		return 0;
+	}
+	uint32_t quantized = (uint32_t) std::lround(weight / scale * maxQuantized);
+	return quantized == 0 && weight > 0.0f ? 1 : quantized;
+}
+
+/**
+ * Decodes a posting list of the binary format.
+ *
+ * @param data - Pointer to the beginning of the posting list
+ * @param end - Pointer past the end of the posting list
+ * @param entry - The entry of the word in the words table
+ * @param encoding - The encoding of the weights
+ * @param numDbImages - The number of DB images, used for validating the ids
+ * @param imageIds - Array where to store the ids of the images
+ * @param weights - Array where to store the weights of the images
+ * @return false if the posting list is corrupted
+ */
+bool decodePostings(const unsigned char* data, const unsigned char* end,
+		const InvertedFileEntry& entry, uint32_t encoding, uint64_t numDbImages,
+		uint32_t* imageIds, float* weights) {
+
+	size_t weightsSize = entry.numPostings * getWeightSize(encoding);
+
+	if (size_t(end - data) < weightsSize) {
+		return false;
+	}
+
+	const unsigned char* weightsData = end - weightsSize;
+
+	uint32_t imageId = 0;
+	for (uint32_t k = 0; k < entry.numPostings; ++k) {
+		uint32_t delta;
+		data = readVarint(data, weightsData, delta);
+		// Ids are strictly increasing, so only the first delta can be zero
+		if (data == NULL || (k > 0 && delta == 0)) {
+			return false;
+		}
+		imageId += delta;
+		if (imageId >= numDbImages) {
+			return false;
+		}
+		imageIds[k] = imageId;
+	}
+
+	if (data != weightsData) {
+		return false;
+	}
+
+	if (encoding == WEIGHTS_FLOAT32) {
+		memcpy(weights, weightsData, weightsSize);
+	} else {
+		float step = entry.scale / getMaxQuantizedWeight(encoding);
+		for (uint32_t k = 0; k < entry.numPostings; ++k) {
+			uint32_t quantized;
+			if (encoding == WEIGHTS_UINT8) {
+				quantized = weightsData[k];
+			} else {
+				uint16_t value;
+				memcpy(&value, weightsData + 2 * k, sizeof(value));
+				quantized = value;
+			}
+			weights[k] = quantized * step;
+		}
+	}
+
+	return true;
+}
+
+} /* namespace */
+
+// --------------------------------------------------------------------------
+
 InvertedIndex::InvertedIndex() :
-		m_numDbImages(0) {
+		m_numDbImages(0), m_postingsEncoding(WEIGHTS_FLOAT32), m_frozen(
+				false), m_mappedWords(NULL), m_mappedPostings(NULL), m_mappedPostingsSize(
+				0) {
 }
 
 // --------------------------------------------------------------------------
@@ -36,9 +167,12 @@ bool InvertedIndex::operator==(const InvertedIndex &other) const {
 				other.size());
 		return false;
 	}
-	// Check words are equal
+	// Check words are equal, in either form
+	std::vector<ImageCount> buffer, otherBuffer;
 	for (int i = 0; i < int(size()); ++i) {
-		if (at(i) != other.at(i)) {
+		if (at(i).m_weight != other.at(i).m_weight
+				|| getInvertedFile(i, buffer)
+						!= other.getInvertedFile(i, otherBuffer)) {
 			printf("Words at position [%d] are unequal\n", i);
 			return false;
 		}
@@ -74,6 +208,12 @@ void InvertedIndex::addFeatureToInvertedFile(int wordIdx, uint imgIdx) {
 
 void InvertedIndex::save(const std::string& filename) const {
 
+	if (filename.size() >= 4
+			&& filename.compare(filename.size() - 4, 4, ".bin") == 0) {
+		saveBinary(filename);
+		return;
+	}
+
 	if (empty() == true) {
 		throw std::runtime_error("[VocabTree::save] "
 				"Vocabulary is empty");
@@ -91,12 +231,14 @@ void InvertedIndex::save(const std::string& filename) const {
 
 	fs << "Words" << "[";
 
+	std::vector<ImageCount> buffer;
+
 	for (size_t i = 0; i < size(); ++i) {
 		fs << "{";
 
 		fs << "weight" << at(i).m_weight;
 		fs << "imageList" << "[";
-		for (ImageCount img : at(i).m_imageList) {
+		for (ImageCount img : getInvertedFile(i, buffer)) {
 			fs << "{:" << "m_index" << int(img.m_index) << "m_count"
 					<< img.m_count << "}";
 		}
@@ -114,8 +256,15 @@ void InvertedIndex::save(const std::string& filename) const {
 
 void InvertedIndex::load(const std::string& filename) {
 
+	if (MappedFile::hasMagic(filename, INVERTED_INDEX_FILE_MAGIC,
+			sizeof(INVERTED_INDEX_FILE_MAGIC)) == true) {
+		loadBinary(filename);
+		return;
+	}
+
 	// Clear index
 	clear();
+	clearPostingLists();
 
 	// Initializing variables
 	std::ifstream inputZippedFileStream;
@@ -177,4 +326,521 @@ void InvertedIndex::load(const std::string& filename) {
 
 }
 
+// --------------------------------------------------------------------------
+
+void InvertedIndex::buildPostingLists(WeightEncoding encoding) {
+	buildPostingLists(encoding, NULL);
+}
+
+// --------------------------------------------------------------------------
+
+void InvertedIndex::buildPostingLists(WeightEncoding encoding,
+		const std::vector<float>& imageNorms) {
+
+	if (imageNorms.size() < (size_t) m_numDbImages) {
+		throw std::runtime_error("[InvertedIndex::buildPostingLists] "
+				"Missing the norms of some DB images");
+	}
+
+	buildPostingLists(encoding, &imageNorms);
+}
+
+// --------------------------------------------------------------------------
+
+void InvertedIndex::buildPostingLists(WeightEncoding encoding,
+		const std::vector<float>* imageNorms) {
+
+	if (isFrozen() == true) {
+		// The posting lists are already available and validated, and the
+		// inverted files they could be rebuilt from are gone
+		return;
+	}
+
+	clearPostingLists();
+
+	size_t numPostings = 0;
+	for (const Word& word : *this) {
+		numPostings += word.m_imageList.size();
+	}
+
+	m_postingsOffsets.reserve(size() + 1);
+	m_postingsImageIds.reserve(numPostings);
+	m_postingsWeights.reserve(numPostings);
+
+	m_postingsOffsets.push_back(0);
+
+	for (size_t i = 0; i < size(); ++i) {
+		const Word& word = at(i);
+		for (const ImageCount& image : word.m_imageList) {
+
+			float count = image.m_count;
+
+			// Raw counts are weighted and normalized as done to the inverted
+			// files by VocabDB::createDatabase and VocabDB::normalizeDatabase
+			if (imageNorms != NULL
+					&& image.m_index < (unsigned int) m_numDbImages) {
+				if (word.m_weight == -1) {
+					count = float(1.0);
+				} else {
+					count *= word.m_weight;
+				}
+				if ((*imageNorms)[image.m_index] > 0.0) {
+					count /= (*imageNorms)[image.m_index];
+				}
+			}
+
+			// Counts must belong to an existing image and be normalized, they
+			// can only be zero if the weight of the word is zero
+			if (image.m_index >= (unsigned int) m_numDbImages || count > 1.0
+					|| count < 0.0 || (count == 0.0 && word.m_weight != 0.0)) {
+				clearPostingLists();
+				std::stringstream ss;
+				ss << "[InvertedIndex::buildPostingLists] Invalid entry for image ["
+						<< image.m_index << "] with count [" << count
+						<< "] in the inverted file of word [" << i << "]";
+				throw std::runtime_error(ss.str());
+			}
+
+			m_postingsImageIds.push_back(image.m_index);
+			m_postingsWeights.push_back(count);
+		}
+		m_postingsOffsets.push_back(m_postingsImageIds.size());
+	}
+
+	if (encoding == WEIGHTS_FLOAT32) {
+		return;
+	}
+
+	if (encoding != WEIGHTS_UINT16 && encoding != WEIGHTS_UINT8) {
+		clearPostingLists();
+		throw std::runtime_error("[InvertedIndex::buildPostingLists] "
+				"Unknown weight encoding");
+	}
+
+	// Replace the validated arrays by their compact version
+	m_postingsEncoding = encoding;
+	m_postingsScales.resize(size(), 0.0f);
+
+	if (m_numDbImages <= 0x10000) {
+		m_postingsShortImageIds.assign(m_postingsImageIds.begin(),
+				m_postingsImageIds.end());
+		std::vector<uint32_t>().swap(m_postingsImageIds);
+	}
+
+	if (encoding == WEIGHTS_UINT8) {
+		m_postingsWeights8.resize(numPostings);
+	} else {
+		m_postingsWeights16.resize(numPostings);
+	}
+
+	uint32_t maxQuantized = getMaxQuantizedWeight(encoding);
+
+	for (size_t i = 0; i < size(); ++i) {
+		float& scale = m_postingsScales[i];
+		for (size_t k = m_postingsOffsets[i]; k < m_postingsOffsets[i + 1];
+				++k) {
+			scale = std::max(scale, m_postingsWeights[k]);
+		}
+		for (size_t k = m_postingsOffsets[i]; k < m_postingsOffsets[i + 1];
+				++k) {
+			uint32_t quantized = quantizeWeight(m_postingsWeights[k], scale,
+					maxQuantized);
+			if (encoding == WEIGHTS_UINT8) {
+				m_postingsWeights8[k] = (uint8_t) quantized;
+			} else {
+				m_postingsWeights16[k] = (uint16_t) quantized;
+			}
+		}
+	}
+
+	std::vector<float>().swap(m_postingsWeights);
+
+}
+
+// --------------------------------------------------------------------------
+
+size_t InvertedIndex::dequantizePostingList(int wordIdx,
+		const uint32_t*& imageIds, const float*& weights,
+		PostingListBuffer& buffer) const {
+
+	size_t begin = m_postingsOffsets[wordIdx];
+	size_t numPostings = m_postingsOffsets[wordIdx + 1] - begin;
+
+	if (m_postingsShortImageIds.empty() == true) {
+		imageIds = m_postingsImageIds.data() + begin;
+	} else {
+		buffer.imageIds.resize(numPostings);
+		const uint16_t* shortIds = m_postingsShortImageIds.data() + begin;
+		for (size_t k = 0; k < numPostings; ++k) {
+			buffer.imageIds[k] = shortIds[k];
+		}
+		imageIds = buffer.imageIds.data();
+	}
+
+	buffer.weights.resize(numPostings);
+	float step = m_postingsScales[wordIdx]
+			/ getMaxQuantizedWeight(m_postingsEncoding);
+	if (m_postingsEncoding == WEIGHTS_UINT8) {
+		const uint8_t* quantized = m_postingsWeights8.data() + begin;
+		for (size_t k = 0; k < numPostings; ++k) {
+			buffer.weights[k] = quantized[k] * step;
+		}
+	} else {
+		const uint16_t* quantized = m_postingsWeights16.data() + begin;
+		for (size_t k = 0; k < numPostings; ++k) {
+			buffer.weights[k] = quantized[k] * step;
+		}
+	}
+	weights = buffer.weights.data();
+
+	return numPostings;
+}
+
+// --------------------------------------------------------------------------
+
+size_t InvertedIndex::getPostingsMemorySize() const {
+
+	if (isDecodedOnDemand() == true) {
+		return m_mappedPostingsSize;
+	}
+
+	return m_postingsOffsets.size() * sizeof(size_t)
+			+ m_postingsImageIds.size() * sizeof(uint32_t)
+			+ m_postingsWeights.size() * sizeof(float)
+			+ m_postingsShortImageIds.size() * sizeof(uint16_t)
+			+ m_postingsWeights16.size() * sizeof(uint16_t)
+			+ m_postingsWeights8.size() * sizeof(uint8_t)
+			+ m_postingsScales.size() * sizeof(float);
+}
+
+// --------------------------------------------------------------------------
+
+void InvertedIndex::clearPostingLists() {
+	std::vector<size_t>().swap(m_postingsOffsets);
+	std::vector<uint32_t>().swap(m_postingsImageIds);
+	std::vector<float>().swap(m_postingsWeights);
+	m_postingsEncoding = WEIGHTS_FLOAT32;
+	std::vector<uint16_t>().swap(m_postingsShortImageIds);
+	std::vector<uint16_t>().swap(m_postingsWeights16);
+	std::vector<uint8_t>().swap(m_postingsWeights8);
+	std::vector<float>().swap(m_postingsScales);
+	m_frozen = false;
+	unmap();
+}
+
+// --------------------------------------------------------------------------
+
+void InvertedIndex::freeze(WeightEncoding encoding) {
+
+	if (isFrozen() == true) {
+		return;
+	}
+
+	if (hasPostingLists() == false || m_postingsEncoding != encoding) {
+		buildPostingLists(encoding);
+	}
+
+	for (Word& word : *this) {
+		std::vector<ImageCount>().swap(word.m_imageList);
+	}
+
+	m_frozen = true;
+}
+
+// --------------------------------------------------------------------------
+
+const std::vector<ImageCount>& InvertedIndex::getInvertedFile(int wordIdx,
+		std::vector<ImageCount>& buffer) const {
+
+	if (isFrozen() == false) {
+		return at(wordIdx).m_imageList;
+	}
+
+	const uint32_t* imageIds;
+	const float* weights;
+	PostingListBuffer postingListBuffer;
+
+	size_t numPostings = getPostingList(wordIdx, imageIds, weights,
+			postingListBuffer);
+
+	buffer.resize(numPostings);
+	for (size_t k = 0; k < numPostings; ++k) {
+		buffer[k] = ImageCount(imageIds[k], weights[k]);
+	}
+
+	return buffer;
+}
+
+// --------------------------------------------------------------------------
+
+void InvertedIndex::saveBinary(const std::string& filename,
+		WeightEncoding encoding) const {
+
+	if (empty() == true) {
+		throw std::runtime_error("[InvertedIndex::saveBinary] "
+				"Inverted index is empty");
+	}
+
+	if (encoding != WEIGHTS_FLOAT32 && encoding != WEIGHTS_UINT16
+			&& encoding != WEIGHTS_UINT8) {
+		throw std::runtime_error("[InvertedIndex::saveBinary] "
+				"Unknown weight encoding");
+	}
+
+	std::vector<InvertedFileEntry> words(size());
+	std::vector<unsigned char> postings;
+
+	uint64_t numPostings = 0;
+
+	std::vector<ImageCount> buffer;
+
+	for (size_t i = 0; i < size(); ++i) {
+		const std::vector<ImageCount>& imageList = getInvertedFile(i, buffer);
+
+		InvertedFileEntry& entry = words[i];
+		memset(&entry, 0, sizeof(entry));
+		entry.weight = at(i).m_weight;
+		entry.numPostings = imageList.size();
+		entry.offset = postings.size();
+		entry.scale = 0.0f;
+
+		uint32_t previousId = 0;
+		for (size_t k = 0; k < imageList.size(); ++k) {
+			if (k > 0 && imageList[k].m_index <= previousId) {
+				std::stringstream ss;
+				ss << "[InvertedIndex::saveBinary] Images of the inverted file of"
+						" word [" << i << "] are not in increasing order";
+				throw std::runtime_error(ss.str());
+			}
+			writeVarint(postings, imageList[k].m_index - previousId);
+			previousId = imageList[k].m_index;
+			entry.scale = std::max(entry.scale, imageList[k].m_count);
+		}
+
+		if (encoding == WEIGHTS_FLOAT32) {
+			entry.scale = 1.0f;
+			size_t offset = postings.size();
+			postings.resize(offset + imageList.size() * sizeof(float));
+			for (size_t k = 0; k < imageList.size(); ++k) {
+				memcpy(&postings[offset + k * sizeof(float)],
+						&imageList[k].m_count, sizeof(float));
+			}
+		} else {
+			uint32_t maxQuantized = getMaxQuantizedWeight(encoding);
+			for (const ImageCount& image : imageList) {
+				uint32_t quantized = quantizeWeight(image.m_count, entry.scale,
+						maxQuantized);
+				if (encoding == WEIGHTS_UINT8) {
+					postings.push_back((unsigned char) quantized);
+				} else {
+					uint16_t value = (uint16_t) quantized;
+					const unsigned char* bytes = (const unsigned char*) &value;
+					postings.insert(postings.end(), bytes, bytes + sizeof(value));
+				}
+			}
+		}
+
+		numPostings += imageList.size();
+	}
+
+	InvertedIndexFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, INVERTED_INDEX_FILE_MAGIC,
+			sizeof(INVERTED_INDEX_FILE_MAGIC));
+	header.version = INVERTED_INDEX_FILE_VERSION;
+	header.weightEncoding = encoding;
+	header.numDbImages = m_numDbImages;
+	header.numWords = size();
+	header.numPostings = numPostings;
+	header.wordsOffset = sizeof(header);
+	header.postingsOffset = header.wordsOffset
+			+ words.size() * sizeof(InvertedFileEntry);
+	header.postingsSize = postings.size();
+
+	std::ofstream outputFileStream(filename.c_str(),
+			std::fstream::out | std::fstream::binary);
+
+	if (outputFileStream.good() == false) {
+		throw std::runtime_error("[InvertedIndex::saveBinary] "
+				"Unable to open file [" + filename + "] for writing");
+	}
+
+	outputFileStream.write((const char*) &header, sizeof(header));
+	outputFileStream.write((const char*) words.data(),
+			words.size() * sizeof(InvertedFileEntry));
+	outputFileStream.write((const char*) postings.data(), postings.size());
+
+	if (outputFileStream.good() == false) {
+		throw std::runtime_error("[InvertedIndex::saveBinary] "
+				"Got error while writing file [" + filename + "]");
+	}
+
+	outputFileStream.close();
+}
+
+// --------------------------------------------------------------------------
+
+void InvertedIndex::loadBinary(const std::string& filename,
+		bool decodeOnDemand) {
+
+	cv::Ptr<MappedFile> mappedFile = new MappedFile(filename);
+
+	if (mappedFile->size() < sizeof(InvertedIndexFileHeader)
+			|| memcmp(mappedFile->data(), INVERTED_INDEX_FILE_MAGIC,
+					sizeof(INVERTED_INDEX_FILE_MAGIC)) != 0) {
+		throw std::runtime_error("[InvertedIndex::loadBinary] "
+				"File [" + filename + "] is not a binary inverted index");
+	}
+
+	const InvertedIndexFileHeader& header =
+			*reinterpret_cast<const InvertedIndexFileHeader*>(mappedFile->data());
+
+	if (header.version != INVERTED_INDEX_FILE_VERSION) {
+		throw std::runtime_error("[InvertedIndex::loadBinary] "
+				"Unsupported format version in file [" + filename + "]");
+	}
+
+	if (header.weightEncoding != WEIGHTS_FLOAT32
+			&& header.weightEncoding != WEIGHTS_UINT16
+			&& header.weightEncoding != WEIGHTS_UINT8) {
+		throw std::runtime_error("[InvertedIndex::loadBinary] "
+				"Unknown weight encoding in file [" + filename + "]");
+	}
+
+	// Sizes are checked one at a time so that they cannot overflow
+	uint64_t fileSize = mappedFile->size();
+
+	if (header.wordsOffset < sizeof(header)
+			|| header.wordsOffset % sizeof(uint64_t) != 0
+			|| header.postingsOffset < header.wordsOffset
+			|| header.postingsOffset > fileSize
+			|| header.numWords > uint64_t(INT32_MAX)
+			|| header.numWords
+					> (header.postingsOffset - header.wordsOffset)
+							/ sizeof(InvertedFileEntry)
+			|| header.postingsSize > fileSize - header.postingsOffset
+			|| header.numDbImages > uint64_t(INT32_MAX)) {
+		throw std::runtime_error("[InvertedIndex::loadBinary] "
+				"File [" + filename + "] is truncated or corrupted");
+	}
+
+	const InvertedFileEntry* words =
+			reinterpret_cast<const InvertedFileEntry*>(mappedFile->data()
+					+ header.wordsOffset);
+	const unsigned char* postings = mappedFile->data() + header.postingsOffset;
+
+	// The posting lists must be contiguous and in the order of the words
+	uint64_t numPostings = 0;
+	for (uint64_t i = 0; i < header.numWords; ++i) {
+		uint64_t end =
+				i + 1 < header.numWords ?
+						words[i + 1].offset : header.postingsSize;
+		if (words[i].offset > end || !(words[i].scale >= 0.0f)) {
+			throw std::runtime_error("[InvertedIndex::loadBinary] "
+					"File [" + filename + "] is truncated or corrupted");
+		}
+		numPostings += words[i].numPostings;
+	}
+
+	if (numPostings != header.numPostings) {
+		throw std::runtime_error("[InvertedIndex::loadBinary] "
+				"File [" + filename + "] is truncated or corrupted");
+	}
+
+	clear();
+	clearPostingLists();
+
+	m_numDbImages = header.numDbImages;
+	resize(header.numWords);
+
+	for (uint64_t i = 0; i < header.numWords; ++i) {
+		Word& word = at(i);
+		word.m_weight = words[i].weight;
+
+		if (decodeOnDemand == true) {
+			continue;
+		}
+
+		const unsigned char* end = postings
+				+ (i + 1 < header.numWords ?
+						words[i + 1].offset : header.postingsSize);
+
+		std::vector<uint32_t> imageIds(words[i].numPostings);
+		std::vector<float> weights(words[i].numPostings);
+
+		if (decodePostings(postings + words[i].offset, end, words[i],
+				header.weightEncoding, header.numDbImages, imageIds.data(),
+				weights.data()) == false) {
+			clear();
+			std::stringstream ss;
+			ss << "[InvertedIndex::loadBinary] Posting list of word [" << i
+					<< "] in file [" << filename << "] is corrupted";
+			throw std::runtime_error(ss.str());
+		}
+
+		word.m_imageList.reserve(imageIds.size());
+		for (size_t k = 0; k < imageIds.size(); ++k) {
+			word.m_imageList.push_back(ImageCount(imageIds[k], weights[k]));
+		}
+	}
+
+	if (decodeOnDemand == true) {
+		m_mappedFile = mappedFile;
+		m_mappedWords = words;
+		m_mappedPostings = postings;
+		m_mappedPostingsSize = header.postingsSize;
+	}
+
+}
+
+// --------------------------------------------------------------------------
+
+size_t InvertedIndex::decodePostingList(int wordIdx,
+		const uint32_t*& imageIds, const float*& weights,
+		PostingListBuffer& buffer) const {
+
+	const InvertedFileEntry& entry = m_mappedWords[wordIdx];
+
+	const unsigned char* end = m_mappedPostings
+			+ (wordIdx + 1 < int(size()) ?
+					m_mappedWords[wordIdx + 1].offset : m_mappedPostingsSize);
+
+	const InvertedIndexFileHeader& header =
+			*reinterpret_cast<const InvertedIndexFileHeader*>(m_mappedFile->data());
+
+	buffer.imageIds.resize(entry.numPostings);
+	buffer.weights.resize(entry.numPostings);
+
+	// Quantized weights are bounded by the scale, so they are normalized if it is
+	bool valid = decodePostings(m_mappedPostings + entry.offset, end, entry,
+			header.weightEncoding, header.numDbImages, buffer.imageIds.data(),
+			buffer.weights.data()) && entry.scale <= 1.0f;
+
+	for (size_t k = 0; valid && k < buffer.weights.size(); ++k) {
+		valid = buffer.weights[k] >= 0.0f && buffer.weights[k] <= 1.0f
+				&& (buffer.weights[k] > 0.0f || at(wordIdx).m_weight == 0.0);
+	}
+
+	if (valid == false) {
+		std::stringstream ss;
+		ss << "[InvertedIndex::decodePostingList] Posting list of word ["
+				<< wordIdx << "] is corrupted or not normalized";
+		throw std::runtime_error(ss.str());
+	}
+
+	imageIds = buffer.imageIds.data();
+	weights = buffer.weights.data();
+
+	return entry.numPostings;
+}
+
+// --------------------------------------------------------------------------
+
+void InvertedIndex::unmap() {
+	m_mappedFile.release();
+	m_mappedWords = NULL;
+	m_mappedPostings = NULL;
+	m_mappedPostingsSize = 0;
+}
+
 } /* namespace vlr */
@@ -0,0 +1,447 @@
+/*
+ * ShardedDB.cpp
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: andresf
+ */
+
+#include <ShardedDB.hpp>
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace vlr {
+
+namespace {
+
+// Messages are made of 32-bit integers and floats in host byte order since
+// workers run on the same machine as the coordinator:
+//  - handshake: number of DB images of the shard, or -1 and an error message,
+//    followed by the number of words and their weights as 64-bit floats
+//  - request: number of entries (-1 to stop), k, distance and the entries
+//  - reply: number of images and the (image id, score) pairs, or -1 and an
+//    error message
+// An error message is sent as its length followed by its characters.
+
+const int32_t STOP_REQUEST = -1;
+const int32_t ERROR_REPLY = -1;
+
+/**
+ * Reads exactly len bytes from a socket.
+ *
+ * @return false if the socket was closed or an error occurred
+ */
+bool readAll(int socket, void* data, size_t len) {
+	char* ptr = static_cast<char*>(data);
+	while (len > 0) {
+		ssize_t n = recv(socket, ptr, len, 0);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		ptr += n;
+		len -= n;
+	}
+	return true;
+}
+
+/**
+ * Writes exactly len bytes to a socket.
+ *
+ * @return false if the socket was closed or an error occurred
+ */
+bool writeAll(int socket, const void* data, size_t len) {
+	const char* ptr = static_cast<const char*>(data);
+	while (len > 0) {
+		ssize_t n = send(socket, ptr, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		ptr += n;
+		len -= n;
+	}
+	return true;
+}
+
+bool writeError(int socket, const std::string& message) {
+	int32_t header[2] = { ERROR_REPLY, (int32_t) message.size() };
+	return writeAll(socket, header, sizeof(header))
+			&& writeAll(socket, message.data(), message.size());
+}
+
+bool readError(int socket, std::string& message) {
+	int32_t len;
+	if (readAll(socket, &len, sizeof(len)) == false || len < 0) {
+		return false;
+	}
+	message.resize(len);
+	return len == 0 || readAll(socket, &message[0], len);
+}
+
+} /* namespace */
+
+// --------------------------------------------------------------------------
+
+std::string getShardFilename(const std::string& filename, int shardIdx) {
+
+	const char* extensions[] = { ".yaml.gz", ".xml.gz", ".bin" };
+
+	std::string shard = ".shard" + std::to_string(shardIdx);
+
+	for (const char* extension : extensions) {
+		size_t len = strlen(extension);
+		if (filename.size() > len
+				&& filename.compare(filename.size() - len, len, extension)
+						== 0) {
+			return filename.substr(0, filename.size() - len) + shard
+					+ extension;
+		}
+	}
+
+	return filename + shard;
+}
+
+// --------------------------------------------------------------------------
+
+ShardedDB::ShardedDB() :
+		m_numDbImages(0) {
+}
+
+// --------------------------------------------------------------------------
+
+ShardedDB::~ShardedDB() {
+	stop();
+}
+
+// --------------------------------------------------------------------------
+
+void ShardedDB::start(const std::vector<std::string>& shardFilenames,
+		WeightEncoding postingsEncoding) {
+
+	if (m_sockets.empty() == false) {
+		throw std::runtime_error("[ShardedDB::start] Workers already started");
+	}
+
+	if (shardFilenames.empty() == true) {
+		throw std::runtime_error("[ShardedDB::start] No shards given");
+	}
+
+	for (size_t i = 0; i < shardFilenames.size(); ++i) {
+
+		int sockets[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+			stop();
+			throw std::runtime_error("[ShardedDB::start] Unable to create"
+					" socket: " + std::string(strerror(errno)));
+		}
+
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			close(sockets[0]);
+			close(sockets[1]);
+			stop();
+			throw std::runtime_error("[ShardedDB::start] Unable to fork worker: "
+					+ std::string(strerror(errno)));
+		}
+
+		if (pid == 0) {
+			// Worker: keeps only its own end of the socket. No exception may
+			// leave this block, otherwise it would unwind into the caller's
+			// stack and the worker would go on as a second coordinator.
+			int status = 0;
+			try {
+				close(sockets[0]);
+				for (int socket : m_sockets) {
+					close(socket);
+				}
+				serveShard(sockets[1], shardFilenames[i], postingsEncoding);
+			} catch (...) {
+				status = 1;
+			}
+			close(sockets[1]);
+			_exit(status);
+		}
+
+		close(sockets[1]);
+		m_sockets.push_back(sockets[0]);
+		m_workers.push_back(pid);
+	}
+
+	// Handshake, every worker replies with the number of images of its shard
+	// and the words weights
+	m_offsets.clear();
+	m_numDbImages = 0;
+	m_wordsWeights.clear();
+
+	std::vector<double> weights;
+
+	for (size_t i = 0; i < m_sockets.size(); ++i) {
+		int32_t numDbImages = 0;
+		int32_t numWords = -1;
+		std::string message = "worker exited";
+		if (readAll(m_sockets[i], &numDbImages, sizeof(numDbImages)) == false
+				|| numDbImages < 0
+				|| readAll(m_sockets[i], &numWords, sizeof(numWords)) == false
+				|| numWords < 0) {
+			if (numDbImages == ERROR_REPLY) {
+				readError(m_sockets[i], message);
+			}
+			stop();
+			throw std::runtime_error("[ShardedDB::start] Unable to load shard ["
+					+ shardFilenames[i] + "]: " + message);
+		}
+
+		weights.resize(numWords);
+		if (numWords > 0
+				&& readAll(m_sockets[i], weights.data(),
+						numWords * sizeof(double)) == false) {
+			stop();
+			throw std::runtime_error("[ShardedDB::start] Unable to load shard ["
+					+ shardFilenames[i] + "]: " + message);
+		}
+
+		// Scores of different shards are only comparable if they were weighted
+		// alike
+		if (i == 0) {
+			m_wordsWeights.swap(weights);
+		} else if (weights != m_wordsWeights) {
+			stop();
+			throw std::runtime_error("[ShardedDB::start] Shard ["
+					+ shardFilenames[i] + "] has different words weights than"
+							" shard [" + shardFilenames[0] + "]");
+		}
+
+		m_offsets.push_back(m_numDbImages);
+		m_numDbImages += numDbImages;
+	}
+
+}
+
+// --------------------------------------------------------------------------
+
+void ShardedDB::stop() {
+
+	for (int socket : m_sockets) {
+		int32_t request = STOP_REQUEST;
+		writeAll(socket, &request, sizeof(request));
+		close(socket);
+	}
+
+	for (pid_t pid : m_workers) {
+		while (waitpid(pid, NULL, 0) < 0 && errno == EINTR) {
+		}
+	}
+
+	m_sockets.clear();
+	m_workers.clear();
+	m_offsets.clear();
+	m_numDbImages = 0;
+	m_wordsWeights.clear();
+
+}
+
+// --------------------------------------------------------------------------
+
+void ShardedDB::queryTopK(const SparseBoFVector& query, int k,
+		vlr::ScoringType distance, std::vector<vlr::ImageScore>& topImages) {
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (m_sockets.empty() == true) {
+		throw std::runtime_error("[ShardedDB::queryTopK] Workers not started");
+	}
+
+	topImages.clear();
+
+	k = std::max(0, std::min(k, m_numDbImages));
+
+	// Scatter, every shard scores the query concurrently
+	int32_t header[3] = { (int32_t) query.size(), k, (int32_t) distance };
+
+	// A failed send or receive leaves replies unread in the other sockets, the
+	// workers are then stopped since later queries would read them
+	for (int socket : m_sockets) {
+		if (writeAll(socket, header, sizeof(header)) == false
+				|| writeAll(socket, query.data(),
+						query.size() * sizeof(BoFEntry)) == false) {
+			stop();
+			throw std::runtime_error("[ShardedDB::queryTopK] Unable to send"
+					" query to worker");
+		}
+	}
+
+	// Gather, every reply is read even if one fails so that the sockets are
+	// left ready for the next query
+	std::string error;
+	std::vector<std::pair<int32_t, float> > reply;
+
+	for (size_t i = 0; i < m_sockets.size(); ++i) {
+
+		int32_t count;
+		if (readAll(m_sockets[i], &count, sizeof(count)) == false
+				|| count < ERROR_REPLY || count > k) {
+			stop();
+			throw std::runtime_error("[ShardedDB::queryTopK] Lost connection"
+					" with worker");
+		}
+
+		if (count == ERROR_REPLY) {
+			std::string message;
+			if (readError(m_sockets[i], message) == false) {
+				stop();
+				throw std::runtime_error("[ShardedDB::queryTopK] Lost"
+						" connection with worker");
+			}
+			error = message;
+			continue;
+		}
+
+		reply.resize(count);
+		if (count > 0
+				&& readAll(m_sockets[i], reply.data(),
+						count * sizeof(reply[0])) == false) {
+			stop();
+			throw std::runtime_error("[ShardedDB::queryTopK] Lost connection"
+					" with worker");
+		}
+
+		for (const std::pair<int32_t, float>& image : reply) {
+			topImages.push_back(
+					vlr::ImageScore(m_offsets[i] + image.first, image.second));
+		}
+	}
+
+	if (error.empty() == false) {
+		topImages.clear();
+		throw std::runtime_error("[ShardedDB::queryTopK] " + error);
+	}
+
+	// Merging the top-k of every shard, with the same order as VocabDB::selectTopK
+	std::sort(topImages.begin(), topImages.end(),
+			[](const vlr::ImageScore& a, const vlr::ImageScore& b) {
+				return a.second > b.second
+						|| (a.second == b.second && a.first < b.first);
+			});
+
+	if ((int) topImages.size() > k) {
+		topImages.resize(k);
+	}
+
+}
+
+// --------------------------------------------------------------------------
+
+void ShardedDB::serveShard(int socket, const std::string& shardFilename,
+		WeightEncoding postingsEncoding) {
+
+	InvertedIndex invertedIndex;
+
+	try {
+		invertedIndex.load(shardFilename);
+		invertedIndex.freeze(postingsEncoding);
+	} catch (const std::exception& e) {
+		writeError(socket, e.what());
+		return;
+	}
+
+	int32_t handshake[2] = { invertedIndex.m_numDbImages,
+			(int32_t) invertedIndex.size() };
+	std::vector<double> weights;
+	for (const Word& word : invertedIndex) {
+		weights.push_back(word.m_weight);
+	}
+	if (writeAll(socket, handshake, sizeof(handshake)) == false
+			|| writeAll(socket, weights.data(),
+					weights.size() * sizeof(double)) == false) {
+		return;
+	}
+
+	int32_t numDbImages = handshake[0];
+
+	SparseBoFVector query;
+	std::vector<float> scores;
+	std::vector<vlr::ImageScore> topImages;
+	std::vector<std::pair<int32_t, float> > reply;
+
+	while (true) {
+
+		int32_t numEntries;
+		if (readAll(socket, &numEntries, sizeof(numEntries)) == false
+				|| numEntries == STOP_REQUEST) {
+			return;
+		}
+
+		int32_t params[2];
+		if (numEntries < 0
+				|| readAll(socket, params, sizeof(params)) == false) {
+			return;
+		}
+
+		query.resize(numEntries);
+		if (numEntries > 0
+				&& readAll(socket, query.data(),
+						numEntries * sizeof(BoFEntry)) == false) {
+			return;
+		}
+
+		int k = params[0];
+		vlr::ScoringType distance = (vlr::ScoringType) params[1];
+
+		if (distance != vlr::L1 && distance != vlr::L2
+				&& distance != vlr::COS) {
+			if (writeError(socket, "Unknown scoring type") == false) {
+				return;
+			}
+			continue;
+		}
+
+		bool valid = true;
+		for (const BoFEntry& entry : query) {
+			if (entry.m_wordId < 0
+					|| entry.m_wordId >= (int) invertedIndex.size()) {
+				valid = false;
+				break;
+			}
+		}
+
+		if (valid == false) {
+			if (writeError(socket, "Query word out of vocabulary") == false) {
+				return;
+			}
+			continue;
+		}
+
+		scores.assign(numDbImages, 0.0f);
+		VocabDB::accumulateScores(invertedIndex, query, distance,
+				scores.data());
+		VocabDB::completeScores(scores.data(), numDbImages, distance);
+		VocabDB::selectTopK(scores.data(), numDbImages, k, topImages);
+
+		reply.clear();
+		for (const vlr::ImageScore& image : topImages) {
+			reply.push_back(std::pair<int32_t, float>(image.first, image.second));
+		}
+
+		int32_t count = reply.size();
+		if (writeAll(socket, &count, sizeof(count)) == false
+				|| writeAll(socket, reply.data(), count * sizeof(reply[0]))
+						== false) {
+			return;
+		}
+	}
+
+}
+
+} /* namespace vlr */
@@ -7,24 +7,191 @@
 
 #include <VocabDB.hpp>
 
-#include <opencv2/imgproc/imgproc.hpp>
+#include <Logging.hpp>
+
+#include <algorithm>
 
 namespace vlr {
 
-void VocabDB::saveInvertedIndex(const std::string& filename) const {
-	m_invertedIndex->save(filename);
+namespace {
+
+/**
+ * Contribution to the score of a word present in both the query and a DB image,
+ * there is a specialization per scoring type so that the choice is made once per
+ * query and not once per posting.
+ */
+template<vlr::ScoringType distance>
+struct ScoreTerm;
+
+template<>
+struct ScoreTerm<vlr::L1> {
+	static float compute(float qi, float di) {
+		return fabs(qi - di) - fabs(qi) - fabs(di);
+	}
+};
+
+template<>
+struct ScoreTerm<vlr::L2> {
+	static float compute(float qi, float di) {
+		return qi * di;
+	}
+};
+
+template<>
+struct ScoreTerm<vlr::COS> {
+	static float compute(float qi, float di) {
+		return qi * di;
+	}
+};
+
+template<vlr::ScoringType distance>
+void scorePostings(const vlr::InvertedIndex& invertedIndex,
+		const vlr::SparseBoFVector& query, float* scores) {
+
+	const uint32_t* imageIds;
+	const float* weights;
+	vlr::PostingListBuffer buffer;
+
+	for (const vlr::BoFEntry& entry : query) {
+		float qi = entry.m_weight;
+		size_t numPostings = invertedIndex.getPostingList(entry.m_wordId,
+				imageIds, weights, buffer);
+		for (size_t k = 0; k < numPostings; ++k) {
+			scores[imageIds[k]] += ScoreTerm<distance>::compute(qi, weights[k]);
+		}
+	}
+
 }
 
+/**
+ * Orders image scores by decreasing score and then by increasing image id.
+ */
+bool isBetterScore(const vlr::ImageScore& a, const vlr::ImageScore& b) {
+	return a.second > b.second || (a.second == b.second && a.first < b.first);
+}
+
+} /* namespace */
+
 // --------------------------------------------------------------------------
 
-void VocabDB::loadInvertedIndex(const std::string& filename) {
-	m_invertedIndex->load(filename);
+void VocabDB::saveInvertedIndex(const std::string& filename,
+		WeightEncoding encoding) const {
+	// Removed images are dropped from the raw counts by the refresh
+	refreshDatabase();
+	if (filename.size() >= 4
+			&& filename.compare(filename.size() - 4, 4, ".bin") == 0) {
+		m_invertedIndex->saveBinary(filename, encoding);
+	} else {
+		m_invertedIndex->save(filename);
+	}
+}
+
+// --------------------------------------------------------------------------
+
+void VocabDB::loadInvertedIndex(const std::string& filename,
+		bool decodeOnDemand) {
+	if (m_incremental == true && decodeOnDemand == true) {
+		throw std::runtime_error("[VocabDB::loadInvertedIndex] Incremental"
+				" databases cannot be decoded on demand");
+	}
+
+	if (MappedFile::hasMagic(filename, INVERTED_INDEX_FILE_MAGIC,
+			sizeof(INVERTED_INDEX_FILE_MAGIC)) == true) {
+		m_invertedIndex->loadBinary(filename, decodeOnDemand);
+	} else {
+		m_invertedIndex->load(filename);
+	}
+
+	if (m_incremental == true) {
+		// The inverted files hold the raw counts, which are still needed
+		m_removedImages.clear();
+		m_stale = true;
+	} else {
+		// Loaded indexes are only scored, hence the inverted files are not kept
+		m_invertedIndex->freeze(m_postingsEncoding);
+	}
+}
+
+// --------------------------------------------------------------------------
+
+void VocabDB::freezeDatabase() {
+	if (m_incremental == true) {
+		throw std::runtime_error("[VocabDB::freezeDatabase] Incremental"
+				" databases cannot be frozen");
+	}
+	m_invertedIndex->freeze(m_postingsEncoding);
+}
+
+// --------------------------------------------------------------------------
+
+void VocabDB::quantize(const cv::Mat& features, int* wordIds,
+		int* nodeIds) const {
+
+	double wordWeight; // not needed
+
+	for (int i = 0; i < features.rows; ++i) {
+		quantize(features.row(i), wordIds[i], wordWeight);
+		if (nodeIds != NULL) {
+			nodeIds[i] = -1;
+		}
+	}
+}
+
+// --------------------------------------------------------------------------
+
+void VocabDB::quantize(const cv::Mat& feature, int knn,
+		std::vector<int>& wordIds, std::vector<float>& distances) const {
+
+	CV_Assert(knn > 0);
+
+	wordIds.resize(1);
+	distances.assign(1, 0.0f);
+
+	quantize(feature, wordIds.data(), NULL);
+}
+
+// --------------------------------------------------------------------------
+
+void VocabDB::setSoftAssignment(int knn, double sigma, int maxLeaves,
+		int maxBranches) {
+
+	if (knn < 1) {
+		throw std::runtime_error(
+				"[VocabDB::setSoftAssignment] Number of words per feature must be positive");
+	}
+
+	if (maxBranches < 1) {
+		throw std::runtime_error(
+				"[VocabDB::setSoftAssignment] Number of branches kept must be positive");
+	}
+
+	m_softAssignmentKnn = knn;
+	m_softAssignmentSigma = sigma;
+	// At least as many leaves as words are needed to find knn words
+	m_softAssignmentMaxLeaves = std::max(knn, maxLeaves);
+	m_softAssignmentMaxBranches = maxBranches;
 }
 
 // --------------------------------------------------------------------------
 
 void VocabDB::addImageToDatabase(int dbImgIdx, cv::Mat dbImgFeatures) {
 
+	std::vector<vlr::WordImageCount> counts;
+	std::vector<int> nodeIds;
+
+	quantizeImage(dbImgIdx, dbImgFeatures, counts, &nodeIds);
+
+	addCountsToDatabase(counts, 1);
+
+	addToDirectIndex(dbImgIdx, nodeIds);
+}
+
+// --------------------------------------------------------------------------
+
+void VocabDB::quantizeImage(int dbImgIdx, const cv::Mat& dbImgFeatures,
+		std::vector<vlr::WordImageCount>& counts,
+		std::vector<int>* nodeIds) const {
+
 	int m_veclen = getFeaturesLength();
 
 	if (dbImgFeatures.empty() == false && dbImgFeatures.cols != m_veclen) {
@@ -38,31 +205,123 @@ void VocabDB::addImageToDatabase(int dbImgIdx, cv::Mat dbImgFeatures) {
 
 	if (m_invertedIndex->empty() == true) {
 		throw std::runtime_error(
-				"[VocabDB::addImageToDatabase] Error while adding image,"
+				"[VocabDB::quantizeImage] Error while adding image,"
 						" vocabulary is empty");
 	}
 
-	int wordId;
-	double wordWeight; // not needed
+	std::vector<int> wordIds(dbImgFeatures.rows);
+
+	if (nodeIds != NULL) {
+		// Node ids follow the order of the features, unlike the counts
+		nodeIds->resize(dbImgFeatures.rows);
+		quantize(dbImgFeatures, wordIds.data(), nodeIds->data());
+	} else {
+		quantize(dbImgFeatures, wordIds.data(), NULL);
+	}
+
+	// Features quantized to the same word are merged into a single count
+	std::sort(wordIds.begin(), wordIds.end());
+
+	for (size_t i = 0; i < wordIds.size(); ++i) {
+		if (i > 0 && wordIds[i] == wordIds[i - 1]) {
+			counts.back().m_count += 1.0f;
+		} else {
+			counts.push_back(vlr::WordImageCount(wordIds[i], dbImgIdx, 1.0f));
+		}
+	}
+}
+
+// --------------------------------------------------------------------------
+
+void VocabDB::addCountsToDatabase(
+		const std::vector<vlr::WordImageCount>& counts, int numImages) {
+
+	if (m_invertedIndex->empty() == true) {
+		throw std::runtime_error(
+				"[VocabDB::addCountsToDatabase] Error while adding image,"
+						" vocabulary is empty");
+	}
+
+	if (m_invertedIndex->isFrozen() == true) {
+		throw std::runtime_error(
+				"[VocabDB::addCountsToDatabase] Error while adding image,"
+						" the database is frozen");
+	}
+
+	m_invertedIndex->clearPostingLists();
+
+	for (const vlr::WordImageCount& count : counts) {
+
+		if (count.m_wordId < 0
+				|| count.m_wordId >= int(m_invertedIndex->size())) {
+			std::stringstream ss;
+			ss << "[VocabDB::addCountsToDatabase] Word [" << count.m_wordId
+					<< "] is not in the vocabulary";
+			throw std::runtime_error(ss.str());
+		}
+
+		std::vector<vlr::ImageCount>& imageList =
+				m_invertedIndex->at(count.m_wordId).m_imageList;
+
+		// The images of every inverted file must stay in increasing order
+		if (imageList.empty() == false
+				&& imageList.back().m_index > count.m_imgIdx) {
+			std::stringstream ss;
+			ss << "[VocabDB::addCountsToDatabase] Image [" << count.m_imgIdx
+					<< "] is added after image [" << imageList.back().m_index
+					<< "] to the inverted file of word [" << count.m_wordId
+					<< "]";
+			throw std::runtime_error(ss.str());
+		}
 
-	for (int i = 0; i < dbImgFeatures.rows; ++i) {
-		quantize(dbImgFeatures.row(i), wordId, wordWeight);
-		m_invertedIndex->addFeatureToInvertedFile(wordId, dbImgIdx);
+		if (imageList.empty() == false
+				&& imageList.back().m_index == count.m_imgIdx) {
+			imageList.back().m_count += count.m_count;
+		} else {
+			imageList.push_back(vlr::ImageCount(count.m_imgIdx, count.m_count));
+		}
 	}
 
 	// Increasing the counter of images in the DB
-	++m_invertedIndex->m_numDbImages;
+	m_invertedIndex->m_numDbImages += numImages;
+
+	if (m_incremental == true) {
+		m_stale = true;
+	}
 }
 
 // --------------------------------------------------------------------------
 
 void VocabDB::computeWordsWeights(vlr::WeightingType weighting) {
 
+	std::vector<int> frequencies;
+	getDocumentFrequencies(frequencies);
+
+	computeWordsWeights(weighting, frequencies,
+			m_invertedIndex->m_numDbImages);
+}
+
+// --------------------------------------------------------------------------
+
+void VocabDB::computeWordsWeights(vlr::WeightingType weighting,
+		const std::vector<int>& frequencies, int numDbImages) {
+
 	if (m_invertedIndex->empty()) {
 		throw std::runtime_error("[VocabDB::computeWordsWeights]"
 				" Error while computing words weights, vocabulary is empty");
 	}
 
+	if (m_invertedIndex->isFrozen() == true) {
+		throw std::runtime_error("[VocabDB::computeWordsWeights]"
+				" Error while computing words weights, the database is frozen");
+	}
+
+	if (frequencies.size() != m_invertedIndex->size()) {
+		throw std::runtime_error("[VocabDB::computeWordsWeights]"
+				" Error while computing words weights, the number of document"
+				" frequencies differs from the number of words");
+	}
+
 	if (weighting == vlr::TF) {
 		// Setting constant weight equal to 1
 		for (vlr::Word& word : *m_invertedIndex) {
@@ -71,15 +330,15 @@ void VocabDB::computeWordsWeights(vlr::WeightingType weighting) {
 	} else if (weighting == vlr::TF_IDF) {
 		// Calculating the IDF part of the TF-IDF score, the complete
 		// TF-IDF score is the result of multiplying the weight by the word count
-		for (vlr::Word& word : *m_invertedIndex) {
-			int len = word.m_imageList.size();
+		for (size_t i = 0; i < m_invertedIndex->size(); ++i) {
+			int len = frequencies[i];
 			// because having that a descriptor from all DB images is quantized
 			// to the same word is quite unlikely
 			if (len > 0) {
-				word.m_weight = log(
-						(double) m_invertedIndex->m_numDbImages / (double) len);
+				m_invertedIndex->at(i).m_weight = log(
+						(double) numDbImages / (double) len);
 			} else {
-				word.m_weight = 0.0;
+				m_invertedIndex->at(i).m_weight = 0.0;
 			}
 		}
 	} else if (weighting == vlr::BINARY) {
@@ -92,6 +351,57 @@ void VocabDB::computeWordsWeights(vlr::WeightingType weighting) {
 		throw std::runtime_error(
 				"[VocabDB::computeWordsWeights] Unknown weighting type");
 	}
+
+	m_invertedIndex->clearPostingLists();
+}
+
+// --------------------------------------------------------------------------
+
+void VocabDB::getDocumentFrequencies(std::vector<int>& frequencies) const {
+
+	std::vector<vlr::ImageCount> buffer;
+
+	frequencies.resize(m_invertedIndex->size());
+	for (size_t i = 0; i < m_invertedIndex->size(); ++i) {
+		frequencies[i] = m_invertedIndex->getInvertedFile(i, buffer).size();
+	}
+}
+
+// --------------------------------------------------------------------------
+
+void VocabDB::loadRawCounts(const std::string& filename) {
+
+	if (m_incremental == true) {
+		throw std::runtime_error("[VocabDB::loadRawCounts] Incremental"
+				" databases are loaded by loadInvertedIndex");
+	}
+
+	m_invertedIndex->load(filename);
+	m_removedImages.clear();
+}
+
+// --------------------------------------------------------------------------
+
+void VocabDB::setWordsWeights(const std::vector<double>& weights) {
+
+	if (m_incremental == true) {
+		throw std::runtime_error("[VocabDB::setWordsWeights] Incremental"
+				" databases weight their raw counts when scoring");
+	}
+
+	if (weights.size() != getNumOfWords()) {
+		throw std::runtime_error("[VocabDB::setWordsWeights] Number of"
+				" weights differs from the number of words");
+	}
+
+	m_invertedIndex->clearPostingLists();
+	m_invertedIndex->clear();
+	for (double weight : weights) {
+		m_invertedIndex->push_back(vlr::Word(weight));
+	}
+	m_invertedIndex->m_numDbImages = 0;
+	m_removedImages.clear();
+	m_invertedIndex->freeze(m_postingsEncoding);
 }
 
 // --------------------------------------------------------------------------
@@ -103,6 +413,18 @@ void VocabDB::createDatabase() {
 				" applying weights to words histogram, vocabulary is empty");
 	}
 
+	if (m_invertedIndex->isFrozen() == true) {
+		throw std::runtime_error("[VocabDB::createDatabase] Error while applying weights to words histogram,"
+				" the database is frozen");
+	}
+
+	if (m_incremental == true) {
+		throw std::runtime_error("[VocabDB::createDatabase] Error while"
+				" applying weights to words histogram, the database is incremental");
+	}
+
+	m_invertedIndex->clearPostingLists();
+
 	// Loop over words
 	for (vlr::Word& word : *m_invertedIndex) {
 		// Apply word weight to the image count
@@ -128,6 +450,16 @@ void VocabDB::normalizeDatabase(vlr::NormType normType) {
 				" normalizing DB BoF vectors, vocabulary is empty");
 	}
 
+	if (m_invertedIndex->isFrozen() == true) {
+		throw std::runtime_error("[VocabDB::normalizeDatabase] Error while"
+				" normalizing DB BoF vectors, the database is frozen");
+	}
+
+	if (m_incremental == true) {
+		throw std::runtime_error("[VocabDB::normalizeDatabase] Error while"
+				" normalizing DB BoF vectors, the database is incremental");
+	}
+
 	// Magnitude of a vector is defined as: sum(abs(xi)^p)^(1/p)
 
 	std::vector<float> mags(m_invertedIndex->m_numDbImages, 0.0);
@@ -171,15 +503,182 @@ void VocabDB::normalizeDatabase(vlr::NormType normType) {
 		}
 	}
 
+	// The DB BoF vectors are final, hence they are prepared for scoring
+	m_invertedIndex->buildPostingLists(m_postingsEncoding);
+
 }
 
 // --------------------------------------------------------------------------
 
 void VocabDB::clearDatabase() {
+	m_invertedIndex->clearPostingLists();
 	m_invertedIndex->resize(getNumOfWords(), vlr::Word(1.0));
 	for (vlr::Word& word : *m_invertedIndex) {
 		std::vector<vlr::ImageCount>().swap(word.m_imageList);
 	}
+	m_invertedIndex->m_numDbImages = 0;
+	m_removedImages.clear();
+	m_stale = m_incremental;
+}
+
+// --------------------------------------------------------------------------
+
+void VocabDB::setIncremental(vlr::WeightingType weighting,
+		vlr::NormType norm) {
+
+	if (m_invertedIndex->isFrozen() == true) {
+		throw std::runtime_error("[VocabDB::setIncremental] Error while"
+				" switching to incremental mode, the database is frozen");
+	}
+
+	if (weighting != vlr::TF_IDF && weighting != vlr::TF
+			&& weighting != vlr::BINARY) {
+		throw std::runtime_error(
+				"[VocabDB::setIncremental] Unknown weighting type");
+	}
+
+	if (norm != vlr::NORM_L1 && norm != vlr::NORM_L2) {
+		throw std::runtime_error("[VocabDB::setIncremental] Unknown norm type");
+	}
+
+	m_incremental = true;
+	m_incrementalWeighting = weighting;
+	m_incrementalNorm = norm;
+	m_stale = true;
+}
+
+// --------------------------------------------------------------------------
+
+int VocabDB::appendImage(const cv::Mat& dbImgFeatures) {
+
+	if (m_incremental == false) {
+		throw std::runtime_error("[VocabDB::appendImage] Error while adding"
+				" image, the database is not incremental");
+	}
+
+	int dbImgIdx = m_invertedIndex->m_numDbImages;
+
+	addImageToDatabase(dbImgIdx, dbImgFeatures);
+
+	return dbImgIdx;
+}
+
+// --------------------------------------------------------------------------
+
+void VocabDB::removeImage(int dbImgIdx) {
+
+	if (m_incremental == false) {
+		throw std::runtime_error("[VocabDB::removeImage] Error while removing"
+				" image, the database is not incremental");
+	}
+
+	if (dbImgIdx < 0 || dbImgIdx >= m_invertedIndex->m_numDbImages) {
+		std::stringstream ss;
+		ss << "[VocabDB::removeImage] Image [" << dbImgIdx
+				<< "] is not in the database";
+		throw std::runtime_error(ss.str());
+	}
+
+	m_removedImages.resize(m_invertedIndex->m_numDbImages, false);
+	m_removedImages[dbImgIdx] = true;
+
+	m_invertedIndex->clearPostingLists();
+	m_stale = true;
+}
+
+// --------------------------------------------------------------------------
+
+void VocabDB::refreshDatabase() const {
+
+	if (m_incremental == false) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_refreshMutex);
+
+	if (m_stale == false) {
+		// Refreshed by another thread while waiting for the lock
+		return;
+	}
+
+	vlr::InvertedIndex& invertedIndex = *m_invertedIndex;
+	int numDbImages = invertedIndex.m_numDbImages;
+
+	invertedIndex.clearPostingLists();
+
+	// Drop the postings of the removed images and find the images with features
+	std::vector<bool> hasFeatures(numDbImages, false);
+
+	for (vlr::Word& word : invertedIndex) {
+		if (m_removedImages.empty() == false) {
+			word.m_imageList.erase(
+					std::remove_if(word.m_imageList.begin(),
+							word.m_imageList.end(),
+							[&](const vlr::ImageCount& image) {
+								return image.m_index < m_removedImages.size()
+										&& m_removedImages[image.m_index];
+							}), word.m_imageList.end());
+		}
+		for (const vlr::ImageCount& image : word.m_imageList) {
+			// Entries of unknown images are rejected when building the posting lists
+			if (image.m_index < (unsigned int) numDbImages) {
+				hasFeatures[image.m_index] = true;
+			}
+		}
+	}
+
+	int numImagesWithFeatures = std::count(hasFeatures.begin(),
+			hasFeatures.end(), true);
+
+	// Words weights as computed by computeWordsWeights
+	for (vlr::Word& word : invertedIndex) {
+		if (m_incrementalWeighting == vlr::TF) {
+			word.m_weight = 1.0;
+		} else if (m_incrementalWeighting == vlr::TF_IDF) {
+			int len = word.m_imageList.size();
+			if (len > 0) {
+				word.m_weight = log(
+						(double) numImagesWithFeatures / (double) len);
+			} else {
+				word.m_weight = 0.0;
+			}
+		} else {
+			word.m_weight = -1.0;
+		}
+	}
+
+	// Norms of the weighted BoF vectors as computed by normalizeDatabase
+	m_imageNorms.assign(numDbImages, 0.0);
+
+	for (const vlr::Word& word : invertedIndex) {
+		for (const vlr::ImageCount& image : word.m_imageList) {
+			if (image.m_index >= (unsigned int) numDbImages) {
+				continue;
+			}
+			float count = image.m_count;
+			if (word.m_weight == -1) {
+				count = float(1.0);
+			} else {
+				count *= word.m_weight;
+			}
+			double dim = count;
+			if (m_incrementalNorm == vlr::NORM_L1) {
+				m_imageNorms[image.m_index] += fabs(dim);
+			} else {
+				m_imageNorms[image.m_index] += pow(dim, 2);
+			}
+		}
+	}
+
+	if (m_incrementalNorm == vlr::NORM_L2) {
+		for (size_t i = 0; i < m_imageNorms.size(); ++i) {
+			m_imageNorms[i] = sqrt(m_imageNorms[i]);
+		}
+	}
+
+	invertedIndex.buildPostingLists(m_postingsEncoding, m_imageNorms);
+
+	m_stale = false;
 }
 
 // --------------------------------------------------------------------------
@@ -214,125 +713,267 @@ void VocabDB::scoreQuery(const cv::Mat& queryImgFeatures, cv::Mat& scores,
 				"[VocabDB::scoreQuery] Unknown scoring method");
 	}
 
+	if (m_stale == true) {
+		refreshDatabase();
+	}
+
+	if (m_invertedIndex->hasPostingLists() == false) {
+		throw std::runtime_error("[VocabDB::scoreQuery]"
+				" Error while scoring query, DB BoF vectors are not normalized");
+	}
+
 	scores = cv::Mat::zeros(1, m_invertedIndex->m_numDbImages,
 			cv::DataType<float>::type);
 
-	cv::Mat queryBoFVector;
+	vlr::StageTimer quantizeTimer(m_timings, "quantize");
+
+	vlr::SparseBoFVector queryBoFVector;
 	transform(queryImgFeatures, queryBoFVector, norm);
 
+	quantizeTimer.stop();
+
+	vlr::StageTimer scoreTimer(m_timings, "score");
+
 	//	Efficient scoring query BoF vector against all DB BoF vectors
 
 	// ||v - w||_{L1} = 2 + Sum(|v_i - w_i| - |v_i| - |w_i|)
 	// ||v - w||_{L2} = sqrt( 2 - 2 * Sum(v_i * w_i) )
 
-	// Calculating sum part of the efficient score implementation
-	for (size_t wordId = 0; wordId < m_invertedIndex->size(); ++wordId) {
-		float qi = queryBoFVector.at<float>(0, wordId);
+	// Calculating sum part of the efficient score implementation, only the
+	// posting lists of the words present in the query are visited
+	accumulateScores(*m_invertedIndex, queryBoFVector, distance,
+			scores.ptr<float>(0));
+
+	// Completing efficient score implementation
+	completeScores(scores.ptr<float>(0), scores.cols, distance);
+
+}
+
+// --------------------------------------------------------------------------
 
-		// Early exit
-		if (qi == 0.0) {
-			continue;
+void VocabDB::completeScores(float* scores, int numScores,
+		vlr::ScoringType distance) {
+
+	if (distance == vlr::L1) {
+		for (int i = 0; i < numScores; ++i) {
+			scores[i] = (float) (-scores[i] / 2.0);
+		}
+	} else if (distance == vlr::L2) {
+		for (int i = 0; i < numScores; ++i) {
+			if (scores[i] >= 1) {
+				// To avoid rounding errors
+				scores[i] = 1.0;
+			} else {
+				// To make it be in the range [0,1]
+				scores[i] = 1.0 - sqrt(1.0 - scores[i]);
+			}
 		}
+	} else if (distance == vlr::COS) {
+		// Do nothing since qi and di are already in the range [0,1]
+	}
 
-		// The inverted file of a word contains all images counts quantized into that word
-		// i.e. if they are there its because their count di is not zero
+}
 
-		// In addition its fair computing qi against di without further verification
-		// since the inverted files contain not null counts
+// --------------------------------------------------------------------------
 
-		for (int imageId = 0;
-				imageId < int(m_invertedIndex->at(wordId).m_imageList.size());
-				++imageId) {
-			float di = m_invertedIndex->at(wordId).m_imageList[imageId].m_count;
+void VocabDB::queryTopK(const cv::Mat& queryImgFeatures, int k,
+		vlr::NormType norm, vlr::ScoringType distance,
+		std::vector<vlr::ImageScore>& topImages) const {
 
-			// qi cannot be zero because we are considering only when its non-zero
-			// qi cannot be more than 1 because it is supposed to be normalized
-			CV_Assert(qi > 0 && qi <= 1.0);
+	cv::Mat scores;
+	scoreQuery(queryImgFeatures, scores, norm, distance);
 
-			// di cannot be more than 1 because it is supposed to be normalized
-			CV_Assert(di <= 1.0);
+	vlr::StageTimer selectTimer(m_timings, "select");
 
-			// di cannot be zero (unless the weight is zero) because the inverted files
-			// contain only counts for images with a descriptor which was quantized
-			// into that word
-			if (m_invertedIndex->at(wordId).m_weight != 0.0) {
-				CV_Assert(di > 0.0);
-			} else {
-				CV_Assert(di >= 0.0);
-			}
+	selectTopK(scores.ptr<float>(0), scores.cols, k, topImages);
 
-			if (distance == vlr::L1) {
-				scores.at<float>(0,
-						m_invertedIndex->at(wordId).m_imageList[imageId].m_index) +=
-						(float) (fabs(qi - di) - fabs(qi) - fabs(di));
-			} else if (distance == vlr::L2 || distance == vlr::COS) {
-				scores.at<float>(0,
-						m_invertedIndex->at(wordId).m_imageList[imageId].m_index) +=
-						(float) qi * di;
-			}
-		}
+}
+
+// --------------------------------------------------------------------------
+
+void VocabDB::selectTopK(const float* scores, int numScores, int k,
+		std::vector<vlr::ImageScore>& topImages) {
+
+	k = std::max(0, std::min(k, numScores));
+
+	topImages.clear();
+	topImages.reserve(k);
+
+	if (k == 0) {
+		return;
 	}
 
-	// Completing efficient score implementation
-	for (int i = 0; i < scores.cols; ++i) {
-		if (distance == vlr::L1) {
-			scores.at<float>(0, i) = (float) (-scores.at<float>(0, i) / 2.0);
-		} else if (distance == vlr::L2) {
-			if (scores.at<float>(0, i) >= 1) {
-				// To avoid rounding errors
-				scores.at<float>(0, i) = 1.0;
-			} else {
-				// To make it be in the range [0,1]
-				scores.at<float>(0, i) = 1.0
-						- sqrt(1.0 - scores.at<float>(0, i));
-			}
-		} else if (distance == vlr::COS) {
-			// Do nothing since qi and di are already in the range [0,1]
+	// Heap whose front is the worst of the best scores found so far
+	for (int i = 0; i < numScores; ++i) {
+		vlr::ImageScore candidate(i, scores[i]);
+		if ((int) topImages.size() < k) {
+			topImages.push_back(candidate);
+			std::push_heap(topImages.begin(), topImages.end(), isBetterScore);
+		} else if (isBetterScore(candidate, topImages.front())) {
+			std::pop_heap(topImages.begin(), topImages.end(), isBetterScore);
+			topImages.back() = candidate;
+			std::push_heap(topImages.begin(), topImages.end(), isBetterScore);
 		}
 	}
 
+	// Leaves the best score first
+	std::sort_heap(topImages.begin(), topImages.end(), isBetterScore);
+
 }
 
 // --------------------------------------------------------------------------
 
-void VocabDB::transform(const cv::Mat& featuresVector, cv::Mat& bofVector,
-		vlr::NormType norm) const {
+void VocabDB::accumulateScores(const vlr::InvertedIndex& invertedIndex,
+		const vlr::SparseBoFVector& queryBoFVector, vlr::ScoringType distance,
+		float* scores) {
+
+	// The query entries are non-zero and normalized by construction while the
+	// posting lists are validated when built, hence no check is done here
+	if (distance == vlr::L1) {
+		scorePostings<vlr::L1>(invertedIndex, queryBoFVector, scores);
+	} else if (distance == vlr::L2) {
+		scorePostings<vlr::L2>(invertedIndex, queryBoFVector, scores);
+	} else if (distance == vlr::COS) {
+		scorePostings<vlr::COS>(invertedIndex, queryBoFVector, scores);
+	} else {
+		throw std::runtime_error(
+				"[VocabDB::accumulateScores] Unknown scoring method");
+	}
 
-	// Initialize query BoF vector
-	bofVector = cv::Mat::zeros(1, m_invertedIndex->size(),
-			cv::DataType<float>::type);
+}
 
-	int wordIdx;
-	double wordWeight;
+// --------------------------------------------------------------------------
+
+void VocabDB::transform(const cv::Mat& featuresVector,
+		vlr::SparseBoFVector& bofVector, vlr::NormType norm) const {
+
+	bofVector.clear();
 
 	int numInvertedFiles = m_invertedIndex->size();
 
-	bool binaryze = false;
+	// Collect one vote per feature and word, the votes of each word are then
+	// merged by sorting, so the cost does not depend on the vocabulary size
+	if (m_softAssignmentKnn == 1) {
+
+		// Quantize all query image feature vectors at once
+		std::vector<int> wordIds(featuresVector.rows);
+		quantize(featuresVector, wordIds.data(), NULL);
+
+		bofVector.reserve(wordIds.size());
+		for (int wordIdx : wordIds) {
+			bofVector.push_back(vlr::BoFEntry(wordIdx, 1.0f));
+		}
+
+	} else {
+
+		std::vector<int> wordIds;
+		std::vector<float> distances;
+		std::vector<double> votes;
+
+		bofVector.reserve(featuresVector.rows * m_softAssignmentKnn);
+
+		for (int i = 0; i < featuresVector.rows; ++i) {
+
+			quantize(featuresVector.row(i), m_softAssignmentKnn, wordIds,
+					distances);
 
-	// Quantize each query image feature vector
-	for (int i = 0; i < featuresVector.rows; ++i) {
+			CV_Assert(wordIds.empty() == false);
+			CV_Assert(wordIds.size() == distances.size());
 
-		quantize(featuresVector.row(i), wordIdx, wordWeight);
+			// Gaussian weights are taken relative to the nearest word, which
+			// leaves the normalized votes unchanged while avoiding underflow
+			double nearest = distances[0];
+			double sigma =
+					m_softAssignmentSigma > 0.0 ?
+							m_softAssignmentSigma : nearest;
 
-		if (wordIdx > numInvertedFiles - 1) {
+			votes.assign(wordIds.size(), 0.0);
+			votes[0] = 1.0;
+			double votesSum = 1.0;
+
+			if (sigma > 0.0) {
+				for (size_t j = 1; j < wordIds.size(); ++j) {
+					double d = distances[j];
+					votes[j] = exp(
+							-(d * d - nearest * nearest) / (2 * sigma * sigma));
+					votesSum += votes[j];
+				}
+			}
+
+			for (size_t j = 0; j < wordIds.size(); ++j) {
+				bofVector.push_back(
+						vlr::BoFEntry(wordIds[j], (float) (votes[j] / votesSum)));
+			}
+		}
+
+	}
+
+	std::sort(bofVector.begin(), bofVector.end());
+
+	// Merge the votes for the same word and apply the word weight
+	size_t numWords = 0;
+	for (size_t i = 0; i < bofVector.size();) {
+
+		int wordIdx = bofVector[i].m_wordId;
+
+		if (wordIdx < 0 || wordIdx > numInvertedFiles - 1) {
 			throw std::runtime_error(
 					"[VocabDB::transform] Feature quantized into a non-existent word");
 		}
 
-		if (wordWeight == -1.0) {
-			binaryze = true;
+		double count = 0.0;
+		for (; i < bofVector.size() && bofVector[i].m_wordId == wordIdx; ++i) {
+			count += bofVector[i].m_weight;
 		}
 
-		bofVector.at<float>(0, wordIdx) += (float) wordWeight;
+		double wordWeight = m_invertedIndex->at(wordIdx).m_weight;
+
+		// Binary weighting is hinted by a weight equal to -1
+		double value = wordWeight == -1.0 ? 1.0 : count * wordWeight;
+
+		// Words with a null weight do not contribute to the score
+		if (value != 0.0) {
+			bofVector[numWords++] = vlr::BoFEntry(wordIdx, (float) value);
+		}
+	}
+	bofVector.resize(numWords);
+
+	//	Normalizing query BoF vector over its non-zero entries
+	double magnitude = 0.0;
+	for (const vlr::BoFEntry& entry : bofVector) {
+		if (norm == vlr::NORM_L1) {
+			magnitude += fabs(entry.m_weight);
+		} else {
+			magnitude += entry.m_weight * entry.m_weight;
+		}
 	}
 
-	if (binaryze) {
-		cv::threshold(bofVector, bofVector, 0, 1.0, cv::THRESH_BINARY);
+	if (norm != vlr::NORM_L1) {
+		magnitude = sqrt(magnitude);
 	}
 
-	//	Normalizing query BoF vector
-	cv::normalize(bofVector, bofVector, 1, 0,
-			norm == vlr::NORM_L1 ? cv::NORM_L1 : cv::NORM_L2);
+	if (magnitude > 0.0) {
+		for (vlr::BoFEntry& entry : bofVector) {
+			entry.m_weight = (float) (entry.m_weight / magnitude);
+		}
+	}
+
+}
+
+// --------------------------------------------------------------------------
+
+void VocabDB::transform(const cv::Mat& featuresVector, cv::Mat& bofVector,
+		vlr::NormType norm) const {
+
+	vlr::SparseBoFVector sparseBoFVector;
+	transform(featuresVector, sparseBoFVector, norm);
+
+	bofVector = cv::Mat::zeros(1, m_invertedIndex->size(),
+			cv::DataType<float>::type);
+
+	for (const vlr::BoFEntry& entry : sparseBoFVector) {
+		bofVector.at<float>(0, entry.m_wordId) = entry.m_weight;
+	}
 
 }
 
@@ -350,14 +991,14 @@ void VocabDB::getDatabaseBoFVector(unsigned int dbImgIdx,
 	dbBoFVector = cv::Mat::zeros(1, m_invertedIndex->size(),
 			cv::DataType<float>::type);
 
+	std::vector<vlr::ImageCount> buffer;
+
 	for (int wordId = 0; wordId < int(m_invertedIndex->size()); ++wordId) {
-		for (int imageId = 0;
-				imageId < int(m_invertedIndex->at(wordId).m_imageList.size());
-				++imageId) {
-			if (m_invertedIndex->at(wordId).m_imageList[imageId].m_index
-					== dbImgIdx) {
-				dbBoFVector.at<float>(0, wordId) =
-						m_invertedIndex->at(wordId).m_imageList[imageId].m_count;
+		const std::vector<vlr::ImageCount>& imageList =
+				m_invertedIndex->getInvertedFile(wordId, buffer);
+		for (const vlr::ImageCount& image : imageList) {
+			if (image.m_index == dbImgIdx) {
+				dbBoFVector.at<float>(0, wordId) = image.m_count;
 			}
 		}
 	}
@@ -374,7 +1015,8 @@ int HKMDB::getFeaturesLength() const {
 void HKMDB::quantize(const cv::Mat& feature, int& wordId,
 		double& wordWeight) const {
 
-	double mytime = cv::getTickCount();
+	bool debug = vlr::isLogEnabled(vlr::LOG_DEBUG);
+	double mytime = debug == true ? (double) cv::getTickCount() : 0.0;
 
 	wordId = -1;
 	int nodeAtL = -1;
@@ -387,14 +1029,37 @@ void HKMDB::quantize(const cv::Mat& feature, int& wordId,
 
 	wordWeight = m_invertedIndex->at(wordId).m_weight;
 
-	mytime = ((double) cv::getTickCount() - mytime) / cv::getTickFrequency()
-			* 1000;
-	printf("   Descriptor quantized in [%lf] ms\n", mytime);
+	if (debug == true) {
+		mytime = ((double) cv::getTickCount() - mytime)
+				/ cv::getTickFrequency() * 1000;
+		vlr::logMessage(vlr::LOG_DEBUG,
+				"   Descriptor quantized in [%lf] ms\n", mytime);
+	}
 
 }
 
 // --------------------------------------------------------------------------
 
+void HKMDB::quantize(const cv::Mat& features, int* wordIds,
+		int* nodeIds) const {
+	m_bofModel->quantize(features, m_directIndex->getLevel(), wordIds, nodeIds);
+}
+
+// --------------------------------------------------------------------------
+
+void HKMDB::quantize(const cv::Mat& feature, int knn,
+		std::vector<int>& wordIds, std::vector<float>& distances) const {
+	// Visiting at least as many leaves as words are requested, more leaves
+	// may be set to improve the recall of the closest words
+	m_bofModel->quantize(feature, knn,
+			vlr::VocabTreeSearchParams(
+					std::max(knn, m_softAssignmentMaxLeaves),
+					m_softAssignmentMaxBranches),
+			wordIds, distances);
+}
+
+// --------------------------------------------------------------------------
+
 void HKMDB::loadBoFModel(const std::string& filename) {
 	m_bofModel->load(filename);
 	setDirectIndexLevel(m_levelsUp);
@@ -408,7 +1073,13 @@ size_t HKMDB::getNumOfWords() const {
 
 // --------------------------------------------------------------------------
 
-int HKMDB::getDirectIndexLevel() {
+void HKMDB::addToDirectIndex(int dbImgIdx, const std::vector<int>& nodeIds) {
+	m_directIndex->addImage(dbImgIdx, nodeIds);
+}
+
+// --------------------------------------------------------------------------
+
+int HKMDB::getDirectIndexLevel() const {
 	return m_directIndex->getLevel();
 }
 
@@ -442,8 +1113,21 @@ void HKMDB::saveDirectIndex(const std::string& filename) const {
 // --------------------------------------------------------------------------
 
 void HKMDB::loadDirectIndex(const std::string& filename) {
+
+	int level = m_directIndex->getLevel();
+
 	m_directIndex->clear();
 	m_directIndex->load(filename);
+
+	if (m_directIndex->getLevel() != level) {
+		std::stringstream ss;
+		ss << "[HKMDB::loadDirectIndex] Direct index level is ["
+				<< m_directIndex->getLevel() << "] while the vocabulary tree"
+				" one is [" << level << "]";
+		m_directIndex->clear();
+		m_directIndex->setLevel(level);
+		throw std::runtime_error(ss.str());
+	}
 }
 
 // --------------------------------------------------------------------------
@@ -474,7 +1158,8 @@ size_t AKMajDB::getNumOfWords() const {
 void AKMajDB::quantize(const cv::Mat& feature, int& wordId,
 		double& wordWeight) const {
 
-	double mytime = cv::getTickCount();
+	bool debug = vlr::isLogEnabled(vlr::LOG_DEBUG);
+	double mytime = debug == true ? (double) cv::getTickCount() : 0.0;
 
 	int knn = 1;
 
@@ -496,10 +1181,75 @@ void AKMajDB::quantize(const cv::Mat& feature, int& wordId,
 	delete[] indices.data;
 	delete[] distances.data;
 
-	mytime = ((double) cv::getTickCount() - mytime) / cv::getTickFrequency()
-			* 1000;
-	printf("   Descriptor quantized in [%lf] ms\n", mytime);
+	if (debug == true) {
+		mytime = ((double) cv::getTickCount() - mytime)
+				/ cv::getTickFrequency() * 1000;
+		vlr::logMessage(vlr::LOG_DEBUG,
+				"   Descriptor quantized in [%lf] ms\n", mytime);
+	}
+
+}
+
+// --------------------------------------------------------------------------
+
+void AKMajDB::quantize(const cv::Mat& features, int* wordIds,
+		int* nodeIds) const {
+
+	if (features.rows == 0) {
+		return;
+	}
+
+	int knn = 1;
+
+	// Searching all the feature vectors at once, word ids are written straight
+	// into the output array since there is a single neighbor per feature vector
+	cv::Mat queries = features.isContinuous() ? features : features.clone();
+
+	cvflann::Matrix<int> indices(wordIds, queries.rows, knn);
+
+	std::vector<int> distancesData(queries.rows * knn, 0);
+	cvflann::Matrix<int> distances(distancesData.data(), queries.rows, knn);
 
+	m_nnIndex->knnSearch(
+			cvflann::Matrix<uchar>((uchar*) queries.data, queries.rows,
+					queries.cols), indices, distances, knn,
+			cvflann::SearchParams());
+
+	if (nodeIds != NULL) {
+		std::fill(nodeIds, nodeIds + queries.rows, -1);
+	}
+}
+
+// --------------------------------------------------------------------------
+
+void AKMajDB::quantize(const cv::Mat& feature, int knn,
+		std::vector<int>& wordIds, std::vector<float>& distances) const {
+
+	CV_Assert(knn > 0);
+	CV_Assert(feature.rows == 1);
+
+	knn = std::min(knn, int(getNumOfWords()));
+
+	cv::Mat query = feature.isContinuous() ? feature : feature.clone();
+
+	std::vector<int> indicesData(knn, -1);
+	cvflann::Matrix<int> indices(indicesData.data(), 1, knn);
+
+	std::vector<int> distancesData(knn, 0);
+	cvflann::Matrix<int> dists(distancesData.data(), 1, knn);
+
+	m_nnIndex->knnSearch(
+			cvflann::Matrix<uchar>((uchar*) query.data, 1, query.cols),
+			indices, dists, knn, cvflann::SearchParams());
+
+	// Neighbors are returned sorted by increasing distance,
+	// those not found are left as -1
+	wordIds.clear();
+	distances.clear();
+	for (int j = 0; j < knn && indicesData[j] != -1; ++j) {
+		wordIds.push_back(indicesData[j]);
+		distances.push_back((float) distancesData[j]);
+	}
 }
 
 // --------------------------------------------------------------------------
@@ -552,7 +1302,8 @@ int IncrementaKMeansDB::getFeaturesLength() const {
 
 void IncrementaKMeansDB::quantize(const cv::Mat& feature, int& wordId, double& wordWeight) const {
 
-	double mytime = cv::getTickCount();
+	bool debug = vlr::isLogEnabled(vlr::LOG_DEBUG);
+	double mytime = debug == true ? (double) cv::getTickCount() : 0.0;
 
 	wordId = -1;
 
@@ -565,9 +1316,10 @@ void IncrementaKMeansDB::quantize(const cv::Mat& feature, int& wordId, double& w
 
 	wordWeight = m_invertedIndex->at(wordId).m_weight;
 
-	mytime = ((double) cv::getTickCount() - mytime) / cv::getTickFrequency() * 1000;
-
-	printf("   Descriptor quantized in [%lf] ms\n", mytime);
+	if (debug == true) {
+		mytime = ((double) cv::getTickCount() - mytime) / cv::getTickFrequency() * 1000;
+		vlr::logMessage(vlr::LOG_DEBUG, "   Descriptor quantized in [%lf] ms\n", mytime);
+	}
 
 }
 
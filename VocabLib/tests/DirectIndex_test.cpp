@@ -41,17 +41,103 @@ TEST(DirectIndex, AddFeature) {
 	EXPECT_TRUE(di->size() == 5);
 
 	for (size_t imgIdx = 0; imgIdx < 5; ++imgIdx) {
-		vlr::TreeNode node = di->lookUpImg(imgIdx);
+		vlr::NodeFeatureRange features = di->lookUpImg(imgIdx);
 
 		// Check each image index has four nodes
-		EXPECT_TRUE(node.size() == 4);
+		EXPECT_TRUE(features.getNumNodes() == 4);
 
-		for (vlr::TreeNode::iterator it = node.begin(); it != node.end();
-				it++) {
-			// Check each nodes has 3000 features
-			EXPECT_TRUE(it->second.size() == 3000);
+		for (size_t nodeIdx = 0; nodeIdx < 4; ++nodeIdx) {
+			// Check each nodes has 3000 features, contiguous and sorted
+			for (size_t featIdx = 0; featIdx < 3000; ++featIdx) {
+				const vlr::NodeFeature& feature = features.begin()[nodeIdx
+						* 3000 + featIdx];
+				EXPECT_EQ(int(nodes[nodeIdx]), feature.m_nodeId);
+				EXPECT_EQ(int(featIdx), feature.m_featureId);
+			}
+		}
+	}
+
+	// Images are added in order
+	EXPECT_THROW(di->addFeature(2, 3, 0), std::runtime_error);
+}
+
+TEST(DirectIndex, AddUnsortedFeatures) {
+
+	vlr::DirectIndex di(2);
+
+	// Features given in feature order as produced by quantizing an image
+	int nodeIds[6] = { 7, 3, 7, -1, 3, 5 };
+
+	for (int featIdx = 0; featIdx < 6; ++featIdx) {
+		if (nodeIds[featIdx] >= 0) {
+			di.addFeature(0, nodeIds[featIdx], featIdx);
+		}
+	}
+
+	// Image 1 is skipped and image 2 is added at once
+	di.addImage(2, std::vector<int>(nodeIds, nodeIds + 6));
+
+	ASSERT_EQ(3u, di.size());
+	EXPECT_TRUE(di.lookUpImg(1).empty());
+
+	int expected[5][2] = { { 3, 1 }, { 3, 4 }, { 5, 5 }, { 7, 0 }, { 7, 2 } };
+
+	for (int imgIdx : { 0, 2 }) {
+		vlr::NodeFeatureRange features = di.lookUpImg(imgIdx);
+		ASSERT_EQ(5u, features.size());
+		EXPECT_EQ(3u, features.getNumNodes());
+		for (int i = 0; i < 5; ++i) {
+			EXPECT_EQ(expected[i][0], features.begin()[i].m_nodeId);
+			EXPECT_EQ(expected[i][1], features.begin()[i].m_featureId);
 		}
 	}
+
+	EXPECT_THROW(di.lookUpImg(3), std::out_of_range);
+	EXPECT_THROW(di.addImage(2, std::vector<int>()), std::runtime_error);
+
+	di.clear();
+	EXPECT_EQ(0u, di.size());
+	EXPECT_EQ(0u, di.getNumFeatures());
+}
+
+TEST(DirectIndex, IntersectNodes) {
+
+	vlr::DirectIndex di;
+
+	int nodes1[5] = { 1, 4, 4, 9, 12 };
+	int nodes2[5] = { 4, 2, 12, 12, 8 };
+
+	di.addImage(0, std::vector<int>(nodes1, nodes1 + 5));
+	di.addImage(1, std::vector<int>(nodes2, nodes2 + 5));
+
+	std::vector<int> sharedNodes;
+	std::vector<std::pair<int, int> > pairs;
+
+	vlr::intersectNodes(di.lookUpImg(0), di.lookUpImg(1),
+			[&](int nodeId, const vlr::NodeFeature* begin1,
+					const vlr::NodeFeature* end1,
+					const vlr::NodeFeature* begin2,
+					const vlr::NodeFeature* end2) {
+				sharedNodes.push_back(nodeId);
+				for (const vlr::NodeFeature* f1 = begin1; f1 != end1; ++f1) {
+					for (const vlr::NodeFeature* f2 = begin2; f2 != end2; ++f2) {
+						pairs.push_back(
+								std::pair<int, int>(f1->m_featureId,
+										f2->m_featureId));
+					}
+				}
+			});
+
+	ASSERT_EQ(2u, sharedNodes.size());
+	EXPECT_EQ(4, sharedNodes[0]);
+	EXPECT_EQ(12, sharedNodes[1]);
+
+	// Node 4: features {1, 2} x {0}, node 12: features {4} x {2, 3}
+	ASSERT_EQ(4u, pairs.size());
+	EXPECT_EQ(std::make_pair(1, 0), pairs[0]);
+	EXPECT_EQ(std::make_pair(2, 0), pairs[1]);
+	EXPECT_EQ(std::make_pair(4, 2), pairs[2]);
+	EXPECT_EQ(std::make_pair(4, 3), pairs[3]);
 }
 
 TEST(DirectIndex, SaveLoad) {
@@ -79,20 +165,43 @@ TEST(DirectIndex, SaveLoad) {
 	EXPECT_TRUE(indexOne->size() == indexTwo->size());
 
 	for (size_t imgIdx = 0; imgIdx < indexOne->size(); ++imgIdx) {
-		vlr::TreeNode nodeOne = indexOne->lookUpImg(imgIdx), nodeTwo =
-				indexTwo->lookUpImg(imgIdx);
+		vlr::NodeFeatureRange featuresOne = indexOne->lookUpImg(imgIdx),
+				featuresTwo = indexTwo->lookUpImg(imgIdx);
 
 		// Check each image index has four nodes
-		EXPECT_TRUE(nodeOne.size() == nodeTwo.size());
-
-		vlr::TreeNode::iterator itOne = nodeOne.begin(), itTwo =
-				nodeTwo.begin();
+		EXPECT_TRUE(featuresOne.getNumNodes() == featuresTwo.getNumNodes());
 
-		for (; itOne != nodeOne.end() && itTwo != nodeTwo.end();
-				++itOne, ++itTwo) {
-			// Check each nodes has 3000 features
-			EXPECT_TRUE(itOne->second.size() == itTwo->second.size());
-		}
+		// Check each nodes has the same features
+		EXPECT_TRUE(featuresOne.size() == featuresTwo.size());
 	}
 
+	// Check node ids are kept
+	EXPECT_TRUE(*indexOne == *indexTwo);
+
+}
+
+TEST(DirectIndex, SaveLoadBinary) {
+
+	vlr::DirectIndex indexOne(4);
+
+	int nodes[6] = { 9, 2, 9, -1, 2, 5 };
+
+	indexOne.addImage(0, std::vector<int>(nodes, nodes + 6));
+	// Image without features
+	indexOne.addImage(1, std::vector<int>());
+	indexOne.addImage(2, std::vector<int>(nodes, nodes + 3));
+
+	indexOne.save("test_di.bin");
+
+	vlr::DirectIndex indexTwo;
+	indexTwo.load("test_di.bin");
+
+	EXPECT_EQ(4, indexTwo.getLevel());
+	EXPECT_EQ(3u, indexTwo.size());
+	EXPECT_TRUE(indexTwo.lookUpImg(1).empty());
+	EXPECT_TRUE(indexOne == indexTwo);
+
+	// An empty index cannot be saved
+	EXPECT_THROW(vlr::DirectIndex().save("test_di.bin"), std::runtime_error);
+
 }
@@ -5,6 +5,11 @@
  *      Author: andresf
  */
 
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+
 #include <gtest/gtest.h>
 #include <opencv2/core/core.hpp>
 
@@ -83,3 +88,221 @@ TEST(InvertedIndex, SaveLoad) {
 	EXPECT_TRUE(index == indexLoaded);
 
 }
+
+TEST(InvertedIndex, InvalidPostingLists) {
+
+	vlr::InvertedIndex index;
+	index.m_numDbImages = 2;
+
+	vlr::Word w(1.0);
+	w.m_imageList.push_back(vlr::ImageCount(0, 0.5));
+	w.m_imageList.push_back(vlr::ImageCount(1, 0.5));
+	index.push_back(w);
+
+	index.buildPostingLists();
+	EXPECT_TRUE(index.hasPostingLists());
+
+	// Counts not normalized
+	index[0].m_imageList[1].m_count = 3.0;
+	EXPECT_THROW(index.buildPostingLists(), std::runtime_error);
+	EXPECT_FALSE(index.hasPostingLists());
+
+	// Non-existent image
+	index[0].m_imageList[1] = vlr::ImageCount(2, 0.5);
+	EXPECT_THROW(index.buildPostingLists(), std::runtime_error);
+
+}
+
+TEST(InvertedIndex, SaveLoadBinary) {
+
+	vlr::InvertedIndex index;
+	index.m_numDbImages = 300;
+
+	// Words with long, short and empty posting lists, ids spanning several varint bytes
+	for (int wordIdx = 0; wordIdx < 4; ++wordIdx) {
+		vlr::Word w(0.5 + wordIdx);
+		for (int imgIdx = wordIdx; wordIdx < 3 && imgIdx < 300; imgIdx +=
+				1 + 70 * wordIdx) {
+			w.m_imageList.push_back(
+					vlr::ImageCount(imgIdx, 1.0 / (1 + imgIdx % 13)));
+		}
+		index.push_back(w);
+	}
+
+	index.buildPostingLists();
+
+	index.saveBinary("test_inv_idx.bin");
+
+	// Loading through the generic method detects the binary format
+	vlr::InvertedIndex indexLoaded;
+	indexLoaded.load("test_inv_idx.bin");
+
+	EXPECT_TRUE(index == indexLoaded);
+	EXPECT_EQ(index.m_numDbImages, indexLoaded.m_numDbImages);
+	EXPECT_FALSE(indexLoaded.isDecodedOnDemand());
+
+	vlr::WeightEncoding encodings[] = { vlr::WEIGHTS_FLOAT32,
+			vlr::WEIGHTS_UINT16, vlr::WEIGHTS_UINT8 };
+	float tolerances[] = { 0.0f, 1.0f / 0xFFFF, 1.0f / 0xFF };
+
+	for (int e = 0; e < 3; ++e) {
+		index.saveBinary("test_inv_idx.bin", encodings[e]);
+
+		vlr::InvertedIndex indexMapped;
+		indexMapped.loadBinary("test_inv_idx.bin", true);
+		indexMapped.buildPostingLists();
+
+		EXPECT_TRUE(indexMapped.isDecodedOnDemand());
+		EXPECT_TRUE(indexMapped.hasPostingLists());
+		ASSERT_EQ(index.size(), indexMapped.size());
+
+		const uint32_t* imageIds;
+		const float* weights;
+		const uint32_t* imageIdsMapped;
+		const float* weightsMapped;
+		vlr::PostingListBuffer buffer;
+
+		for (size_t i = 0; i < index.size(); ++i) {
+			EXPECT_EQ(index[i].m_weight, indexMapped[i].m_weight);
+
+			size_t n = index.getPostingList(i, imageIds, weights, buffer);
+			size_t nMapped = indexMapped.getPostingList(i, imageIdsMapped,
+					weightsMapped, buffer);
+
+			ASSERT_EQ(n, nMapped);
+			for (size_t k = 0; k < n; ++k) {
+				EXPECT_EQ(imageIds[k], imageIdsMapped[k]);
+				EXPECT_NEAR(weights[k], weightsMapped[k], tolerances[e]);
+			}
+		}
+	}
+
+	// Images not in increasing order cannot be delta-encoded
+	std::swap(index[0].m_imageList[0], index[0].m_imageList[1]);
+	EXPECT_THROW(index.saveBinary("test_inv_idx.bin"), std::runtime_error);
+
+}
+
+TEST(InvertedIndex, LoadCorruptedBinary) {
+
+	vlr::InvertedIndex index;
+	index.m_numDbImages = 3;
+
+	for (int wordIdx = 0; wordIdx < 3; ++wordIdx) {
+		vlr::Word w(1.0 + wordIdx);
+		w.m_imageList.push_back(vlr::ImageCount(wordIdx, 0.5));
+		index.push_back(w);
+	}
+
+	index.buildPostingLists();
+	index.saveBinary("test_inv_idx.bin");
+
+	std::ifstream in("test_inv_idx.bin", std::fstream::binary);
+	std::vector<char> original((std::istreambuf_iterator<char>(in)),
+			std::istreambuf_iterator<char>());
+	in.close();
+
+	vlr::InvertedIndexFileHeader header;
+	memcpy(&header, original.data(), sizeof(header));
+
+	// Words table overlapping the header, number of words whose size in bytes
+	// wraps around and size of the posting lists running past the file end
+	vlr::InvertedIndexFileHeader corrupted[3] = { header, header, header };
+	corrupted[0].wordsOffset = 0;
+	corrupted[1].numWords = std::numeric_limits<uint64_t>::max()
+			/ sizeof(vlr::InvertedFileEntry) + 2;
+	corrupted[2].postingsSize = std::numeric_limits<uint64_t>::max();
+
+	for (int c = 0; c < 3; ++c) {
+		std::vector<char> data(original);
+		memcpy(data.data(), &corrupted[c], sizeof(header));
+
+		std::ofstream out("test_inv_idx.bin",
+				std::fstream::out | std::fstream::binary);
+		out.write(data.data(), data.size());
+		out.close();
+
+		vlr::InvertedIndex indexLoaded;
+		EXPECT_THROW(indexLoaded.loadBinary("test_inv_idx.bin"),
+				std::runtime_error);
+	}
+
+}
+
+TEST(InvertedIndex, QuantizedPostingLists) {
+
+	vlr::InvertedIndex index;
+	index.m_numDbImages = 3;
+
+	vlr::Word w(1.0);
+	w.m_imageList.push_back(vlr::ImageCount(0, 0.5));
+	w.m_imageList.push_back(vlr::ImageCount(2, 0.001));
+	index.push_back(w);
+	index.push_back(vlr::Word(1.0));
+
+	index.buildPostingLists(vlr::WEIGHTS_UINT8);
+	EXPECT_EQ(vlr::WEIGHTS_UINT8, index.getPostingsEncoding());
+
+	const uint32_t* imageIds;
+	const float* weights;
+	vlr::PostingListBuffer buffer;
+
+	ASSERT_EQ(2u, index.getPostingList(0, imageIds, weights, buffer));
+	EXPECT_EQ(0u, imageIds[0]);
+	EXPECT_EQ(2u, imageIds[1]);
+	// The largest weight of a word is exact and small weights do not vanish
+	EXPECT_FLOAT_EQ(0.5f, weights[0]);
+	EXPECT_GT(weights[1], 0.0f);
+	EXPECT_EQ(0u, index.getPostingList(1, imageIds, weights, buffer));
+
+	// Rebuilding in float restores the original weights
+	index.buildPostingLists();
+	EXPECT_EQ(vlr::WEIGHTS_FLOAT32, index.getPostingsEncoding());
+	index.getPostingList(0, imageIds, weights, buffer);
+	EXPECT_FLOAT_EQ(0.001f, weights[1]);
+
+}
+
+TEST(InvertedIndex, Freeze) {
+
+	vlr::InvertedIndex index;
+	index.m_numDbImages = 3;
+
+	for (int wordIdx = 0; wordIdx < 3; ++wordIdx) {
+		vlr::Word w(1.0 + wordIdx);
+		for (int imgIdx = wordIdx; imgIdx < 3; ++imgIdx) {
+			w.m_imageList.push_back(vlr::ImageCount(imgIdx, 0.25));
+		}
+		index.push_back(w);
+	}
+
+	vlr::InvertedIndex frozen = index;
+	frozen.freeze();
+
+	EXPECT_TRUE(frozen.isFrozen());
+	EXPECT_TRUE(frozen.hasPostingLists());
+
+	// Only the word weights are left in the inverted files
+	std::vector<vlr::ImageCount> buffer;
+	for (size_t i = 0; i < frozen.size(); ++i) {
+		EXPECT_TRUE(frozen[i].m_imageList.empty());
+		EXPECT_EQ(index[i].m_weight, frozen[i].m_weight);
+		EXPECT_TRUE(index[i].m_imageList == frozen.getInvertedFile(i, buffer));
+	}
+
+	EXPECT_TRUE(index == frozen);
+
+	// Frozen indexes are saved from their posting lists
+	frozen.save("test_inv_idx.yaml.gz");
+	vlr::InvertedIndex indexLoaded;
+	indexLoaded.load("test_inv_idx.yaml.gz");
+	EXPECT_TRUE(index == indexLoaded);
+
+	// Building the posting lists again is a no-op
+	frozen.buildPostingLists();
+	EXPECT_TRUE(index == frozen);
+
+	frozen.clearPostingLists();
+	EXPECT_FALSE(frozen.isFrozen());
+
+}
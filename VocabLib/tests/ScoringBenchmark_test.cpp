@@ -0,0 +1,242 @@
+/*
+ * ScoringBenchmark_test.cpp
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: andresf
+ */
+
+#include <gtest/gtest.h>
+#include <opencv2/core/core.hpp>
+
+#include <VocabDB.hpp>
+
+// --------------------------------------------------------------------------
+
+/**
+ * Builds a random inverted index whose DB BoF vectors are L1-normalized.
+ *
+ * @param numWords - Number of words of the index
+ * @param numDbImages - Number of DB images
+ * @param maxPostings - Maximum number of postings per word
+ * @param index - The index to fill
+ */
+void buildRandomIndex(int numWords, int numDbImages, int maxPostings,
+		vlr::InvertedIndex& index) {
+
+	cv::RNG rng(0x5eed);
+
+	index.clear();
+	index.m_numDbImages = numDbImages;
+	index.resize(numWords, vlr::Word(1.0));
+
+	std::vector<int> imageIds;
+	for (vlr::Word& word : index) {
+		// Image ids must be sorted and unique as when added by addFeatureToInvertedFile
+		imageIds.resize(rng.uniform(0, maxPostings + 1));
+		for (int& imgIdx : imageIds) {
+			imgIdx = rng.uniform(0, numDbImages);
+		}
+		std::sort(imageIds.begin(), imageIds.end());
+		imageIds.erase(std::unique(imageIds.begin(), imageIds.end()),
+				imageIds.end());
+		for (int imgIdx : imageIds) {
+			word.m_imageList.push_back(
+					vlr::ImageCount(imgIdx, rng.uniform(0.01f, 1.0f)));
+		}
+	}
+
+	std::vector<float> mags(numDbImages, 0.0f);
+	for (vlr::Word& word : index) {
+		for (vlr::ImageCount& image : word.m_imageList) {
+			mags[image.m_index] += image.m_count;
+		}
+	}
+	for (vlr::Word& word : index) {
+		for (vlr::ImageCount& image : word.m_imageList) {
+			image.m_count /= mags[image.m_index];
+		}
+	}
+
+	index.buildPostingLists();
+}
+
+// --------------------------------------------------------------------------
+
+/**
+ * Scoring loop as done before the posting lists, i.e. walking the inverted files
+ * through bounds-checked lookups and checking every entry and the scoring type
+ * once per posting.
+ */
+void scoreInvertedFiles(const vlr::InvertedIndex& index,
+		const vlr::SparseBoFVector& query, vlr::ScoringType distance,
+		cv::Mat& scores) {
+
+	for (const vlr::BoFEntry& entry : query) {
+		float qi = entry.m_weight;
+		for (int imageId = 0;
+				imageId < int(index.at(entry.m_wordId).m_imageList.size());
+				++imageId) {
+			float di = index.at(entry.m_wordId).m_imageList[imageId].m_count;
+
+			CV_Assert(qi > 0 && qi <= 1.0);
+			CV_Assert(di <= 1.0);
+			if (index.at(entry.m_wordId).m_weight != 0.0) {
+				CV_Assert(di > 0.0);
+			} else {
+				CV_Assert(di >= 0.0);
+			}
+
+			if (distance == vlr::L1) {
+				scores.at<float>(0,
+						index.at(entry.m_wordId).m_imageList[imageId].m_index) +=
+						(float) (fabs(qi - di) - fabs(qi) - fabs(di));
+			} else if (distance == vlr::L2 || distance == vlr::COS) {
+				scores.at<float>(0,
+						index.at(entry.m_wordId).m_imageList[imageId].m_index) +=
+						(float) qi * di;
+			}
+		}
+	}
+}
+
+// --------------------------------------------------------------------------
+
+TEST(VocabDB, ScoringThroughput) {
+
+	int numWords = 100000;
+	int numDbImages = 20000;
+	int maxPostings = 64;
+	int queryLength = 2000;
+	int rounds = 20;
+
+	vlr::InvertedIndex index;
+	buildRandomIndex(numWords, numDbImages, maxPostings, index);
+
+	// Random query made of distinct words
+	cv::RNG rng(0xbeef);
+	std::vector<bool> used(numWords, false);
+	vlr::SparseBoFVector query;
+	while ((int) query.size() < queryLength) {
+		int wordIdx = rng.uniform(0, numWords);
+		if (used[wordIdx] == false) {
+			used[wordIdx] = true;
+			query.push_back(vlr::BoFEntry(wordIdx, 1.0f / queryLength));
+		}
+	}
+	std::sort(query.begin(), query.end());
+
+	size_t numPostings = 0;
+	for (const vlr::BoFEntry& entry : query) {
+		numPostings += index[entry.m_wordId].m_imageList.size();
+	}
+
+	vlr::ScoringType distances[] = { vlr::L1, vlr::COS };
+
+	for (vlr::ScoringType distance : distances) {
+
+		cv::Mat invertedFilesScores, postingListsScores;
+
+		// Before: inverted files of image counts
+		double invertedFilesTime = (double) cv::getTickCount();
+		for (int r = 0; r < rounds; ++r) {
+			invertedFilesScores = cv::Mat::zeros(1, numDbImages,
+					cv::DataType<float>::type);
+			scoreInvertedFiles(index, query, distance, invertedFilesScores);
+		}
+		invertedFilesTime = ((double) cv::getTickCount() - invertedFilesTime)
+				/ cv::getTickFrequency();
+
+		// After: posting lists in structure-of-arrays layout
+		double postingListsTime = (double) cv::getTickCount();
+		for (int r = 0; r < rounds; ++r) {
+			postingListsScores = cv::Mat::zeros(1, numDbImages,
+					cv::DataType<float>::type);
+			vlr::VocabDB::accumulateScores(index, query, distance,
+					postingListsScores.ptr<float>(0));
+		}
+		postingListsTime = ((double) cv::getTickCount() - postingListsTime)
+				/ cv::getTickFrequency();
+
+		printf("   [%s] Inverted files scored [%lf] postings/s\n",
+				distance == vlr::L1 ? "L1" : "COS",
+				rounds * numPostings / invertedFilesTime);
+		printf("   [%s] Posting lists scored [%lf] postings/s\n",
+				distance == vlr::L1 ? "L1" : "COS",
+				rounds * numPostings / postingListsTime);
+
+		// Both layouts must produce the same scores
+		for (int i = 0; i < numDbImages; ++i) {
+			ASSERT_FLOAT_EQ(invertedFilesScores.at<float>(0, i),
+					postingListsScores.at<float>(0, i));
+		}
+	}
+
+}
+
+// --------------------------------------------------------------------------
+
+TEST(VocabDB, QuantizedPostingsMemory) {
+
+	int numWords = 100000;
+	int numDbImages = 20000;
+	int maxPostings = 64;
+	int queryLength = 2000;
+	int top = 10;
+
+	vlr::InvertedIndex index;
+	buildRandomIndex(numWords, numDbImages, maxPostings, index);
+
+	cv::RNG rng(0xbeef);
+	vlr::SparseBoFVector query;
+	for (int wordIdx = 0; wordIdx < numWords; wordIdx += numWords / queryLength) {
+		query.push_back(vlr::BoFEntry(wordIdx, rng.uniform(0.01f, 1.0f)));
+	}
+
+	std::vector<float> floatScores(numDbImages, 0.0f);
+	vlr::VocabDB::accumulateScores(index, query, vlr::COS, floatScores.data());
+
+	std::vector<vlr::ImageScore> floatTop;
+	vlr::VocabDB::selectTopK(floatScores.data(), numDbImages, top, floatTop);
+
+	size_t floatMemory = index.getPostingsMemorySize();
+
+	vlr::WeightEncoding encodings[] = { vlr::WEIGHTS_UINT16, vlr::WEIGHTS_UINT8 };
+
+	for (vlr::WeightEncoding encoding : encodings) {
+		index.buildPostingLists(encoding);
+
+		std::vector<float> scores(numDbImages, 0.0f);
+		double time = (double) cv::getTickCount();
+		vlr::VocabDB::accumulateScores(index, query, vlr::COS, scores.data());
+		time = ((double) cv::getTickCount() - time) / cv::getTickFrequency();
+
+		std::vector<vlr::ImageScore> quantizedTop;
+		vlr::VocabDB::selectTopK(scores.data(), numDbImages, top,
+				quantizedTop);
+
+		float maxError = 0.0f;
+		for (int i = 0; i < numDbImages; ++i) {
+			maxError = std::max(maxError, fabsf(scores[i] - floatScores[i]));
+		}
+
+		int overlap = 0;
+		for (const vlr::ImageScore& a : floatTop) {
+			for (const vlr::ImageScore& b : quantizedTop) {
+				overlap += a.first == b.first;
+			}
+		}
+
+		size_t memory = index.getPostingsMemorySize();
+
+		printf("   [%d bits] Posting lists take [%lu] bytes against [%lu] (%.1lf%%),"
+				" scored in [%lf] ms, max score error [%g], top-%d overlap [%d]\n",
+				encoding == vlr::WEIGHTS_UINT8 ? 8 : 16, memory, floatMemory,
+				100.0 * memory / floatMemory, time * 1000, maxError, top,
+				overlap);
+
+		EXPECT_LT(memory, floatMemory);
+		EXPECT_LT(maxError, encoding == vlr::WEIGHTS_UINT8 ? 0.05f : 0.001f);
+		EXPECT_GE(overlap, top / 2);
+	}
+
+}
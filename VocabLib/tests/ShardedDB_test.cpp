@@ -0,0 +1,216 @@
+/*
+ * ShardedDB_test.cpp
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: andresf
+ */
+
+#include <signal.h>
+
+#include <gtest/gtest.h>
+#include <opencv2/core/core.hpp>
+
+#include <ShardedDB.hpp>
+
+TEST(ShardedDB, ShardFilename) {
+
+	EXPECT_EQ("db.shard0.yaml.gz", vlr::getShardFilename("db.yaml.gz", 0));
+	EXPECT_EQ("db.shard1.xml.gz", vlr::getShardFilename("db.xml.gz", 1));
+	EXPECT_EQ("out/db.shard12.bin", vlr::getShardFilename("out/db.bin", 12));
+	EXPECT_EQ("db.idx.shard2", vlr::getShardFilename("db.idx", 2));
+
+}
+
+TEST(ShardedDB, MatchesSingleIndex) {
+
+	int numWords = 300, numDbImages = 50, numShards = 3;
+
+	cv::RNG rng(0x5eed);
+
+	// Random index whose DB BoF vectors are L1-normalized
+	vlr::InvertedIndex index;
+	index.m_numDbImages = numDbImages;
+	index.resize(numWords, vlr::Word(1.0));
+
+	std::vector<float> mags(numDbImages, 0.0f);
+	for (vlr::Word& word : index) {
+		word.m_weight = rng.uniform(0.0, 2.0);
+		for (int imgIdx = 0; imgIdx < numDbImages; ++imgIdx) {
+			if (rng.uniform(0, 10) == 0) {
+				word.m_imageList.push_back(
+						vlr::ImageCount(imgIdx, rng.uniform(0.01f, 1.0f)));
+				mags[imgIdx] += word.m_imageList.back().m_count;
+			}
+		}
+	}
+	for (vlr::Word& word : index) {
+		for (vlr::ImageCount& image : word.m_imageList) {
+			image.m_count /= mags[image.m_index];
+		}
+	}
+
+	// Splitting the images into shards of consecutive images with local ids
+	std::vector<std::string> shardFilenames;
+	for (int s = 0; s < numShards; ++s) {
+		int first = s * numDbImages / numShards;
+		int last = (s + 1) * numDbImages / numShards;
+
+		vlr::InvertedIndex shard;
+		shard.m_numDbImages = last - first;
+		shard.resize(numWords);
+		for (int i = 0; i < numWords; ++i) {
+			shard[i].m_weight = index[i].m_weight;
+			for (const vlr::ImageCount& image : index[i].m_imageList) {
+				if ((int) image.m_index >= first && (int) image.m_index < last) {
+					shard[i].m_imageList.push_back(
+							vlr::ImageCount(image.m_index - first,
+									image.m_count));
+				}
+			}
+		}
+
+		shardFilenames.push_back(
+				vlr::getShardFilename("test_sharded_db.bin", s));
+		shard.save(shardFilenames.back());
+	}
+
+	index.buildPostingLists();
+
+	vlr::ShardedDB sharded;
+	sharded.start(shardFilenames);
+
+	ASSERT_EQ(numShards, sharded.getNumShards());
+	ASSERT_EQ(numDbImages, sharded.getNumDbImages());
+
+	// Words weights are sent by the workers
+	ASSERT_EQ(size_t(numWords), sharded.getWordsWeights().size());
+	for (int i = 0; i < numWords; ++i) {
+		EXPECT_EQ(index[i].m_weight, sharded.getWordsWeights()[i]);
+	}
+
+	std::vector<float> scores(numDbImages);
+	std::vector<vlr::ImageScore> expected, actual;
+
+	for (int q = 0; q < 10; ++q) {
+
+		vlr::SparseBoFVector query;
+		float mag = 0.0f;
+		for (int i = 0; i < numWords; ++i) {
+			if (rng.uniform(0, 5) == 0) {
+				query.push_back(vlr::BoFEntry(i, rng.uniform(0.01f, 1.0f)));
+				mag += query.back().m_weight;
+			}
+		}
+		for (vlr::BoFEntry& entry : query) {
+			entry.m_weight /= mag;
+		}
+
+		for (vlr::ScoringType distance : { vlr::L1, vlr::L2, vlr::COS }) {
+			std::fill(scores.begin(), scores.end(), 0.0f);
+			vlr::VocabDB::accumulateScores(index, query, distance,
+					scores.data());
+			vlr::VocabDB::completeScores(scores.data(), numDbImages,
+					distance);
+			vlr::VocabDB::selectTopK(scores.data(), numDbImages, 10,
+					expected);
+
+			sharded.queryTopK(query, 10, distance, actual);
+
+			ASSERT_EQ(expected.size(), actual.size());
+			for (size_t i = 0; i < expected.size(); ++i) {
+				EXPECT_EQ(expected[i].first, actual[i].first);
+				EXPECT_FLOAT_EQ(expected[i].second, actual[i].second);
+			}
+		}
+	}
+
+	// Words out of the vocabulary are reported without breaking the workers
+	vlr::SparseBoFVector invalid(1, vlr::BoFEntry(numWords, 1.0f));
+	EXPECT_THROW(sharded.queryTopK(invalid, 10, vlr::L1, actual),
+			std::runtime_error);
+
+	sharded.queryTopK(vlr::SparseBoFVector(), 5, vlr::COS, actual);
+	EXPECT_EQ(5u, actual.size());
+
+	sharded.stop();
+	EXPECT_EQ(0, sharded.getNumShards());
+
+}
+
+TEST(ShardedDB, MissingShard) {
+
+	vlr::ShardedDB sharded;
+
+	std::vector<std::string> shardFilenames(1, "test_missing_shard.bin");
+
+	EXPECT_THROW(sharded.start(shardFilenames), std::runtime_error);
+	EXPECT_EQ(0, sharded.getNumShards());
+
+}
+
+TEST(ShardedDB, DifferentWordsWeights) {
+
+	std::vector<std::string> shardFilenames;
+
+	for (int s = 0; s < 2; ++s) {
+		vlr::InvertedIndex shard;
+		shard.m_numDbImages = 1;
+		shard.resize(10, vlr::Word(1.0 + s));
+		shard[0].m_imageList.push_back(vlr::ImageCount(0, 1.0f));
+
+		shardFilenames.push_back(
+				vlr::getShardFilename("test_sharded_db_weights.bin", s));
+		shard.save(shardFilenames.back());
+	}
+
+	vlr::ShardedDB sharded;
+
+	// Shards weighted differently would give scores that cannot be merged
+	EXPECT_THROW(sharded.start(shardFilenames), std::runtime_error);
+	EXPECT_EQ(0, sharded.getNumShards());
+
+}
+
+/**
+ * Gives access to the worker processes to simulate their failure.
+ */
+class KillableShardedDB: public vlr::ShardedDB {
+public:
+	void killWorker(int shardIdx) {
+		kill(m_workers[shardIdx], SIGKILL);
+	}
+};
+
+TEST(ShardedDB, LostWorker) {
+
+	std::vector<std::string> shardFilenames;
+
+	for (int s = 0; s < 2; ++s) {
+		vlr::InvertedIndex shard;
+		shard.m_numDbImages = 1;
+		shard.resize(10, vlr::Word(1.0));
+		shard[0].m_imageList.push_back(vlr::ImageCount(0, 1.0f));
+
+		shardFilenames.push_back(
+				vlr::getShardFilename("test_sharded_db_lost.bin", s));
+		shard.save(shardFilenames.back());
+	}
+
+	KillableShardedDB sharded;
+	sharded.start(shardFilenames);
+
+	vlr::SparseBoFVector query(1, vlr::BoFEntry(0, 1.0f));
+	std::vector<vlr::ImageScore> topImages;
+
+	sharded.queryTopK(query, 2, vlr::L1, topImages);
+	EXPECT_EQ(2u, topImages.size());
+
+	// The remaining worker is stopped as its reply would be left unread
+	sharded.killWorker(1);
+	EXPECT_THROW(sharded.queryTopK(query, 2, vlr::L1, topImages),
+			std::runtime_error);
+	EXPECT_EQ(0, sharded.getNumShards());
+	EXPECT_THROW(sharded.queryTopK(query, 2, vlr::L1, topImages),
+			std::runtime_error);
+
+}
@@ -8,6 +8,7 @@
 #include <gtest/gtest.h>
 
 #include <VocabDB.hpp>
+#include <ThreadPool.hpp>
 
 TEST(HierarchicalKMeans, TestDatabase) {
 
@@ -481,3 +482,427 @@ TEST(IncrementalKMeans, TestDatabase) {
 	}
 
 }
+
+TEST(HierarchicalKMajority, SoftAssignment) {
+
+	cv::Mat imgDescriptors;
+
+	/////////////////////////////////////////////////////////////////////
+	std::vector<std::string> keysFilenames;
+	keysFilenames.push_back("brief_0.bin");
+	keysFilenames.push_back("brief_1.bin");
+	vlr::Mat data(keysFilenames);
+	/////////////////////////////////////////////////////////////////////
+
+	vlr::VocabTreeParams params;
+	params["depth"] = 3;
+
+	cv::Ptr<vlr::VocabTreeBin> tree = new vlr::VocabTreeBin(data, params);
+
+	tree->build();
+
+	tree->save("test_vocab.yaml.gz");
+
+	cv::Ptr<vlr::VocabDB> db = new vlr::HKMDB(true);
+
+	db->loadBoFModel("test_vocab.yaml.gz");
+
+	db->clearDatabase();
+
+	int imgIdx = 0;
+	for (std::string& keyFileName : keysFilenames) {
+		FileUtils::loadDescriptors(keyFileName, imgDescriptors);
+		db->addImageToDatabase(imgIdx, imgDescriptors);
+		++imgIdx;
+	}
+
+	db->computeWordsWeights(vlr::TF_IDF);
+	db->createDatabase();
+	db->normalizeDatabase(vlr::NORM_L1);
+
+	imgDescriptors = cv::Mat();
+	FileUtils::loadDescriptors(keysFilenames[0], imgDescriptors);
+
+	cv::Mat hardBoFVector, softBoFVector;
+
+	// A single word per feature is the same as hard assignment
+	db->setSoftAssignment(1);
+	db->transform(imgDescriptors, hardBoFVector, vlr::NORM_L1);
+
+	db->setSoftAssignment(3);
+	ASSERT_TRUE(3 == db->getSoftAssignmentKnn());
+	db->transform(imgDescriptors, softBoFVector, vlr::NORM_L1);
+
+	// Soft votes spread over more words and add up to a normalized vector
+	EXPECT_TRUE(
+			cv::countNonZero(softBoFVector) >= cv::countNonZero(hardBoFVector));
+	EXPECT_NEAR(1.0, cv::norm(softBoFVector, cv::NORM_L1), 1e-4);
+
+	// Leaves visited are at least the number of words
+	EXPECT_EQ(3, db->getSoftAssignmentMaxLeaves());
+
+	// Visiting more leaves than words searches the tree further
+	db->setSoftAssignment(3, 0.0, 12, 8);
+	EXPECT_EQ(12, db->getSoftAssignmentMaxLeaves());
+	EXPECT_EQ(8, db->getSoftAssignmentMaxBranches());
+	db->transform(imgDescriptors, softBoFVector, vlr::NORM_L1);
+	EXPECT_NEAR(1.0, cv::norm(softBoFVector, cv::NORM_L1), 1e-4);
+
+	EXPECT_THROW(db->setSoftAssignment(3, 0.0, 12, 0), std::runtime_error);
+
+	// The inverted index built by hard assignment can still be queried
+	imgIdx = 0;
+
+	for (std::string& keyFileName : keysFilenames) {
+		cv::Mat scores;
+
+		imgDescriptors = cv::Mat();
+		FileUtils::loadDescriptors(keyFileName, imgDescriptors);
+		db->scoreQuery(imgDescriptors, scores, vlr::NORM_L1, vlr::L1);
+
+		EXPECT_TRUE((int )keysFilenames.size() == scores.cols);
+
+		cv::Mat perm;
+		cv::sortIdx(scores, perm, cv::SORT_EVERY_ROW + cv::SORT_DESCENDING);
+
+		EXPECT_TRUE(imgIdx == perm.at<int>(0, 0));
+		++imgIdx;
+	}
+
+}
+
+TEST(HierarchicalKMajority, SparseTransform) {
+
+	cv::Mat imgDescriptors;
+
+	/////////////////////////////////////////////////////////////////////
+	std::vector<std::string> keysFilenames;
+	keysFilenames.push_back("brief_0.bin");
+	keysFilenames.push_back("brief_1.bin");
+	vlr::Mat data(keysFilenames);
+	/////////////////////////////////////////////////////////////////////
+
+	vlr::VocabTreeParams params;
+	params["depth"] = 3;
+
+	cv::Ptr<vlr::VocabTreeBin> tree = new vlr::VocabTreeBin(data, params);
+
+	tree->build();
+
+	tree->save("test_vocab.yaml.gz");
+
+	cv::Ptr<vlr::VocabDB> db = new vlr::HKMDB(true);
+
+	db->loadBoFModel("test_vocab.yaml.gz");
+
+	db->clearDatabase();
+
+	int imgIdx = 0;
+	for (std::string& keyFileName : keysFilenames) {
+		FileUtils::loadDescriptors(keyFileName, imgDescriptors);
+		db->addImageToDatabase(imgIdx, imgDescriptors);
+		++imgIdx;
+	}
+
+	db->computeWordsWeights(vlr::TF_IDF);
+
+	imgDescriptors = cv::Mat();
+	FileUtils::loadDescriptors(keysFilenames[0], imgDescriptors);
+
+	for (int knn = 1; knn <= 3; knn += 2) {
+
+		db->setSoftAssignment(knn);
+
+		vlr::SparseBoFVector sparseBoFVector;
+		db->transform(imgDescriptors, sparseBoFVector, vlr::NORM_L2);
+
+		cv::Mat denseBoFVector;
+		db->transform(imgDescriptors, denseBoFVector, vlr::NORM_L2);
+
+		// The sparse vector holds exactly the non-zero entries sorted by word id
+		ASSERT_TRUE(
+				(int ) sparseBoFVector.size()
+						== cv::countNonZero(denseBoFVector));
+		for (size_t i = 0; i < sparseBoFVector.size(); ++i) {
+			if (i > 0) {
+				EXPECT_LT(sparseBoFVector[i - 1].m_wordId,
+						sparseBoFVector[i].m_wordId);
+			}
+			EXPECT_EQ(denseBoFVector.at<float>(0, sparseBoFVector[i].m_wordId),
+					sparseBoFVector[i].m_weight);
+		}
+
+		EXPECT_NEAR(1.0, cv::norm(denseBoFVector, cv::NORM_L2), 1e-4);
+	}
+
+}
+
+TEST(VocabDB, SelectTopK) {
+
+	cv::RNG rng(0x70b);
+
+	for (int trial = 0; trial < 100; ++trial) {
+
+		int numScores = rng.uniform(1, 500);
+		int k = rng.uniform(0, numScores + 10);
+
+		// Few distinct values to have plenty of ties
+		cv::Mat scores(1, numScores, cv::DataType<float>::type);
+		for (int i = 0; i < numScores; ++i) {
+			scores.at<float>(0, i) = (float) rng.uniform(0, 20) / 20.0f;
+		}
+
+		std::vector<vlr::ImageScore> topImages;
+		vlr::VocabDB::selectTopK(scores.ptr<float>(0), numScores, k, topImages);
+
+		ASSERT_EQ(std::min(k, numScores), (int ) topImages.size());
+
+		// Same result as fully sorting the scores
+		std::vector<vlr::ImageScore> sortedImages;
+		for (int i = 0; i < numScores; ++i) {
+			sortedImages.push_back(vlr::ImageScore(i, scores.at<float>(0, i)));
+		}
+		std::stable_sort(sortedImages.begin(), sortedImages.end(),
+				[](const vlr::ImageScore& a, const vlr::ImageScore& b) {
+					return a.second > b.second;
+				});
+
+		for (size_t j = 0; j < topImages.size(); ++j) {
+			ASSERT_EQ(sortedImages[j].first, topImages[j].first);
+			ASSERT_EQ(sortedImages[j].second, topImages[j].second);
+		}
+	}
+
+}
+
+TEST(HierarchicalKMajority, ConcurrentBuild) {
+
+	/////////////////////////////////////////////////////////////////////
+	std::vector<std::string> keysFilenames;
+	keysFilenames.push_back("brief_0.bin");
+	keysFilenames.push_back("brief_1.bin");
+	keysFilenames.push_back("brief_0.bin");
+	keysFilenames.push_back("brief_1.bin");
+	vlr::Mat data(keysFilenames);
+	/////////////////////////////////////////////////////////////////////
+
+	vlr::VocabTreeParams params;
+	params["depth"] = 3;
+
+	cv::Ptr<vlr::VocabTreeBin> tree = new vlr::VocabTreeBin(data, params);
+
+	tree->build();
+
+	tree->save("test_vocab.yaml.gz");
+
+	cv::Ptr<vlr::VocabDB> db = new vlr::HKMDB(true);
+	db->loadBoFModel("test_vocab.yaml.gz");
+	db->clearDatabase();
+
+	cv::Ptr<vlr::VocabDB> dbConcurrent = new vlr::HKMDB(true);
+	dbConcurrent->loadBoFModel("test_vocab.yaml.gz");
+	dbConcurrent->clearDatabase();
+
+	cv::Mat imgDescriptors;
+	for (size_t imgIdx = 0; imgIdx < keysFilenames.size(); ++imgIdx) {
+		FileUtils::loadDescriptors(keysFilenames[imgIdx], imgDescriptors);
+		db->addImageToDatabase(imgIdx, imgDescriptors);
+	}
+
+	// Each image is quantized by a different thread into its own buffer
+	std::vector<std::vector<vlr::WordImageCount> > counts(keysFilenames.size());
+
+	vlr::ThreadPool pool(4);
+	pool.parallelFor(0, keysFilenames.size(), 1, [&](int begin, int end) {
+		cv::Mat descriptors;
+		for (int imgIdx = begin; imgIdx < end; ++imgIdx) {
+			FileUtils::loadDescriptors(keysFilenames[imgIdx], descriptors);
+			dbConcurrent->quantizeImage(imgIdx, descriptors, counts[imgIdx]);
+		}
+	});
+
+	// Adding images out of order would break the inverted files order
+	dbConcurrent->addCountsToDatabase(counts[1], 1);
+	EXPECT_THROW(dbConcurrent->addCountsToDatabase(counts[0], 1),
+			std::runtime_error);
+
+	dbConcurrent->clearDatabase();
+	for (size_t imgIdx = 0; imgIdx < counts.size(); ++imgIdx) {
+		dbConcurrent->addCountsToDatabase(counts[imgIdx], 1);
+	}
+
+	ASSERT_EQ(db->getInvertedIndex()->m_numDbImages,
+			dbConcurrent->getInvertedIndex()->m_numDbImages);
+	ASSERT_TRUE(*(db->getInvertedIndex()) == *(dbConcurrent->getInvertedIndex()));
+
+}
+
+TEST(HierarchicalKMajority, DirectIndex) {
+
+	/////////////////////////////////////////////////////////////////////
+	std::vector<std::string> keysFilenames;
+	keysFilenames.push_back("brief_0.bin");
+	keysFilenames.push_back("brief_1.bin");
+	keysFilenames.push_back("brief_0.bin");
+	vlr::Mat data(keysFilenames);
+	/////////////////////////////////////////////////////////////////////
+
+	vlr::VocabTreeParams params;
+	params["depth"] = 3;
+
+	cv::Ptr<vlr::VocabTreeBin> tree = new vlr::VocabTreeBin(data, params);
+
+	tree->build();
+
+	tree->save("test_vocab.yaml.gz");
+
+	cv::Ptr<vlr::HKMDB> db = new vlr::HKMDB(true, 1);
+	db->loadBoFModel("test_vocab.yaml.gz");
+	db->clearDatabase();
+
+	cv::Ptr<vlr::HKMDB> dbConcurrent = new vlr::HKMDB(true, 1);
+	dbConcurrent->loadBoFModel("test_vocab.yaml.gz");
+	dbConcurrent->clearDatabase();
+
+	size_t numFeatures = 0;
+	cv::Mat imgDescriptors;
+	for (size_t imgIdx = 0; imgIdx < keysFilenames.size(); ++imgIdx) {
+		FileUtils::loadDescriptors(keysFilenames[imgIdx], imgDescriptors);
+		db->addImageToDatabase(imgIdx, imgDescriptors);
+		numFeatures += imgDescriptors.rows;
+	}
+
+	// Every feature of every image is assigned to a node
+	ASSERT_EQ(keysFilenames.size(), db->getDirectIndex()->size());
+	EXPECT_EQ(numFeatures, db->getDirectIndex()->getNumFeatures());
+	EXPECT_EQ(1, db->getDirectIndexLevel());
+
+	// The same descriptors are assigned to the same nodes
+	vlr::NodeFeatureRange first = db->getDirectIndex()->lookUpImg(0);
+	vlr::NodeFeatureRange third = db->getDirectIndex()->lookUpImg(2);
+	ASSERT_EQ(first.size(), third.size());
+	for (size_t i = 0; i < first.size(); ++i) {
+		EXPECT_EQ(first.begin()[i].m_nodeId, third.begin()[i].m_nodeId);
+		EXPECT_EQ(first.begin()[i].m_featureId, third.begin()[i].m_featureId);
+	}
+
+	// Node ids returned by quantizeImage give the same direct index
+	std::vector<vlr::WordImageCount> counts;
+	std::vector<int> nodeIds;
+	for (size_t imgIdx = 0; imgIdx < keysFilenames.size(); ++imgIdx) {
+		FileUtils::loadDescriptors(keysFilenames[imgIdx], imgDescriptors);
+		dbConcurrent->quantizeImage(imgIdx, imgDescriptors, counts, &nodeIds);
+		ASSERT_EQ(imgDescriptors.rows, int(nodeIds.size()));
+		dbConcurrent->addToDirectIndex(imgIdx, nodeIds);
+	}
+
+	ASSERT_TRUE(*(db->getDirectIndex()) == *(dbConcurrent->getDirectIndex()));
+
+	db->saveDirectIndex("test_di.bin");
+
+	cv::Ptr<vlr::HKMDB> dbLoaded = new vlr::HKMDB(true, 1);
+	dbLoaded->loadBoFModel("test_vocab.yaml.gz");
+	dbLoaded->loadDirectIndex("test_di.bin");
+
+	ASSERT_TRUE(*(db->getDirectIndex()) == *(dbLoaded->getDirectIndex()));
+
+	// A direct index built at another level does not match the vocabulary
+	cv::Ptr<vlr::HKMDB> dbOtherLevel = new vlr::HKMDB(true, 0);
+	dbOtherLevel->loadBoFModel("test_vocab.yaml.gz");
+	EXPECT_THROW(dbOtherLevel->loadDirectIndex("test_di.bin"),
+			std::runtime_error);
+
+}
+
+TEST(HierarchicalKMajority, IncrementalDatabase) {
+
+	/////////////////////////////////////////////////////////////////////
+	std::vector<std::string> keysFilenames;
+	keysFilenames.push_back("brief_0.bin");
+	keysFilenames.push_back("brief_1.bin");
+	vlr::Mat data(keysFilenames);
+	/////////////////////////////////////////////////////////////////////
+
+	vlr::VocabTreeParams params;
+	params["depth"] = 3;
+
+	cv::Ptr<vlr::VocabTreeBin> tree = new vlr::VocabTreeBin(data, params);
+
+	tree->build();
+
+	tree->save("test_vocab.yaml.gz");
+
+	// Three images, the third one made of half of the features of the first one
+	std::vector<cv::Mat> descriptors(3);
+	FileUtils::loadDescriptors(keysFilenames[0], descriptors[0]);
+	FileUtils::loadDescriptors(keysFilenames[1], descriptors[1]);
+	descriptors[2] = descriptors[0].rowRange(0, descriptors[0].rows / 2);
+
+	// Batch database made of the last two images
+	cv::Ptr<vlr::VocabDB> db = new vlr::HKMDB(true);
+	db->loadBoFModel("test_vocab.yaml.gz");
+	db->clearDatabase();
+	db->addImageToDatabase(0, descriptors[1]);
+	db->addImageToDatabase(1, descriptors[2]);
+	db->computeWordsWeights(vlr::TF_IDF);
+	db->createDatabase();
+	db->normalizeDatabase(vlr::NORM_L1);
+
+	// Incremental database where the three images are added and the first removed
+	cv::Ptr<vlr::VocabDB> dbIncremental = new vlr::HKMDB(true);
+	dbIncremental->loadBoFModel("test_vocab.yaml.gz");
+	dbIncremental->clearDatabase();
+	dbIncremental->setIncremental(vlr::TF_IDF, vlr::NORM_L1);
+
+	for (int imgIdx = 0; imgIdx < 3; ++imgIdx) {
+		EXPECT_EQ(imgIdx, dbIncremental->appendImage(descriptors[imgIdx]));
+	}
+
+	cv::Mat scores, scoresIncremental;
+
+	// The first image is found by itself while it is in the database
+	dbIncremental->scoreQuery(descriptors[0], scoresIncremental, vlr::NORM_L1,
+			vlr::L1);
+	EXPECT_NEAR(1.0, scoresIncremental.at<float>(0, 0), 1e-6);
+
+	dbIncremental->removeImage(0);
+	EXPECT_THROW(dbIncremental->removeImage(3), std::runtime_error);
+
+	// Batch steps would overwrite the raw counts
+	EXPECT_THROW(dbIncremental->createDatabase(), std::runtime_error);
+
+	// Saving drops the removed image and keeps the raw counts
+	dbIncremental->saveInvertedIndex("test_idf.yaml.gz");
+
+	cv::Ptr<vlr::VocabDB> dbLoad = new vlr::HKMDB(true);
+	dbLoad->loadBoFModel("test_vocab.yaml.gz");
+	dbLoad->setIncremental(vlr::TF_IDF, vlr::NORM_L1);
+	dbLoad->loadInvertedIndex("test_idf.yaml.gz");
+
+	cv::Ptr<vlr::VocabDB> incrementalDbs[] = { dbIncremental, dbLoad };
+
+	for (size_t q = 0; q < descriptors.size(); ++q) {
+		db->scoreQuery(descriptors[q], scores, vlr::NORM_L1, vlr::L1);
+
+		for (cv::Ptr<vlr::VocabDB>& other : incrementalDbs) {
+			other->scoreQuery(descriptors[q], scoresIncremental, vlr::NORM_L1,
+					vlr::L1);
+
+			ASSERT_EQ(3, scoresIncremental.cols);
+			// The removed image no longer matches and the remaining ones score
+			// as in a database built from scratch without the removed image
+			EXPECT_EQ(0.0f, scoresIncremental.at<float>(0, 0));
+			EXPECT_NEAR(scores.at<float>(0, 0),
+					scoresIncremental.at<float>(0, 1), 1e-6);
+			EXPECT_NEAR(scores.at<float>(0, 1),
+					scoresIncremental.at<float>(0, 2), 1e-6);
+		}
+	}
+
+	// Images can still be appended after loading
+	EXPECT_EQ(3, dbLoad->appendImage(descriptors[0]));
+	dbLoad->scoreQuery(descriptors[0], scoresIncremental, vlr::NORM_L1,
+			vlr::L1);
+	EXPECT_NEAR(1.0, scoresIncremental.at<float>(0, 3), 1e-6);
+
+}
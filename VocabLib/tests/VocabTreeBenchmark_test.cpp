@@ -0,0 +1,162 @@
+/*
+ * VocabTreeBenchmark_test.cpp
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: andresf
+ */
+
+#include <gtest/gtest.h>
+#include <opencv2/core/core.hpp>
+
+#include <FileUtils.hpp>
+#include <VocabTree.h>
+
+typedef vlr::VocabTreeNode<uchar>* VocabTreeNodePtr;
+
+// --------------------------------------------------------------------------
+
+/**
+ * Rebuilds the pointer-based layout used by the tree before being flattened,
+ * i.e. every center and every children array is a separate heap allocation.
+ *
+ * @param tree - The flattened tree to copy
+ * @param nodeIdx - The position in the nodes table of the node to copy
+ * @return a pointer to the copied node
+ */
+VocabTreeNodePtr buildPointerTree(const vlr::VocabTreeBin& tree, int nodeIdx) {
+
+	const vlr::VocabTreeFlatNode& flatNode = tree.getNode(nodeIdx);
+
+	VocabTreeNodePtr node = new vlr::VocabTreeNode<uchar>();
+	node->node_id = flatNode.node_id;
+	node->word_id = flatNode.word_id;
+	node->center = new uchar[tree.getVeclen()];
+	std::copy(tree.getCenter(nodeIdx), tree.getCenter(nodeIdx) + tree.getVeclen(),
+			node->center);
+
+	if (flatNode.first_child != -1) {
+		node->children = new VocabTreeNodePtr[tree.getBranching()];
+		for (int c = 0; c < tree.getBranching(); ++c) {
+			node->children[c] = buildPointerTree(tree, flatNode.first_child + c);
+		}
+	}
+
+	return node;
+}
+
+// --------------------------------------------------------------------------
+
+void releasePointerTree(VocabTreeNodePtr node, int branching) {
+	delete[] node->center;
+	if (node->children != NULL) {
+		for (int c = 0; c < branching; ++c) {
+			releasePointerTree(node->children[c], branching);
+		}
+		delete[] node->children;
+	}
+	delete node;
+}
+
+// --------------------------------------------------------------------------
+
+/**
+ * Greedy descent over the pointer-based layout, as done before flattening the tree.
+ */
+int quantizePointerTree(VocabTreeNodePtr root, const uchar* feature,
+		size_t veclen, int branching) {
+
+	cv::Hamming distance;
+
+	VocabTreeNodePtr best_node = root;
+
+	while (best_node->children != NULL) {
+		VocabTreeNodePtr node = best_node;
+		best_node = node->children[0];
+		int best_distance = distance(feature, best_node->center, veclen);
+		for (int j = 1; j < branching; ++j) {
+			int d = distance(feature, node->children[j]->center, veclen);
+			if (d < best_distance) {
+				best_distance = d;
+				best_node = node->children[j];
+			}
+		}
+	}
+
+	return best_node->word_id;
+}
+
+// --------------------------------------------------------------------------
+
+TEST(VocabTreeBinary, QuantizationThroughput) {
+
+	/////////////////////////////////////////////////////////////////////
+	std::vector<std::string> keysFilenames;
+	keysFilenames.push_back("brief_0.bin");
+	keysFilenames.push_back("brief_1.bin");
+
+	vlr::Mat data(keysFilenames);
+
+	cv::Mat descriptors;
+	FileUtils::loadDescriptors("brief_0.bin", descriptors);
+	/////////////////////////////////////////////////////////////////////
+
+	ASSERT_TRUE(descriptors.empty() == false);
+
+	cv::Ptr<vlr::VocabTreeBin> tree = new vlr::VocabTreeBin(data);
+
+	tree->build();
+
+	VocabTreeNodePtr root = buildPointerTree(*tree.obj, 0);
+
+	int rounds = 50;
+	std::vector<int> pointerWords(descriptors.rows);
+	std::vector<int> flatWords(descriptors.rows);
+	std::vector<int> flatNodes(descriptors.rows);
+	std::vector<int> batchWords(descriptors.rows);
+	std::vector<int> batchNodes(descriptors.rows);
+
+	// Before: pointer-based layout
+	double pointerTime = (double) cv::getTickCount();
+	for (int r = 0; r < rounds; ++r) {
+		for (int i = 0; i < descriptors.rows; ++i) {
+			pointerWords[i] = quantizePointerTree(root, descriptors.ptr<uchar>(i),
+					tree->getVeclen(), tree->getBranching());
+		}
+	}
+	pointerTime = ((double) cv::getTickCount() - pointerTime)
+			/ cv::getTickFrequency();
+
+	// After: flattened layout
+	double flatTime = (double) cv::getTickCount();
+	for (int r = 0; r < rounds; ++r) {
+		for (int i = 0; i < descriptors.rows; ++i) {
+			tree->quantize(descriptors.row(i), 0, flatWords[i], flatNodes[i]);
+		}
+	}
+	flatTime = ((double) cv::getTickCount() - flatTime) / cv::getTickFrequency();
+
+	// Flattened layout quantizing all descriptors at once
+	double batchTime = (double) cv::getTickCount();
+	for (int r = 0; r < rounds; ++r) {
+		tree->quantize(descriptors, 0, batchWords.data(), batchNodes.data());
+	}
+	batchTime = ((double) cv::getTickCount() - batchTime)
+			/ cv::getTickFrequency();
+
+	printf("   Pointer tree quantized [%lf] descriptors/s\n",
+			rounds * descriptors.rows / pointerTime);
+	printf("   Flattened tree quantized [%lf] descriptors/s\n",
+			rounds * descriptors.rows / flatTime);
+	printf("   Flattened tree (batch) quantized [%lf] descriptors/s\n",
+			rounds * descriptors.rows / batchTime);
+
+	// Both layouts must quantize into the same words
+	for (int i = 0; i < descriptors.rows; ++i) {
+		ASSERT_EQ(pointerWords[i], flatWords[i]);
+		ASSERT_EQ(flatWords[i], batchWords[i]);
+		ASSERT_EQ(flatNodes[i], batchNodes[i]);
+	}
+
+	releasePointerTree(root, tree->getBranching());
+
+}
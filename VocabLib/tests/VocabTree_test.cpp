@@ -7,6 +7,10 @@
 
 #include <limits.h>
 
+#include <fstream>
+#include <iterator>
+#include <limits>
+
 #include <gtest/gtest.h>
 #include <opencv2/core/core.hpp>
 
@@ -63,6 +67,37 @@ TEST(VocabTreeReal, LoadSave) {
 
 }
 
+TEST(VocabTreeReal, LoadSaveBinaryFormat) {
+
+	/////////////////////////////////////////////////////////////////////
+	std::vector<std::string> keysFilenames;
+	keysFilenames.push_back("sift_0.bin");
+	keysFilenames.push_back("sift_1.bin");
+
+	vlr::Mat data(keysFilenames);
+	/////////////////////////////////////////////////////////////////////
+
+	cv::Ptr<vlr::VocabTreeReal> tree = new vlr::VocabTreeReal(data);
+
+	tree->build();
+
+	tree->save("test_tree.bin");
+
+	ASSERT_TRUE(vlr::VocabBase::loadVocabType("test_tree.bin").compare("HKM") == 0);
+
+	cv::Ptr<vlr::VocabTreeReal> treeLoad = new vlr::VocabTreeReal();
+
+	treeLoad->load("test_tree.bin");
+
+	// Check tree structure is the same
+	ASSERT_TRUE(*tree.obj == *treeLoad.obj);
+
+	// Check vocabulary size is the same
+	ASSERT_TRUE(tree->getNumNodes() == treeLoad->getNumNodes());
+	ASSERT_TRUE(tree->getNumWords() == treeLoad->getNumWords());
+
+}
+
 TEST(VocabTreeBinary, LoadSave) {
 
 	/////////////////////////////////////////////////////////////////////
@@ -92,3 +127,225 @@ TEST(VocabTreeBinary, LoadSave) {
 	ASSERT_TRUE(tree->getNumNodes() == treeLoad->getNumNodes());
 
 }
+
+TEST(VocabTreeBinary, LoadSaveBinaryFormat) {
+
+	/////////////////////////////////////////////////////////////////////
+	std::vector<std::string> keysFilenames;
+	keysFilenames.push_back("brief_0.bin");
+	keysFilenames.push_back("brief_1.bin");
+
+	vlr::Mat data(keysFilenames);
+
+	cv::Mat descriptors;
+	FileUtils::loadDescriptors("brief_0.bin", descriptors);
+	/////////////////////////////////////////////////////////////////////
+
+	cv::Ptr<vlr::VocabTreeBin> tree = new vlr::VocabTreeBin(data);
+
+	tree->build();
+
+	tree->save("test_tree.bin");
+
+	ASSERT_TRUE(
+			vlr::VocabBase::loadVocabType("test_tree.bin").compare("HKMAJ") == 0);
+
+	cv::Ptr<vlr::VocabTreeBin> treeLoad = new vlr::VocabTreeBin();
+
+	treeLoad->load("test_tree.bin");
+
+	// Check tree structure is the same
+	ASSERT_TRUE(*tree.obj == *treeLoad.obj);
+
+	// Check the mapped tree quantizes as the built one
+	for (int i = 0; i < descriptors.rows; ++i) {
+		int wordId, nodeId, wordIdLoad, nodeIdLoad;
+		tree->quantize(descriptors.row(i), 1, wordId, nodeId);
+		treeLoad->quantize(descriptors.row(i), 1, wordIdLoad, nodeIdLoad);
+		ASSERT_EQ(wordId, wordIdLoad);
+		ASSERT_EQ(nodeId, nodeIdLoad);
+	}
+
+	// Loading the YAML format over a mapped tree releases the mapping
+	tree->save("test_tree.yaml.gz");
+	treeLoad->load("test_tree.yaml.gz");
+
+	ASSERT_TRUE(*tree.obj == *treeLoad.obj);
+
+}
+
+TEST(VocabTreeBinary, LoadCorruptedBinaryFormat) {
+
+	/////////////////////////////////////////////////////////////////////
+	std::vector<std::string> keysFilenames;
+	keysFilenames.push_back("brief_0.bin");
+
+	vlr::Mat data(keysFilenames);
+	/////////////////////////////////////////////////////////////////////
+
+	cv::Ptr<vlr::VocabTreeBin> tree = new vlr::VocabTreeBin(data);
+	tree->build();
+	tree->save("test_tree.bin");
+
+	std::ifstream inputFileStream("test_tree.bin", std::fstream::binary);
+	std::string contents((std::istreambuf_iterator<char>(inputFileStream)),
+			std::istreambuf_iterator<char>());
+	inputFileStream.close();
+
+	vlr::VocabFileHeader header;
+	memcpy(&header, contents.data(), sizeof(header));
+
+	cv::Ptr<vlr::VocabTreeBin> treeLoad = new vlr::VocabTreeBin();
+
+	// Children of the root pointing past the end of the nodes table
+	std::string corrupted = contents;
+	vlr::VocabTreeFlatNode root;
+	memcpy(&root, corrupted.data() + header.nodesOffset, sizeof(root));
+	root.first_child = int(header.size);
+	memcpy(&corrupted[header.nodesOffset], &root, sizeof(root));
+	std::ofstream("test_tree_corrupted.bin", std::fstream::binary)
+			<< corrupted;
+	EXPECT_THROW(treeLoad->load("test_tree_corrupted.bin"),
+			std::runtime_error);
+
+	// Number of nodes that would overflow the size of the nodes table
+	corrupted = contents;
+	header.size = std::numeric_limits<uint64_t>::max() / 4;
+	memcpy(&corrupted[0], &header, sizeof(header));
+	std::ofstream("test_tree_corrupted.bin", std::fstream::binary)
+			<< corrupted;
+	EXPECT_THROW(treeLoad->load("test_tree_corrupted.bin"),
+			std::runtime_error);
+
+	// Truncated centers
+	std::ofstream("test_tree_corrupted.bin", std::fstream::binary)
+			<< contents.substr(0, contents.size() - 1);
+	EXPECT_THROW(treeLoad->load("test_tree_corrupted.bin"),
+			std::runtime_error);
+
+}
+
+TEST(VocabTreeBinary, ParallelBuildMatchesSerial) {
+
+	/////////////////////////////////////////////////////////////////////
+	std::vector<std::string> keysFilenames;
+	keysFilenames.push_back("brief_0.bin");
+	keysFilenames.push_back("brief_1.bin");
+
+	vlr::Mat data(keysFilenames);
+	/////////////////////////////////////////////////////////////////////
+
+	cv::Ptr<vlr::VocabTreeBin> serialTree = new vlr::VocabTreeBin(data,
+			vlr::VocabTreeParams(10, 6, 10, cvflann::FLANN_CENTERS_RANDOM, 1));
+	cv::Ptr<vlr::VocabTreeBin> parallelTree = new vlr::VocabTreeBin(data,
+			vlr::VocabTreeParams(10, 6, 10, cvflann::FLANN_CENTERS_RANDOM, 4));
+
+	cvflann::seed_random(1);
+	serialTree->build();
+
+	cvflann::seed_random(1);
+	parallelTree->build();
+
+	// Check tree structure is the same
+	ASSERT_TRUE(*serialTree.obj == *parallelTree.obj);
+
+	// Check ids are the same
+	ASSERT_TRUE(serialTree->getNumNodes() == parallelTree->getNumNodes());
+	for (size_t i = 0; i < serialTree->getNumNodes(); ++i) {
+		ASSERT_EQ(serialTree->getNode(i).node_id,
+				parallelTree->getNode(i).node_id);
+		ASSERT_EQ(serialTree->getNode(i).word_id,
+				parallelTree->getNode(i).word_id);
+	}
+
+}
+
+TEST(VocabTreeReal, ParallelBuildMatchesSerial) {
+
+	/////////////////////////////////////////////////////////////////////
+	std::vector<std::string> keysFilenames;
+	keysFilenames.push_back("sift_0.bin");
+	keysFilenames.push_back("sift_1.bin");
+
+	vlr::Mat data(keysFilenames);
+	/////////////////////////////////////////////////////////////////////
+
+	cv::Ptr<vlr::VocabTreeReal> serialTree = new vlr::VocabTreeReal(data,
+			vlr::VocabTreeParams(10, 4, 10, cvflann::FLANN_CENTERS_RANDOM, 1));
+	cv::Ptr<vlr::VocabTreeReal> parallelTree = new vlr::VocabTreeReal(data,
+			vlr::VocabTreeParams(10, 4, 10, cvflann::FLANN_CENTERS_RANDOM, 0));
+
+	cvflann::seed_random(1);
+	serialTree->build();
+
+	cvflann::seed_random(1);
+	parallelTree->build();
+
+	// Float centroids are reduced in the same order whatever the number of threads
+	ASSERT_TRUE(*serialTree.obj == *parallelTree.obj);
+
+}
+
+TEST(VocabTreeBinary, MultiBranchQuantization) {
+
+	/////////////////////////////////////////////////////////////////////
+	std::vector<std::string> keysFilenames;
+	keysFilenames.push_back("brief_0.bin");
+	keysFilenames.push_back("brief_1.bin");
+
+	vlr::Mat data(keysFilenames);
+
+	cv::Mat descriptors;
+	FileUtils::loadDescriptors("brief_0.bin", descriptors);
+	/////////////////////////////////////////////////////////////////////
+
+	cv::Ptr<vlr::VocabTreeBin> tree = new vlr::VocabTreeBin(data,
+			vlr::VocabTreeParams(10, 3));
+
+	tree->build();
+
+	// Distance from every leaf center, leaves are searched exhaustively
+	std::vector<std::pair<int, int> > leaves;
+	for (size_t i = 0; i < tree->getNumNodes(); ++i) {
+		if (tree->getNode(i).first_child == -1) {
+			leaves.push_back(std::make_pair(i, tree->getNode(i).word_id));
+		}
+	}
+
+	vlr::Hamming distance;
+	int knn = 5;
+
+	std::vector<int> wordIds;
+	std::vector<float> distances;
+
+	for (int i = 0; i < descriptors.rows; ++i) {
+
+		// A single leaf is the greedy descent
+		int wordId, nodeId;
+		tree->quantize(descriptors.row(i), 0, wordId, nodeId);
+		tree->quantize(descriptors.row(i), 1, vlr::VocabTreeSearchParams(1),
+				wordIds, distances);
+		ASSERT_EQ(1, int(wordIds.size()));
+		ASSERT_EQ(wordId, wordIds[0]);
+
+		// Visiting all the leaves gives the closest words
+		tree->quantize(descriptors.row(i), knn,
+				vlr::VocabTreeSearchParams(leaves.size(), tree->getNumNodes()),
+				wordIds, distances);
+
+		std::vector<int> exactDistances;
+		for (size_t l = 0; l < leaves.size(); ++l) {
+			exactDistances.push_back(
+					distance(descriptors.ptr<uchar>(i),
+							tree->getCenter(leaves[l].first),
+							tree->getVeclen()));
+		}
+		std::sort(exactDistances.begin(), exactDistances.end());
+
+		ASSERT_EQ(std::min(knn, int(leaves.size())), int(wordIds.size()));
+		for (size_t k = 0; k < wordIds.size(); ++k) {
+			ASSERT_EQ(exactDistances[k], int(distances[k]));
+		}
+	}
+
+}
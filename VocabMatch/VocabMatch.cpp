@@ -17,15 +17,20 @@
 
 #include <VocabTree.h>
 #include <VocabDB.hpp>
+#include <ShardedDB.hpp>
 
 #include <FileUtils.hpp>
 
 #include <FunctionUtils.hpp>
 #include <HtmlResultsWriter.hpp>
+#include <Logging.hpp>
+#include <ThreadPool.hpp>
+#include <TimingCollector.hpp>
 
 double mytime;
 
-const static boost::regex DESCRIPTOR_REGEX("^(.+)(\\.)(yaml|xml)(\\.)(gz)$");
+const static boost::regex DESCRIPTOR_REGEX(
+		"^(.+)(\\.)((yaml|xml)(\\.)(gz)|bin)$");
 
 /**
  * Filters a set of features by keeping only those inside the region determined by query.
@@ -37,21 +42,88 @@ const static boost::regex DESCRIPTOR_REGEX("^(.+)(\\.)(yaml|xml)(\\.)(gz)$");
  */
 int filterFeaturesByRegion(FileUtils::Query& query, cv::Mat& descriptors);
 
+/**
+ * Outcome of scoring a query, filled concurrently and consumed in query order.
+ */
+struct QueryResult {
+	// Whether the query had features to score
+	bool scored;
+	// Best database images sorted by decreasing score
+	std::vector<vlr::ImageScore> topImages;
+	// Number of features filtered out by region, -1 if not filtered
+	int numFilteredFeatures;
+	// Error that stopped scoring the query, empty on success
+	std::string error;
+};
+
+/**
+ * Loads the descriptors of a query, scores them against the database images
+ * and selects the database images with the highest scores.
+ *
+ * @param timings - Collector of the time taken by each stage
+ * @param db - The database to score against
+ * @param sharded - The shards holding the database images, if NULL the
+ * 					inverted index of db is scored
+ * @param query - The query to score
+ * @param top - Number of database images to select
+ * @param useRegions - Whether to keep only the features inside the query region
+ * @param isBinary - Whether the vocabulary is made of binary descriptors
+ * @param norm - Method used to normalize BoF vectors
+ * @param distance - Distance used to compare BoF vectors
+ * @param result - The best database images, or the error if the query could not be scored
+ */
+void scoreQuery(vlr::TimingCollector& timings, const vlr::VocabDB& db,
+		vlr::ShardedDB* sharded, FileUtils::Query query, int top,
+		bool useRegions, bool isBinary, vlr::NormType norm,
+		vlr::ScoringType distance, QueryResult& result);
+
 int main(int argc, char **argv) {
 
-	if (argc < 6 || argc > 12) {
+	if (argc < 6 || argc > 23) {
 		printf(
 				"\nUsage:\n\t"
 						"VocabMatch <in.vocab> <in.inverted.index> <in.db.desc.list> <in.queries.list>"
 						" <out.ranked.files.folder> [in.num.neighbors:ALL] [in.norm:L2] [in.scoring:COS] [out.results:results.html]"
-						" [in.use.regions:0] [in.nn.index:nn_index.bin]\n\n"
+						" [in.use.regions:0] [in.nn.index:nn_index.bin] [in.soft.knn:1] [in.soft.sigma:0]"
+						" [in.num.threads:1] [in.log.level:INFO] [out.timings:timings.csv]"
+						" [in.decode.on.demand:0] [in.postings.bits:32]"
+						" [in.incremental.weighting:-] [in.num.shards:1]"
+						" [in.soft.max.leaves:0] [in.soft.max.branches:32]\n\n"
 						"Norm:\n"
 						"\tL1: L1-norm\n"
 						"\tL2: L2-norm\n\n"
 						"Distance:\n"
 						"\tL1: Manhattan distance or Sum of absolute differences\n"
 						"\tL2: Euclidean distance or Sum of squared differences\n"
-						"\tCOS: Cosine distance or Euclidean dot product\n\n");
+						"\tCOS: Cosine distance or Euclidean dot product\n\n"
+						"Soft assignment:\n"
+						"\tin.soft.knn: number of words each query feature votes for\n"
+						"\tin.soft.sigma: width of the Gaussian weighting the votes,"
+						" 0 to use the distance to the nearest word\n"
+						"\tin.soft.max.leaves: leaves visited when searching the words"
+						" of a feature, at least in.soft.knn\n"
+						"\tin.soft.max.branches: unexplored branches kept for"
+						" backtracking\n\n"
+						"Threads:\n"
+						"\tin.num.threads: number of queries scored concurrently,"
+						" 0 to use as many as hardware threads\n\n"
+						"Log level:\n"
+						"\tQUIET, ERROR, INFO or DEBUG, the latter prints every score\n\n"
+						"Timings:\n"
+						"\tLatency percentiles of each stage, in JSON format if the file"
+						" name ends with .json and in CSV format otherwise\n\n"
+						"Decode on demand:\n"
+						"\tIf 1 and the inverted index is in binary format, its posting"
+						" lists are kept compressed and decoded when scored\n\n"
+						"Postings bits:\n"
+						"\tBits of the posting weights held in memory, either 32 (float),"
+						" 16 or 8\n\n"
+						"Incremental weighting:\n"
+						"\tTFIDF, TF or BIN if the inverted index was built in incremental"
+						" mode and holds raw counts, - otherwise\n\n"
+						"Shards:\n"
+						"\tNumber of shards the inverted index was split into by"
+						" VocabBuildDB,\n\teach one is scored by its own worker process\n\n");
 		return EXIT_FAILURE;
 	}
 
@@ -66,6 +138,17 @@ int main(int argc, char **argv) {
 	std::string out_html = "results.html";
 	bool in_use_regions = false;
 	std::string in_nn_index = "nn_index.bin";
+	int in_soft_knn = 1;
+	double in_soft_sigma = 0.0;
+	int in_num_threads = 1;
+	std::string in_log_level = "INFO";
+	std::string out_timings = "timings.csv";
+	bool in_decode_on_demand = false;
+	int in_postings_bits = 32;
+	std::string in_incremental_weighting = "-";
+	int in_num_shards = 1;
+	int in_soft_max_leaves = 0;
+	int in_soft_max_branches = 32;
 
 	if (argc >= 7) {
 		in_num_nbrs = atoi(argv[6]);
@@ -91,10 +174,71 @@ int main(int argc, char **argv) {
 		in_nn_index = argv[11];
 	}
 
-	// Checking that database filename refers to a compressed YAML or XML file
+	if (argc >= 13) {
+		in_soft_knn = atoi(argv[12]);
+	}
+
+	if (argc >= 14) {
+		in_soft_sigma = atof(argv[13]);
+	}
+
+	if (argc >= 15) {
+		in_num_threads = atoi(argv[14]);
+	}
+
+	if (argc >= 16) {
+		in_log_level = argv[15];
+	}
+
+	if (argc >= 17) {
+		out_timings = argv[16];
+	}
+
+	if (argc >= 18) {
+		in_decode_on_demand = atoi(argv[17]);
+	}
+
+	if (argc >= 19) {
+		in_postings_bits = atoi(argv[18]);
+	}
+
+	if (argc >= 20) {
+		in_incremental_weighting = argv[19];
+	}
+
+	if (argc >= 21) {
+		in_num_shards = atoi(argv[20]);
+	}
+
+	if (argc >= 22) {
+		in_soft_max_leaves = atoi(argv[21]);
+	}
+
+	if (argc >= 23) {
+		in_soft_max_branches = atoi(argv[22]);
+	}
+
+	if (in_num_shards < 1) {
+		fprintf(stderr, "Number of shards must be positive\n");
+		return EXIT_FAILURE;
+	}
+
+	if (in_num_shards > 1 && in_incremental_weighting.compare("-") != 0) {
+		fprintf(stderr, "Incremental indexes cannot be sharded\n");
+		return EXIT_FAILURE;
+	}
+
+	try {
+		vlr::setLogLevel(vlr::parseLogLevel(in_log_level));
+	} catch (const std::runtime_error& error) {
+		fprintf(stderr, "%s\n", error.what());
+		return EXIT_FAILURE;
+	}
+
+	// Checking that vocabulary filename refers to a compressed YAML or XML file or to a binary file
 	if (boost::regex_match(in_vocab, DESCRIPTOR_REGEX) == false) {
 		fprintf(stderr,
-				"Input vocabulary file must have the extension .yaml.gz or .xml.gz\n");
+				"Input vocabulary file must have the extension .yaml.gz, .xml.gz or .bin\n");
 		return EXIT_FAILURE;
 	}
 
@@ -114,19 +258,22 @@ int main(int argc, char **argv) {
 		db = new vlr::AKMajDB();
 	}
 
-	printf("-- Loading vocabulary from [%s]\n", in_vocab.c_str());
+	vlr::logMessage(vlr::LOG_INFO, "-- Loading vocabulary from [%s]\n",
+			in_vocab.c_str());
 
 	mytime = cv::getTickCount();
 	db->loadBoFModel(in_vocab);
 	mytime = ((double) cv::getTickCount() - mytime) / cv::getTickFrequency()
 			* 1000;
-	printf("   Vocabulary loaded in [%lf] ms, got [%lu] words \n", mytime,
+	vlr::logMessage(vlr::LOG_INFO,
+			"   Vocabulary loaded in [%lf] ms, got [%lu] words \n", mytime,
 			db->getNumOfWords());
 
 	// Load nearest neighbor index when scoring using an AKMaj vocabulary
 	if (in_type.compare("HKM") != 0 && in_type.compare("HKMAJ") != 0) {
 
-		printf("-- Loading nearest neighbors index from [%s]\n",
+		vlr::logMessage(vlr::LOG_INFO,
+				"-- Loading nearest neighbors index from [%s]\n",
 				in_nn_index.c_str());
 
 		mytime = cv::getTickCount();
@@ -134,29 +281,96 @@ int main(int argc, char **argv) {
 		mytime = ((double) cv::getTickCount() - mytime) / cv::getTickFrequency()
 				* 1000;
 
-		printf("   Loaded in [%lf] ms\n", mytime);
+		vlr::logMessage(vlr::LOG_INFO, "   Loaded in [%lf] ms\n", mytime);
 	}
 
-	printf("-- Loading inverted index [%s]\n", in_inverted_index.c_str());
+	vlr::logMessage(vlr::LOG_INFO, "-- Loading inverted index [%s]\n",
+			in_inverted_index.c_str());
+
+	if (in_postings_bits == 16) {
+		db->setPostingsEncoding(vlr::WEIGHTS_UINT16);
+	} else if (in_postings_bits == 8) {
+		db->setPostingsEncoding(vlr::WEIGHTS_UINT8);
+	} else if (in_postings_bits != 32) {
+		fprintf(stderr, "Postings bits must be either 32, 16 or 8\n");
+		return EXIT_FAILURE;
+	}
+
+	if (in_incremental_weighting.compare("-") != 0) {
+		// Raw counts are weighted and normalized as when the index was built
+		vlr::WeightingType weighting = vlr::TF_IDF;
+		if (in_incremental_weighting.compare("TF") == 0) {
+			weighting = vlr::TF;
+		} else if (in_incremental_weighting.compare("BIN") == 0) {
+			weighting = vlr::BINARY;
+		}
+		db->setIncremental(weighting,
+				in_norm.compare("L2") == 0 ? vlr::NORM_L2 : vlr::NORM_L1);
+	}
+
+	// Workers are forked before any thread is started
+	vlr::ShardedDB sharded;
 
 	mytime = cv::getTickCount();
-	db->loadInvertedIndex(in_inverted_index);
+	try {
+		if (in_num_shards > 1) {
+			std::vector<std::string> shardFilenames;
+			for (int i = 0; i < in_num_shards; ++i) {
+				shardFilenames.push_back(
+						vlr::getShardFilename(in_inverted_index, i));
+			}
+			sharded.start(shardFilenames, db->getPostingsEncoding());
+			// Every shard holds the words weights of the whole database, which
+			// the workers send back so that no shard is loaded here as well
+			db->setWordsWeights(sharded.getWordsWeights());
+		} else {
+			db->loadInvertedIndex(in_inverted_index, in_decode_on_demand);
+			db->refreshDatabase();
+		}
+	} catch (const std::runtime_error& error) {
+		fprintf(stderr, "%s\n", error.what());
+		return EXIT_FAILURE;
+	}
 	mytime = ((double) cv::getTickCount() - mytime) / cv::getTickFrequency()
 			* 1000;
 
-	printf("   Inverted index loaded in [%lf] ms\n", mytime);
+	vlr::logMessage(vlr::LOG_INFO, "   Inverted index loaded in [%lf] ms\n", mytime);
+
+	if (in_num_shards > 1) {
+		vlr::logMessage(vlr::LOG_INFO,
+				"   Started [%d] workers serving [%d] database images\n",
+				sharded.getNumShards(), sharded.getNumDbImages());
+	} else {
+		vlr::logMessage(vlr::LOG_INFO, "   Posting lists take [%lu] bytes\n",
+				db->getPostingsMemorySize());
+	}
+
+	int numDbImages =
+			in_num_shards > 1 ?
+					sharded.getNumDbImages() :
+					db->getInvertedIndex()->m_numDbImages;
+
+	try {
+		db->setSoftAssignment(in_soft_knn, in_soft_sigma, in_soft_max_leaves,
+				in_soft_max_branches);
+	} catch (const std::runtime_error& error) {
+		fprintf(stderr, "%s\n", error.what());
+		return EXIT_FAILURE;
+	}
 
 	// Step 2/4: load names of database files
-	printf("-- Loading names of database files\n");
+	vlr::logMessage(vlr::LOG_INFO, "-- Loading names of database files\n");
 	std::vector<std::string> db_desc_list;
 	FileUtils::loadList(in_db_desc_list, db_desc_list);
-	printf("   Loaded, got [%lu] entries\n", db_desc_list.size());
+	vlr::logMessage(vlr::LOG_INFO, "   Loaded, got [%lu] entries\n",
+			db_desc_list.size());
 
 	// Step 3/4: load list of queries descriptors
-	printf("-- Loading list of queries descriptors\n");
+	vlr::logMessage(vlr::LOG_INFO, "-- Loading list of queries descriptors\n");
 	std::vector<FileUtils::Query> query_filenames;
 	FileUtils::loadQueriesList(in_queries_desc_list, query_filenames);
-	printf("   Loaded, got [%lu] entries\n", query_filenames.size());
+	vlr::logMessage(vlr::LOG_INFO, "   Loaded, got [%lu] entries\n",
+			query_filenames.size());
 
 	// Step 4/4: score each query
 	vlr::NormType norm = vlr::NORM_L1;
@@ -173,109 +387,144 @@ int main(int argc, char **argv) {
 		distance = vlr::L2;
 	}
 
-	printf(
+	vlr::logMessage(vlr::LOG_INFO,
 			"-- Scoring [%lu] query images against [%d] database images using [%s-norm] and [%s distance]\n",
-			query_filenames.size(), db->getInvertedIndex()->m_numDbImages,
+			query_filenames.size(), numDbImages,
 			norm == vlr::NORM_L1 ? "L1" :
 			norm == vlr::NORM_L2 ? "L2" : "Unknown",
 			distance == vlr::L1 ? "L1" : distance == vlr::L2 ? "L2" :
 			distance == vlr::COS ? "Cosine" : "Unknown");
 
-	cv::Mat imgDescriptors;
-	cv::Mat scores;
-
 	// Compute the number of candidates
 	int top =
-			in_num_nbrs != -1 ?
-					in_num_nbrs : db->getInvertedIndex()->m_numDbImages;
+			in_num_nbrs != -1 ? std::min(in_num_nbrs, numDbImages) : numDbImages;
 
 	HtmlResultsWriter::getInstance().open(out_html, top);
 
-	for (size_t i = 0; i < query_filenames.size(); ++i) {
-		// Initialize descriptors
-		imgDescriptors = cv::Mat();
+	bool is_binary = in_type.compare("HKM") != 0;
 
-		// Load query descriptors
-		FileUtils::loadDescriptors(query_filenames[i].name, imgDescriptors);
+	vlr::TimingCollector timings;
+	db->setTimingCollector(&timings);
 
-		if (in_use_regions == true) {
-			// Load key-points and use them to filter the features
-
-			int numFilteredFeatures = filterFeaturesByRegion(query_filenames[i],
-					imgDescriptors);
+	// The DB is read-only from now on, so queries can be scored concurrently,
+	// they are processed in windows to bound the memory taken by the scores
+	// and the results of each window are written in query order
+	cv::Ptr<vlr::ThreadPool> pool;
+	size_t window = 1;
 
-			printf("   Filtered out [%d] features\n", numFilteredFeatures);
-
-		}
+	if (in_num_threads != 1) {
+		pool = new vlr::ThreadPool(in_num_threads);
+		window = 4 * pool->getNumThreads();
+		vlr::logMessage(vlr::LOG_INFO,
+				"   Scoring up to [%lu] queries concurrently using [%d] threads\n",
+				window, pool->getNumThreads());
+	}
 
-		if (imgDescriptors.empty() == true) {
-			continue;
+	std::vector<QueryResult> results(window);
+
+	for (size_t first = 0; first < query_filenames.size(); first += window) {
+
+		size_t last = std::min(first + window, query_filenames.size());
+
+		if (pool.empty() == true) {
+			scoreQuery(timings, *db, in_num_shards > 1 ? &sharded : NULL,
+					query_filenames[first], top, in_use_regions, is_binary,
+					norm, distance, results[0]);
+		} else {
+			pool->parallelFor(first, last, 1, [&](int begin, int end) {
+				for (int i = begin; i < end; ++i) {
+					scoreQuery(timings, *db,
+							in_num_shards > 1 ? &sharded : NULL,
+							query_filenames[i], top, in_use_regions, is_binary,
+							norm, distance, results[i - first]);
+				}
+			});
 		}
 
-		// Check type of descriptors
-		bool is_binary = in_type.compare("HKM") != 0;
-		if ((imgDescriptors.type() == CV_8U) != is_binary) {
-			fprintf(stderr,
-					"Descriptor type doesn't coincide, it is said to be [%s] while it is [%s]\n",
-					is_binary == true ? "binary" : "non-binary",
-					imgDescriptors.type() == CV_8U ? "binary" : "real");
-			return EXIT_FAILURE;
+		for (size_t i = first; i < last; ++i) {
+
+			QueryResult& result = results[i - first];
+
+			if (result.numFilteredFeatures != -1) {
+				vlr::logMessage(vlr::LOG_INFO,
+						"   Filtered out [%d] features\n",
+						result.numFilteredFeatures);
+			}
+
+			if (result.error.empty() == false) {
+				fprintf(stderr, "%s\n", result.error.c_str());
+				return EXIT_FAILURE;
+			}
+
+			if (result.scored == false) {
+				// Query without features
+				continue;
+			}
+
+			std::vector<vlr::ImageScore>& topImages = result.topImages;
+
+			vlr::StageTimer writeTimer(&timings, "write");
+
+			// Print to standard output the matching scores between
+			// the query BoF vector and the best database images BoF vectors
+			if (vlr::isLogEnabled(vlr::LOG_DEBUG) == true) {
+				for (const vlr::ImageScore& image : topImages) {
+					vlr::logMessage(vlr::LOG_DEBUG,
+							"   Match score between [%lu] query image and [%d] database image: %f\n",
+							i, image.first, image.second);
+				}
+			}
+
+			std::stringstream ranked_list_fname;
+			vlr::logMessage(vlr::LOG_INFO, "%lu) %s\n", i,
+					query_filenames[i].name.c_str());
+			ranked_list_fname << out_ranked_files_folder << "/query_" << i
+					<< "_ranked.txt";
+
+			std::ofstream f_ranked_list(ranked_list_fname.str().c_str(),
+					std::fstream::out);
+			if (f_ranked_list.good() == false) {
+				fprintf(stderr, "Error opening file [%s] for writing\n",
+						ranked_list_fname.str().c_str());
+				return EXIT_FAILURE;
+			}
+			// Note: recall that the index of the images in the inverted file corresponds
+			// to the zero-based line number in the file used to build the database.
+			for (const vlr::ImageScore& image : topImages) {
+				// Get base filename: remove extension and folder path
+				std::string d_base = FunctionUtils::basify(
+						db_desc_list[image.first]);
+				f_ranked_list << d_base + "\n";
+			}
+			f_ranked_list.close();
+
+			// Print to a file the ranked list of candidates ordered by score in HTML format
+			HtmlResultsWriter::getInstance().writeRow(query_filenames[i].name,
+					topImages, db_desc_list);
+			std::vector<vlr::ImageScore>().swap(topImages);
 		}
+	}
 
-		// Score query BoF vector against database images BoF vectors
-		mytime = cv::getTickCount();
-		try {
-			db->scoreQuery(imgDescriptors, scores, norm, distance);
-		} catch (const std::runtime_error& error) {
-			fprintf(stderr, "%s\n", error.what());
-			return EXIT_FAILURE;
-		}
-		mytime = ((double) cv::getTickCount() - mytime) / cv::getTickFrequency()
-				* 1000;
-		imgDescriptors.release();
-
-		// Print to standard output the matching scores between
-		// the query BoF vector and the database images BoF vectors
-		for (size_t j = 0; (int) j < scores.cols; ++j) {
-			printf(
-					"   Match score between [%lu] query image and [%lu] database image: %f\n",
-					i, j, scores.at<float>(0, j));
-		}
+	HtmlResultsWriter::getInstance().close();
 
-		// Obtain indices of ordered scores
-		cv::Mat perm;
-		// Note: recall that the index of the images in the inverted file corresponds
-		// to the zero-based line number in the file used to build the database.
-		cv::sortIdx(scores, perm, cv::SORT_EVERY_ROW + cv::SORT_DESCENDING);
-
-		std::stringstream ranked_list_fname;
-		printf("%lu) %s\n", i, query_filenames[i].name.c_str());
-		ranked_list_fname << out_ranked_files_folder << "/query_" << i
-				<< "_ranked.txt";
-
-		std::ofstream f_ranked_list(ranked_list_fname.str().c_str(),
-				std::fstream::out);
-		if (f_ranked_list.good() == false) {
-			fprintf(stderr, "Error opening file [%s] for writing\n",
-					ranked_list_fname.str().c_str());
-			return EXIT_FAILURE;
-		}
-		for (int j = 0; j < top; ++j) {
-			// Get base filename: remove extension and folder path
-			std::string d_base = FunctionUtils::basify(
-					db_desc_list[perm.at<int>(0, j)]);
-			f_ranked_list << d_base + "\n";
-		}
-		f_ranked_list.close();
+	db->setTimingCollector(NULL);
 
-		// Print to a file the ranked list of candidates ordered by score in HTML format
-		HtmlResultsWriter::getInstance().writeRow(query_filenames[i].name,
-				scores, perm, top, db_desc_list);
-		scores.release();
-		perm.release();
+	// Summary of the latency of each stage
+	std::vector<vlr::StageSummary> summaries = timings.summarize();
+	for (const vlr::StageSummary& summary : summaries) {
+		vlr::logMessage(vlr::LOG_INFO,
+				"   Stage [%s] ran [%lu] times, mean [%lf] ms, p50 [%lf] ms,"
+						" p90 [%lf] ms, p99 [%lf] ms, max [%lf] ms\n",
+				summary.stage.c_str(), summary.count, summary.mean, summary.p50,
+				summary.p90, summary.p99, summary.max);
 	}
 
-	HtmlResultsWriter::getInstance().close();
+	try {
+		timings.save(out_timings);
+	} catch (const std::runtime_error& error) {
+		fprintf(stderr, "%s\n", error.what());
+		return EXIT_FAILURE;
+	}
 
 	return EXIT_SUCCESS;
 }
@@ -312,3 +561,72 @@ int filterFeaturesByRegion(FileUtils::Query& q, cv::Mat& descriptors) {
 	return numFilteredFeatures;
 
 }
+
+// --------------------------------------------------------------------------
+
+void scoreQuery(vlr::TimingCollector& timings, const vlr::VocabDB& db,
+		vlr::ShardedDB* sharded, FileUtils::Query query, int top,
+		bool useRegions, bool isBinary, vlr::NormType norm,
+		vlr::ScoringType distance, QueryResult& result) {
+
+	result = QueryResult();
+	result.scored = false;
+	result.numFilteredFeatures = -1;
+
+	cv::Mat imgDescriptors;
+
+	try {
+		vlr::StageTimer loadTimer(&timings, "load");
+
+		// Load query descriptors
+		FileUtils::loadDescriptors(query.name, imgDescriptors);
+
+		if (useRegions == true) {
+			// Load key-points and use them to filter the features
+			result.numFilteredFeatures = filterFeaturesByRegion(query,
+					imgDescriptors);
+		}
+
+		loadTimer.stop();
+
+		if (imgDescriptors.empty() == true) {
+			return;
+		}
+
+		// Check type of descriptors
+		if ((imgDescriptors.type() == CV_8U) != isBinary) {
+			std::stringstream ss;
+			ss << "Descriptor type doesn't coincide, it is said to be ["
+					<< (isBinary == true ? "binary" : "non-binary")
+					<< "] while it is ["
+					<< (imgDescriptors.type() == CV_8U ? "binary" : "real")
+					<< "]";
+			result.error = ss.str();
+			return;
+		}
+
+		// Score query BoF vector against database images BoF vectors and keep
+		// the best ones, each query owns its scores so that queries can be
+		// scored concurrently
+		if (sharded == NULL) {
+			db.queryTopK(imgDescriptors, top, norm, distance,
+					result.topImages);
+		} else {
+			// Only the query BoF vector is built here, the shards are scored
+			// by the workers
+			vlr::StageTimer quantizeTimer(&timings, "quantize");
+			vlr::SparseBoFVector queryBoFVector;
+			db.transform(imgDescriptors, queryBoFVector, norm);
+			quantizeTimer.stop();
+
+			vlr::StageTimer scoreTimer(&timings, "score");
+			sharded->queryTopK(queryBoFVector, top, distance,
+					result.topImages);
+		}
+		result.scored = true;
+	} catch (const std::runtime_error& error) {
+		result.error = error.what();
+		return;
+	}
+
+}